@@ -0,0 +1,197 @@
+/*
+ * Example consumer of the frames a Moonlight source shares with local
+ * processes ("Share decoded frames with local applications")
+ *
+ * Usage: frame-export-consumer <name> [hold ms]
+ *
+ * Maps the source's frames read-only and reads them in place: prints the
+ * frame size and format once, then once a second the frames read and
+ * skipped, how old a frame is when it is read, and the average luma of
+ * the last one. With a hold time each frame is held that long, as a slow
+ * consumer would; the source keeps decoding at its own pace and the
+ * consumer skips to the newest frame.
+ */
+
+#include "frame-export-reader.h"
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static volatile sig_atomic_t stop;
+
+static void on_signal(int signal)
+{
+	(void)signal;
+	stop = 1;
+}
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static void sleep_ms(int ms)
+{
+	struct timespec ts = {.tv_sec = ms / 1000,
+			      .tv_nsec = (long)(ms % 1000) * 1000000};
+	nanosleep(&ts, NULL);
+}
+
+static const char *format_name(enum frame_export_format format)
+{
+	switch (format) {
+	case FRAME_EXPORT_I420:
+		return "I420";
+	case FRAME_EXPORT_I010:
+		return "I010";
+	case FRAME_EXPORT_P010:
+		return "P010";
+	default:
+		return "unknown";
+	}
+}
+
+// Average of every 16th sample of every 16th row, scaled to 8 bits
+static double average_luma(const struct frame_export_frame *frame)
+{
+	bool wide = frame->format != FRAME_EXPORT_I420;
+	uint64_t sum = 0, count = 0;
+
+	for (uint32_t y = 0; y < frame->height; y += 16) {
+		const uint8_t *row =
+			frame->data[0] + (size_t)y * frame->linesize[0];
+		for (uint32_t x = 0; x < frame->width; x += 16) {
+			count++;
+			if (!wide) {
+				sum += row[x];
+				continue;
+			}
+
+			// Little endian; P010 keeps its 10 bits at the top
+			unsigned sample = row[2 * x] | (unsigned)row[2 * x + 1]
+							       << 8;
+			sum += frame->format == FRAME_EXPORT_P010 ? sample >> 8
+								  : sample >> 2;
+		}
+	}
+
+	return count ? (double)sum / count : 0.0;
+}
+
+static struct frame_export_reader *connect_export(const char *name)
+{
+	bool waiting = false;
+
+	while (!stop) {
+		struct frame_export_reader *reader =
+			frame_export_reader_open(name);
+		if (reader)
+			return reader;
+
+		if (errno != EAGAIN && errno != ECONNREFUSED) {
+			fprintf(stderr, "Cannot read '%s': %s\n", name,
+				strerror(errno));
+			return NULL;
+		}
+
+		if (!waiting)
+			printf("Waiting for '%s'...\n", name);
+		waiting = true;
+		sleep_ms(500);
+	}
+
+	return NULL;
+}
+
+int main(int argc, char **argv)
+{
+	if (argc < 2) {
+		fprintf(stderr, "Usage: %s <name> [hold ms]\n", argv[0]);
+		return 1;
+	}
+
+	const char *name = argv[1];
+	int hold_ms = argc > 2 ? atoi(argv[2]) : 0;
+
+	signal(SIGINT, on_signal);
+	signal(SIGTERM, on_signal);
+
+	struct frame_export_reader *reader = connect_export(name);
+	uint32_t width = 0, height = 0;
+	enum frame_export_format format = FRAME_EXPORT_NONE;
+
+	uint64_t frames = 0, missed = 0, overwritten = 0;
+	uint64_t total_age_ns = 0, max_age_ns = 0;
+	uint64_t report_ns = now_ns() + 1000000000ULL;
+	double luma = 0.0;
+
+	while (reader && !stop) {
+		struct frame_export_frame frame;
+		enum frame_export_status status =
+			frame_export_reader_wait(reader, 100)
+				? frame_export_reader_next(reader, &frame)
+				: FRAME_EXPORT_NO_FRAME;
+
+		if (status == FRAME_EXPORT_CLOSED) {
+			// The stream stopped, or changed size
+			frame_export_reader_close(reader);
+			reader = connect_export(name);
+			continue;
+		}
+
+		if (status == FRAME_EXPORT_FRAME) {
+			if (frame.width != width || frame.height != height ||
+			    frame.format != format) {
+				width = frame.width;
+				height = frame.height;
+				format = frame.format;
+				printf("%ux%u %s%s\n", width, height,
+				       format_name(format),
+				       frame.full_range ? ", full range" : "");
+			}
+
+			uint64_t age = now_ns() - frame.decoded_ns;
+			total_age_ns += age;
+			if (age > max_age_ns)
+				max_age_ns = age;
+
+			// In place, no copy
+			double frame_luma = average_luma(&frame);
+			if (hold_ms)
+				sleep_ms(hold_ms);
+
+			// The result only counts if the frame is still there
+			if (frame_export_reader_check(reader, &frame))
+				luma = frame_luma;
+			else
+				overwritten++;
+
+			frames++;
+			missed += frame.missed;
+		}
+
+		uint64_t now = now_ns();
+		if (now >= report_ns) {
+			printf("%llu frames, %llu skipped, %llu overwritten "
+			       "while held; age avg %.2f ms, max %.2f ms; "
+			       "luma %.1f\n",
+			       (unsigned long long)frames,
+			       (unsigned long long)missed,
+			       (unsigned long long)overwritten,
+			       frames ? total_age_ns / 1e6 / frames : 0.0,
+			       max_age_ns / 1e6, luma);
+
+			frames = missed = overwritten = 0;
+			total_age_ns = max_age_ns = 0;
+			report_ns = now + 1000000000ULL;
+		}
+	}
+
+	frame_export_reader_close(reader);
+	return 0;
+}
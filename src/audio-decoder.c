@@ -1,6 +1,6 @@
 #include "audio-decoder.h"
 #include "moonlight-source.h"
-#include "plugin-main.h"
+#include "hot-log.h"
 #include <libavcodec/avcodec.h>
 #include <libavutil/opt.h>
 #include <obs-module.h>
@@ -10,6 +10,9 @@
 #define DEFAULT_CHANNELS 2
 #define AUDIO_BUFFER_SECONDS 2
 
+// Audio kept buffered ahead of the local clock
+#define AUDIO_TARGET_BUFFER_NS 10000000ULL
+
 struct audio_decoder *audio_decoder_create(struct moonlight_source *source)
 {
 	struct audio_decoder *decoder =
@@ -24,7 +27,7 @@ struct audio_decoder *audio_decoder_create(struct moonlight_source *source)
 	// Find Opus decoder (commonly used in game streaming)
 	const AVCodec *codec = avcodec_find_decoder(AV_CODEC_ID_OPUS);
 	if (!codec) {
-		mlog(LOG_ERROR, "Opus decoder not found");
+		hlog(LOG_ERROR, "Opus decoder not found");
 		bfree(decoder);
 		return NULL;
 	}
@@ -32,7 +35,7 @@ struct audio_decoder *audio_decoder_create(struct moonlight_source *source)
 	// Allocate codec context
 	AVCodecContext *codec_ctx = avcodec_alloc_context3(codec);
 	if (!codec_ctx) {
-		mlog(LOG_ERROR, "Failed to allocate audio codec context");
+		hlog(LOG_ERROR, "Failed to allocate audio codec context");
 		bfree(decoder);
 		return NULL;
 	}
@@ -46,7 +49,7 @@ struct audio_decoder *audio_decoder_create(struct moonlight_source *source)
 
 	// Open codec
 	if (avcodec_open2(codec_ctx, codec, NULL) < 0) {
-		mlog(LOG_ERROR, "Failed to open audio codec");
+		hlog(LOG_ERROR, "Failed to open audio codec");
 		avcodec_free_context(&codec_ctx);
 		bfree(decoder);
 		return NULL;
@@ -57,7 +60,7 @@ struct audio_decoder *audio_decoder_create(struct moonlight_source *source)
 	// Allocate frame
 	AVFrame *frame = av_frame_alloc();
 	if (!frame) {
-		mlog(LOG_ERROR, "Failed to allocate audio frame");
+		hlog(LOG_ERROR, "Failed to allocate audio frame");
 		avcodec_free_context(&codec_ctx);
 		bfree(decoder);
 		return NULL;
@@ -70,7 +73,14 @@ struct audio_decoder *audio_decoder_create(struct moonlight_source *source)
 			       sizeof(float) * AUDIO_BUFFER_SECONDS;
 	decoder->output_data = bmalloc(decoder->output_size);
 
-	mlog(LOG_INFO, "Audio decoder created (%d Hz, %d channels)",
+	// Host and OBS audio clocks drift apart, resample to keep the
+	// buffering constant
+	decoder->resampler = bzalloc(sizeof(struct audio_resampler));
+	audio_resampler_init(decoder->resampler, DEFAULT_CHANNELS);
+	audio_drift_init(&decoder->drift, DEFAULT_SAMPLE_RATE,
+			 AUDIO_TARGET_BUFFER_NS);
+
+	hlog(LOG_INFO, "Audio decoder created (%d Hz, %d channels)",
 	     DEFAULT_SAMPLE_RATE, DEFAULT_CHANNELS);
 	return decoder;
 }
@@ -80,7 +90,9 @@ void audio_decoder_destroy(struct audio_decoder *decoder)
 	if (!decoder)
 		return;
 
-	mlog(LOG_INFO, "Destroying audio decoder");
+	hlog(LOG_INFO, "Destroying audio decoder (drift %.1f ppm, %llu resets)",
+	     (decoder->drift.ratio - 1.0) * 1e6,
+	     (unsigned long long)decoder->drift.resets);
 
 	if (decoder->frame) {
 		av_frame_free((AVFrame **)&decoder->frame);
@@ -97,6 +109,7 @@ void audio_decoder_destroy(struct audio_decoder *decoder)
 		decoder->output_data = NULL;
 	}
 
+	bfree(decoder->resampler);
 	bfree(decoder);
 }
 
@@ -122,7 +135,7 @@ bool audio_decoder_decode(struct audio_decoder *decoder, uint8_t *data,
 	av_packet_free(&packet);
 
 	if (ret < 0) {
-		mlog(LOG_ERROR, "Error sending audio packet to decoder: %d",
+		hlog(LOG_ERROR, "Error sending audio packet to decoder: %d",
 		     ret);
 		return false;
 	}
@@ -132,24 +145,38 @@ bool audio_decoder_decode(struct audio_decoder *decoder, uint8_t *data,
 	if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF) {
 		return true; // Need more data
 	} else if (ret < 0) {
-		mlog(LOG_ERROR, "Error receiving audio frame from decoder: %d",
+		hlog(LOG_ERROR, "Error receiving audio frame from decoder: %d",
 		     ret);
 		return false;
 	}
 
+	// Compensate for clock drift, timestamps follow a continuous timeline
+	uint64_t timestamp = audio_drift_update(&decoder->drift,
+						os_gettime_ns());
+
+	size_t max_frames =
+		decoder->output_size / (sizeof(float) * decoder->channels);
+	float *planes[MAX_AV_PLANES] = {0};
+	for (int ch = 0; ch < decoder->channels; ch++)
+		planes[ch] = (float *)decoder->output_data + ch * max_frames;
+
+	size_t frames = audio_resampler_process(
+		decoder->resampler, (const float *const *)frame->data,
+		frame->nb_samples, planes, max_frames, decoder->drift.ratio);
+	audio_drift_advance(&decoder->drift, frames);
+
+	if (frames == 0)
+		return true;
+
 	// Prepare audio data for OBS
 	struct obs_source_audio audio_data = {0};
-	audio_data.data[0] = frame->data[0];
-	audio_data.frames = frame->nb_samples;
+	for (int ch = 0; ch < decoder->channels; ch++)
+		audio_data.data[ch] = (uint8_t *)planes[ch];
+	audio_data.frames = (uint32_t)frames;
 	audio_data.speakers = SPEAKERS_STEREO;
 	audio_data.samples_per_sec = decoder->sample_rate;
 	audio_data.format = AUDIO_FORMAT_FLOAT_PLANAR;
-	audio_data.timestamp = os_gettime_ns();
-
-	// If stereo, set second channel
-	if (decoder->channels == 2 && frame->data[1]) {
-		audio_data.data[1] = frame->data[1];
-	}
+	audio_data.timestamp = timestamp;
 
 	// Send audio to OBS
 	struct moonlight_source *source = decoder->source;
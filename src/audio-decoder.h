@@ -3,6 +3,7 @@
 #include <stdint.h>
 #include <stddef.h>
 #include <stdbool.h>
+#include "audio-resampler.h"
 
 // Forward declarations
 struct moonlight_source;
@@ -22,6 +23,10 @@ struct audio_decoder {
 	// Output buffer
 	uint8_t *output_data;
 	size_t output_size;
+
+	// Clock drift compensation
+	struct audio_drift drift;
+	struct audio_resampler *resampler;
 };
 
 // Decoder lifecycle
@@ -0,0 +1,237 @@
+#include "audio-resampler.h"
+#include <math.h>
+#include <string.h>
+
+#if defined(__SSE__) || defined(_M_X64) || \
+	(defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <xmmintrin.h>
+#define RESAMPLER_SSE 1
+#endif
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+// Passband edge relative to Nyquist, leaves room for the slight speed-up
+#define RESAMPLER_CUTOFF 0.95
+
+// Fill level smoothing and PI controller gains. The error is in seconds and
+// the output is a ratio offset, so a 5 ms error pulls the rate by 250 ppm.
+// KI = KP^2 / 4 keeps the loop critically damped.
+#define DRIFT_SMOOTHING 0.02
+#define DRIFT_KP 0.05
+#define DRIFT_KI 0.000625
+
+// Re-anchor the timeline after stalls instead of slewing through them
+#define DRIFT_RESET_NS 100000000.0
+
+static double blackman(double x, double half_width)
+{
+	double t = (x + half_width) / (2.0 * half_width);
+	if (t <= 0.0 || t >= 1.0)
+		return 0.0;
+
+	return 0.42 - 0.5 * cos(2.0 * M_PI * t) + 0.08 * cos(4.0 * M_PI * t);
+}
+
+static double sinc(double x)
+{
+	if (fabs(x) < 1e-9)
+		return 1.0;
+
+	return sin(M_PI * x) / (M_PI * x);
+}
+
+void audio_resampler_init(struct audio_resampler *resampler, int channels)
+{
+	memset(resampler, 0, sizeof(*resampler));
+
+	if (channels > RESAMPLER_MAX_CHANNELS)
+		channels = RESAMPLER_MAX_CHANNELS;
+	resampler->channels = channels;
+
+	// Windowed sinc, each phase is delayed by a fraction of a sample
+	const double center = RESAMPLER_TAPS / 2 - 1;
+	const double half_width = RESAMPLER_TAPS / 2;
+
+	for (int phase = 0; phase <= RESAMPLER_PHASES; phase++) {
+		double frac = (double)phase / RESAMPLER_PHASES;
+		double sum = 0.0;
+
+		for (int tap = 0; tap < RESAMPLER_TAPS; tap++) {
+			double x = tap - center - frac;
+			double c = RESAMPLER_CUTOFF *
+				   sinc(RESAMPLER_CUTOFF * x) *
+				   blackman(x, half_width);
+			resampler->coeffs[phase][tap] = (float)c;
+			sum += c;
+		}
+
+		// Unity gain at DC for every phase
+		for (int tap = 0; tap < RESAMPLER_TAPS; tap++)
+			resampler->coeffs[phase][tap] /= (float)sum;
+	}
+
+	// Silence up to the filter centre keeps output aligned with input
+	resampler->input_frames = RESAMPLER_TAPS / 2 - 1;
+}
+
+// Interpolate the filter for a fractional position between two phases
+static void interpolate_coeffs(const float *c0, const float *c1, float t,
+			       float *coeffs)
+{
+#ifdef RESAMPLER_SSE
+	__m128 vt = _mm_set1_ps(t);
+	for (int i = 0; i < RESAMPLER_TAPS; i += 4) {
+		__m128 a = _mm_loadu_ps(c0 + i);
+		__m128 b = _mm_loadu_ps(c1 + i);
+		__m128 c = _mm_add_ps(a, _mm_mul_ps(_mm_sub_ps(b, a), vt));
+		_mm_storeu_ps(coeffs + i, c);
+	}
+#else
+	for (int i = 0; i < RESAMPLER_TAPS; i++)
+		coeffs[i] = c0[i] + (c1[i] - c0[i]) * t;
+#endif
+}
+
+static float dot(const float *x, const float *coeffs)
+{
+#ifdef RESAMPLER_SSE
+	__m128 acc = _mm_mul_ps(_mm_loadu_ps(x), _mm_loadu_ps(coeffs));
+	for (int i = 4; i < RESAMPLER_TAPS; i += 4)
+		acc = _mm_add_ps(acc, _mm_mul_ps(_mm_loadu_ps(x + i),
+						 _mm_loadu_ps(coeffs + i)));
+
+	// Horizontal sum
+	__m128 shuf = _mm_shuffle_ps(acc, acc, _MM_SHUFFLE(2, 3, 0, 1));
+	__m128 sums = _mm_add_ps(acc, shuf);
+	shuf = _mm_movehl_ps(shuf, sums);
+	sums = _mm_add_ss(sums, shuf);
+	return _mm_cvtss_f32(sums);
+#else
+	float acc = 0.0f;
+	for (int i = 0; i < RESAMPLER_TAPS; i++)
+		acc += x[i] * coeffs[i];
+	return acc;
+#endif
+}
+
+size_t audio_resampler_process(struct audio_resampler *resampler,
+			       const float *const *in, size_t in_frames,
+			       float *const *out, size_t max_out, double ratio)
+{
+	const int channels = resampler->channels;
+
+	// Append the new input
+	size_t space = RESAMPLER_BUFFER_FRAMES - resampler->input_frames;
+	if (in_frames > space)
+		in_frames = space;
+
+	for (int ch = 0; ch < channels; ch++)
+		memcpy(resampler->input[ch] + resampler->input_frames, in[ch],
+		       in_frames * sizeof(float));
+	resampler->input_frames += in_frames;
+
+	float coeffs[RESAMPLER_TAPS];
+	double position = resampler->position;
+	size_t produced = 0;
+
+	while (produced < max_out) {
+		size_t index = (size_t)position;
+		if (index + RESAMPLER_TAPS > resampler->input_frames)
+			break;
+
+		double phase = (position - (double)index) * RESAMPLER_PHASES;
+		int p = (int)phase;
+		interpolate_coeffs(resampler->coeffs[p],
+				   resampler->coeffs[p + 1],
+				   (float)(phase - p), coeffs);
+
+		for (int ch = 0; ch < channels; ch++)
+			out[ch][produced] =
+				dot(resampler->input[ch] + index, coeffs);
+
+		position += ratio;
+		produced++;
+	}
+
+	// Drop input that no output frame can reach any more
+	size_t consumed = (size_t)position;
+	if (consumed > resampler->input_frames)
+		consumed = resampler->input_frames;
+
+	size_t remaining = resampler->input_frames - consumed;
+	for (int ch = 0; ch < channels; ch++)
+		memmove(resampler->input[ch], resampler->input[ch] + consumed,
+			remaining * sizeof(float));
+
+	resampler->input_frames = remaining;
+	resampler->position = position - (double)consumed;
+	return produced;
+}
+
+void audio_drift_init(struct audio_drift *drift, uint32_t sample_rate,
+		      uint64_t target_ns)
+{
+	memset(drift, 0, sizeof(*drift));
+	drift->sample_rate = sample_rate;
+	drift->target_ns = target_ns;
+	drift->ratio = 1.0;
+}
+
+static void reset_timeline(struct audio_drift *drift, uint64_t now_ns)
+{
+	drift->base_ns = now_ns + drift->target_ns;
+	drift->frames_out = 0;
+	drift->fill_ns = (double)drift->target_ns;
+	drift->last_update_ns = now_ns;
+}
+
+uint64_t audio_drift_update(struct audio_drift *drift, uint64_t now_ns)
+{
+	if (!drift->started) {
+		drift->started = true;
+		reset_timeline(drift, now_ns);
+	}
+
+	uint64_t next_ns = drift->base_ns +
+			   drift->frames_out * 1000000000ULL /
+				   drift->sample_rate;
+	double fill = (double)next_ns - (double)now_ns;
+
+	// Too far off to slew back (stall, lost packets, suspend)
+	if (fabs(fill - (double)drift->target_ns) > DRIFT_RESET_NS) {
+		drift->resets++;
+		reset_timeline(drift, now_ns);
+		return drift->base_ns;
+	}
+
+	// Packet arrival jitter dominates the raw fill level, smooth it
+	drift->fill_ns += (fill - drift->fill_ns) * DRIFT_SMOOTHING;
+
+	// Consume input faster while the buffer is above target
+	double error = (drift->fill_ns - (double)drift->target_ns) * 1e-9;
+	double dt = (double)(now_ns - drift->last_update_ns) * 1e-9;
+	drift->last_update_ns = now_ns;
+	drift->integral += error * DRIFT_KI * dt;
+
+	const double max_offset = AUDIO_DRIFT_MAX_PPM * 1e-6;
+	if (drift->integral > max_offset)
+		drift->integral = max_offset;
+	else if (drift->integral < -max_offset)
+		drift->integral = -max_offset;
+
+	double offset = error * DRIFT_KP + drift->integral;
+	if (offset > max_offset)
+		offset = max_offset;
+	else if (offset < -max_offset)
+		offset = -max_offset;
+
+	drift->ratio = 1.0 + offset;
+	return next_ns;
+}
+
+void audio_drift_advance(struct audio_drift *drift, size_t frames)
+{
+	drift->frames_out += frames;
+}
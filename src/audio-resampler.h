@@ -0,0 +1,68 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Polyphase filter layout
+#define RESAMPLER_TAPS 16
+#define RESAMPLER_PHASES 64
+#define RESAMPLER_MAX_CHANNELS 8
+#define RESAMPLER_BUFFER_FRAMES 8192
+
+// Limits of the drift correction, in parts per million
+#define AUDIO_DRIFT_MAX_PPM 2000.0
+
+// Fractional resampler with a continuously variable ratio, for planar float
+// audio
+struct audio_resampler {
+	int channels;
+
+	// Filter coefficients, one extra phase so neighbours can be
+	// interpolated without wrapping
+	float coeffs[RESAMPLER_PHASES + 1][RESAMPLER_TAPS];
+
+	// Buffered input and fractional read position within it
+	float input[RESAMPLER_MAX_CHANNELS][RESAMPLER_BUFFER_FRAMES];
+	size_t input_frames;
+	double position;
+};
+
+// Estimates the host/local clock rate ratio from how far the output timeline
+// runs ahead of the local clock
+struct audio_drift {
+	uint32_t sample_rate;
+	uint64_t target_ns;
+
+	// Output timeline
+	bool started;
+	uint64_t base_ns;
+	uint64_t frames_out;
+
+	// Controller state
+	uint64_t last_update_ns;
+	double fill_ns;
+	double integral;
+	double ratio;
+
+	// Statistics
+	uint64_t resets;
+};
+
+void audio_resampler_init(struct audio_resampler *resampler, int channels);
+
+// Resample in_frames of input. ratio is the number of input frames consumed
+// per output frame. Returns the number of frames written to out.
+size_t audio_resampler_process(struct audio_resampler *resampler,
+			       const float *const *in, size_t in_frames,
+			       float *const *out, size_t max_out, double ratio);
+
+void audio_drift_init(struct audio_drift *drift, uint32_t sample_rate,
+		      uint64_t target_ns);
+
+// Update the rate estimate from the current fill level. Returns the
+// timestamp of the next output frame.
+uint64_t audio_drift_update(struct audio_drift *drift, uint64_t now_ns);
+
+// Advance the output timeline after frames have been output
+void audio_drift_advance(struct audio_drift *drift, size_t frames);
@@ -0,0 +1,157 @@
+#include "decoder-pool.h"
+#include "video-decoder.h"
+#include "moonlight-source.h"
+#include "plugin-main.h"
+#include <pthread.h>
+#include <stdlib.h>
+
+// Warm decoders match a source with default settings
+#define WARM_CODEC MOONLIGHT_CODEC_H264
+#define WARM_WIDTH 1920
+#define WARM_HEIGHT 1080
+#define WARM_SLICE_DECODE false
+
+static struct {
+	pthread_mutex_t mutex;
+	struct video_decoder *idle[DECODER_POOL_MAX_IDLE];
+	size_t idle_count;
+	struct decoder_pool_stats stats;
+} pool = {.mutex = PTHREAD_MUTEX_INITIALIZER};
+
+static int warm_count(void)
+{
+	const char *value = getenv(DECODER_POOL_WARM_ENV);
+	if (!value || !*value)
+		return DECODER_POOL_DEFAULT_WARM;
+
+	int count = atoi(value);
+	if (count < 0)
+		count = 0;
+	if (count > DECODER_POOL_MAX_IDLE)
+		count = DECODER_POOL_MAX_IDLE;
+	return count;
+}
+
+void decoder_pool_init(void)
+{
+	int count = warm_count();
+	uint64_t start = os_gettime_ns();
+
+	pthread_mutex_lock(&pool.mutex);
+	while (pool.idle_count < (size_t)count) {
+		struct video_decoder *decoder = video_decoder_open(
+			WARM_CODEC, WARM_WIDTH, WARM_HEIGHT, WARM_SLICE_DECODE);
+		if (!decoder)
+			break;
+		pool.idle[pool.idle_count++] = decoder;
+	}
+	size_t idle = pool.idle_count;
+	pthread_mutex_unlock(&pool.mutex);
+
+	mlog(LOG_INFO, "Decoder pool ready: %zu warm decoders in %llu ms", idle,
+	     (unsigned long long)((os_gettime_ns() - start) / 1000000));
+}
+
+void decoder_pool_free(void)
+{
+	pthread_mutex_lock(&pool.mutex);
+	for (size_t i = 0; i < pool.idle_count; i++)
+		video_decoder_destroy(pool.idle[i]);
+	pool.idle_count = 0;
+
+	struct decoder_pool_stats stats = pool.stats;
+	pthread_mutex_unlock(&pool.mutex);
+
+	mlog(LOG_INFO,
+	     "Decoder pool freed (%llu pooled, %llu opened; "
+	     "acquire max %llu us)",
+	     (unsigned long long)stats.hits, (unsigned long long)stats.misses,
+	     (unsigned long long)(stats.max_acquire_ns / 1000));
+}
+
+// Index of the best idle decoder for the source, -1 if none fits. The codec
+// and slice mode are fixed when a codec is opened, the stream size is not.
+static int find_idle(struct moonlight_source *source)
+{
+	int match = -1;
+
+	for (size_t i = 0; i < pool.idle_count; i++) {
+		struct video_decoder *decoder = pool.idle[i];
+		if ((int)decoder->codec != source->video_codec ||
+		    decoder->slice_decode != source->slice_decode)
+			continue;
+
+		if (decoder->width == source->width &&
+		    decoder->height == source->height)
+			return (int)i;
+		if (match < 0)
+			match = (int)i;
+	}
+
+	return match;
+}
+
+struct video_decoder *decoder_pool_acquire(struct moonlight_source *source)
+{
+	uint64_t start = os_gettime_ns();
+
+	pthread_mutex_lock(&pool.mutex);
+	struct video_decoder *decoder = NULL;
+	int index = find_idle(source);
+	if (index >= 0) {
+		decoder = pool.idle[index];
+		pool.idle[index] = pool.idle[--pool.idle_count];
+	}
+	pthread_mutex_unlock(&pool.mutex);
+
+	bool pooled = decoder != NULL;
+	if (pooled)
+		video_decoder_attach(decoder, source);
+	else
+		decoder = video_decoder_create(source);
+
+	if (!decoder)
+		return NULL;
+
+	uint64_t elapsed = os_gettime_ns() - start;
+
+	pthread_mutex_lock(&pool.mutex);
+	if (pooled)
+		pool.stats.hits++;
+	else
+		pool.stats.misses++;
+	pool.stats.last_acquire_ns = elapsed;
+	if (elapsed > pool.stats.max_acquire_ns)
+		pool.stats.max_acquire_ns = elapsed;
+	pthread_mutex_unlock(&pool.mutex);
+
+	mlog(LOG_INFO, "Video decoder ready in %llu us (%s)",
+	     (unsigned long long)(elapsed / 1000),
+	     pooled ? "pooled" : "opened");
+	return decoder;
+}
+
+void decoder_pool_release(struct video_decoder *decoder)
+{
+	if (!decoder)
+		return;
+
+	video_decoder_detach(decoder);
+
+	pthread_mutex_lock(&pool.mutex);
+	bool kept = pool.idle_count < DECODER_POOL_MAX_IDLE;
+	if (kept)
+		pool.idle[pool.idle_count++] = decoder;
+	pthread_mutex_unlock(&pool.mutex);
+
+	if (!kept)
+		video_decoder_destroy(decoder);
+}
+
+void decoder_pool_get_stats(struct decoder_pool_stats *stats)
+{
+	pthread_mutex_lock(&pool.mutex);
+	*stats = pool.stats;
+	stats->idle = pool.idle_count;
+	pthread_mutex_unlock(&pool.mutex);
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+struct moonlight_source;
+struct video_decoder;
+
+// Decoders kept open while idle
+#define DECODER_POOL_MAX_IDLE 8
+
+// Decoders opened when the module loads (default)
+#define DECODER_POOL_DEFAULT_WARM 1
+
+// Overrides the warm count, 0 disables prewarming
+#define DECODER_POOL_WARM_ENV "MOONLIGHT_DECODER_POOL_WARM"
+
+struct decoder_pool_stats {
+	// Acquires served from the pool, and those that opened a decoder
+	uint64_t hits;
+	uint64_t misses;
+	size_t idle;
+
+	// Time to hand out a decoder
+	uint64_t last_acquire_ns;
+	uint64_t max_acquire_ns;
+};
+
+// Opened video decoders with their frame buffers, shared by all sources.
+// Opening a codec starts its thread pool and allocates its tables, so a
+// shown source takes a pooled decoder for its codec, resolution and slice
+// mode, and a hidden one gives it back flushed instead of freeing it.
+
+// Opens the warm decoders, for the source's default stream settings
+void decoder_pool_init(void);
+void decoder_pool_free(void);
+
+// A decoder attached to the source. Taken from the pool if one matches
+// (an idle decoder with another resolution is resized), opened otherwise.
+struct video_decoder *decoder_pool_acquire(struct moonlight_source *source);
+
+// Detach a decoder from its source and keep it for the next acquire. Past
+// DECODER_POOL_MAX_IDLE it is destroyed.
+void decoder_pool_release(struct video_decoder *decoder);
+
+void decoder_pool_get_stats(struct decoder_pool_stats *stats);
@@ -0,0 +1,122 @@
+#pragma once
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+// Shared-memory layout of an exported frame stream, between the plugin
+// (frame-export.c) and readers in other processes (frame-export-reader.c).
+// Nothing here depends on OBS or FFmpeg.
+//
+// The mapping starts with a header, followed by FRAME_EXPORT_SLOTS slots of
+// slot_size bytes each. Frame n is written to slot (n - 1) % slot_count,
+// always over the oldest frame: the writer never waits for a reader. Each
+// slot is a seqlock, its sequence is odd while the slot is written, so a
+// reader knows whether a frame it used was overwritten meanwhile.
+
+// "MLFX", and the layout version readers must match
+#define FRAME_EXPORT_MAGIC 0x58464c4du
+#define FRAME_EXPORT_VERSION 1
+
+#define FRAME_EXPORT_SLOTS 4
+#define FRAME_EXPORT_PLANES 3
+
+// Rows start on a cache line, slots on a page
+#define FRAME_EXPORT_ALIGN 64
+#define FRAME_EXPORT_PAGE 4096
+
+// Readers ask for the mapping on the abstract unix socket with this prefix
+// and the export name, and receive a read-only file descriptor
+#define FRAME_EXPORT_SOCKET_PREFIX "moonlight-obs/"
+#define FRAME_EXPORT_MAX_NAME 64
+
+enum frame_export_format {
+	FRAME_EXPORT_NONE,
+
+	// 8-bit 4:2:0: Y, U and V planes
+	FRAME_EXPORT_I420,
+
+	// 10-bit 4:2:0 in 16-bit little-endian samples (low bits): Y, U and
+	// V planes
+	FRAME_EXPORT_I010,
+
+	// 10-bit 4:2:0 in 16-bit little-endian samples (high bits): Y plane
+	// and interleaved UV plane
+	FRAME_EXPORT_P010,
+};
+
+// The frame was concealed by the decoder after packet loss
+#define FRAME_EXPORT_CORRUPT (1u << 0)
+
+struct frame_export_slot {
+	// Odd while the slot is written
+	atomic_uint sequence;
+
+	uint32_t format;
+	uint32_t width;
+	uint32_t height;
+	uint32_t planes;
+	uint32_t linesize[FRAME_EXPORT_PLANES];
+
+	// From the start of the mapping
+	uint64_t plane_offset[FRAME_EXPORT_PLANES];
+
+	// Frame number (from 1), and when its last packet arrived and when
+	// it was decoded, on the host's monotonic clock (CLOCK_MONOTONIC)
+	uint64_t number;
+	uint64_t received_ns;
+	uint64_t decoded_ns;
+
+	// ITU-T H.273 colour description
+	uint8_t full_range;
+	uint8_t color_primaries;
+	uint8_t color_trc;
+	uint8_t color_matrix;
+	uint32_t flags;
+};
+
+struct frame_export_header {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t slot_count;
+	uint32_t header_size;
+	uint64_t slot_size;
+	uint64_t map_size;
+
+	// Number of the newest complete frame, 0 before the first
+	_Atomic uint64_t latest;
+
+	// Low 32 bits of latest, changed on every frame and when the export
+	// closes: readers wait for it to change (a futex)
+	atomic_uint published;
+
+	// The writer is gone, or moved to a larger mapping: readers connect
+	// again
+	atomic_uint closed;
+
+	struct frame_export_slot slots[FRAME_EXPORT_SLOTS];
+};
+
+static inline uint32_t frame_export_planes(enum frame_export_format format)
+{
+	return format == FRAME_EXPORT_P010 ? 2 : 3;
+}
+
+// Bytes per row (unpadded) and rows of one plane
+static inline void frame_export_plane_size(enum frame_export_format format,
+					   uint32_t width, uint32_t height,
+					   uint32_t plane, uint32_t *row_bytes,
+					   uint32_t *rows)
+{
+	uint32_t sample = format == FRAME_EXPORT_I420 ? 1 : 2;
+	uint32_t chroma_width = (width + 1) / 2;
+
+	if (plane == 0) {
+		*row_bytes = width * sample;
+		*rows = height;
+	} else {
+		*row_bytes = chroma_width * sample *
+			     (format == FRAME_EXPORT_P010 ? 2 : 1);
+		*rows = (height + 1) / 2;
+	}
+}
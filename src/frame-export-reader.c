@@ -0,0 +1,299 @@
+// MSG_CMSG_CLOEXEC
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE
+#endif
+
+#include "frame-export-reader.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+// A slot being overwritten as it is read is tried again this often, then
+// the reader waits for the next frame
+#define READ_ATTEMPTS 4
+
+struct frame_export_reader {
+	const struct frame_export_header *header;
+	size_t size;
+
+	// Number of the last frame returned
+	uint64_t last;
+};
+
+// The export's read-only descriptor, sent over its socket
+static int receive_mapping(const char *name)
+{
+	struct sockaddr_un addr = {.sun_family = AF_UNIX};
+	int length = snprintf(addr.sun_path + 1, sizeof(addr.sun_path) - 1,
+			      FRAME_EXPORT_SOCKET_PREFIX "%s", name);
+	if (length < 0 || (size_t)length >= sizeof(addr.sun_path) - 1) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+	socklen_t size = (socklen_t)(offsetof(struct sockaddr_un, sun_path) +
+				     1 + (size_t)length);
+
+	int sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (sock < 0)
+		return -1;
+	if (connect(sock, (struct sockaddr *)&addr, size) != 0) {
+		int error = errno;
+		close(sock);
+		errno = error;
+		return -1;
+	}
+
+	uint32_t version = 0;
+	struct iovec iov = {.iov_base = &version, .iov_len = sizeof(version)};
+	union {
+		struct cmsghdr header;
+		char data[CMSG_SPACE(sizeof(int))];
+	} control;
+	struct msghdr msg = {
+		.msg_iov = &iov,
+		.msg_iovlen = 1,
+		.msg_control = control.data,
+		.msg_controllen = sizeof(control.data),
+	};
+
+	ssize_t received = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+	close(sock);
+
+	int fd = -1;
+	struct cmsghdr *cmsg = received > 0 ? CMSG_FIRSTHDR(&msg) : NULL;
+	if (cmsg && cmsg->cmsg_level == SOL_SOCKET &&
+	    cmsg->cmsg_type == SCM_RIGHTS &&
+	    cmsg->cmsg_len == CMSG_LEN(sizeof(int)))
+		memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+
+	if (fd < 0) {
+		// Turned away: no frame to map yet
+		errno = EAGAIN;
+		return -1;
+	}
+	if (received != sizeof(version) || version != FRAME_EXPORT_VERSION) {
+		close(fd);
+		errno = EPROTO;
+		return -1;
+	}
+
+	return fd;
+}
+
+static bool valid_header(const struct frame_export_header *header,
+			 size_t size)
+{
+	return header->magic == FRAME_EXPORT_MAGIC &&
+	       header->version == FRAME_EXPORT_VERSION &&
+	       header->slot_count == FRAME_EXPORT_SLOTS &&
+	       header->map_size == size &&
+	       header->header_size >= sizeof(struct frame_export_header) &&
+	       header->slot_size <= (size - header->header_size) /
+					    header->slot_count;
+}
+
+struct frame_export_reader *frame_export_reader_open(const char *name)
+{
+	if (!name || !*name) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	int fd = receive_mapping(name);
+	if (fd < 0)
+		return NULL;
+
+	// Without the seal the writer could shrink the mapping, and reading
+	// past its end would fault
+	struct stat st;
+	int seals = fcntl(fd, F_GET_SEALS);
+	if (fstat(fd, &st) != 0 ||
+	    (size_t)st.st_size < sizeof(struct frame_export_header) ||
+	    seals < 0 || !(seals & F_SEAL_SHRINK)) {
+		close(fd);
+		errno = EPROTO;
+		return NULL;
+	}
+
+	size_t size = (size_t)st.st_size;
+	void *map = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return NULL;
+
+	if (!valid_header(map, size)) {
+		munmap(map, size);
+		errno = EPROTO;
+		return NULL;
+	}
+
+	struct frame_export_reader *reader = calloc(1, sizeof(*reader));
+	if (!reader) {
+		munmap(map, size);
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	reader->header = map;
+	reader->size = size;
+	return reader;
+}
+
+void frame_export_reader_close(struct frame_export_reader *reader)
+{
+	if (!reader)
+		return;
+
+	munmap((void *)reader->header, reader->size);
+	free(reader);
+}
+
+// The writer is trusted to stay within the mapping, but a reader must not
+// fault if it does not
+static bool valid_frame(struct frame_export_reader *reader,
+			const struct frame_export_frame *frame)
+{
+	if (frame->format < FRAME_EXPORT_I420 ||
+	    frame->format > FRAME_EXPORT_P010 ||
+	    frame->planes != frame_export_planes(frame->format))
+		return false;
+
+	const uint8_t *base = (const uint8_t *)reader->header;
+	for (uint32_t i = 0; i < frame->planes; i++) {
+		uint32_t row_bytes, rows;
+		frame_export_plane_size(frame->format, frame->width,
+					frame->height, i, &row_bytes, &rows);
+
+		size_t offset = (size_t)(frame->data[i] - base);
+		size_t end = (size_t)frame->linesize[i] * (rows - 1) +
+			     row_bytes;
+		if (frame->linesize[i] < row_bytes || offset > reader->size ||
+		    end > reader->size - offset)
+			return false;
+	}
+
+	return true;
+}
+
+static void read_slot(struct frame_export_reader *reader,
+		      const struct frame_export_slot *slot,
+		      struct frame_export_frame *frame)
+{
+	const uint8_t *base = (const uint8_t *)reader->header;
+
+	frame->number = slot->number;
+	frame->format = (enum frame_export_format)slot->format;
+	frame->width = slot->width;
+	frame->height = slot->height;
+	frame->planes = slot->planes < FRAME_EXPORT_PLANES
+				? slot->planes
+				: FRAME_EXPORT_PLANES;
+	for (uint32_t i = 0; i < FRAME_EXPORT_PLANES; i++) {
+		bool used = i < frame->planes &&
+			    slot->plane_offset[i] < reader->size;
+		frame->data[i] = used ? base + slot->plane_offset[i] : NULL;
+		frame->linesize[i] = used ? slot->linesize[i] : 0;
+	}
+
+	frame->received_ns = slot->received_ns;
+	frame->decoded_ns = slot->decoded_ns;
+	frame->full_range = slot->full_range;
+	frame->color_primaries = slot->color_primaries;
+	frame->color_trc = slot->color_trc;
+	frame->color_matrix = slot->color_matrix;
+	frame->corrupt = slot->flags & FRAME_EXPORT_CORRUPT;
+}
+
+enum frame_export_status
+frame_export_reader_next(struct frame_export_reader *reader,
+			 struct frame_export_frame *frame)
+{
+	const struct frame_export_header *header = reader->header;
+
+	for (int attempt = 0; attempt < READ_ATTEMPTS; attempt++) {
+		if (atomic_load_explicit(&header->closed, memory_order_acquire))
+			return FRAME_EXPORT_CLOSED;
+
+		uint64_t latest = atomic_load_explicit(&header->latest,
+						       memory_order_acquire);
+		if (!latest || latest == reader->last)
+			return FRAME_EXPORT_NO_FRAME;
+
+		uint32_t index = (uint32_t)((latest - 1) % header->slot_count);
+		const struct frame_export_slot *slot = &header->slots[index];
+
+		unsigned sequence = atomic_load_explicit(&slot->sequence,
+							 memory_order_acquire);
+		if (sequence & 1)
+			continue;
+
+		read_slot(reader, slot, frame);
+
+		// Nothing read above may come from a later write
+		atomic_thread_fence(memory_order_acquire);
+		if (atomic_load_explicit(&slot->sequence,
+					 memory_order_relaxed) != sequence ||
+		    frame->number != latest)
+			continue;
+
+		if (!valid_frame(reader, frame))
+			return FRAME_EXPORT_CLOSED;
+
+		frame->slot = index;
+		frame->sequence = sequence;
+		frame->missed = reader->last ? latest - reader->last - 1 : 0;
+		reader->last = latest;
+		return FRAME_EXPORT_FRAME;
+	}
+
+	return FRAME_EXPORT_NO_FRAME;
+}
+
+bool frame_export_reader_check(struct frame_export_reader *reader,
+			       const struct frame_export_frame *frame)
+{
+	const struct frame_export_slot *slot =
+		&reader->header->slots[frame->slot];
+
+	// The planes were read before the sequence is looked at again
+	atomic_thread_fence(memory_order_acquire);
+	return atomic_load_explicit(&slot->sequence, memory_order_relaxed) ==
+	       frame->sequence;
+}
+
+bool frame_export_reader_wait(struct frame_export_reader *reader,
+			      int timeout_ms)
+{
+	const struct frame_export_header *header = reader->header;
+
+	unsigned published = atomic_load_explicit(&header->published,
+						  memory_order_acquire);
+	if (published != (unsigned)reader->last ||
+	    atomic_load_explicit(&header->closed, memory_order_acquire))
+		return true;
+
+	// The writer wakes every waiter after each frame; a wait on a
+	// read-only mapping is fine, the futex word is only compared
+	struct timespec timeout = {
+		.tv_sec = timeout_ms / 1000,
+		.tv_nsec = (long)(timeout_ms % 1000) * 1000000,
+	};
+	syscall(SYS_futex, &header->published, FUTEX_WAIT, published,
+		timeout_ms < 0 ? NULL : &timeout, NULL, 0);
+
+	return atomic_load_explicit(&header->published,
+				    memory_order_acquire) !=
+		       (unsigned)reader->last ||
+	       atomic_load_explicit(&header->closed, memory_order_acquire);
+}
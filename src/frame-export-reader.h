@@ -0,0 +1,91 @@
+#pragma once
+
+#include "frame-export-layout.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+// Reads the frames a Moonlight source exports (see frame-export.h) from
+// another process on the same machine. Links against nothing but libc;
+// Linux only.
+//
+//	struct frame_export_reader *reader =
+//		frame_export_reader_open("Game Capture");
+//	struct frame_export_frame frame;
+//	while (frame_export_reader_wait(reader, 100)) {
+//		if (frame_export_reader_next(reader, &frame) !=
+//		    FRAME_EXPORT_FRAME)
+//			continue;
+//		use(frame.data, frame.linesize);
+//		if (!frame_export_reader_check(reader, &frame))
+//			discard_result(); // overwritten while in use
+//	}
+//
+// Frames are used in place, in the read-only mapping. The writer never
+// waits: a frame stays valid for FRAME_EXPORT_SLOTS - 1 frame times, a
+// reader that takes longer finds it overwritten when it checks.
+
+struct frame_export_reader;
+
+enum frame_export_status {
+	// A frame newer than the last one returned
+	FRAME_EXPORT_FRAME,
+
+	// Nothing new yet
+	FRAME_EXPORT_NO_FRAME,
+
+	// The source stopped exporting or moved to a larger mapping: close
+	// the reader and open it again
+	FRAME_EXPORT_CLOSED,
+};
+
+struct frame_export_frame {
+	uint64_t number;
+	enum frame_export_format format;
+	uint32_t width;
+	uint32_t height;
+
+	uint32_t planes;
+	const uint8_t *data[FRAME_EXPORT_PLANES];
+	uint32_t linesize[FRAME_EXPORT_PLANES];
+
+	// Host monotonic clock (CLOCK_MONOTONIC)
+	uint64_t received_ns;
+	uint64_t decoded_ns;
+
+	// ITU-T H.273 colour description
+	bool full_range;
+	uint8_t color_primaries;
+	uint8_t color_trc;
+	uint8_t color_matrix;
+
+	// Concealed by the decoder after packet loss
+	bool corrupt;
+
+	// Frames published since the previous one returned, that this
+	// reader never saw
+	uint64_t missed;
+
+	uint32_t slot;
+	uint32_t sequence;
+};
+
+// Connects to the export of that name and maps it. NULL with errno set if
+// there is no such export (ECONNREFUSED), it has no frame yet (EAGAIN) or
+// the layout differs (EPROTO).
+struct frame_export_reader *frame_export_reader_open(const char *name);
+void frame_export_reader_close(struct frame_export_reader *reader);
+
+// The newest frame, skipping those published since the last call
+enum frame_export_status
+frame_export_reader_next(struct frame_export_reader *reader,
+			 struct frame_export_frame *frame);
+
+// Whether the frame's planes are still as returned. Call it after using
+// them: false means they were overwritten meanwhile.
+bool frame_export_reader_check(struct frame_export_reader *reader,
+			       const struct frame_export_frame *frame);
+
+// Wait up to timeout_ms for a new frame or for the export to close. False
+// on timeout.
+bool frame_export_reader_wait(struct frame_export_reader *reader,
+			      int timeout_ms);
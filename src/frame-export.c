@@ -0,0 +1,497 @@
+// memfd_create, accept4, SO_PEERCRED
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE
+#endif
+
+#include "frame-export.h"
+#include "hot-log.h"
+#include <stdio.h>
+#include <string.h>
+#ifdef __linux__
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <linux/futex.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+#define MB (1024 * 1024)
+
+#ifdef __linux__
+
+struct export_mapping {
+	// The writer's descriptor, and a read-only one for readers
+	int fd;
+	int read_fd;
+
+	struct frame_export_header *header;
+	size_t size;
+};
+
+struct frame_export {
+	char name[FRAME_EXPORT_MAX_NAME];
+
+	// Written by the decode thread only; the mutex guards read_fd, which
+	// the socket thread hands out
+	struct export_mapping mapping;
+	pthread_mutex_t mutex;
+	uint64_t number;
+	bool skip_logged;
+
+	int listen_fd;
+	int wakeup_fd;
+	pthread_t thread;
+
+	atomic_uint_fast64_t frames;
+	atomic_uint_fast64_t skipped;
+	atomic_uint_fast64_t mappings;
+	atomic_uint_fast64_t readers;
+	atomic_uint_fast64_t last_publish_ns;
+	atomic_uint_fast64_t max_publish_ns;
+};
+
+static size_t align_size(size_t size, size_t alignment)
+{
+	return (size + alignment - 1) / alignment * alignment;
+}
+
+// Where each plane of a picture goes in a slot, and the slot size it needs
+static size_t slot_layout(const struct frame_export_picture *picture,
+			  uint32_t linesize[FRAME_EXPORT_PLANES],
+			  size_t offset[FRAME_EXPORT_PLANES])
+{
+	size_t size = 0;
+
+	for (uint32_t i = 0; i < frame_export_planes(picture->format); i++) {
+		uint32_t row_bytes, rows;
+		frame_export_plane_size(picture->format, picture->width,
+					picture->height, i, &row_bytes, &rows);
+
+		linesize[i] = (uint32_t)align_size(row_bytes,
+						   FRAME_EXPORT_ALIGN);
+		offset[i] = size;
+		size += (size_t)linesize[i] * rows;
+	}
+
+	return align_size(size, FRAME_EXPORT_PAGE);
+}
+
+static void wake_readers(struct frame_export_header *header)
+{
+	syscall(SYS_futex, &header->published, FUTEX_WAKE, INT_MAX, NULL,
+		NULL, 0);
+}
+
+static void unmap_export(struct export_mapping *mapping)
+{
+	if (!mapping->header)
+		return;
+
+	// Readers keep their own mapping until they let go of it
+	atomic_store(&mapping->header->closed, 1);
+	atomic_fetch_add(&mapping->header->published, 1);
+	wake_readers(mapping->header);
+
+	munmap(mapping->header, mapping->size);
+	close(mapping->read_fd);
+	close(mapping->fd);
+	mapping->header = NULL;
+}
+
+static bool map_export(struct export_mapping *mapping, const char *name,
+		       size_t slot_size)
+{
+	size_t header_size = align_size(sizeof(struct frame_export_header),
+					FRAME_EXPORT_PAGE);
+	size_t size = header_size + FRAME_EXPORT_SLOTS * slot_size;
+
+	char memfd_name[FRAME_EXPORT_MAX_NAME + 16];
+	snprintf(memfd_name, sizeof(memfd_name), PLUGIN_NAME ":%s", name);
+
+	int fd = memfd_create(memfd_name, MFD_CLOEXEC | MFD_ALLOW_SEALING);
+	if (fd < 0)
+		return false;
+
+	void *map = MAP_FAILED;
+	if (ftruncate(fd, (off_t)size) == 0)
+		map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd,
+			   0);
+	if (map == MAP_FAILED) {
+		close(fd);
+		return false;
+	}
+
+	// The size is fixed, so a reader never faults past the end, and no
+	// one else may map it writable (kernels before 5.1 lack the seal,
+	// the read-only descriptor still keeps readers from writing)
+	int seals = F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL;
+#ifdef F_SEAL_FUTURE_WRITE
+	if (fcntl(fd, F_ADD_SEALS, seals | F_SEAL_FUTURE_WRITE) != 0)
+#endif
+		fcntl(fd, F_ADD_SEALS, seals);
+
+	char path[32];
+	snprintf(path, sizeof(path), "/proc/self/fd/%d", fd);
+	int read_fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (read_fd < 0) {
+		munmap(map, size);
+		close(fd);
+		return false;
+	}
+
+	struct frame_export_header *header = map;
+	header->magic = FRAME_EXPORT_MAGIC;
+	header->version = FRAME_EXPORT_VERSION;
+	header->slot_count = FRAME_EXPORT_SLOTS;
+	header->header_size = (uint32_t)header_size;
+	header->slot_size = slot_size;
+	header->map_size = size;
+
+	mapping->fd = fd;
+	mapping->read_fd = read_fd;
+	mapping->header = header;
+	mapping->size = size;
+	return true;
+}
+
+// Move to a mapping with room for the picture. Readers of the old one see
+// it closed and ask for the new one.
+static bool remap_export(struct frame_export *export,
+			 const struct frame_export_picture *picture,
+			 size_t slot_size)
+{
+	struct export_mapping mapping;
+	if (!map_export(&mapping, export->name, slot_size)) {
+		hlog(LOG_ERROR, "Frame export '%s': failed to map %zu MB: %s",
+		     export->name, FRAME_EXPORT_SLOTS * slot_size / MB,
+		     strerror(errno));
+		return false;
+	}
+
+	struct export_mapping old = export->mapping;
+	pthread_mutex_lock(&export->mutex);
+	export->mapping = mapping;
+	pthread_mutex_unlock(&export->mutex);
+	unmap_export(&old);
+
+	atomic_fetch_add(&export->mappings, 1);
+	hlog(LOG_INFO, "Frame export '%s': %ux%u, %zu MB shared",
+	     export->name, picture->width, picture->height,
+	     mapping.size / MB);
+	return true;
+}
+
+// Only processes of the same user get the frames
+static void serve_reader(struct frame_export *export, int fd)
+{
+	struct ucred cred;
+	socklen_t length = sizeof(cred);
+	if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &length) != 0 ||
+	    cred.uid != geteuid()) {
+		hlog(LOG_WARNING, "Frame export '%s': refused a reader of "
+				  "another user",
+		     export->name);
+		return;
+	}
+
+	uint32_t version = FRAME_EXPORT_VERSION;
+	struct iovec iov = {.iov_base = &version, .iov_len = sizeof(version)};
+	union {
+		struct cmsghdr header;
+		char data[CMSG_SPACE(sizeof(int))];
+	} control;
+	memset(&control, 0, sizeof(control));
+
+	struct msghdr msg = {
+		.msg_iov = &iov,
+		.msg_iovlen = 1,
+		.msg_control = control.data,
+		.msg_controllen = sizeof(control.data),
+	};
+	struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+
+	// Before the first frame there is nothing to map yet, the reader is
+	// turned away and tries again
+	pthread_mutex_lock(&export->mutex);
+	if (export->mapping.header) {
+		// Counted first, the reader may be reading before sendmsg
+		// returns
+		atomic_fetch_add(&export->readers, 1);
+		memcpy(CMSG_DATA(cmsg), &export->mapping.read_fd, sizeof(int));
+		if (sendmsg(fd, &msg, MSG_NOSIGNAL) != sizeof(version))
+			atomic_fetch_sub(&export->readers, 1);
+	}
+	pthread_mutex_unlock(&export->mutex);
+}
+
+static void *socket_thread(void *arg)
+{
+	struct frame_export *export = arg;
+
+	for (;;) {
+		struct pollfd fds[2] = {
+			{export->listen_fd, POLLIN, 0},
+			{export->wakeup_fd, POLLIN, 0},
+		};
+		if (poll(fds, 2, -1) < 0 && errno != EINTR)
+			break;
+		if (fds[1].revents)
+			break;
+		if (!(fds[0].revents & POLLIN))
+			continue;
+
+		int fd = accept4(export->listen_fd, NULL, NULL, SOCK_CLOEXEC);
+		if (fd >= 0) {
+			serve_reader(export, fd);
+			close(fd);
+		}
+	}
+
+	return NULL;
+}
+
+// An abstract socket: no file to clean up, it goes with the process
+static int listen_socket(const char *name)
+{
+	struct sockaddr_un addr = {.sun_family = AF_UNIX};
+	int length = snprintf(addr.sun_path + 1, sizeof(addr.sun_path) - 1,
+			      FRAME_EXPORT_SOCKET_PREFIX "%s", name);
+	socklen_t size = (socklen_t)(offsetof(struct sockaddr_un, sun_path) +
+				     1 + (size_t)length);
+
+	int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK,
+			0);
+	if (fd < 0)
+		return -1;
+
+	if (bind(fd, (struct sockaddr *)&addr, size) != 0 ||
+	    listen(fd, 8) != 0) {
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+struct frame_export *frame_export_create(const char *name)
+{
+	if (!name || !*name)
+		return NULL;
+
+	struct frame_export *export = bzalloc(sizeof(struct frame_export));
+	snprintf(export->name, sizeof(export->name), "%s", name);
+
+	export->listen_fd = listen_socket(export->name);
+	if (export->listen_fd < 0) {
+		hlog(LOG_ERROR, "Frame export '%s': cannot listen: %s",
+		     export->name, strerror(errno));
+		bfree(export);
+		return NULL;
+	}
+
+	export->wakeup_fd = eventfd(0, EFD_CLOEXEC);
+	pthread_mutex_init(&export->mutex, NULL);
+
+	if (export->wakeup_fd < 0 ||
+	    pthread_create(&export->thread, NULL, socket_thread, export) != 0) {
+		hlog(LOG_ERROR, "Frame export '%s': failed to start",
+		     export->name);
+		if (export->wakeup_fd >= 0)
+			close(export->wakeup_fd);
+		close(export->listen_fd);
+		pthread_mutex_destroy(&export->mutex);
+		bfree(export);
+		return NULL;
+	}
+
+	hlog(LOG_INFO, "Exporting decoded frames as '%s'", export->name);
+	return export;
+}
+
+void frame_export_destroy(struct frame_export *export)
+{
+	if (!export)
+		return;
+
+	uint64_t value = 1;
+	if (write(export->wakeup_fd, &value, sizeof(value)) < 0)
+		hlog(LOG_WARNING, "Frame export '%s': failed to stop",
+		     export->name);
+	pthread_join(export->thread, NULL);
+	close(export->wakeup_fd);
+	close(export->listen_fd);
+
+	unmap_export(&export->mapping);
+	pthread_mutex_destroy(&export->mutex);
+
+	hlog(LOG_INFO, "Frame export '%s' closed: %llu frames, %llu readers",
+	     export->name, (unsigned long long)atomic_load(&export->frames),
+	     (unsigned long long)atomic_load(&export->readers));
+	bfree(export);
+}
+
+const char *frame_export_get_name(struct frame_export *export)
+{
+	return export ? export->name : NULL;
+}
+
+static void copy_plane(uint8_t *dst, uint32_t dst_linesize,
+		       const uint8_t *src, int src_linesize,
+		       uint32_t row_bytes, uint32_t rows)
+{
+	if ((int)dst_linesize == src_linesize) {
+		memcpy(dst, src, (size_t)dst_linesize * (rows - 1) + row_bytes);
+		return;
+	}
+
+	for (uint32_t y = 0; y < rows; y++)
+		memcpy(dst + (size_t)y * dst_linesize,
+		       src + (ptrdiff_t)y * src_linesize, row_bytes);
+}
+
+void frame_export_publish(struct frame_export *export,
+			  const struct frame_export_picture *picture)
+{
+	if (!export || !picture)
+		return;
+
+	uint64_t start = os_gettime_ns();
+
+	if (picture->format == FRAME_EXPORT_NONE || !picture->width ||
+	    !picture->height) {
+		if (!export->skip_logged)
+			hlog(LOG_WARNING, "Frame export '%s': frame format "
+					  "not exported",
+			     export->name);
+		export->skip_logged = true;
+		atomic_fetch_add(&export->skipped, 1);
+		return;
+	}
+
+	uint32_t linesize[FRAME_EXPORT_PLANES] = {0};
+	size_t offset[FRAME_EXPORT_PLANES] = {0};
+	size_t slot_size = slot_layout(picture, linesize, offset);
+
+	struct frame_export_header *header = export->mapping.header;
+	if (!header || slot_size > header->slot_size) {
+		if (!remap_export(export, picture, slot_size)) {
+			atomic_fetch_add(&export->skipped, 1);
+			return;
+		}
+		header = export->mapping.header;
+	}
+
+	// The oldest slot, whether or not a reader still uses it
+	uint64_t number = ++export->number;
+	uint32_t index = (uint32_t)((number - 1) % header->slot_count);
+	struct frame_export_slot *slot = &header->slots[index];
+	size_t slot_offset = header->header_size + index * header->slot_size;
+
+	unsigned sequence =
+		atomic_load_explicit(&slot->sequence, memory_order_relaxed);
+	atomic_store_explicit(&slot->sequence, sequence + 1,
+			      memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+
+	uint32_t planes = frame_export_planes(picture->format);
+	for (uint32_t i = 0; i < planes; i++) {
+		uint32_t row_bytes, rows;
+		frame_export_plane_size(picture->format, picture->width,
+					picture->height, i, &row_bytes, &rows);
+
+		slot->linesize[i] = linesize[i];
+		slot->plane_offset[i] = slot_offset + offset[i];
+		copy_plane((uint8_t *)header + slot->plane_offset[i],
+			   linesize[i], picture->data[i], picture->linesize[i],
+			   row_bytes, rows);
+	}
+
+	slot->format = picture->format;
+	slot->width = picture->width;
+	slot->height = picture->height;
+	slot->planes = planes;
+	slot->number = number;
+	slot->received_ns = picture->received_ns;
+	slot->decoded_ns = start;
+	slot->full_range = picture->full_range;
+	slot->color_primaries = picture->color_primaries;
+	slot->color_trc = picture->color_trc;
+	slot->color_matrix = picture->color_matrix;
+	slot->flags = picture->corrupt ? FRAME_EXPORT_CORRUPT : 0;
+
+	atomic_store_explicit(&slot->sequence, sequence + 2,
+			      memory_order_release);
+	atomic_store_explicit(&header->latest, number, memory_order_release);
+	atomic_store_explicit(&header->published, (unsigned)number,
+			      memory_order_release);
+	wake_readers(header);
+
+	uint64_t elapsed = os_gettime_ns() - start;
+	atomic_fetch_add(&export->frames, 1);
+	atomic_store(&export->last_publish_ns, elapsed);
+	if (elapsed > atomic_load(&export->max_publish_ns))
+		atomic_store(&export->max_publish_ns, elapsed);
+}
+
+void frame_export_get_stats(struct frame_export *export,
+			    struct frame_export_stats *stats)
+{
+	memset(stats, 0, sizeof(*stats));
+	if (!export)
+		return;
+
+	stats->frames = atomic_load(&export->frames);
+	stats->skipped = atomic_load(&export->skipped);
+	stats->mappings = atomic_load(&export->mappings);
+	stats->readers = atomic_load(&export->readers);
+	stats->last_publish_ns = atomic_load(&export->last_publish_ns);
+	stats->max_publish_ns = atomic_load(&export->max_publish_ns);
+}
+
+#else
+
+// Needs memfd, sealing and descriptor passing
+struct frame_export *frame_export_create(const char *name)
+{
+	hlog(LOG_WARNING, "Frame export '%s' is only available on Linux",
+	     name ? name : "");
+	return NULL;
+}
+
+void frame_export_destroy(struct frame_export *export)
+{
+	UNUSED_PARAMETER(export);
+}
+
+const char *frame_export_get_name(struct frame_export *export)
+{
+	UNUSED_PARAMETER(export);
+	return NULL;
+}
+
+void frame_export_publish(struct frame_export *export,
+			  const struct frame_export_picture *picture)
+{
+	UNUSED_PARAMETER(export);
+	UNUSED_PARAMETER(picture);
+}
+
+void frame_export_get_stats(struct frame_export *export,
+			    struct frame_export_stats *stats)
+{
+	UNUSED_PARAMETER(export);
+	memset(stats, 0, sizeof(*stats));
+}
+
+#endif
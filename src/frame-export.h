@@ -0,0 +1,63 @@
+#pragma once
+
+#include "frame-export-layout.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// A decoded frame to export, planes as the decoder left them
+struct frame_export_picture {
+	enum frame_export_format format;
+	uint32_t width;
+	uint32_t height;
+	const uint8_t *data[FRAME_EXPORT_PLANES];
+	int linesize[FRAME_EXPORT_PLANES];
+
+	bool full_range;
+	uint8_t color_primaries;
+	uint8_t color_trc;
+	uint8_t color_matrix;
+	bool corrupt;
+
+	// When the frame's last packet arrived
+	uint64_t received_ns;
+};
+
+struct frame_export_stats {
+	uint64_t frames;
+
+	// Frames in a format that is not exported
+	uint64_t skipped;
+
+	// Mappings made (a larger stream needs a new one), and readers that
+	// were handed one
+	uint64_t mappings;
+	uint64_t readers;
+
+	// Time to copy a frame into the mapping
+	uint64_t last_publish_ns;
+	uint64_t max_publish_ns;
+};
+
+// Decoded frames of one source, published for processes on this machine
+// (see frame-export-layout.h). The planes are copied into a sealed memfd
+// mapping, which readers map read-only and use in place. The mapping is
+// made with the first frame and made again when a frame does not fit.
+// Only on Linux, elsewhere create returns NULL.
+struct frame_export;
+
+// Listens on FRAME_EXPORT_SOCKET_PREFIX name. NULL if the name is in use.
+struct frame_export *frame_export_create(const char *name);
+
+// Readers see the export closed
+void frame_export_destroy(struct frame_export *export);
+
+const char *frame_export_get_name(struct frame_export *export);
+
+// Copy a frame into the oldest slot. Never waits for a reader; called from
+// the decode thread only.
+void frame_export_publish(struct frame_export *export,
+			  const struct frame_export_picture *picture);
+
+void frame_export_get_stats(struct frame_export *export,
+			    struct frame_export_stats *stats);
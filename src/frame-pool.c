@@ -0,0 +1,336 @@
+// MAP_HUGETLB, MADV_HUGEPAGE
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE
+#endif
+
+#include "frame-pool.h"
+#include "plugin-main.h"
+#include <pthread.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+
+#define HUGE_PAGE_SIZE (2 * 1024 * 1024)
+
+#if !defined(MAP_ANONYMOUS) && defined(MAP_ANON)
+#define MAP_ANONYMOUS MAP_ANON
+#endif
+
+struct pool_block {
+	size_t offset;
+	size_t size;
+	bool in_use;
+};
+
+struct frame_pool {
+	pthread_mutex_t mutex;
+
+	// The mapping, and the arena within it (aligned to a huge page)
+	void *map;
+	size_t map_size;
+	uint8_t *arena;
+
+	// Blocks carved so far, in arena order
+	struct pool_block blocks[FRAME_POOL_MAX_BLOCKS];
+	uint32_t block_count;
+
+	// The owner released the pool, it goes when its buffers are back
+	bool released;
+
+	struct frame_pool_stats stats;
+};
+
+static size_t align_size(size_t size, size_t alignment)
+{
+	return (size + alignment - 1) / alignment * alignment;
+}
+
+static size_t round_request(size_t size)
+{
+	if (size > FRAME_POOL_SMALL_SIZE)
+		return align_size(size, FRAME_POOL_ALIGN);
+
+	size_t rounded = FRAME_POOL_ALIGN;
+	while (rounded < size)
+		rounded *= 2;
+	return rounded;
+}
+
+int frame_pool_stream_budget(int width, int height, int bytes_per_sample,
+			     int threads)
+{
+	// Decoders pad frames to whole macroblocks / coding tree units
+	size_t frame = align_size((size_t)width, 64) *
+		       align_size((size_t)height, 64) * 3 / 2 *
+		       (size_t)bytes_per_sample;
+	size_t frames = FRAME_POOL_MAX_REFS + FRAME_POOL_OUTPUT_FRAMES +
+			(size_t)(threads > 1 ? threads : 1);
+
+	size_t mb = 1024 * 1024;
+	return (int)(align_size(frame * frames, mb) / mb) +
+	       FRAME_POOL_HEADROOM_MB;
+}
+
+// Reserve the arena's address range. Pages are only backed once touched,
+// on Windows once carved.
+static bool map_arena(struct frame_pool *pool, size_t size, bool hugepages)
+{
+#ifdef _WIN32
+	UNUSED_PARAMETER(hugepages);
+	pool->map = VirtualAlloc(NULL, size, MEM_RESERVE, PAGE_NOACCESS);
+	pool->map_size = size;
+	pool->arena = pool->map;
+	pool->stats.pages = FRAME_POOL_PAGES_NORMAL;
+	return pool->map != NULL;
+#else
+	int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+
+#ifdef MAP_HUGETLB
+	// Reserved huge pages, only there if the system set some aside. The
+	// whole budget is reserved now, rather than failing on a page fault.
+	if (hugepages) {
+		void *map = mmap(NULL, size, PROT_READ | PROT_WRITE,
+				 flags | MAP_HUGETLB, -1, 0);
+		if (map != MAP_FAILED) {
+			pool->map = map;
+			pool->map_size = size;
+			pool->arena = map;
+			pool->stats.pages = FRAME_POOL_PAGES_HUGE;
+			return true;
+		}
+	}
+#endif
+
+#ifdef MAP_NORESERVE
+	flags |= MAP_NORESERVE;
+#endif
+
+	// One huge page more, to start the arena on a huge page boundary
+	size_t map_size = size + (hugepages ? HUGE_PAGE_SIZE : 0);
+	void *map = mmap(NULL, map_size, PROT_READ | PROT_WRITE, flags, -1,
+			 0);
+	if (map == MAP_FAILED)
+		return false;
+
+	pool->map = map;
+	pool->map_size = map_size;
+	pool->arena = map;
+	pool->stats.pages = FRAME_POOL_PAGES_NORMAL;
+
+#ifdef MADV_HUGEPAGE
+	if (hugepages) {
+		pool->arena = (uint8_t *)align_size((uintptr_t)map,
+						    HUGE_PAGE_SIZE);
+		if (madvise(pool->arena, size, MADV_HUGEPAGE) == 0)
+			pool->stats.pages = FRAME_POOL_PAGES_TRANSPARENT_HUGE;
+	}
+#endif
+
+	return true;
+#endif
+}
+
+static void unmap_arena(struct frame_pool *pool)
+{
+#ifdef _WIN32
+	VirtualFree(pool->map, 0, MEM_RELEASE);
+#else
+	munmap(pool->map, pool->map_size);
+#endif
+}
+
+struct frame_pool *frame_pool_create(size_t budget, bool hugepages)
+{
+	size_t size = align_size(budget, HUGE_PAGE_SIZE);
+	if (!size)
+		return NULL;
+
+	struct frame_pool *pool = bzalloc(sizeof(struct frame_pool));
+	if (!map_arena(pool, size, hugepages)) {
+		mlog(LOG_ERROR, "Failed to reserve %zu MB for decoder buffers",
+		     size / (1024 * 1024));
+		bfree(pool);
+		return NULL;
+	}
+
+	pthread_mutex_init(&pool->mutex, NULL);
+	pool->stats.budget = size;
+
+	if (hugepages && pool->stats.pages == FRAME_POOL_PAGES_NORMAL)
+		mlog(LOG_INFO, "No huge pages for decoder buffers, using "
+			       "normal pages");
+	return pool;
+}
+
+static void destroy_pool(struct frame_pool *pool)
+{
+	unmap_arena(pool);
+	pthread_mutex_destroy(&pool->mutex);
+	bfree(pool);
+}
+
+void frame_pool_release(struct frame_pool *pool)
+{
+	if (!pool)
+		return;
+
+	pthread_mutex_lock(&pool->mutex);
+	pool->released = true;
+	bool idle = pool->stats.in_use == 0;
+	pthread_mutex_unlock(&pool->mutex);
+
+	if (idle)
+		destroy_pool(pool);
+}
+
+// The smallest free block for the request, wasting at most half of it
+// unless strict is false. -1 if none.
+static int find_free_block(struct frame_pool *pool, size_t size, bool strict)
+{
+	int best = -1;
+
+	for (uint32_t i = 0; i < pool->block_count; i++) {
+		struct pool_block *block = &pool->blocks[i];
+		if (block->in_use || block->size < size ||
+		    (strict && block->size / 2 > size))
+			continue;
+		if (best < 0 || block->size < pool->blocks[best].size)
+			best = (int)i;
+	}
+
+	return best;
+}
+
+// Called with the mutex held. -1 if the budget has no room.
+static int carve_block(struct frame_pool *pool, size_t size)
+{
+	if (pool->block_count == FRAME_POOL_MAX_BLOCKS ||
+	    size > pool->stats.budget - pool->stats.carved)
+		return -1;
+
+#ifdef _WIN32
+	// Reserved pages count against the commit limit only once committed
+	if (!VirtualAlloc(pool->arena + pool->stats.carved, size, MEM_COMMIT,
+			  PAGE_READWRITE))
+		return -1;
+#endif
+
+	struct pool_block *block = &pool->blocks[pool->block_count];
+	block->offset = pool->stats.carved;
+	block->size = size;
+	block->in_use = false;
+
+	pool->stats.carved += size;
+	return (int)pool->block_count++;
+}
+
+void *frame_pool_alloc(struct frame_pool *pool, size_t size)
+{
+	if (!pool || !size)
+		return NULL;
+
+	size = round_request(size);
+
+	pthread_mutex_lock(&pool->mutex);
+
+	// A block of its size, a new one, or any one large enough
+	int index = find_free_block(pool, size, true);
+	if (index < 0)
+		index = carve_block(pool, size);
+	if (index < 0)
+		index = find_free_block(pool, size, false);
+
+	if (index < 0) {
+		pool->stats.refused++;
+		pthread_mutex_unlock(&pool->mutex);
+		return NULL;
+	}
+
+	struct pool_block *block = &pool->blocks[index];
+	block->in_use = true;
+
+	struct frame_pool_stats *stats = &pool->stats;
+	stats->allocs++;
+	stats->in_use += block->size;
+	if (stats->in_use > stats->peak_in_use)
+		stats->peak_in_use = stats->in_use;
+
+	void *buffer = pool->arena + block->offset;
+	pthread_mutex_unlock(&pool->mutex);
+
+	return buffer;
+}
+
+void frame_pool_free(struct frame_pool *pool, void *buffer)
+{
+	if (!pool || !buffer)
+		return;
+
+	size_t offset = (size_t)((uint8_t *)buffer - pool->arena);
+
+	pthread_mutex_lock(&pool->mutex);
+
+	struct pool_block *block = NULL;
+	for (uint32_t i = 0; i < pool->block_count; i++) {
+		if (pool->blocks[i].offset == offset) {
+			block = &pool->blocks[i];
+			break;
+		}
+	}
+
+	if (!block || !block->in_use) {
+		pthread_mutex_unlock(&pool->mutex);
+		mlog(LOG_WARNING, "Decoder buffer %p is not from this pool",
+		     buffer);
+		return;
+	}
+
+	block->in_use = false;
+	pool->stats.in_use -= block->size;
+
+	// Give the free blocks at the end back to the arena, so that a
+	// stream of another size is carved afresh
+	while (pool->block_count &&
+	       !pool->blocks[pool->block_count - 1].in_use) {
+		pool->block_count--;
+		pool->stats.carved = pool->blocks[pool->block_count].offset;
+	}
+
+	bool destroy = pool->released && pool->stats.in_use == 0;
+	pthread_mutex_unlock(&pool->mutex);
+
+	if (destroy)
+		destroy_pool(pool);
+}
+
+void frame_pool_get_stats(struct frame_pool *pool,
+			  struct frame_pool_stats *stats)
+{
+	pthread_mutex_lock(&pool->mutex);
+	*stats = pool->stats;
+	stats->blocks = pool->block_count;
+	pthread_mutex_unlock(&pool->mutex);
+}
+
+void frame_pool_reset_stats(struct frame_pool *pool)
+{
+	pthread_mutex_lock(&pool->mutex);
+	pool->stats.peak_in_use = pool->stats.in_use;
+	pool->stats.allocs = 0;
+	pool->stats.refused = 0;
+	pthread_mutex_unlock(&pool->mutex);
+}
+
+const char *frame_pool_pages_name(enum frame_pool_pages pages)
+{
+	switch (pages) {
+	case FRAME_POOL_PAGES_HUGE:
+		return "huge pages";
+	case FRAME_POOL_PAGES_TRANSPARENT_HUGE:
+		return "transparent huge pages";
+	default:
+		return "normal pages";
+	}
+}
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Frames a decoder holds at once besides one per frame thread: the most
+// references an H.264 or HEVC stream may keep (MaxDpbFrames), and the
+// pictures queued for output
+#define FRAME_POOL_MAX_REFS 16
+#define FRAME_POOL_OUTPUT_FRAMES 4
+
+// Room for packets and row padding on top of the frames, in MB
+#define FRAME_POOL_HEADROOM_MB 16
+
+// Buffers start on a cache line, as FFmpeg's SIMD code expects
+#define FRAME_POOL_ALIGN 64
+
+// Buffers held and free at once (frames, packets and the output)
+#define FRAME_POOL_MAX_BLOCKS 64
+
+// Requests up to this size (packets) are rounded up to a power of two, so
+// that blocks are reused as packet sizes vary
+#define FRAME_POOL_SMALL_SIZE (1024 * 1024)
+
+// What backs the arena
+enum frame_pool_pages {
+	FRAME_POOL_PAGES_NORMAL,
+	FRAME_POOL_PAGES_HUGE,
+	FRAME_POOL_PAGES_TRANSPARENT_HUGE,
+};
+
+struct frame_pool_stats {
+	size_t budget;
+	enum frame_pool_pages pages;
+
+	// Bytes carved from the arena, held by buffers now, and the most
+	// held at once
+	size_t carved;
+	size_t in_use;
+	size_t peak_in_use;
+	uint32_t blocks;
+
+	// Buffers handed out, and refused because the budget was reached
+	uint64_t allocs;
+	uint64_t refused;
+};
+
+// The buffers of one decoder, carved from a single arena: the frames FFmpeg
+// decodes into and the packets handed to it. The address range of the
+// whole budget is reserved up front and only the pages of carved buffers
+// are touched, so a session uses what its stream needs and never more than
+// its budget. A returned buffer is reused for a request of its size; the
+// arena shrinks back as the buffers at its end are returned.
+struct frame_pool;
+
+// With hugepages the arena is backed by 2 MB pages: reserved ones if the
+// system has them, transparent huge pages otherwise. NULL if the address
+// range cannot be reserved.
+struct frame_pool *frame_pool_create(size_t budget, bool hugepages);
+
+// Default budget of a decoder, in MB: 4:2:0 frames of the stream size with
+// samples of bytes_per_sample (1 for 8-bit, 2 for 10-bit), as many as the
+// references, decode threads and output queue hold at once. Only the
+// pages of carved buffers are touched, so a generous budget costs address
+// space rather than memory.
+int frame_pool_stream_budget(int width, int height, int bytes_per_sample,
+			     int threads);
+
+// The owner is done with the pool. The arena is unmapped once the last
+// buffer is returned (a decoder may still hold frames).
+void frame_pool_release(struct frame_pool *pool);
+
+// A buffer of at least size bytes, aligned to FRAME_POOL_ALIGN. NULL if the
+// budget has no room for it. Thread safe.
+void *frame_pool_alloc(struct frame_pool *pool, size_t size);
+void frame_pool_free(struct frame_pool *pool, void *buffer);
+
+void frame_pool_get_stats(struct frame_pool *pool,
+			  struct frame_pool_stats *stats);
+
+// Start the counters and the peak over, for the next stream
+void frame_pool_reset_stats(struct frame_pool *pool);
+
+const char *frame_pool_pages_name(enum frame_pool_pages pages);
@@ -0,0 +1,1050 @@
+#include "handshake.h"
+#include "plugin-main.h"
+#include <curl/curl.h>
+#include <openssl/evp.h>
+#include <openssl/pem.h>
+#include <openssl/sha.h>
+#include <openssl/x509.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define UNIQUE_ID "0123456789ABCDEF"
+#define CLIENT_VERSION_HEADER "X-GS-ClientVersion: 14"
+#define CONNECT_TIMEOUT_MS 3000
+#define REQUEST_TIMEOUT_MS 10000
+
+// Video packet payload size requested from the host
+#define VIDEO_PACKET_SIZE 1392
+
+// Host versions from this generation accept reference frame invalidation
+#define RFI_MIN_APP_VERSION 7
+
+// Codecs the host can encode (ServerCodecModeSupport)
+#define SCM_H264 0x00001
+#define SCM_HEVC 0x00100
+#define SCM_HEVC_MAIN10 0x00200
+#define SCM_AV1_MAIN8 0x10000
+#define SCM_AV1_MAIN10 0x20000
+
+// Ask for HDR10 (PQ) with the display characteristics left to the host
+static const char hdr_launch_query[] =
+	"&hdrMode=1&clientHdrCapVersion=0"
+	"&clientHdrCapSupportedFlagsInUint32=0"
+	"&clientHdrCapMetaDataId=NV_STATIC_METADATA_TYPE_1"
+	"&clientHdrCapDisplayData=0x0x0x0x0x0x0x0x0x0x0";
+
+// Growable response body
+struct buffer {
+	char *data;
+	size_t size;
+};
+
+// Cached responses for one host
+struct host_cache {
+	char *host;
+	char *serverinfo;
+	uint64_t serverinfo_ns;
+	char *applist;
+	uint64_t applist_ns;
+
+	// Public key of the host certificate saved at pairing, in curl's
+	// "sha256//<base64>" form. Reloaded by every handshake.
+	char *pinned_key;
+
+	struct host_cache *next;
+};
+
+// Pairing credentials, loaded once and handed to curl from memory
+struct credentials {
+	char *cert_path;
+	char *key_path;
+	struct buffer cert;
+	struct buffer key;
+};
+
+static CURLSH *share;
+static pthread_mutex_t share_locks[CURL_LOCK_DATA_LAST];
+
+static pthread_mutex_t cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct host_cache *cache;
+static struct credentials credentials;
+
+/* ------------------------------------------------------------------------- */
+/* Module state */
+
+static void share_lock(CURL *handle, curl_lock_data data,
+		       curl_lock_access access, void *param)
+{
+	UNUSED_PARAMETER(handle);
+	UNUSED_PARAMETER(access);
+	UNUSED_PARAMETER(param);
+	pthread_mutex_lock(&share_locks[data]);
+}
+
+static void share_unlock(CURL *handle, curl_lock_data data, void *param)
+{
+	UNUSED_PARAMETER(handle);
+	UNUSED_PARAMETER(param);
+	pthread_mutex_unlock(&share_locks[data]);
+}
+
+void handshake_global_init(void)
+{
+	curl_global_init(CURL_GLOBAL_DEFAULT);
+
+	for (int i = 0; i < CURL_LOCK_DATA_LAST; i++)
+		pthread_mutex_init(&share_locks[i], NULL);
+
+	// TLS sessions, DNS results and open connections survive between
+	// handshakes, so a reconnect skips the full TLS handshake
+	share = curl_share_init();
+	curl_share_setopt(share, CURLSHOPT_LOCKFUNC, share_lock);
+	curl_share_setopt(share, CURLSHOPT_UNLOCKFUNC, share_unlock);
+	curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+	curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+	curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT);
+}
+
+static void free_cache_entry(struct host_cache *entry)
+{
+	bfree(entry->host);
+	bfree(entry->serverinfo);
+	bfree(entry->applist);
+	bfree(entry->pinned_key);
+	bfree(entry);
+}
+
+void handshake_global_free(void)
+{
+	pthread_mutex_lock(&cache_mutex);
+
+	while (cache) {
+		struct host_cache *next = cache->next;
+		free_cache_entry(cache);
+		cache = next;
+	}
+
+	bfree(credentials.cert_path);
+	bfree(credentials.key_path);
+	bfree(credentials.cert.data);
+	bfree(credentials.key.data);
+	memset(&credentials, 0, sizeof(credentials));
+
+	pthread_mutex_unlock(&cache_mutex);
+
+	curl_share_cleanup(share);
+	share = NULL;
+
+	for (int i = 0; i < CURL_LOCK_DATA_LAST; i++)
+		pthread_mutex_destroy(&share_locks[i]);
+
+	curl_global_cleanup();
+}
+
+/* ------------------------------------------------------------------------- */
+/* Host cache */
+
+static struct host_cache *find_cache_entry(const char *host)
+{
+	for (struct host_cache *entry = cache; entry; entry = entry->next) {
+		if (strcmp(entry->host, host) == 0)
+			return entry;
+	}
+
+	return NULL;
+}
+
+// Returns a copy of a cached response, or NULL if missing or expired
+static char *cache_get(const char *host, bool applist, uint64_t now_ns)
+{
+	char *response = NULL;
+
+	pthread_mutex_lock(&cache_mutex);
+
+	struct host_cache *entry = find_cache_entry(host);
+	if (entry && applist && entry->applist &&
+	    now_ns - entry->applist_ns < HANDSHAKE_APPLIST_TTL_NS)
+		response = bstrdup(entry->applist);
+	else if (entry && !applist && entry->serverinfo &&
+		 now_ns - entry->serverinfo_ns < HANDSHAKE_SERVERINFO_TTL_NS)
+		response = bstrdup(entry->serverinfo);
+
+	pthread_mutex_unlock(&cache_mutex);
+	return response;
+}
+
+// Called with the cache mutex held
+static struct host_cache *get_cache_entry(const char *host)
+{
+	struct host_cache *entry = find_cache_entry(host);
+	if (!entry) {
+		entry = bzalloc(sizeof(struct host_cache));
+		entry->host = bstrdup(host);
+		entry->next = cache;
+		cache = entry;
+	}
+
+	return entry;
+}
+
+static void cache_put(const char *host, bool applist, const char *response,
+		      uint64_t now_ns)
+{
+	pthread_mutex_lock(&cache_mutex);
+
+	struct host_cache *entry = get_cache_entry(host);
+
+	if (applist) {
+		bfree(entry->applist);
+		entry->applist = bstrdup(response);
+		entry->applist_ns = now_ns;
+	} else {
+		bfree(entry->serverinfo);
+		entry->serverinfo = bstrdup(response);
+		entry->serverinfo_ns = now_ns;
+	}
+
+	pthread_mutex_unlock(&cache_mutex);
+}
+
+void handshake_invalidate(const char *host)
+{
+	pthread_mutex_lock(&cache_mutex);
+
+	struct host_cache *entry = find_cache_entry(host);
+	if (entry) {
+		bfree(entry->serverinfo);
+		bfree(entry->applist);
+		entry->serverinfo = NULL;
+		entry->applist = NULL;
+	}
+
+	pthread_mutex_unlock(&cache_mutex);
+}
+
+/* ------------------------------------------------------------------------- */
+/* Requests */
+
+static size_t write_buffer(char *ptr, size_t size, size_t nmemb, void *param)
+{
+	struct buffer *buffer = param;
+	size_t bytes = size * nmemb;
+
+	buffer->data = brealloc(buffer->data, buffer->size + bytes + 1);
+	memcpy(buffer->data + buffer->size, ptr, bytes);
+	buffer->size += bytes;
+	buffer->data[buffer->size] = 0;
+	return bytes;
+}
+
+static bool load_file(const char *path, struct buffer *buffer)
+{
+	FILE *file = fopen(path, "rb");
+	if (!file)
+		return false;
+
+	char chunk[4096];
+	size_t bytes;
+	while ((bytes = fread(chunk, 1, sizeof(chunk), file)) > 0)
+		write_buffer(chunk, 1, bytes, buffer);
+
+	fclose(file);
+	return buffer->size > 0;
+}
+
+static bool path_changed(const char *cached, const char *path)
+{
+	if (!cached || !path)
+		return cached != path;
+
+	return strcmp(cached, path) != 0;
+}
+
+static void load_credentials(const struct handshake_params *params)
+{
+	pthread_mutex_lock(&cache_mutex);
+
+	if (path_changed(credentials.cert_path, params->cert_path) ||
+	    path_changed(credentials.key_path, params->key_path)) {
+		bfree(credentials.cert_path);
+		bfree(credentials.key_path);
+		bfree(credentials.cert.data);
+		bfree(credentials.key.data);
+		memset(&credentials, 0, sizeof(credentials));
+
+		credentials.cert_path = bstrdup(params->cert_path);
+		credentials.key_path = bstrdup(params->key_path);
+
+		if (params->cert_path && params->key_path &&
+		    (!load_file(params->cert_path, &credentials.cert) ||
+		     !load_file(params->key_path, &credentials.key)))
+			mlog(LOG_WARNING, "Failed to load pairing credentials");
+	}
+
+	pthread_mutex_unlock(&cache_mutex);
+}
+
+// curl's pin for the public key of a PEM certificate
+static char *public_key_pin(const struct buffer *pem)
+{
+	BIO *bio = BIO_new_mem_buf(pem->data, (int)pem->size);
+	X509 *cert = bio ? PEM_read_bio_X509(bio, NULL, NULL, NULL) : NULL;
+	BIO_free(bio);
+	if (!cert)
+		return NULL;
+
+	unsigned char *der = NULL;
+	int size = i2d_X509_PUBKEY(X509_get_X509_PUBKEY(cert), &der);
+	X509_free(cert);
+	if (size <= 0)
+		return NULL;
+
+	unsigned char digest[SHA256_DIGEST_LENGTH];
+	SHA256(der, (size_t)size, digest);
+	OPENSSL_free(der);
+
+	static const char prefix[] = "sha256//";
+	size_t encoded = 4 * ((SHA256_DIGEST_LENGTH + 2) / 3);
+	char *pin = bzalloc(sizeof(prefix) + encoded);
+	memcpy(pin, prefix, sizeof(prefix) - 1);
+	EVP_EncodeBlock((unsigned char *)pin + sizeof(prefix) - 1, digest,
+			SHA256_DIGEST_LENGTH);
+	return pin;
+}
+
+// The rikey sent at launch also keys the streams, so TLS requests are only
+// made to a host that presents the certificate saved at pairing
+static bool load_pinned_key(const struct handshake_params *params)
+{
+	if (params->disable_tls)
+		return true;
+
+	struct buffer pem = {0};
+	char *pin = NULL;
+	if (params->server_cert_path &&
+	    load_file(params->server_cert_path, &pem))
+		pin = public_key_pin(&pem);
+	bfree(pem.data);
+
+	if (!pin) {
+		mlog(LOG_ERROR, "No certificate from pairing with %s, not "
+				"connecting",
+		     params->host);
+		return false;
+	}
+
+	pthread_mutex_lock(&cache_mutex);
+	struct host_cache *entry = get_cache_entry(params->host);
+	bfree(entry->pinned_key);
+	entry->pinned_key = pin;
+	pthread_mutex_unlock(&cache_mutex);
+	return true;
+}
+
+static void random_hex(char *out, size_t bytes)
+{
+	static const char digits[] = "0123456789abcdef";
+
+	for (size_t i = 0; i < bytes; i++) {
+		uint8_t value = (uint8_t)rand();
+		out[i * 2] = digits[value >> 4];
+		out[i * 2 + 1] = digits[value & 15];
+	}
+	out[bytes * 2] = 0;
+}
+
+struct handshake_wakeup {
+	pthread_mutex_t mutex;
+
+	// The requests in flight, NULL between requests
+	CURLM *multi;
+};
+
+struct handshake_wakeup *handshake_wakeup_create(void)
+{
+	struct handshake_wakeup *wakeup =
+		bzalloc(sizeof(struct handshake_wakeup));
+	pthread_mutex_init(&wakeup->mutex, NULL);
+	return wakeup;
+}
+
+void handshake_wakeup_destroy(struct handshake_wakeup *wakeup)
+{
+	if (!wakeup)
+		return;
+
+	pthread_mutex_destroy(&wakeup->mutex);
+	bfree(wakeup);
+}
+
+void handshake_wakeup_signal(struct handshake_wakeup *wakeup)
+{
+	if (!wakeup)
+		return;
+
+	pthread_mutex_lock(&wakeup->mutex);
+	if (wakeup->multi)
+		curl_multi_wakeup(wakeup->multi);
+	pthread_mutex_unlock(&wakeup->mutex);
+}
+
+static void set_wakeup_target(struct handshake_wakeup *wakeup, CURLM *multi)
+{
+	if (!wakeup)
+		return;
+
+	pthread_mutex_lock(&wakeup->mutex);
+	wakeup->multi = multi;
+	pthread_mutex_unlock(&wakeup->mutex);
+}
+
+static bool is_cancelled(const struct handshake_params *params)
+{
+	return params->cancelled && params->cancelled(params->cancel_param);
+}
+
+// Aborts a request in flight once the handshake is cancelled. curl calls it
+// on every pass of its transfer loop, at least once a second.
+static int check_cancelled(void *param, curl_off_t dltotal, curl_off_t dlnow,
+			   curl_off_t ultotal, curl_off_t ulnow)
+{
+	UNUSED_PARAMETER(dltotal);
+	UNUSED_PARAMETER(dlnow);
+	UNUSED_PARAMETER(ultotal);
+	UNUSED_PARAMETER(ulnow);
+	return is_cancelled(param) ? 1 : 0;
+}
+
+static void set_cancel_check(CURL *curl,
+			     const struct handshake_params *params)
+{
+	if (!params->cancelled)
+		return;
+
+	curl_easy_setopt(curl, CURLOPT_NOPROGRESS, 0L);
+	curl_easy_setopt(curl, CURLOPT_XFERINFOFUNCTION, check_cancelled);
+	curl_easy_setopt(curl, CURLOPT_XFERINFODATA, (void *)params);
+}
+
+static CURL *create_request(const struct handshake_params *params,
+			    const char *endpoint, const char *query,
+			    struct buffer *response)
+{
+	CURL *curl = curl_easy_init();
+	if (!curl)
+		return NULL;
+
+	char uuid[33];
+	random_hex(uuid, 16);
+
+	char url[1024];
+	snprintf(url, sizeof(url), "%s://%s:%d/%s?uniqueid=%s&uuid=%s%s",
+		 params->disable_tls ? "http" : "https", params->host,
+		 params->https_port, endpoint, UNIQUE_ID, uuid,
+		 query ? query : "");
+
+	curl_easy_setopt(curl, CURLOPT_URL, url);
+	curl_easy_setopt(curl, CURLOPT_SHARE, share);
+	curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_buffer);
+	curl_easy_setopt(curl, CURLOPT_WRITEDATA, response);
+	curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT_MS, CONNECT_TIMEOUT_MS);
+	curl_easy_setopt(curl, CURLOPT_TIMEOUT_MS, REQUEST_TIMEOUT_MS);
+	curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
+	curl_easy_setopt(curl, CURLOPT_TCP_NODELAY, 1L);
+	set_cancel_check(curl, params);
+
+	if (!params->disable_tls) {
+		// The host certificate is self-signed, so there is no CA
+		// chain to verify. Instead its public key must match the
+		// certificate saved at pairing, or curl fails the request.
+		// The pin is loaded before any request and only replaced.
+		curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, 0L);
+		curl_easy_setopt(curl, CURLOPT_SSL_VERIFYHOST, 0L);
+
+		pthread_mutex_lock(&cache_mutex);
+		struct host_cache *entry = find_cache_entry(params->host);
+		curl_easy_setopt(curl, CURLOPT_PINNEDPUBLICKEY,
+				 entry ? entry->pinned_key : NULL);
+
+		// Another source may reload the credentials while this
+		// request is in flight, so curl keeps its own copy
+		if (credentials.cert.size && credentials.key.size) {
+			struct curl_blob cert = {credentials.cert.data,
+						 credentials.cert.size,
+						 CURL_BLOB_COPY};
+			struct curl_blob key = {credentials.key.data,
+						credentials.key.size,
+						CURL_BLOB_COPY};
+			curl_easy_setopt(curl, CURLOPT_SSLCERT_BLOB, &cert);
+			curl_easy_setopt(curl, CURLOPT_SSLKEY_BLOB, &key);
+		}
+		pthread_mutex_unlock(&cache_mutex);
+	}
+
+	return curl;
+}
+
+// Runs requests concurrently, recording when each one finished
+static bool perform_all(const struct handshake_params *params,
+			CURL **handles, int count, uint64_t start_ns,
+			uint64_t *elapsed_ns)
+{
+	CURLM *multi = curl_multi_init();
+	if (!multi)
+		return false;
+
+	for (int i = 0; i < count; i++)
+		curl_multi_add_handle(multi, handles[i]);
+
+	// A cancel from another thread ends the wait below at once
+	set_wakeup_target(params->wakeup, multi);
+
+	bool ok = true;
+	int running = count;
+
+	while (running) {
+		if (curl_multi_perform(multi, &running) != CURLM_OK) {
+			ok = false;
+			break;
+		}
+
+		CURLMsg *msg;
+		int queued;
+		while ((msg = curl_multi_info_read(multi, &queued))) {
+			if (msg->msg != CURLMSG_DONE)
+				continue;
+
+			for (int i = 0; i < count; i++) {
+				if (handles[i] == msg->easy_handle)
+					elapsed_ns[i] =
+						os_gettime_ns() - start_ns;
+			}
+
+			long status = 0;
+			curl_easy_getinfo(msg->easy_handle,
+					  CURLINFO_RESPONSE_CODE, &status);
+			if (msg->data.result == CURLE_ABORTED_BY_CALLBACK) {
+				ok = false;
+			} else if (msg->data.result != CURLE_OK ||
+				   status != 200) {
+				mlog(LOG_WARNING,
+				     "Handshake request failed: %s "
+				     "(status %ld)",
+				     curl_easy_strerror(msg->data.result),
+				     status);
+				ok = false;
+			}
+		}
+
+		if (running && is_cancelled(params)) {
+			ok = false;
+			break;
+		}
+
+		if (running)
+			curl_multi_poll(multi, NULL, 0, 100, NULL);
+	}
+
+	set_wakeup_target(params->wakeup, NULL);
+
+	for (int i = 0; i < count; i++)
+		curl_multi_remove_handle(multi, handles[i]);
+	curl_multi_cleanup(multi);
+	return ok;
+}
+
+/* ------------------------------------------------------------------------- */
+/* Response parsing */
+
+static bool xml_get(const char *xml, const char *tag, char *out, size_t size)
+{
+	char open[64], close[64];
+	snprintf(open, sizeof(open), "<%s>", tag);
+	snprintf(close, sizeof(close), "</%s>", tag);
+
+	const char *start = strstr(xml, open);
+	if (!start)
+		return false;
+	start += strlen(open);
+
+	const char *end = strstr(start, close);
+	if (!end || (size_t)(end - start) >= size)
+		return false;
+
+	memcpy(out, start, end - start);
+	out[end - start] = 0;
+	return true;
+}
+
+static int xml_get_int(const char *xml, const char *tag, int fallback)
+{
+	char value[32];
+	return xml_get(xml, tag, value, sizeof(value)) ? atoi(value)
+						       : fallback;
+}
+
+// Hosts answer 200 and report errors in the root element
+static bool status_ok(const char *xml)
+{
+	const char *status = strstr(xml, "status_code=\"");
+	if (!status)
+		return true;
+
+	return atoi(status + strlen("status_code=\"")) == 200;
+}
+
+static int find_app_id(const char *applist, const char *app_name)
+{
+	const char *app = applist;
+
+	while ((app = strstr(app, "<App>"))) {
+		const char *end = strstr(app, "</App>");
+		if (!end)
+			break;
+
+		char title[256];
+		char id[32];
+		size_t length = end - app;
+		char *entry = bmalloc(length + 1);
+		memcpy(entry, app, length);
+		entry[length] = 0;
+
+		bool match = xml_get(entry, "AppTitle", title, sizeof(title)) &&
+			     strcmp(title, app_name) == 0 &&
+			     xml_get(entry, "ID", id, sizeof(id));
+		bfree(entry);
+
+		if (match)
+			return atoi(id);
+
+		app = end;
+	}
+
+	return -1;
+}
+
+/* ------------------------------------------------------------------------- */
+/* Phases */
+
+static bool fetch_host_info(const struct handshake_params *params,
+			    char **serverinfo, char **applist,
+			    struct handshake_timing *timing)
+{
+	uint64_t start = os_gettime_ns();
+
+	*serverinfo = cache_get(params->host, false, start);
+	*applist = cache_get(params->host, true, start);
+	timing->serverinfo_cached = *serverinfo != NULL;
+	timing->applist_cached = *applist != NULL;
+
+	// serverinfo and applist do not depend on each other
+	struct buffer responses[2] = {0};
+	CURL *handles[2];
+	bool is_applist[2];
+	uint64_t elapsed[2] = {0};
+	int count = 0;
+
+	if (!*serverinfo) {
+		handles[count] = create_request(params, "serverinfo", NULL,
+						&responses[count]);
+		is_applist[count++] = false;
+	}
+	if (!*applist) {
+		handles[count] = create_request(params, "applist", NULL,
+						&responses[count]);
+		is_applist[count++] = true;
+	}
+
+	bool ok = count == 0 ||
+		  perform_all(params, handles, count, start, elapsed);
+	uint64_t now = os_gettime_ns();
+
+	for (int i = 0; i < count; i++) {
+		curl_easy_cleanup(handles[i]);
+
+		const char *body = responses[i].data ? responses[i].data : "";
+		if (ok && status_ok(body))
+			cache_put(params->host, is_applist[i], body, now);
+		else
+			ok = false;
+
+		if (is_applist[i]) {
+			*applist = responses[i].data;
+			timing->applist_ns = elapsed[i];
+		} else {
+			*serverinfo = responses[i].data;
+			timing->serverinfo_ns = elapsed[i];
+		}
+	}
+
+	return ok && *serverinfo && *applist;
+}
+
+static bool launch_app(const struct handshake_params *params, bool resume,
+		       struct handshake_result *result)
+{
+	char rikey[HANDSHAKE_RI_KEY_SIZE * 2 + 1];
+	for (int i = 0; i < HANDSHAKE_RI_KEY_SIZE; i++)
+		snprintf(rikey + i * 2, 3, "%02x", params->ri_key[i]);
+
+	result->resumed = resume;
+
+	const char *hdr = result->hdr ? hdr_launch_query : "";
+
+	char query[768];
+	if (result->resumed) {
+		snprintf(query, sizeof(query),
+			 "&mode=%dx%dx%d&rikey=%s&rikeyid=%u"
+			 "&surroundAudioInfo=196610%s",
+			 params->width, params->height, params->fps, rikey,
+			 params->ri_key_id, hdr);
+	} else {
+		snprintf(query, sizeof(query),
+			 "&appid=%d&mode=%dx%dx%d&additionalStates=1&sops=0"
+			 "&rikey=%s&rikeyid=%u&localAudioPlayMode=0"
+			 "&surroundAudioInfo=196610"
+			 "&remoteControllersBitmap=0&gcmap=0%s",
+			 result->app_id, params->width, params->height,
+			 params->fps, rikey, params->ri_key_id, hdr);
+	}
+
+	struct buffer response = {0};
+	CURL *curl = create_request(params,
+				    result->resumed ? "resume" : "launch",
+				    query, &response);
+	uint64_t start = os_gettime_ns();
+	uint64_t elapsed = 0;
+
+	bool ok = perform_all(params, &curl, 1, start, &elapsed) &&
+		  response.data && status_ok(response.data);
+	curl_easy_cleanup(curl);
+
+	result->timing.launch_ns = elapsed;
+
+	if (ok && !xml_get(response.data, "sessionUrl0", result->session_url,
+			   sizeof(result->session_url)))
+		snprintf(result->session_url, sizeof(result->session_url),
+			 "rtsp://%s:%d", params->host, params->rtsp_port);
+
+	bfree(response.data);
+	return ok;
+}
+
+// RTSP request state, server ports are read from the Transport header
+struct rtsp_state {
+	const struct handshake_params *params;
+	CURL *curl;
+	int *server_port;
+};
+
+static size_t rtsp_header(char *ptr, size_t size, size_t nmemb, void *param)
+{
+	struct rtsp_state *state = param;
+	size_t bytes = size * nmemb;
+
+	if (state->server_port && bytes > 10 &&
+	    strncmp(ptr, "Transport:", 10) == 0) {
+		const char *port = strstr(ptr, "server_port=");
+		if (port && port < ptr + bytes)
+			*state->server_port = atoi(port + 12);
+	}
+
+	return bytes;
+}
+
+static bool rtsp_request(struct rtsp_state *state, long request,
+			 const char *uri, const char *transport,
+			 const char *body, int *server_port)
+{
+	CURL *curl = state->curl;
+
+	state->server_port = server_port;
+	curl_easy_setopt(curl, CURLOPT_RTSP_REQUEST, request);
+	curl_easy_setopt(curl, CURLOPT_RTSP_STREAM_URI, uri);
+	curl_easy_setopt(curl, CURLOPT_RTSP_TRANSPORT, transport);
+	curl_easy_setopt(curl, CURLOPT_POSTFIELDS, body);
+	if (body)
+		curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE,
+				 (long)strlen(body));
+
+	// Through the multi loop like the HTTP requests, so that a cancel is
+	// seen at once. The connection stays in the shared cache.
+	uint64_t elapsed;
+	if (!perform_all(state->params, &curl, 1, os_gettime_ns(), &elapsed)) {
+		if (!is_cancelled(state->params))
+			mlog(LOG_WARNING, "RTSP request %s failed", uri);
+		return false;
+	}
+
+	return true;
+}
+
+// Numeric SDP attribute ("a=name:value"), 0 if missing
+static uint32_t sdp_get_uint(const char *sdp, const char *name)
+{
+	const char *attribute = sdp ? strstr(sdp, name) : NULL;
+	if (!attribute || attribute[strlen(name)] != ':')
+		return 0;
+
+	return (uint32_t)strtoul(attribute + strlen(name) + 1, NULL, 10);
+}
+
+static bool setup_rtsp(const struct handshake_params *params,
+		       struct handshake_result *result)
+{
+	uint64_t start = os_gettime_ns();
+
+	struct buffer response = {0};
+	struct curl_slist *headers =
+		curl_slist_append(NULL, CLIENT_VERSION_HEADER);
+
+	struct rtsp_state state = {.params = params, .curl = curl_easy_init()};
+	if (!state.curl)
+		return false;
+
+	CURL *curl = state.curl;
+	curl_easy_setopt(curl, CURLOPT_URL, result->session_url);
+	curl_easy_setopt(curl, CURLOPT_SHARE, share);
+	curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
+	curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_buffer);
+	curl_easy_setopt(curl, CURLOPT_WRITEDATA, &response);
+	curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, rtsp_header);
+	curl_easy_setopt(curl, CURLOPT_HEADERDATA, &state);
+	curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT_MS, CONNECT_TIMEOUT_MS);
+	curl_easy_setopt(curl, CURLOPT_TIMEOUT_MS, REQUEST_TIMEOUT_MS);
+	curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
+	curl_easy_setopt(curl, CURLOPT_TCP_NODELAY, 1L);
+	set_cancel_check(curl, params);
+
+	bool ok =
+		rtsp_request(&state, CURL_RTSPREQ_OPTIONS, result->session_url,
+			     NULL, NULL, NULL) &&
+		rtsp_request(&state, CURL_RTSPREQ_DESCRIBE,
+			     result->session_url, NULL, NULL, NULL);
+
+	// Encrypt the streams the host supports of those that were asked for
+	result->encryption =
+		sdp_get_uint(response.data,
+			     "x-ss-general.encryptionSupported") &
+		params->encryption;
+
+	char encryption[64] = "";
+	if (result->encryption)
+		snprintf(encryption, sizeof(encryption),
+			 "a=x-ss-general.encryptionRequested:%u \r\n",
+			 result->encryption);
+
+	// Stream configuration announced to the host
+	char sdp[1536];
+	snprintf(sdp, sizeof(sdp),
+		 "v=0\r\n"
+		 "o=android 0 14 IN IPv4 %s\r\n"
+		 "s=NVIDIA Streaming Client\r\n"
+		 "a=x-nv-video[0].clientViewportWd:%d \r\n"
+		 "a=x-nv-video[0].clientViewportHt:%d \r\n"
+		 "a=x-nv-video[0].maxFPS:%d \r\n"
+		 "a=x-nv-video[0].packetSize:%d \r\n"
+		 "a=x-nv-video[0].rateControlMode:4 \r\n"
+		 "a=x-nv-video[0].timeoutLengthMs:7000 \r\n"
+		 "a=x-nv-video[0].framesWithInvalidRefThreshold:0 \r\n"
+		 "a=x-nv-video[0].initialBitrateKbps:%d \r\n"
+		 "a=x-nv-vqos[0].bw.maximumBitrateKbps:%d \r\n"
+		 "a=x-nv-vqos[0].bw.minimumBitrateKbps:%d \r\n"
+		 "a=x-nv-vqos[0].bitStreamFormat:%d \r\n"
+		 "a=x-nv-video[0].dynamicRangeMode:%d \r\n"
+		 "a=x-nv-aqos.packetDuration:5 \r\n"
+		 "%s"
+		 "t=0 0\r\n"
+		 "m=video %d  \r\n",
+		 params->host, params->width, params->height, params->fps,
+		 VIDEO_PACKET_SIZE, params->bitrate, params->bitrate,
+		 params->bitrate, (int)result->codec, result->hdr ? 1 : 0,
+		 encryption, params->rtsp_port);
+
+	ok = ok &&
+	     rtsp_request(&state, CURL_RTSPREQ_SETUP, "streamid=audio/0/0",
+			  "unicast;X-GS-ClientPort=50000-50001", NULL,
+			  &result->audio_port) &&
+	     rtsp_request(&state, CURL_RTSPREQ_SETUP, "streamid=video/0/0",
+			  "unicast;X-GS-ClientPort=50000-50001", NULL,
+			  &result->video_port) &&
+	     rtsp_request(&state, CURL_RTSPREQ_SETUP, "streamid=control/13/0",
+			  "unicast;X-GS-ClientPort=50000-50001", NULL,
+			  &result->control_port) &&
+	     rtsp_request(&state, CURL_RTSPREQ_ANNOUNCE,
+			  "streamid=control/13/0", NULL, sdp, NULL) &&
+	     rtsp_request(&state, CURL_RTSPREQ_PLAY, "/", NULL, NULL, NULL);
+
+	curl_easy_cleanup(curl);
+	curl_slist_free_all(headers);
+	bfree(response.data);
+
+	result->timing.rtsp_ns = os_gettime_ns() - start;
+	return ok;
+}
+
+static const char *codec_name(enum handshake_codec codec)
+{
+	switch (codec) {
+	case HANDSHAKE_CODEC_HEVC:
+		return "HEVC";
+	case HANDSHAKE_CODEC_AV1:
+		return "AV1";
+	default:
+		return "H.264";
+	}
+}
+
+// Pick the preferred video format if the host can encode it, otherwise the
+// closest one it can: HDR needs a Main10 encoder, and every host does H.264
+static void select_video_format(const struct handshake_params *params,
+				const char *serverinfo,
+				struct handshake_result *result)
+{
+	int modes = xml_get_int(serverinfo, "ServerCodecModeSupport", SCM_H264);
+
+	bool hevc = params->hdr ? (modes & SCM_HEVC_MAIN10)
+				: (modes & SCM_HEVC);
+	bool av1 = params->hdr ? (modes & SCM_AV1_MAIN10)
+			       : (modes & (SCM_AV1_MAIN8 | SCM_AV1_MAIN10));
+
+	result->codec = HANDSHAKE_CODEC_H264;
+	if (params->codec == HANDSHAKE_CODEC_AV1 && av1)
+		result->codec = HANDSHAKE_CODEC_AV1;
+	else if (params->codec != HANDSHAKE_CODEC_H264 && hevc)
+		result->codec = HANDSHAKE_CODEC_HEVC;
+	else if (params->codec != HANDSHAKE_CODEC_H264 && av1)
+		result->codec = HANDSHAKE_CODEC_AV1;
+
+	result->hdr = params->hdr && result->codec != HANDSHAKE_CODEC_H264;
+
+	if (result->codec != params->codec || result->hdr != params->hdr)
+		mlog(LOG_WARNING,
+		     "Host %s cannot stream %s%s, using %s%s instead",
+		     params->host, codec_name(params->codec),
+		     params->hdr ? " HDR" : "", codec_name(result->codec),
+		     result->hdr ? " HDR" : "");
+}
+
+static bool run_handshake(const struct handshake_params *params,
+			  struct handshake_result *result)
+{
+	char *serverinfo = NULL;
+	char *applist = NULL;
+	bool ok = false;
+
+	if (!fetch_host_info(params, &serverinfo, &applist, &result->timing)) {
+		if (!is_cancelled(params))
+			mlog(LOG_ERROR, "Failed to query host %s",
+			     params->host);
+		goto done;
+	}
+
+	result->supports_rfi = xml_get_int(serverinfo, "appversion", 0) >=
+			       RFI_MIN_APP_VERSION;
+	select_video_format(params, serverinfo, result);
+
+	result->app_id = find_app_id(applist, params->app_name);
+	if (result->app_id < 0) {
+		mlog(LOG_ERROR, "App '%s' not found on host %s",
+		     params->app_name, params->host);
+		goto done;
+	}
+
+	// Resume if the app is already running on the host
+	int current_game = xml_get_int(serverinfo, "currentgame", 0);
+	bool resume = current_game != 0 && current_game == result->app_id;
+
+	if (!launch_app(params, resume, result)) {
+		if (!is_cancelled(params))
+			mlog(LOG_ERROR, "Failed to launch '%s' on host %s",
+			     params->app_name, params->host);
+		goto done;
+	}
+
+	ok = setup_rtsp(params, result);
+
+done:
+	bfree(serverinfo);
+	bfree(applist);
+	return ok;
+}
+
+static const char *handshake_outcome(const struct handshake_params *params,
+				     bool ok)
+{
+	if (ok)
+		return "completed";
+	return is_cancelled(params) ? "cancelled" : "failed";
+}
+
+bool handshake_run(const struct handshake_params *params,
+		   struct handshake_result *result)
+{
+	uint64_t start = os_gettime_ns();
+
+	memset(result, 0, sizeof(*result));
+	if (!load_pinned_key(params))
+		return false;
+	load_credentials(params);
+
+	bool ok = run_handshake(params, result);
+
+	// Cached host state may be stale (app exited, host restarted)
+	if (!ok && !is_cancelled(params) &&
+	    (result->timing.serverinfo_cached ||
+	     result->timing.applist_cached)) {
+		mlog(LOG_INFO, "Retrying handshake without cached host info");
+		handshake_invalidate(params->host);
+		memset(result, 0, sizeof(*result));
+		ok = run_handshake(params, result);
+	}
+
+	struct handshake_timing *timing = &result->timing;
+	timing->total_ns = os_gettime_ns() - start;
+
+	mlog(LOG_INFO,
+	     "Handshake with %s %s in %llu ms (serverinfo %llu ms%s, "
+	     "applist %llu ms%s, %s %llu ms, rtsp %llu ms)",
+	     params->host, handshake_outcome(params, ok),
+	     (unsigned long long)(timing->total_ns / 1000000),
+	     (unsigned long long)(timing->serverinfo_ns / 1000000),
+	     timing->serverinfo_cached ? " cached" : "",
+	     (unsigned long long)(timing->applist_ns / 1000000),
+	     timing->applist_cached ? " cached" : "",
+	     result->resumed ? "resume" : "launch",
+	     (unsigned long long)(timing->launch_ns / 1000000),
+	     (unsigned long long)(timing->rtsp_ns / 1000000));
+
+	return ok;
+}
+
+bool handshake_reconfigure(const struct handshake_params *params,
+			   struct handshake_result *result)
+{
+	uint64_t start = os_gettime_ns();
+
+	if (!load_pinned_key(params))
+		return false;
+	load_credentials(params);
+
+	// The app keeps running, only its stream is set up again
+	memset(&result->timing, 0, sizeof(result->timing));
+	bool ok = launch_app(params, true, result) &&
+		  setup_rtsp(params, result);
+
+	struct handshake_timing *timing = &result->timing;
+	timing->total_ns = os_gettime_ns() - start;
+
+	mlog(LOG_INFO,
+	     "Stream setup with %s %s in %llu ms (resume %llu ms, "
+	     "rtsp %llu ms)",
+	     params->host, handshake_outcome(params, ok),
+	     (unsigned long long)(timing->total_ns / 1000000),
+	     (unsigned long long)(timing->launch_ns / 1000000),
+	     (unsigned long long)(timing->rtsp_ns / 1000000));
+
+	return ok;
+}
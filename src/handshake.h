@@ -0,0 +1,126 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// GameStream ports are fixed offsets from the base (HTTP) port
+#define GAMESTREAM_HTTPS_PORT_OFFSET -5
+#define GAMESTREAM_RTSP_PORT_OFFSET 21
+
+// How long cached host responses stay valid
+#define HANDSHAKE_SERVERINFO_TTL_NS (60ULL * 1000000000ULL)
+#define HANDSHAKE_APPLIST_TTL_NS (600ULL * 1000000000ULL)
+
+// Remote input key size (AES-128)
+#define HANDSHAKE_RI_KEY_SIZE 16
+
+// Video codec of the stream (x-nv-vqos[0].bitStreamFormat)
+enum handshake_codec {
+	HANDSHAKE_CODEC_H264 = 0,
+	HANDSHAKE_CODEC_HEVC = 1,
+	HANDSHAKE_CODEC_AV1 = 2,
+};
+
+// Lets another thread interrupt a handshake waiting on its host, so that a
+// cancel is seen at once rather than at the next poll timeout
+struct handshake_wakeup;
+
+struct handshake_params {
+	const char *host;
+	int https_port;
+	int rtsp_port;
+	const char *app_name;
+
+	// Stream configuration
+	int width;
+	int height;
+	int fps;
+	int bitrate;
+
+	// Preferred codec, and 10-bit HDR (HEVC and AV1 Main10 only). The
+	// host falls back to what it supports.
+	enum handshake_codec codec;
+	bool hdr;
+
+	// Pairing credentials (PEM files), optional
+	const char *cert_path;
+	const char *key_path;
+
+	// The host's certificate saved at pairing (PEM). TLS requests are
+	// only made with its public key pinned.
+	const char *server_cert_path;
+
+	// Remote input encryption key, also the stream key
+	uint8_t ri_key[HANDSHAKE_RI_KEY_SIZE];
+	uint32_t ri_key_id;
+
+	// Streams to encrypt if the host supports it (STREAM_ENCRYPT_*)
+	uint32_t encryption;
+
+	// Plain HTTP, only for local stand-in hosts
+	bool disable_tls;
+
+	// Polled while requests are in flight, the handshake gives up once
+	// it returns true. Optional, as is the wakeup that makes a waiting
+	// handshake poll at once.
+	bool (*cancelled)(void *param);
+	void *cancel_param;
+	struct handshake_wakeup *wakeup;
+};
+
+// Per-phase timing breakdown
+struct handshake_timing {
+	uint64_t serverinfo_ns;
+	uint64_t applist_ns;
+	uint64_t launch_ns;
+	uint64_t rtsp_ns;
+	uint64_t total_ns;
+	bool serverinfo_cached;
+	bool applist_cached;
+};
+
+struct handshake_result {
+	int app_id;
+	bool resumed;
+	bool supports_rfi;
+
+	// Stream endpoints negotiated over RTSP
+	char session_url[256];
+	int video_port;
+	int audio_port;
+	int control_port;
+
+	// Video format the host was asked to send
+	enum handshake_codec codec;
+	bool hdr;
+
+	// Streams the host agreed to encrypt
+	uint32_t encryption;
+
+	struct handshake_timing timing;
+};
+
+// Module-level state (shared TLS sessions, connections and host cache)
+void handshake_global_init(void);
+void handshake_global_free(void);
+
+// Connect to a host and start or resume the app. Requests that do not
+// depend on each other run concurrently. Fails without retrying once
+// params->cancelled returns true.
+bool handshake_run(const struct handshake_params *params,
+		   struct handshake_result *result);
+
+// Set up the stream of a running session again with new parameters. The
+// app is resumed rather than relaunched, so only the stream restarts.
+// result must hold the session from a previous handshake_run.
+bool handshake_reconfigure(const struct handshake_params *params,
+			   struct handshake_result *result);
+
+struct handshake_wakeup *handshake_wakeup_create(void);
+void handshake_wakeup_destroy(struct handshake_wakeup *wakeup);
+
+// Wake the handshake using this wakeup, if one is waiting. Thread safe.
+void handshake_wakeup_signal(struct handshake_wakeup *wakeup);
+
+// Drop cached responses for a host
+void handshake_invalidate(const char *host);
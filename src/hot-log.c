@@ -0,0 +1,441 @@
+// eventfd, syscall
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE
+#endif
+
+#include "hot-log.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/eventfd.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#endif
+
+struct hot_log_record {
+	int level;
+	char text[HOT_LOG_RECORD_SIZE];
+};
+
+// Written only by its thread, read only with the mutex held
+struct hot_log_ring {
+	struct hot_log_record records[HOT_LOG_RING_SIZE];
+	atomic_uint_fast64_t head;
+	atomic_uint_fast64_t tail;
+	atomic_uint_fast64_t dropped;
+
+	// The thread exited, the ring is freed once it is empty
+	atomic_bool orphaned;
+	struct hot_log_ring *next;
+};
+
+static struct {
+	atomic_bool running;
+	atomic_uint generation;
+	pthread_t thread;
+	pthread_key_t ring_key;
+
+	// Rings of the threads that logged
+	pthread_mutex_t mutex;
+	struct hot_log_ring *rings;
+
+	// Call sites that suppressed records (never removed, sites are
+	// static)
+	_Atomic(struct hot_log_site *) sites;
+
+	// Wakes the drain thread, only written while it waits (read end,
+	// write end; the same eventfd on Linux)
+	int wakeup_fds[2];
+	atomic_bool waiting;
+
+	atomic_uint_fast64_t written;
+	atomic_uint_fast64_t suppressed;
+	atomic_uint_fast64_t dropped;
+} hot_log = {.mutex = PTHREAD_MUTEX_INITIALIZER};
+
+static _Thread_local struct hot_log_ring *thread_ring;
+static _Thread_local unsigned thread_ring_generation;
+
+static bool wakeup_init(void)
+{
+#ifdef __linux__
+	int fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	hot_log.wakeup_fds[0] = fd;
+	hot_log.wakeup_fds[1] = fd;
+	return fd >= 0;
+#else
+	if (pipe(hot_log.wakeup_fds) != 0)
+		return false;
+
+	for (int i = 0; i < 2; i++)
+		fcntl(hot_log.wakeup_fds[i], F_SETFL,
+		      fcntl(hot_log.wakeup_fds[i], F_GETFL) | O_NONBLOCK);
+	return true;
+#endif
+}
+
+static void wakeup_free(void)
+{
+	if (hot_log.wakeup_fds[1] != hot_log.wakeup_fds[0])
+		close(hot_log.wakeup_fds[1]);
+	close(hot_log.wakeup_fds[0]);
+}
+
+static void wakeup_signal(void)
+{
+	uint64_t value = 1;
+	if (write(hot_log.wakeup_fds[1], &value, sizeof(value)) < 0 &&
+	    errno != EAGAIN)
+		blog(LOG_WARNING,
+		     "[" PLUGIN_NAME "] Failed to wake log thread: %d", errno);
+}
+
+static void wakeup_drain(void)
+{
+	uint64_t value[8];
+	while (read(hot_log.wakeup_fds[0], value, sizeof(value)) > 0)
+		;
+}
+
+// A system call only for the first record after the thread went idle
+static void wake_drain_thread(void)
+{
+	// Orders the record before the check, the drain thread sets the flag
+	// before it looks at the rings
+	atomic_thread_fence(memory_order_seq_cst);
+	if (atomic_load(&hot_log.waiting) &&
+	    atomic_exchange(&hot_log.waiting, false))
+		wakeup_signal();
+}
+
+static void release_ring(void *data)
+{
+	struct hot_log_ring *ring = data;
+	atomic_store(&ring->orphaned, true);
+}
+
+static struct hot_log_ring *get_thread_ring(void)
+{
+	unsigned generation = atomic_load(&hot_log.generation);
+	if (thread_ring && thread_ring_generation == generation)
+		return thread_ring;
+
+	struct hot_log_ring *ring = bzalloc(sizeof(struct hot_log_ring));
+
+	pthread_mutex_lock(&hot_log.mutex);
+	ring->next = hot_log.rings;
+	hot_log.rings = ring;
+	pthread_mutex_unlock(&hot_log.mutex);
+
+	pthread_setspecific(hot_log.ring_key, ring);
+	thread_ring = ring;
+	thread_ring_generation = generation;
+	return ring;
+}
+
+static void list_site(struct hot_log_site *site)
+{
+	if (atomic_exchange(&site->listed, true))
+		return;
+
+	struct hot_log_site *head = atomic_load(&hot_log.sites);
+	do {
+		site->next = head;
+	} while (!atomic_compare_exchange_weak(&hot_log.sites, &head, site));
+}
+
+// Counts the record against its site, false if it is over the limit
+static bool site_allows(struct hot_log_site *site, int log_level)
+{
+	uint64_t now = os_gettime_ns();
+	uint_fast64_t start = atomic_load(&site->window_start_ns);
+	if (now - start >= HOT_LOG_WINDOW_NS &&
+	    atomic_compare_exchange_strong(&site->window_start_ns, &start,
+					   now))
+		atomic_store(&site->window_count, 0);
+
+	if (atomic_fetch_add(&site->window_count, 1) < HOT_LOG_BURST)
+		return true;
+
+	atomic_store(&site->level, log_level);
+	list_site(site);
+
+	// The first one needs a summary, later ones join it. The total is
+	// counted after the site, the drain thread checks it for new ones.
+	bool first = atomic_fetch_add(&site->suppressed, 1) == 0;
+	atomic_fetch_add(&hot_log.suppressed, 1);
+	if (first)
+		wake_drain_thread();
+	return false;
+}
+
+void hot_log_write(struct hot_log_site *site, int log_level,
+		   const char *format, ...)
+{
+	if (!site_allows(site, log_level))
+		return;
+
+	atomic_fetch_add(&hot_log.written, 1);
+
+	va_list args;
+	va_start(args, format);
+
+	if (!atomic_load(&hot_log.running)) {
+		char text[HOT_LOG_RECORD_SIZE];
+		vsnprintf(text, sizeof(text), format, args);
+		va_end(args);
+		blog(log_level, "%s", text);
+		return;
+	}
+
+	struct hot_log_ring *ring = get_thread_ring();
+	uint_fast64_t tail =
+		atomic_load_explicit(&ring->tail, memory_order_relaxed);
+	uint_fast64_t head =
+		atomic_load_explicit(&ring->head, memory_order_acquire);
+
+	if (tail - head >= HOT_LOG_RING_SIZE) {
+		va_end(args);
+		atomic_fetch_add(&ring->dropped, 1);
+		atomic_fetch_add(&hot_log.dropped, 1);
+		wake_drain_thread();
+		return;
+	}
+
+	struct hot_log_record *record =
+		&ring->records[tail % HOT_LOG_RING_SIZE];
+	record->level = log_level;
+	vsnprintf(record->text, sizeof(record->text), format, args);
+	va_end(args);
+
+	atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+	wake_drain_thread();
+}
+
+static const char *file_name(const char *path)
+{
+	const char *slash = strrchr(path, '/');
+	return slash ? slash + 1 : path;
+}
+
+// Called with the mutex held
+static void drain_rings(void)
+{
+	struct hot_log_ring **link = &hot_log.rings;
+
+	while (*link) {
+		struct hot_log_ring *ring = *link;
+		uint_fast64_t head = atomic_load(&ring->head);
+		uint_fast64_t tail = atomic_load_explicit(
+			&ring->tail, memory_order_acquire);
+
+		for (; head != tail; head++) {
+			struct hot_log_record *record =
+				&ring->records[head % HOT_LOG_RING_SIZE];
+			blog(record->level, "%s", record->text);
+			atomic_store_explicit(&ring->head, head + 1,
+					      memory_order_release);
+		}
+
+		uint64_t dropped = atomic_exchange(&ring->dropped, 0);
+		if (dropped)
+			blog(LOG_WARNING,
+			     "[" PLUGIN_NAME "] %llu log records dropped, "
+			     "log ring full",
+			     (unsigned long long)dropped);
+
+		if (atomic_load(&ring->orphaned) &&
+		    atomic_load(&ring->tail) == head) {
+			*link = ring->next;
+			bfree(ring);
+			continue;
+		}
+
+		link = &ring->next;
+	}
+}
+
+// Summaries for sites that suppressed records, at most one per site and
+// window unless forced. Returns the time of the next one due, 0 if none.
+static uint64_t report_suppressed(uint64_t now, bool force)
+{
+	uint64_t next_ns = 0;
+
+	for (struct hot_log_site *site = atomic_load(&hot_log.sites); site;
+	     site = site->next) {
+		if (!atomic_load(&site->suppressed))
+			continue;
+
+		// A summary covers a window from the first record it counts
+		if (!site->pending_since_ns)
+			site->pending_since_ns = now;
+
+		uint64_t due_ns = site->pending_since_ns + HOT_LOG_WINDOW_NS;
+		if (!force && now < due_ns) {
+			if (!next_ns || due_ns < next_ns)
+				next_ns = due_ns;
+			continue;
+		}
+
+		uint64_t count = atomic_exchange(&site->suppressed, 0);
+		site->pending_since_ns = 0;
+		blog(atomic_load(&site->level),
+		     "[" PLUGIN_NAME "] %s:%d: suppressed %llu messages",
+		     file_name(site->file), site->line,
+		     (unsigned long long)count);
+	}
+
+	return next_ns;
+}
+
+static bool rings_pending(void)
+{
+	bool pending = false;
+
+	pthread_mutex_lock(&hot_log.mutex);
+	for (struct hot_log_ring *ring = hot_log.rings; ring && !pending;
+	     ring = ring->next)
+		pending = atomic_load(&ring->head) !=
+				  atomic_load(&ring->tail) ||
+			  atomic_load(&ring->dropped);
+	pthread_mutex_unlock(&hot_log.mutex);
+
+	return pending;
+}
+
+// The first record after the drain thread went idle wakes it. At normal
+// priority it would preempt the writer on a busy CPU, and the log call
+// would return only after the drain thread wrote the record out.
+static void lower_drain_priority(void)
+{
+#if defined(__linux__)
+	// Applies to this thread only
+	setpriority(PRIO_PROCESS, (id_t)syscall(SYS_gettid), 19);
+#elif defined(__APPLE__)
+	pthread_set_qos_class_self_np(QOS_CLASS_UTILITY, 0);
+#endif
+}
+
+static void *drain_thread(void *arg)
+{
+	(void)arg;
+
+	lower_drain_priority();
+
+	for (;;) {
+		uint64_t suppressed = atomic_load(&hot_log.suppressed);
+
+		pthread_mutex_lock(&hot_log.mutex);
+		drain_rings();
+		uint64_t next_ns = report_suppressed(os_gettime_ns(), false);
+		pthread_mutex_unlock(&hot_log.mutex);
+
+		if (!atomic_load(&hot_log.running))
+			break;
+
+		// Writers check the flag after publishing a record or counting
+		// a suppressed one, so either is seen here or wakes the poll
+		atomic_store(&hot_log.waiting, true);
+		if (rings_pending() ||
+		    atomic_load(&hot_log.suppressed) != suppressed) {
+			atomic_store(&hot_log.waiting, false);
+			continue;
+		}
+
+		// Sleep until a record arrives or a summary is due
+		int timeout = -1;
+		uint64_t now = os_gettime_ns();
+		if (next_ns > now)
+			timeout = (int)((next_ns - now + 999999) / 1000000);
+		else if (next_ns)
+			timeout = 0;
+
+		struct pollfd fd = {hot_log.wakeup_fds[0], POLLIN, 0};
+		poll(&fd, 1, timeout);
+		wakeup_drain();
+		atomic_store(&hot_log.waiting, false);
+	}
+
+	return NULL;
+}
+
+void hot_log_init(void)
+{
+	if (atomic_load(&hot_log.running))
+		return;
+
+	if (pthread_key_create(&hot_log.ring_key, release_ring) != 0)
+		return;
+
+	if (!wakeup_init()) {
+		pthread_key_delete(hot_log.ring_key);
+		return;
+	}
+
+	// Rings of an earlier init are not used again
+	atomic_fetch_add(&hot_log.generation, 1);
+	atomic_store(&hot_log.running, true);
+
+	if (pthread_create(&hot_log.thread, NULL, drain_thread, NULL) != 0) {
+		atomic_store(&hot_log.running, false);
+		wakeup_free();
+		pthread_key_delete(hot_log.ring_key);
+		blog(LOG_ERROR, "[" PLUGIN_NAME "] Failed to create log "
+				"thread, logging synchronously");
+	}
+}
+
+// Only once no other thread logs anymore
+void hot_log_free(void)
+{
+	if (!atomic_load(&hot_log.running))
+		return;
+
+	atomic_store(&hot_log.running, false);
+	wakeup_signal();
+	pthread_join(hot_log.thread, NULL);
+
+	pthread_mutex_lock(&hot_log.mutex);
+	drain_rings();
+	report_suppressed(os_gettime_ns(), true);
+	while (hot_log.rings) {
+		struct hot_log_ring *ring = hot_log.rings;
+		hot_log.rings = ring->next;
+		bfree(ring);
+	}
+	pthread_mutex_unlock(&hot_log.mutex);
+
+	// No ring destructors run for threads that outlive the module
+	pthread_key_delete(hot_log.ring_key);
+	wakeup_free();
+
+	struct hot_log_stats stats;
+	hot_log_get_stats(&stats);
+	blog(LOG_INFO,
+	     "[" PLUGIN_NAME "] Hot path log: %llu written, %llu suppressed, "
+	     "%llu dropped",
+	     (unsigned long long)stats.written,
+	     (unsigned long long)stats.suppressed,
+	     (unsigned long long)stats.dropped);
+}
+
+void hot_log_flush(void)
+{
+	pthread_mutex_lock(&hot_log.mutex);
+	drain_rings();
+	report_suppressed(os_gettime_ns(), true);
+	pthread_mutex_unlock(&hot_log.mutex);
+}
+
+void hot_log_get_stats(struct hot_log_stats *stats)
+{
+	stats->written = atomic_load(&hot_log.written);
+	stats->suppressed = atomic_load(&hot_log.suppressed);
+	stats->dropped = atomic_load(&hot_log.dropped);
+}
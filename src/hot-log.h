@@ -0,0 +1,82 @@
+#pragma once
+
+#include "plugin-main.h"
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+// Logging from the streaming, decode and input threads. A call formats its
+// record into a ring owned by the calling thread and returns; a background
+// thread hands the records to blog. Each call site logs at most
+// HOT_LOG_BURST records per HOT_LOG_WINDOW_NS, the rest are counted and
+// reported as one "suppressed" line, so a burst of packet loss costs a few
+// lines rather than thousands of synchronous writes.
+//
+// Before hot_log_init (and after hot_log_free) records go straight to blog.
+
+// Levels more verbose than this compile to nothing
+#ifndef HOT_LOG_LEVEL
+#ifdef _DEBUG
+#define HOT_LOG_LEVEL LOG_DEBUG
+#else
+#define HOT_LOG_LEVEL LOG_INFO
+#endif
+#endif
+
+#define HOT_LOG_BURST 10
+#define HOT_LOG_WINDOW_NS 1000000000ULL
+
+// Records per thread, and the longest record (longer ones are cut)
+#define HOT_LOG_RING_SIZE 256
+#define HOT_LOG_RECORD_SIZE 256
+
+// Rate limit state of one call site
+struct hot_log_site {
+	const char *file;
+	int line;
+
+	atomic_uint_fast64_t window_start_ns;
+	atomic_uint window_count;
+	atomic_uint_fast64_t suppressed;
+	atomic_int level;
+
+	// Sites that suppressed records, reported by the drain thread
+	atomic_bool listed;
+	struct hot_log_site *next;
+	uint64_t pending_since_ns;
+};
+
+struct hot_log_stats {
+	uint64_t written;
+	uint64_t suppressed;
+
+	// Records lost because a thread's ring was full
+	uint64_t dropped;
+};
+
+void hot_log_init(void);
+void hot_log_free(void);
+
+// Write out everything queued so far, from any thread
+void hot_log_flush(void);
+
+void hot_log_get_stats(struct hot_log_stats *stats);
+
+#ifdef __GNUC__
+__attribute__((format(printf, 3, 4)))
+#endif
+void hot_log_write(struct hot_log_site *site, int log_level,
+		   const char *format, ...);
+
+#define hlog(log_level, format, ...)                                      \
+	do {                                                              \
+		if ((log_level) <= HOT_LOG_LEVEL) {                       \
+			static struct hot_log_site hot_log_site_ = {       \
+				.file = __FILE__,                          \
+				.line = __LINE__,                          \
+			};                                                 \
+			hot_log_write(&hot_log_site_, log_level,           \
+				      "[" PLUGIN_NAME "] " format,         \
+				      ##__VA_ARGS__);                      \
+		}                                                         \
+	} while (0)
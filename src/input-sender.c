@@ -0,0 +1,443 @@
+#include "input-sender.h"
+#include "hot-log.h"
+#include <pthread.h>
+#include <string.h>
+
+// Largest input packet (absolute mouse motion)
+#define INPUT_PACKET_MAX_SIZE 18
+
+// Held keys are tracked for virtual-key codes below this
+#define KEY_COUNT 256
+
+// An input packet, encoded when the event arrives
+struct input_packet {
+	uint8_t data[INPUT_PACKET_MAX_SIZE];
+	size_t size;
+	uint64_t time_ns;
+};
+
+struct input_sender {
+	input_send_t send;
+	void *param;
+
+	pthread_t thread;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	bool running;
+	bool active;
+
+	// Keys, buttons and scrolling, in order
+	struct input_packet queue[INPUT_QUEUE_SIZE];
+	size_t head;
+	size_t count;
+
+	// Latest pointer position, not sent yet. Positions that arrive while
+	// a packet is being sent replace it.
+	struct input_packet motion;
+	bool motion_pending;
+
+	// Held down on the host, released when focus is lost
+	uint8_t keys_down[KEY_COUNT / 8];
+	bool buttons_down[INPUT_BUTTON_COUNT + 1];
+
+	struct input_sender_stats stats;
+};
+
+// Packet header: size of the rest of the packet (BE32), magic (LE32)
+static void put_header(uint8_t *data, size_t size, uint32_t magic)
+{
+	uint32_t length = (uint32_t)size - 4;
+	data[0] = (uint8_t)(length >> 24);
+	data[1] = (uint8_t)(length >> 16);
+	data[2] = (uint8_t)(length >> 8);
+	data[3] = (uint8_t)length;
+	for (int i = 0; i < 4; i++)
+		data[4 + i] = (uint8_t)(magic >> (i * 8));
+}
+
+static void put_be16(uint8_t *data, int value)
+{
+	data[0] = (uint8_t)((uint16_t)value >> 8);
+	data[1] = (uint8_t)value;
+}
+
+static void encode_key(struct input_packet *packet, uint16_t key_code,
+		       uint8_t modifiers, bool down)
+{
+	// Flags, key code (LE16, high bit set for a virtual-key code),
+	// modifiers, reserved
+	uint16_t code = 0x8000 | key_code;
+	packet->size = 14;
+	put_header(packet->data, packet->size,
+		   down ? INPUT_MAGIC_KEY_DOWN : INPUT_MAGIC_KEY_UP);
+	packet->data[8] = 0;
+	packet->data[9] = (uint8_t)code;
+	packet->data[10] = (uint8_t)(code >> 8);
+	packet->data[11] = modifiers;
+	packet->data[12] = 0;
+	packet->data[13] = 0;
+}
+
+static void encode_button(struct input_packet *packet, uint8_t button,
+			  bool down)
+{
+	packet->size = 9;
+	put_header(packet->data, packet->size,
+		   down ? INPUT_MAGIC_MOUSE_BUTTON_DOWN
+			: INPUT_MAGIC_MOUSE_BUTTON_UP);
+	packet->data[8] = button;
+}
+
+static int clamp(int value, int min, int max)
+{
+	return value < min ? min : value > max ? max : value;
+}
+
+static void encode_move(struct input_packet *packet, int x, int y,
+			int width, int height)
+{
+	// x, y, reserved, reference size (BE16). The host scales the
+	// reference size one pixel short, hence the - 1 (as other clients do).
+	packet->size = 18;
+	put_header(packet->data, packet->size, INPUT_MAGIC_MOUSE_MOVE_ABS);
+	put_be16(packet->data + 8, clamp(x, 0, width - 1));
+	put_be16(packet->data + 10, clamp(y, 0, height - 1));
+	put_be16(packet->data + 12, 0);
+	put_be16(packet->data + 14, width - 1);
+	put_be16(packet->data + 16, height - 1);
+}
+
+static void encode_scroll(struct input_packet *packet, int amount)
+{
+	// Amount (BE16) twice, reserved
+	amount = clamp(amount, INT16_MIN, INT16_MAX);
+	packet->size = 14;
+	put_header(packet->data, packet->size, INPUT_MAGIC_SCROLL);
+	put_be16(packet->data + 8, amount);
+	put_be16(packet->data + 10, amount);
+	put_be16(packet->data + 12, 0);
+}
+
+static void encode_hscroll(struct input_packet *packet, int amount)
+{
+	amount = clamp(amount, INT16_MIN, INT16_MAX);
+	packet->size = 10;
+	put_header(packet->data, packet->size, INPUT_MAGIC_HSCROLL);
+	put_be16(packet->data + 8, amount);
+}
+
+static void enqueue(struct input_sender *sender,
+		    const struct input_packet *packet)
+{
+	if (sender->count == INPUT_QUEUE_SIZE) {
+		sender->stats.dropped++;
+		return;
+	}
+
+	size_t tail = (sender->head + sender->count) % INPUT_QUEUE_SIZE;
+	sender->queue[tail] = *packet;
+	sender->count++;
+}
+
+// Queue the pending pointer position ahead of a key or button, so that a
+// click lands where the pointer was
+static void flush_motion(struct input_sender *sender)
+{
+	if (!sender->motion_pending)
+		return;
+
+	enqueue(sender, &sender->motion);
+	sender->motion_pending = false;
+}
+
+// Called with the mutex held. Returns false if nothing is sent because
+// there is no session.
+static bool begin_event(struct input_sender *sender)
+{
+	if (!sender->active)
+		return false;
+
+	sender->stats.events++;
+	return true;
+}
+
+// Takes the next packet to send, waiting for one. Returns false when the
+// sender is destroyed. The pointer position goes out as soon as the thread
+// is free, so motion is only merged while a send is in progress.
+static bool next_packet(struct input_sender *sender,
+			struct input_packet *packet)
+{
+	for (;;) {
+		if (!sender->running)
+			return false;
+
+		if (sender->count) {
+			*packet = sender->queue[sender->head];
+			sender->head = (sender->head + 1) % INPUT_QUEUE_SIZE;
+			sender->count--;
+			return true;
+		}
+
+		if (sender->motion_pending) {
+			*packet = sender->motion;
+			sender->motion_pending = false;
+			return true;
+		}
+
+		pthread_cond_wait(&sender->cond, &sender->mutex);
+	}
+}
+
+static void *sender_thread(void *arg)
+{
+	struct input_sender *sender = arg;
+	struct input_packet packet;
+
+	pthread_mutex_lock(&sender->mutex);
+	while (next_packet(sender, &packet)) {
+		pthread_mutex_unlock(&sender->mutex);
+
+		bool sent = sender->send &&
+			    sender->send(sender->param, packet.data,
+					 packet.size);
+		uint64_t latency = os_gettime_ns() - packet.time_ns;
+
+		pthread_mutex_lock(&sender->mutex);
+		struct input_sender_stats *stats = &sender->stats;
+		if (!sent) {
+			stats->send_failures++;
+			continue;
+		}
+
+		stats->packets++;
+		stats->total_latency_ns += latency;
+		if (latency > stats->max_latency_ns)
+			stats->max_latency_ns = latency;
+	}
+	pthread_mutex_unlock(&sender->mutex);
+
+	return NULL;
+}
+
+struct input_sender *input_sender_create(input_send_t send, void *param)
+{
+	struct input_sender *sender = bzalloc(sizeof(struct input_sender));
+	sender->send = send;
+	sender->param = param;
+	sender->running = true;
+
+	pthread_cond_init(&sender->cond, NULL);
+	pthread_mutex_init(&sender->mutex, NULL);
+
+	if (pthread_create(&sender->thread, NULL, sender_thread, sender) !=
+	    0) {
+		hlog(LOG_ERROR, "Failed to create input thread");
+		pthread_cond_destroy(&sender->cond);
+		pthread_mutex_destroy(&sender->mutex);
+		bfree(sender);
+		return NULL;
+	}
+
+	return sender;
+}
+
+void input_sender_destroy(struct input_sender *sender)
+{
+	if (!sender)
+		return;
+
+	pthread_mutex_lock(&sender->mutex);
+	sender->running = false;
+	pthread_cond_signal(&sender->cond);
+	pthread_mutex_unlock(&sender->mutex);
+
+	pthread_join(sender->thread, NULL);
+
+	pthread_cond_destroy(&sender->cond);
+	pthread_mutex_destroy(&sender->mutex);
+	bfree(sender);
+}
+
+void input_sender_start(struct input_sender *sender)
+{
+	if (!sender)
+		return;
+
+	pthread_mutex_lock(&sender->mutex);
+	sender->active = true;
+	pthread_mutex_unlock(&sender->mutex);
+}
+
+void input_sender_stop(struct input_sender *sender)
+{
+	if (!sender)
+		return;
+
+	pthread_mutex_lock(&sender->mutex);
+	sender->active = false;
+	sender->count = 0;
+	sender->motion_pending = false;
+	memset(sender->keys_down, 0, sizeof(sender->keys_down));
+	memset(sender->buttons_down, 0, sizeof(sender->buttons_down));
+	pthread_mutex_unlock(&sender->mutex);
+}
+
+void input_sender_mouse_move(struct input_sender *sender, int x, int y,
+			     int width, int height)
+{
+	if (!sender || width <= 0 || height <= 0)
+		return;
+
+	pthread_mutex_lock(&sender->mutex);
+	if (!begin_event(sender)) {
+		pthread_mutex_unlock(&sender->mutex);
+		return;
+	}
+
+	// The packet keeps the time of the oldest position it replaces
+	uint64_t time_ns = os_gettime_ns();
+	if (sender->motion_pending) {
+		time_ns = sender->motion.time_ns;
+		sender->stats.moves_merged++;
+	}
+
+	encode_move(&sender->motion, x, y, width, height);
+	sender->motion.time_ns = time_ns;
+	sender->motion_pending = true;
+	pthread_mutex_unlock(&sender->mutex);
+
+	pthread_cond_signal(&sender->cond);
+}
+
+void input_sender_mouse_button(struct input_sender *sender, uint8_t button,
+			       bool down)
+{
+	if (!sender || !button || button > INPUT_BUTTON_COUNT)
+		return;
+
+	struct input_packet packet = {.time_ns = os_gettime_ns()};
+	encode_button(&packet, button, down);
+
+	pthread_mutex_lock(&sender->mutex);
+	if (begin_event(sender)) {
+		flush_motion(sender);
+		enqueue(sender, &packet);
+		sender->buttons_down[button] = down;
+	}
+	pthread_mutex_unlock(&sender->mutex);
+
+	pthread_cond_signal(&sender->cond);
+}
+
+void input_sender_scroll(struct input_sender *sender, int vertical,
+			 int horizontal)
+{
+	if (!sender || (!vertical && !horizontal))
+		return;
+
+	struct input_packet packets[2];
+	size_t count = 0;
+	uint64_t time_ns = os_gettime_ns();
+
+	if (vertical) {
+		packets[count] = (struct input_packet){.time_ns = time_ns};
+		encode_scroll(&packets[count++], vertical);
+	}
+	if (horizontal) {
+		packets[count] = (struct input_packet){.time_ns = time_ns};
+		encode_hscroll(&packets[count++], horizontal);
+	}
+
+	pthread_mutex_lock(&sender->mutex);
+	if (begin_event(sender)) {
+		flush_motion(sender);
+		for (size_t i = 0; i < count; i++)
+			enqueue(sender, &packets[i]);
+	}
+	pthread_mutex_unlock(&sender->mutex);
+
+	pthread_cond_signal(&sender->cond);
+}
+
+void input_sender_key(struct input_sender *sender, uint16_t key_code,
+		      uint8_t modifiers, bool down)
+{
+	if (!sender || !key_code)
+		return;
+
+	struct input_packet packet = {.time_ns = os_gettime_ns()};
+	encode_key(&packet, key_code, modifiers, down);
+
+	pthread_mutex_lock(&sender->mutex);
+	if (begin_event(sender)) {
+		flush_motion(sender);
+		enqueue(sender, &packet);
+
+		if (key_code < KEY_COUNT) {
+			uint8_t bit = (uint8_t)(1 << (key_code % 8));
+			if (down)
+				sender->keys_down[key_code / 8] |= bit;
+			else
+				sender->keys_down[key_code / 8] &= ~bit;
+		}
+	}
+	pthread_mutex_unlock(&sender->mutex);
+
+	pthread_cond_signal(&sender->cond);
+}
+
+void input_sender_release_all(struct input_sender *sender)
+{
+	if (!sender)
+		return;
+
+	uint64_t time_ns = os_gettime_ns();
+	struct input_packet packet = {.time_ns = time_ns};
+	size_t released = 0;
+
+	pthread_mutex_lock(&sender->mutex);
+	if (!sender->active) {
+		pthread_mutex_unlock(&sender->mutex);
+		return;
+	}
+
+	for (uint16_t key = 0; key < KEY_COUNT; key++) {
+		if (!(sender->keys_down[key / 8] & (1 << (key % 8))))
+			continue;
+
+		encode_key(&packet, key, 0, false);
+		enqueue(sender, &packet);
+		released++;
+	}
+
+	for (uint8_t button = 1; button <= INPUT_BUTTON_COUNT; button++) {
+		if (!sender->buttons_down[button])
+			continue;
+
+		encode_button(&packet, button, false);
+		enqueue(sender, &packet);
+		released++;
+	}
+
+	memset(sender->keys_down, 0, sizeof(sender->keys_down));
+	memset(sender->buttons_down, 0, sizeof(sender->buttons_down));
+	pthread_mutex_unlock(&sender->mutex);
+
+	if (released) {
+		hlog(LOG_DEBUG, "Released %zu held keys and buttons", released);
+		pthread_cond_signal(&sender->cond);
+	}
+}
+
+void input_sender_get_stats(struct input_sender *sender,
+			    struct input_sender_stats *stats)
+{
+	memset(stats, 0, sizeof(*stats));
+
+	if (!sender)
+		return;
+
+	pthread_mutex_lock(&sender->mutex);
+	*stats = sender->stats;
+	pthread_mutex_unlock(&sender->mutex);
+}
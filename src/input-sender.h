@@ -0,0 +1,81 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Sends an input packet on the control stream (the client's send_control
+// with CONTROL_TYPE_INPUT_DATA)
+typedef bool (*input_send_t)(void *param, const void *packet, size_t size);
+
+// GameStream input packets (Gen5+), magic numbers in the packet header
+#define INPUT_MAGIC_KEY_DOWN 0x00000003
+#define INPUT_MAGIC_KEY_UP 0x00000004
+#define INPUT_MAGIC_MOUSE_MOVE_ABS 0x00000005
+#define INPUT_MAGIC_MOUSE_BUTTON_DOWN 0x00000008
+#define INPUT_MAGIC_MOUSE_BUTTON_UP 0x00000009
+#define INPUT_MAGIC_SCROLL 0x0000000A
+#define INPUT_MAGIC_HSCROLL 0x55000001
+
+// Key modifiers
+#define INPUT_MODIFIER_SHIFT 0x01
+#define INPUT_MODIFIER_CTRL 0x02
+#define INPUT_MODIFIER_ALT 0x04
+#define INPUT_MODIFIER_META 0x08
+
+// Mouse buttons
+#define INPUT_BUTTON_LEFT 1
+#define INPUT_BUTTON_MIDDLE 2
+#define INPUT_BUTTON_RIGHT 3
+#define INPUT_BUTTON_COUNT 3
+
+// Events waiting to be sent, past this new ones are dropped
+#define INPUT_QUEUE_SIZE 256
+
+struct input_sender_stats {
+	// Events from OBS, and packets sent for them. Mouse motion that
+	// arrives while a packet is being sent is merged into one packet.
+	uint64_t events;
+	uint64_t packets;
+	uint64_t moves_merged;
+	uint64_t dropped;
+	uint64_t send_failures;
+
+	// Time from an event to its packet being sent
+	uint64_t total_latency_ns;
+	uint64_t max_latency_ns;
+};
+
+// Forwards mouse and keyboard input to the host on a thread of its own, so
+// the OBS UI thread never waits on the network. Every event is sent as soon
+// as the thread is free; pointer positions that arrive while it is sending
+// are merged, the latest one wins.
+struct input_sender;
+
+struct input_sender *input_sender_create(input_send_t send, void *param);
+void input_sender_destroy(struct input_sender *sender);
+
+// Input is forwarded between start and stop, i.e. while the host has a
+// session. Stop drops queued events and forgets held keys and buttons.
+void input_sender_start(struct input_sender *sender);
+void input_sender_stop(struct input_sender *sender);
+
+// Absolute pointer position within a width x height picture
+void input_sender_mouse_move(struct input_sender *sender, int x, int y,
+			     int width, int height);
+void input_sender_mouse_button(struct input_sender *sender, uint8_t button,
+			       bool down);
+
+// Scroll amounts in wheel units (120 per notch), positive is up
+void input_sender_scroll(struct input_sender *sender, int vertical,
+			 int horizontal);
+
+// key_code is a Windows virtual-key code
+void input_sender_key(struct input_sender *sender, uint16_t key_code,
+		      uint8_t modifiers, bool down);
+
+// Release held keys and buttons, for when the source loses focus
+void input_sender_release_all(struct input_sender *sender);
+
+void input_sender_get_stats(struct input_sender *sender,
+			    struct input_sender_stats *stats);
@@ -1,66 +1,687 @@
+// recvmmsg
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE
+#endif
+
 #include "moonlight-client.h"
 #include "moonlight-source.h"
 #include "video-decoder.h"
 #include "audio-decoder.h"
-#include "plugin-main.h"
+#include "reference-tracker.h"
+#include "stream-recorder.h"
+#include "stream-crypto.h"
+#include "input-sender.h"
+#include "handshake.h"
+#include "frame-pool.h"
+#include "frame-export.h"
+#include "hot-log.h"
 #include <obs-module.h>
+#include <openssl/rand.h>
+#include <ctype.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <pthread.h>
 #include <unistd.h>
-#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
+#include <sys/socket.h>
+#ifdef __linux__
+#include <sys/eventfd.h>
+#endif
+
+// Packets read per system call, and the size of each receive slot (a video
+// packet with all protocol headers fits)
+#define RECV_BATCH_SIZE 32
+#define RECV_PACKET_SIZE 2048
+
+// Room for a burst of video packets while the thread is busy decoding
+#define STREAM_SOCKET_BUFFER_SIZE (1024 * 1024)
 
-// Placeholder sleep duration in nanoseconds (approximately 60 FPS)
-#define PLACEHOLDER_FRAME_INTERVAL_NS 16666666
+// Pings tell the host where to send a stream, until it starts arriving
+#define PING_INTERVAL_NS 500000000ULL
 
 // Private data structure for client implementation
 struct client_priv {
 	pthread_t thread;
 	bool should_stop;
 	pthread_mutex_t mutex;
+
+	// Wakes the streaming thread for stop and reconfigure commands
+	// (read end, write end; the same eventfd on Linux), and a handshake
+	// the thread waits on
+	int wakeup_fds[2];
+	struct handshake_wakeup *handshake_wakeup;
+
+	// Stream sockets, -1 while closed
+	int stream_fds[MOONLIGHT_STREAM_COUNT];
+	bool stream_receiving[MOONLIGHT_STREAM_COUNT];
+	uint64_t last_ping_ns;
+	uint8_t *recv_buffer;
+
+	// Stream decryption, set up when the host agreed to encrypt
+	struct stream_crypto crypto;
+	uint64_t packets_decrypted;
+	uint64_t decrypt_failures;
+
+	// Reference chain of received video frames
+	struct reference_tracker refs;
+	uint64_t frames_received;
+
+	// Frame currently being received slice by slice
+	uint8_t *frame_data;
+	size_t frame_size;
+	size_t frame_capacity;
+	uint32_t slice_frame;
+	uint32_t slice_frame_flags;
+	bool slice_frame_active;
+	enum reference_action slice_frame_action;
+	bool slice_frame_recorded;
+
+	// Session negotiated by the handshake
+	char session_url[256];
+	char *cert_path;
+	char *key_path;
+	char *server_cert_path;
+
+	// Stream parameters requested while streaming, applied by the
+	// streaming thread
+	bool reconfigure_pending;
+	int pending_width;
+	int pending_height;
+	int pending_fps;
+	int pending_bitrate;
+	uint64_t reconfigure_request_ns;
+	uint64_t reconfigurations;
+	uint64_t last_reconfigure_ns;
 };
 
-// Thread function for streaming
+static void put_le64(uint8_t *dst, uint64_t value)
+{
+	for (int i = 0; i < 8; i++)
+		dst[i] = (uint8_t)(value >> (i * 8));
+}
+
+// Ask the host to recover from lost frames
+static void send_reference_request(struct moonlight_client *client,
+				   const struct reference_request *request)
+{
+	if (!client->send_control) {
+		hlog(LOG_WARNING, "No control stream, cannot request recovery");
+		return;
+	}
+
+	if (request->type == REFERENCE_REQUEST_INVALIDATE) {
+		// First frame, last frame, reserved
+		uint8_t payload[24] = {0};
+		put_le64(payload, request->first_frame);
+		put_le64(payload + 8, request->last_frame);
+
+		hlog(LOG_DEBUG, "Invalidating reference frames %u-%u",
+		     request->first_frame, request->last_frame);
+		client->send_control(client->send_control_param,
+				     CONTROL_TYPE_INVALIDATE_REF_FRAMES,
+				     payload, sizeof(payload));
+	} else if (request->type == REFERENCE_REQUEST_IDR) {
+		hlog(LOG_DEBUG, "Requesting IDR frame");
+		client->send_control(client->send_control_param,
+				     CONTROL_TYPE_REQUEST_IDR_FRAME, NULL, 0);
+	}
+}
+
+// Input packets go out on the control stream like the messages above
+static bool send_input(void *param, const void *packet, size_t size)
+{
+	struct moonlight_client *client = param;
+
+	if (!client->send_control)
+		return false;
+
+	return client->send_control(client->send_control_param,
+				    CONTROL_TYPE_INPUT_DATA, packet, size);
+}
+
+static bool wakeup_init(struct client_priv *priv)
+{
+#ifdef __linux__
+	int fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	priv->wakeup_fds[0] = fd;
+	priv->wakeup_fds[1] = fd;
+	return fd >= 0;
+#else
+	if (pipe(priv->wakeup_fds) != 0)
+		return false;
+
+	for (int i = 0; i < 2; i++)
+		fcntl(priv->wakeup_fds[i], F_SETFL,
+		      fcntl(priv->wakeup_fds[i], F_GETFL) | O_NONBLOCK);
+	return true;
+#endif
+}
+
+static void wakeup_free(struct client_priv *priv)
+{
+	if (priv->wakeup_fds[1] != priv->wakeup_fds[0])
+		close(priv->wakeup_fds[1]);
+	close(priv->wakeup_fds[0]);
+}
+
+static void wakeup_signal(struct client_priv *priv)
+{
+	uint64_t value = 1;
+	if (write(priv->wakeup_fds[1], &value, sizeof(value)) < 0 &&
+	    errno != EAGAIN)
+		hlog(LOG_WARNING, "Failed to wake streaming thread: %d", errno);
+}
+
+static void wakeup_drain(struct client_priv *priv)
+{
+	uint64_t value[8];
+	while (read(priv->wakeup_fds[0], value, sizeof(value)) > 0)
+		;
+}
+
+// Remote input key, sent to the host at launch. It also keys the encrypted
+// streams, so it has to come from a CSPRNG.
+static bool generate_ri_key(struct moonlight_client *client)
+{
+	return RAND_bytes(client->ri_key, sizeof(client->ri_key)) == 1 &&
+	       RAND_bytes((unsigned char *)&client->ri_key_id,
+			  sizeof(client->ri_key_id)) == 1;
+}
+
+static int open_stream_socket(const char *host, int port)
+{
+	char service[16];
+	snprintf(service, sizeof(service), "%d", port);
+
+	struct addrinfo hints = {
+		.ai_family = AF_UNSPEC,
+		.ai_socktype = SOCK_DGRAM,
+	};
+	struct addrinfo *addrs;
+	if (getaddrinfo(host, service, &hints, &addrs) != 0)
+		return -1;
+
+	int fd = -1;
+	for (struct addrinfo *addr = addrs; addr; addr = addr->ai_next) {
+		fd = socket(addr->ai_family, addr->ai_socktype,
+			    addr->ai_protocol);
+		if (fd < 0)
+			continue;
+
+		if (connect(fd, addr->ai_addr, addr->ai_addrlen) == 0)
+			break;
+
+		close(fd);
+		fd = -1;
+	}
+
+	freeaddrinfo(addrs);
+
+	if (fd >= 0) {
+		int size = STREAM_SOCKET_BUFFER_SIZE;
+		setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+		fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+	}
+
+	return fd;
+}
+
+static void close_stream_sockets(struct client_priv *priv)
+{
+	for (int i = 0; i < MOONLIGHT_STREAM_COUNT; i++) {
+		if (priv->stream_fds[i] >= 0)
+			close(priv->stream_fds[i]);
+		priv->stream_fds[i] = -1;
+		priv->stream_receiving[i] = false;
+	}
+}
+
+static bool open_stream_sockets(struct moonlight_client *client)
+{
+	struct client_priv *priv = client->priv;
+
+	close_stream_sockets(priv);
+
+	priv->stream_fds[MOONLIGHT_STREAM_VIDEO] =
+		open_stream_socket(client->host, client->video_port);
+	priv->stream_fds[MOONLIGHT_STREAM_AUDIO] =
+		open_stream_socket(client->host, client->audio_port);
+	priv->last_ping_ns = 0;
+
+	if (priv->stream_fds[MOONLIGHT_STREAM_VIDEO] < 0 ||
+	    priv->stream_fds[MOONLIGHT_STREAM_AUDIO] < 0) {
+		hlog(LOG_ERROR, "Failed to open stream sockets for %s",
+		     client->host);
+		return false;
+	}
+
+	return true;
+}
+
+// The handshake gives up once the client is stopped, rather than holding
+// up moonlight_client_stop until the host answers or times out
+static bool stop_requested(void *param)
+{
+	struct client_priv *priv = param;
+
+	pthread_mutex_lock(&priv->mutex);
+	bool should_stop = priv->should_stop;
+	pthread_mutex_unlock(&priv->mutex);
+
+	return should_stop;
+}
+
+static void init_handshake_params(struct moonlight_client *client,
+				  struct handshake_params *params)
+{
+	struct client_priv *priv = client->priv;
+
+	memset(params, 0, sizeof(*params));
+	params->host = client->host;
+	params->https_port = client->port + GAMESTREAM_HTTPS_PORT_OFFSET;
+	params->rtsp_port = client->port + GAMESTREAM_RTSP_PORT_OFFSET;
+	params->app_name = client->app_name;
+	params->width = client->width;
+	params->height = client->height;
+	params->fps = client->fps;
+	params->bitrate = client->bitrate;
+	params->codec = (enum handshake_codec)client->codec;
+	params->hdr = client->hdr;
+	params->cert_path = priv->cert_path;
+	params->key_path = priv->key_path;
+	params->server_cert_path = priv->server_cert_path;
+	params->ri_key_id = client->ri_key_id;
+	memcpy(params->ri_key, client->ri_key, sizeof(params->ri_key));
+	params->disable_tls = client->disable_tls;
+	if (client->encrypt_streams)
+		params->encryption =
+			STREAM_ENCRYPT_VIDEO | STREAM_ENCRYPT_AUDIO;
+	params->cancelled = stop_requested;
+	params->cancel_param = priv;
+	params->wakeup = priv->handshake_wakeup;
+}
+
+// Expand the key schedules for the streams the host encrypts, once per
+// session rather than per packet
+static bool setup_stream_crypto(struct moonlight_client *client,
+				uint32_t encryption)
+{
+	struct client_priv *priv = client->priv;
+
+	stream_crypto_free(&priv->crypto);
+	if (client->encrypt_streams && !encryption)
+		hlog(LOG_INFO, "Host does not support stream encryption");
+	if (!encryption)
+		return true;
+
+	if (!stream_crypto_init(&priv->crypto, encryption, client->ri_key,
+				client->ri_key_id))
+		return false;
+
+	hlog(LOG_INFO, "Stream encryption enabled (video: %s, audio: %s)",
+	     (encryption & STREAM_ENCRYPT_VIDEO) ? "yes" : "no",
+	     (encryption & STREAM_ENCRYPT_AUDIO) ? "yes" : "no");
+	return true;
+}
+
+// Connect to the host, start or resume the app and set up the streams
+static bool connect_to_host(struct moonlight_client *client)
+{
+	struct client_priv *priv = client->priv;
+
+	// Pairing credentials live in the plugin config directory
+	bfree(priv->cert_path);
+	bfree(priv->key_path);
+	priv->cert_path = obs_module_config_path("client.pem");
+	priv->key_path = obs_module_config_path("key.pem");
+	if (!priv->cert_path || !priv->key_path ||
+	    !os_file_exists(priv->cert_path) ||
+	    !os_file_exists(priv->key_path)) {
+		bfree(priv->cert_path);
+		bfree(priv->key_path);
+		priv->cert_path = NULL;
+		priv->key_path = NULL;
+	}
+
+	// The host's certificate from pairing, one file per host
+	char name[256];
+	snprintf(name, sizeof(name), "server-%s.pem", client->host);
+	for (char *c = name; *c; c++) {
+		if (!isalnum((unsigned char)*c) && *c != '.' && *c != '-')
+			*c = '_';
+	}
+	bfree(priv->server_cert_path);
+	priv->server_cert_path = obs_module_config_path(name);
+
+	struct handshake_params params;
+	init_handshake_params(client, &params);
+
+	struct handshake_result result;
+	if (!handshake_run(&params, &result))
+		return false;
+
+	snprintf(priv->session_url, sizeof(priv->session_url), "%s",
+		 result.session_url);
+	client->video_port = result.video_port;
+	client->audio_port = result.audio_port;
+	client->control_port = result.control_port;
+	client->codec = (enum moonlight_video_codec)result.codec;
+	client->hdr = result.hdr;
+
+	// The decoder was set up for the preferred codec
+	struct moonlight_source *source = client->source;
+	if (source->video_dec &&
+	    !video_decoder_set_codec(source->video_dec, client->codec))
+		return false;
+	client->slice_decode =
+		video_decoder_slice_mode(source->slice_decode, client->codec);
+
+	if (!setup_stream_crypto(client, result.encryption))
+		return false;
+
+	pthread_mutex_lock(&priv->mutex);
+	client->host_supports_rfi = result.supports_rfi;
+	priv->refs.host_supports_rfi = result.supports_rfi;
+	pthread_mutex_unlock(&priv->mutex);
+
+	client->connected = true;
+	return true;
+}
+
+// Set the stream up again within the running app session. The decoder and
+// its buffers are kept, the new stream opens with an IDR frame.
+static bool restart_stream(struct moonlight_client *client)
+{
+	struct client_priv *priv = client->priv;
+
+	struct handshake_params params;
+	init_handshake_params(client, &params);
+
+	struct handshake_result result = {0};
+	snprintf(result.session_url, sizeof(result.session_url), "%s",
+		 priv->session_url);
+	result.codec = (enum handshake_codec)client->codec;
+	result.hdr = client->hdr;
+
+	if (!handshake_reconfigure(&params, &result))
+		return false;
+
+	snprintf(priv->session_url, sizeof(priv->session_url), "%s",
+		 result.session_url);
+	client->video_port = result.video_port;
+	client->audio_port = result.audio_port;
+	client->control_port = result.control_port;
+
+	if (!setup_stream_crypto(client, result.encryption) ||
+	    !open_stream_sockets(client))
+		return false;
+
+	struct moonlight_source *source = client->source;
+	if (source->video_dec)
+		video_decoder_set_size(source->video_dec, client->width,
+				       client->height);
+
+	pthread_mutex_lock(&priv->mutex);
+	reference_tracker_init(&priv->refs, client->host_supports_rfi);
+	priv->refs.conceal = client->conceal;
+	priv->slice_frame_active = false;
+	pthread_mutex_unlock(&priv->mutex);
+
+	return true;
+}
+
+// Apply stream parameters requested through moonlight_client_reconfigure
+static void apply_reconfiguration(struct moonlight_client *client)
+{
+	struct client_priv *priv = client->priv;
+
+	pthread_mutex_lock(&priv->mutex);
+	bool pending = priv->reconfigure_pending;
+	int width = priv->pending_width;
+	int height = priv->pending_height;
+	int fps = priv->pending_fps;
+	int bitrate = priv->pending_bitrate;
+	uint64_t request_ns = priv->reconfigure_request_ns;
+	priv->reconfigure_pending = false;
+	pthread_mutex_unlock(&priv->mutex);
+
+	if (!pending)
+		return;
+
+	if (width == client->width && height == client->height &&
+	    fps == client->fps && bitrate == client->bitrate)
+		return;
+
+	int old_width = client->width;
+	int old_height = client->height;
+	int old_fps = client->fps;
+	int old_bitrate = client->bitrate;
+
+	client->width = width;
+	client->height = height;
+	client->fps = fps;
+	client->bitrate = bitrate;
+
+	if (!restart_stream(client)) {
+		client->width = old_width;
+		client->height = old_height;
+		client->fps = old_fps;
+		client->bitrate = old_bitrate;
+		hlog(LOG_ERROR,
+		     "Failed to reconfigure stream to %dx%d@%dfps, %d Kbps",
+		     width, height, fps, bitrate);
+		return;
+	}
+
+	uint64_t elapsed = os_gettime_ns() - request_ns;
+
+	pthread_mutex_lock(&priv->mutex);
+	priv->reconfigurations++;
+	priv->last_reconfigure_ns = elapsed;
+	pthread_mutex_unlock(&priv->mutex);
+
+	hlog(LOG_INFO,
+	     "Stream reconfigured to %dx%d@%dfps, %d Kbps in %llu ms", width,
+	     height, fps, bitrate, (unsigned long long)(elapsed / 1000000));
+}
+
+// Returns the poll timeout in milliseconds, -1 once every stream arrives
+static int send_pings(struct client_priv *priv, uint64_t now_ns)
+{
+	static const uint8_t ping[] = {'P', 'I', 'N', 'G'};
+
+	bool waiting = false;
+	for (int i = 0; i < MOONLIGHT_STREAM_COUNT; i++)
+		waiting |= priv->stream_fds[i] >= 0 &&
+			   !priv->stream_receiving[i];
+
+	if (!waiting)
+		return -1;
+
+	if (now_ns - priv->last_ping_ns >= PING_INTERVAL_NS) {
+		for (int i = 0; i < MOONLIGHT_STREAM_COUNT; i++) {
+			if (priv->stream_fds[i] >= 0 &&
+			    !priv->stream_receiving[i])
+				send(priv->stream_fds[i], ping, sizeof(ping),
+				     0);
+		}
+		priv->last_ping_ns = now_ns;
+	}
+
+	uint64_t next_ns = priv->last_ping_ns + PING_INTERVAL_NS;
+	return (int)((next_ns - now_ns + 999999) / 1000000);
+}
+
+static void deliver_packet(struct moonlight_client *client,
+			   enum moonlight_stream stream, const uint8_t *data,
+			   size_t size)
+{
+	struct client_priv *priv = client->priv;
+
+	priv->stream_receiving[stream] = true;
+
+	if (client->receive_packet && size > 0)
+		client->receive_packet(client->receive_packet_param, stream,
+				       data, size);
+}
+
+// Decrypt a received batch in place. Packets that fail are counted and
+// dropped (size 0) rather than logged, a flood of them must not stall the
+// thread.
+static void decrypt_packets(struct client_priv *priv,
+			    enum moonlight_stream stream,
+			    struct stream_packet *packets, size_t count)
+{
+	struct stream_crypto *crypto = &priv->crypto;
+	uint64_t failures = crypto->auth_failures + crypto->malformed;
+	size_t decrypted;
+
+	if (stream == MOONLIGHT_STREAM_VIDEO)
+		decrypted = stream_crypto_decrypt_video(crypto, packets, count);
+	else
+		decrypted = stream_crypto_decrypt_audio(crypto, packets, count);
+
+	failures = crypto->auth_failures + crypto->malformed - failures;
+
+	pthread_mutex_lock(&priv->mutex);
+	priv->packets_decrypted += decrypted;
+	priv->decrypt_failures += failures;
+	pthread_mutex_unlock(&priv->mutex);
+}
+
+static bool stream_encrypted(struct client_priv *priv,
+			     enum moonlight_stream stream)
+{
+	uint32_t flag = stream == MOONLIGHT_STREAM_VIDEO ? STREAM_ENCRYPT_VIDEO
+							 : STREAM_ENCRYPT_AUDIO;
+	return (priv->crypto.streams & flag) != 0;
+}
+
+// Read everything queued on a stream socket, a batch per system call
+static void receive_packets(struct moonlight_client *client,
+			    enum moonlight_stream stream)
+{
+	struct client_priv *priv = client->priv;
+	int fd = priv->stream_fds[stream];
+	bool encrypted = stream_encrypted(priv, stream);
+
+#ifdef __linux__
+	struct mmsghdr msgs[RECV_BATCH_SIZE];
+	struct iovec iovs[RECV_BATCH_SIZE];
+	struct stream_packet packets[RECV_BATCH_SIZE];
+
+	memset(msgs, 0, sizeof(msgs));
+	for (int i = 0; i < RECV_BATCH_SIZE; i++) {
+		iovs[i].iov_base = priv->recv_buffer + i * RECV_PACKET_SIZE;
+		iovs[i].iov_len = RECV_PACKET_SIZE;
+		msgs[i].msg_hdr.msg_iov = &iovs[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	for (;;) {
+		int count = recvmmsg(fd, msgs, RECV_BATCH_SIZE, MSG_DONTWAIT,
+				     NULL);
+		if (count <= 0)
+			break;
+
+		for (int i = 0; i < count; i++)
+			packets[i] = (struct stream_packet){iovs[i].iov_base,
+							    msgs[i].msg_len};
+
+		if (encrypted)
+			decrypt_packets(priv, stream, packets, (size_t)count);
+
+		for (int i = 0; i < count; i++)
+			deliver_packet(client, stream, packets[i].data,
+				       packets[i].size);
+
+		if (count < RECV_BATCH_SIZE)
+			break;
+	}
+#else
+	for (;;) {
+		ssize_t size = recv(fd, priv->recv_buffer, RECV_PACKET_SIZE,
+				    MSG_DONTWAIT);
+		if (size < 0)
+			break;
+
+		struct stream_packet packet = {priv->recv_buffer,
+					       (size_t)size};
+		if (encrypted)
+			decrypt_packets(priv, stream, &packet, 1);
+
+		deliver_packet(client, stream, packet.data, packet.size);
+	}
+#endif
+}
+
+// Thread function for streaming. Sleeps in poll until a packet arrives or
+// a command is signalled, so an idle stream costs no CPU and a stop request
+// is seen immediately.
 static void *streaming_thread(void *arg)
 {
 	struct moonlight_client *client = arg;
 	struct client_priv *priv = client->priv;
 
-	mlog(LOG_INFO, "Streaming thread started for %s:%d", client->host,
+	hlog(LOG_INFO, "Streaming thread started for %s:%d", client->host,
 	     client->port);
 
-	// In a real implementation, this would:
-	// 1. Connect to the GameStream/Sunshine host
-	// 2. Negotiate stream parameters
-	// 3. Start receiving video/audio packets
-	// 4. Decode and pass frames to OBS
-	//
-	// For now, this is a placeholder that demonstrates the structure
+	if (!connect_to_host(client) || !open_stream_sockets(client)) {
+		if (!stop_requested(priv))
+			hlog(LOG_ERROR, "Failed to connect to %s:%d",
+			     client->host, client->port);
+		close_stream_sockets(priv);
+		stream_crypto_free(&priv->crypto);
+		return NULL;
+	}
+
+	input_sender_start(client->input);
+
+	for (;;) {
+		struct pollfd fds[1 + MOONLIGHT_STREAM_COUNT];
+		enum moonlight_stream streams[MOONLIGHT_STREAM_COUNT];
+		nfds_t count = 0;
 
-	while (!priv->should_stop) {
-		pthread_mutex_lock(&priv->mutex);
-		bool should_stop = priv->should_stop;
-		pthread_mutex_unlock(&priv->mutex);
+		fds[count++] = (struct pollfd){priv->wakeup_fds[0], POLLIN, 0};
+		for (int i = 0; i < MOONLIGHT_STREAM_COUNT; i++) {
+			if (priv->stream_fds[i] < 0)
+				continue;
+			streams[count - 1] = (enum moonlight_stream)i;
+			fds[count++] =
+				(struct pollfd){priv->stream_fds[i], POLLIN, 0};
+		}
 
-		if (should_stop)
+		int timeout = send_pings(priv, os_gettime_ns());
+		if (poll(fds, count, timeout) < 0 && errno != EINTR) {
+			hlog(LOG_ERROR, "Streaming thread poll failed: %d",
+			     errno);
 			break;
+		}
 
-		// TODO: Receive and process stream packets
-		// This would involve:
-		// - Receiving H.264/H.265 video packets
-		// - Receiving Opus audio packets
-		// - Calling moonlight_client_video_frame() with video data
-		// - Calling moonlight_client_audio_frame() with audio data
-
-		// Placeholder sleep for ~60 FPS frame interval
-		struct timespec ts = {
-			.tv_sec = 0,
-			.tv_nsec = PLACEHOLDER_FRAME_INTERVAL_NS
-		};
-		nanosleep(&ts, NULL);
+		if (fds[0].revents & POLLIN) {
+			wakeup_drain(priv);
+			if (stop_requested(priv))
+				break;
+
+			apply_reconfiguration(client);
+		}
+
+		// A refused ping shows up as POLLERR, the read clears it
+		for (nfds_t i = 1; i < count; i++) {
+			if (fds[i].revents & (POLLIN | POLLERR))
+				receive_packets(client, streams[i - 1]);
+		}
 	}
 
-	mlog(LOG_INFO, "Streaming thread stopped");
+	input_sender_stop(client->input);
+	close_stream_sockets(priv);
+	stream_crypto_free(&priv->crypto);
+
+	hlog(LOG_INFO, "Streaming thread stopped");
 	return NULL;
 }
 
@@ -82,11 +703,25 @@ struct moonlight_client *moonlight_client_create(struct moonlight_source *source
 		return NULL;
 	}
 
+	if (!wakeup_init(priv)) {
+		hlog(LOG_ERROR, "Failed to create streaming thread wakeup");
+		bfree(priv);
+		bfree(client);
+		return NULL;
+	}
+
 	pthread_mutex_init(&priv->mutex, NULL);
 	priv->should_stop = false;
+	priv->handshake_wakeup = handshake_wakeup_create();
+	for (int i = 0; i < MOONLIGHT_STREAM_COUNT; i++)
+		priv->stream_fds[i] = -1;
+	priv->recv_buffer = bmalloc(RECV_BATCH_SIZE * RECV_PACKET_SIZE);
 	client->priv = priv;
 
-	mlog(LOG_INFO, "Moonlight client created");
+	// Idle until a session starts
+	client->input = input_sender_create(send_input, client);
+
+	hlog(LOG_INFO, "Moonlight client created");
 	return client;
 }
 
@@ -95,17 +730,27 @@ void moonlight_client_destroy(struct moonlight_client *client)
 	if (!client)
 		return;
 
-	mlog(LOG_INFO, "Destroying Moonlight client");
+	hlog(LOG_INFO, "Destroying Moonlight client");
 
 	// Stop streaming if active
 	if (client->streaming) {
 		moonlight_client_stop(client);
 	}
 
+	input_sender_destroy(client->input);
+	client->input = NULL;
+
 	// Free private data
 	if (client->priv) {
 		struct client_priv *priv = client->priv;
 		pthread_mutex_destroy(&priv->mutex);
+		wakeup_free(priv);
+		handshake_wakeup_destroy(priv->handshake_wakeup);
+		bfree(priv->recv_buffer);
+		bfree(priv->frame_data);
+		bfree(priv->cert_path);
+		bfree(priv->key_path);
+		bfree(priv->server_cert_path);
 		bfree(priv);
 	}
 
@@ -123,10 +768,17 @@ bool moonlight_client_start(struct moonlight_client *client, const char *host,
 
 	struct client_priv *priv = client->priv;
 
-	mlog(LOG_INFO, "Starting Moonlight client: %s:%d (app: %s)", host, port,
+	hlog(LOG_INFO, "Starting Moonlight client: %s:%d (app: %s)", host, port,
 	     app_name);
 
+	if (!generate_ri_key(client)) {
+		hlog(LOG_ERROR, "Failed to generate the remote input key");
+		return false;
+	}
+
 	// Store connection parameters
+	bfree(client->host);
+	bfree(client->app_name);
 	client->host = bstrdup(host);
 	client->port = port;
 	client->app_name = bstrdup(app_name);
@@ -137,11 +789,29 @@ bool moonlight_client_start(struct moonlight_client *client, const char *host,
 	client->height = source->height;
 	client->fps = source->fps;
 	client->bitrate = source->bitrate;
+	client->encrypt_streams = source->encrypt_streams;
+	client->codec = (enum moonlight_video_codec)source->video_codec;
+	client->slice_decode =
+		video_decoder_slice_mode(source->slice_decode, client->codec);
+	client->hdr = source->hdr;
+	client->connected = false;
+
+	client->conceal = source->concealment == MOONLIGHT_CONCEAL_SHOW;
+
+	// Start with an empty reference chain, the host opens with an IDR frame
+	pthread_mutex_lock(&priv->mutex);
+	reference_tracker_init(&priv->refs, client->host_supports_rfi);
+	priv->refs.conceal = client->conceal;
+	priv->frames_received = 0;
+	priv->slice_frame_active = false;
+	priv->reconfigure_pending = false;
+	pthread_mutex_unlock(&priv->mutex);
 
 	// Start streaming thread
 	priv->should_stop = false;
+	wakeup_drain(priv);
 	if (pthread_create(&priv->thread, NULL, streaming_thread, client) != 0) {
-		mlog(LOG_ERROR, "Failed to create streaming thread");
+		hlog(LOG_ERROR, "Failed to create streaming thread");
 		bfree(client->host);
 		bfree(client->app_name);
 		client->host = NULL;
@@ -150,9 +820,8 @@ bool moonlight_client_start(struct moonlight_client *client, const char *host,
 	}
 
 	client->streaming = true;
-	client->connected = true;
 
-	mlog(LOG_INFO, "Moonlight client started successfully");
+	hlog(LOG_INFO, "Moonlight client started successfully");
 	return true;
 }
 
@@ -161,7 +830,7 @@ void moonlight_client_stop(struct moonlight_client *client)
 	if (!client || !client->streaming)
 		return;
 
-	mlog(LOG_INFO, "Stopping Moonlight client");
+	hlog(LOG_INFO, "Stopping Moonlight client");
 
 	struct client_priv *priv = client->priv;
 
@@ -169,6 +838,8 @@ void moonlight_client_stop(struct moonlight_client *client)
 	pthread_mutex_lock(&priv->mutex);
 	priv->should_stop = true;
 	pthread_mutex_unlock(&priv->mutex);
+	wakeup_signal(priv);
+	handshake_wakeup_signal(priv->handshake_wakeup);
 
 	// Wait for thread to finish
 	pthread_join(priv->thread, NULL);
@@ -176,10 +847,215 @@ void moonlight_client_stop(struct moonlight_client *client)
 	client->streaming = false;
 	client->connected = false;
 
-	mlog(LOG_INFO, "Moonlight client stopped");
+	// The session's own lines and summaries come before the totals
+	hot_log_flush();
+
+	struct moonlight_client_stats stats;
+	moonlight_client_get_stats(client, &stats);
+	hlog(LOG_INFO,
+	     "Moonlight client stopped (frames: %llu received, %llu lost, "
+	     "%llu dropped; recovery: %llu RFI, %llu IDR, avg %llu ms, "
+	     "max %llu ms; decode latency: avg %llu us, max %llu us; "
+	     "concealment: %llu concealed, %llu corrupt, %llu held, "
+	     "%llu errors; freezes: %llu, total %llu ms, max %llu ms; "
+	     "%llu frames off program; decryption: %llu packets, "
+	     "%llu failed; input: %llu events, %llu packets, "
+	     "avg %llu us, max %llu us; memory: peak %llu of %llu MB, "
+	     "%llu refused; export: %llu frames, %llu readers, "
+	     "max %llu us)",
+	     (unsigned long long)stats.frames_received,
+	     (unsigned long long)stats.frames_lost,
+	     (unsigned long long)stats.frames_dropped,
+	     (unsigned long long)stats.rfi_requests,
+	     (unsigned long long)stats.idr_requests,
+	     (unsigned long long)(stats.avg_recovery_ns / 1000000),
+	     (unsigned long long)(stats.max_recovery_ns / 1000000),
+	     (unsigned long long)(stats.avg_decode_latency_ns / 1000),
+	     (unsigned long long)(stats.max_decode_latency_ns / 1000),
+	     (unsigned long long)stats.frames_concealed,
+	     (unsigned long long)stats.frames_corrupt,
+	     (unsigned long long)stats.frames_held,
+	     (unsigned long long)stats.decode_errors,
+	     (unsigned long long)stats.freezes,
+	     (unsigned long long)(stats.total_freeze_ns / 1000000),
+	     (unsigned long long)(stats.max_freeze_ns / 1000000),
+	     (unsigned long long)stats.frames_inactive,
+	     (unsigned long long)stats.packets_decrypted,
+	     (unsigned long long)stats.decrypt_failures,
+	     (unsigned long long)stats.input_events,
+	     (unsigned long long)stats.input_packets,
+	     (unsigned long long)(stats.avg_input_latency_ns / 1000),
+	     (unsigned long long)(stats.max_input_latency_ns / 1000),
+	     (unsigned long long)(stats.memory_peak / (1024 * 1024)),
+	     (unsigned long long)(stats.memory_budget / (1024 * 1024)),
+	     (unsigned long long)stats.memory_refused,
+	     (unsigned long long)stats.export_frames,
+	     (unsigned long long)stats.export_readers,
+	     (unsigned long long)(stats.max_export_ns / 1000));
+}
+
+void moonlight_client_reconfigure(struct moonlight_client *client, int width,
+				  int height, int fps, int bitrate)
+{
+	if (!client || !client->streaming)
+		return;
+
+	struct client_priv *priv = client->priv;
+
+	// Requests made before the last one was applied are merged
+	pthread_mutex_lock(&priv->mutex);
+	if (!priv->reconfigure_pending)
+		priv->reconfigure_request_ns = os_gettime_ns();
+	priv->reconfigure_pending = true;
+	priv->pending_width = width;
+	priv->pending_height = height;
+	priv->pending_fps = fps;
+	priv->pending_bitrate = bitrate;
+	pthread_mutex_unlock(&priv->mutex);
+
+	wakeup_signal(priv);
+}
+
+void moonlight_client_get_stats(struct moonlight_client *client,
+				struct moonlight_client_stats *stats)
+{
+	memset(stats, 0, sizeof(*stats));
+
+	if (!client)
+		return;
+
+	struct client_priv *priv = client->priv;
+
+	pthread_mutex_lock(&priv->mutex);
+
+	const struct reference_tracker *refs = &priv->refs;
+	stats->frames_received = priv->frames_received;
+	stats->frames_lost = refs->frames_lost;
+	stats->frames_dropped = refs->frames_dropped;
+	stats->frames_concealed = refs->frames_concealed;
+	stats->rfi_requests = refs->rfi_requests;
+	stats->idr_requests = refs->idr_requests;
+	stats->recoveries = refs->recoveries;
+	stats->last_recovery_ns = refs->last_recovery_ns;
+	stats->max_recovery_ns = refs->max_recovery_ns;
+	if (refs->recoveries)
+		stats->avg_recovery_ns =
+			refs->total_recovery_ns / refs->recoveries;
+	stats->reconfigurations = priv->reconfigurations;
+	stats->last_reconfigure_ns = priv->last_reconfigure_ns;
+	stats->packets_decrypted = priv->packets_decrypted;
+	stats->decrypt_failures = priv->decrypt_failures;
+
+	pthread_mutex_unlock(&priv->mutex);
+
+	struct input_sender_stats input;
+	input_sender_get_stats(client->input, &input);
+	stats->input_events = input.events;
+	stats->input_packets = input.packets;
+	stats->max_input_latency_ns = input.max_latency_ns;
+	if (input.packets)
+		stats->avg_input_latency_ns =
+			input.total_latency_ns / input.packets;
+
+	struct moonlight_source *source = client->source;
+	if (!source)
+		return;
+
+	pthread_mutex_lock(&source->mutex);
+
+	struct video_decoder *video_dec = source->video_dec;
+	if (video_dec) {
+		stats->frames_decoded = video_dec->frames_decoded;
+		stats->max_decode_latency_ns = video_dec->max_latency_ns;
+		if (video_dec->frames_decoded)
+			stats->avg_decode_latency_ns =
+				video_dec->total_latency_ns /
+				video_dec->frames_decoded;
+		stats->frames_corrupt = video_dec->frames_corrupt;
+		stats->frames_held = video_dec->frames_held;
+		stats->decode_errors = video_dec->decode_errors;
+		stats->freezes = video_dec->freezes;
+		stats->total_freeze_ns = video_dec->total_freeze_ns;
+		stats->max_freeze_ns = video_dec->max_freeze_ns;
+		stats->frames_inactive = video_dec->frames_inactive;
+
+		struct frame_pool_stats memory;
+		frame_pool_get_stats(video_dec->pool, &memory);
+		stats->memory_budget = memory.budget;
+		stats->memory_in_use = memory.in_use;
+		stats->memory_peak = memory.peak_in_use;
+		stats->memory_refused = memory.refused;
+
+		struct frame_export_stats export;
+		frame_export_get_stats(video_dec->export, &export);
+		stats->export_frames = export.frames;
+		stats->export_readers = export.readers;
+		stats->max_export_ns = export.max_publish_ns;
+	}
+
+	pthread_mutex_unlock(&source->mutex);
+}
+
+// Decides whether a frame that references lost data is dropped or decoded
+// with concealment until the host recovers
+static enum reference_action track_frame(struct moonlight_client *client,
+					 uint32_t frame_number, uint32_t flags)
+{
+	struct client_priv *priv = client->priv;
+
+	struct reference_request request;
+	pthread_mutex_lock(&priv->mutex);
+	priv->frames_received++;
+	enum reference_action action = reference_tracker_frame(
+		&priv->refs, frame_number, flags, os_gettime_ns(), &request);
+	pthread_mutex_unlock(&priv->mutex);
+
+	if (request.type != REFERENCE_REQUEST_NONE)
+		send_reference_request(client, &request);
+
+	return action;
+}
+
+// Slices of a frame that is already being decoded were lost
+static enum reference_action track_incomplete(struct moonlight_client *client,
+					      uint32_t frame_number)
+{
+	struct client_priv *priv = client->priv;
+
+	struct reference_request request;
+	pthread_mutex_lock(&priv->mutex);
+	enum reference_action action = reference_tracker_frame_incomplete(
+		&priv->refs, frame_number, os_gettime_ns(), &request);
+	pthread_mutex_unlock(&priv->mutex);
+
+	if (request.type != REFERENCE_REQUEST_NONE)
+		send_reference_request(client, &request);
+
+	return action;
+}
+
+// Hands a complete frame to the passthrough recorder, which may need an
+// IDR frame to start a file
+static void record_video(struct moonlight_client *client,
+			 uint32_t frame_number, uint32_t flags,
+			 const uint8_t *data, size_t size)
+{
+	struct stream_recorder *recorder = client->source->recorder;
+	if (!recorder)
+		return;
+
+	stream_recorder_write_video(recorder, frame_number, flags, data, size);
+
+	if (stream_recorder_keyframe_wanted(recorder)) {
+		struct reference_request request = {
+			.type = REFERENCE_REQUEST_IDR,
+		};
+		send_reference_request(client, &request);
+	}
 }
 
 void moonlight_client_video_frame(struct moonlight_client *client,
+				  uint32_t frame_number, uint32_t flags,
 				  uint8_t *data, size_t size)
 {
 	if (!client || !client->source)
@@ -187,12 +1063,95 @@ void moonlight_client_video_frame(struct moonlight_client *client,
 
 	struct moonlight_source *source = client->source;
 
+	enum reference_action action = track_frame(client, frame_number, flags);
+	if (action == REFERENCE_ACTION_DROP)
+		return;
+
+	record_video(client, frame_number, flags, data, size);
+
 	// Pass the video frame to the decoder
 	if (source->video_dec) {
-		video_decoder_decode(source->video_dec, data, size);
+		video_decoder_decode(source->video_dec, data, size,
+				     action == REFERENCE_ACTION_CONCEAL);
 	}
 }
 
+void moonlight_client_video_slice(struct moonlight_client *client,
+				  uint32_t frame_number, uint32_t flags,
+				  uint8_t *data, size_t size, bool end_of_frame)
+{
+	if (!client || !client->source)
+		return;
+
+	struct moonlight_source *source = client->source;
+	struct client_priv *priv = client->priv;
+
+	bool new_frame = !priv->slice_frame_active ||
+			 priv->slice_frame != frame_number;
+	if (new_frame) {
+		priv->slice_frame = frame_number;
+		priv->slice_frame_flags = 0;
+		priv->slice_frame_active = true;
+		priv->frame_size = 0;
+
+		// Decided per frame so a recording starting mid-frame does
+		// not get a partial one
+		priv->slice_frame_recorded =
+			stream_recorder_active(source->recorder);
+	}
+
+	// Loss of earlier slices is reported with a later one
+	uint32_t new_flags = flags & ~priv->slice_frame_flags;
+	priv->slice_frame_flags |= flags;
+
+	// Reassemble the whole frame before decoding it, or for the recorder
+	if (!client->slice_decode || priv->slice_frame_recorded) {
+		size_t needed = priv->frame_size + size;
+		if (needed > priv->frame_capacity) {
+			priv->frame_capacity = needed * 2;
+			priv->frame_data = brealloc(priv->frame_data,
+						    priv->frame_capacity);
+		}
+
+		memcpy(priv->frame_data + priv->frame_size, data, size);
+		priv->frame_size = needed;
+	}
+
+	if (!client->slice_decode) {
+		if (end_of_frame) {
+			priv->slice_frame_active = false;
+			moonlight_client_video_frame(
+				client, frame_number, priv->slice_frame_flags,
+				priv->frame_data, priv->frame_size);
+		}
+		return;
+	}
+
+	// Decode each slice while the rest of the frame is still on the wire
+	if (new_frame)
+		priv->slice_frame_action =
+			track_frame(client, frame_number, flags);
+	else if ((new_flags & MOONLIGHT_FRAME_INCOMPLETE) &&
+		 priv->slice_frame_action != REFERENCE_ACTION_DROP)
+		priv->slice_frame_action =
+			track_incomplete(client, frame_number);
+
+	if (end_of_frame)
+		priv->slice_frame_active = false;
+
+	if (priv->slice_frame_action != REFERENCE_ACTION_DROP &&
+	    source->video_dec) {
+		video_decoder_decode_slice(
+			source->video_dec, data, size, end_of_frame,
+			priv->slice_frame_action == REFERENCE_ACTION_CONCEAL);
+	}
+
+	if (end_of_frame && priv->slice_frame_recorded &&
+	    priv->slice_frame_action != REFERENCE_ACTION_DROP)
+		record_video(client, frame_number, priv->slice_frame_flags,
+			     priv->frame_data, priv->frame_size);
+}
+
 void moonlight_client_audio_frame(struct moonlight_client *client,
 				  uint8_t *data, size_t size)
 {
@@ -201,6 +1160,8 @@ void moonlight_client_audio_frame(struct moonlight_client *client,
 
 	struct moonlight_source *source = client->source;
 
+	stream_recorder_write_audio(source->recorder, data, size);
+
 	// Pass the audio frame to the decoder
 	if (source->audio_dec) {
 		audio_decoder_decode(source->audio_dec, data, size);
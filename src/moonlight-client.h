@@ -1,10 +1,105 @@
 #pragma once
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
 // Forward declarations
 struct moonlight_source;
+struct input_sender;
+
+// Control stream message types
+#define CONTROL_TYPE_INVALIDATE_REF_FRAMES 0x0301
+#define CONTROL_TYPE_REQUEST_IDR_FRAME 0x0302
+#define CONTROL_TYPE_INPUT_DATA 0x0206
+
+// Sends a message on the control stream (provided by the protocol
+// implementation)
+typedef bool (*moonlight_control_send_t)(void *param, uint16_t type,
+					 const void *payload, size_t size);
+
+// Video codec of the stream (same values as the host's bitStreamFormat)
+enum moonlight_video_codec {
+	MOONLIGHT_CODEC_H264 = 0,
+	MOONLIGHT_CODEC_HEVC = 1,
+	MOONLIGHT_CODEC_AV1 = 2,
+};
+
+// Streams received over UDP
+enum moonlight_stream {
+	MOONLIGHT_STREAM_VIDEO,
+	MOONLIGHT_STREAM_AUDIO,
+	MOONLIGHT_STREAM_COUNT,
+};
+
+// Handles a packet received on a stream socket (provided by the protocol
+// implementation, which reassembles frames and passes them to the
+// callbacks below). Called on the streaming thread.
+typedef void (*moonlight_packet_handler_t)(void *param,
+					   enum moonlight_stream stream,
+					   const uint8_t *data, size_t size);
+
+// Stream statistics
+struct moonlight_client_stats {
+	uint64_t frames_received;
+	uint64_t frames_lost;
+	uint64_t frames_dropped;
+	uint64_t frames_concealed;
+
+	// Loss recovery
+	uint64_t rfi_requests;
+	uint64_t idr_requests;
+	uint64_t recoveries;
+	uint64_t last_recovery_ns;
+	uint64_t max_recovery_ns;
+	uint64_t avg_recovery_ns;
+
+	// Time from the last packet of a frame to the decoded frame
+	uint64_t frames_decoded;
+	uint64_t avg_decode_latency_ns;
+	uint64_t max_decode_latency_ns;
+
+	// Damaged pictures: shown concealed or held back, and periods
+	// without a new picture
+	uint64_t frames_corrupt;
+	uint64_t frames_held;
+	uint64_t decode_errors;
+	uint64_t freezes;
+	uint64_t total_freeze_ns;
+	uint64_t max_freeze_ns;
+
+	// Frames decoded off program, not passed to OBS
+	uint64_t frames_inactive;
+
+	// Live stream parameter changes
+	uint64_t reconfigurations;
+	uint64_t last_reconfigure_ns;
+
+	// Encrypted streams: packets decrypted, and dropped because they
+	// failed authentication or were malformed
+	uint64_t packets_decrypted;
+	uint64_t decrypt_failures;
+
+	// Forwarded input: events from OBS, packets sent for them (pointer
+	// motion is merged per frame), and the time from event to send
+	uint64_t input_events;
+	uint64_t input_packets;
+	uint64_t avg_input_latency_ns;
+	uint64_t max_input_latency_ns;
+
+	// Decoder buffers: the source's budget, bytes held now and at most,
+	// and buffers refused because the budget was reached
+	uint64_t memory_budget;
+	uint64_t memory_in_use;
+	uint64_t memory_peak;
+	uint64_t memory_refused;
+
+	// Frames published to local processes (frame-export.h), readers
+	// that mapped them, and the longest copy into the shared mapping
+	uint64_t export_frames;
+	uint64_t export_readers;
+	uint64_t max_export_ns;
+};
 
 // Moonlight client structure
 struct moonlight_client {
@@ -20,10 +115,42 @@ struct moonlight_client {
 	int height;
 	int fps;
 	int bitrate;
+	bool slice_decode;
+	bool conceal;
+	bool encrypt_streams;
+
+	// Requested video format, the negotiated one once connected
+	enum moonlight_video_codec codec;
+	bool hdr;
 	
 	// State
 	bool connected;
 	bool streaming;
+
+	// Host capabilities
+	bool host_supports_rfi;
+
+	// Negotiated during the handshake
+	uint8_t ri_key[16];
+	uint32_t ri_key_id;
+	int video_port;
+	int audio_port;
+	int control_port;
+
+	// Control stream
+	moonlight_control_send_t send_control;
+	void *send_control_param;
+
+	// Stream packets
+	moonlight_packet_handler_t receive_packet;
+	void *receive_packet_param;
+
+	// Mouse and keyboard input for the host, sent on the control stream
+	// while streaming
+	struct input_sender *input;
+
+	// Plain HTTP handshake, only for local stand-in hosts
+	bool disable_tls;
 	
 	// Implementation-specific data
 	void *priv;
@@ -38,8 +165,23 @@ bool moonlight_client_start(struct moonlight_client *client, const char *host,
 			     int port, const char *app_name);
 void moonlight_client_stop(struct moonlight_client *client);
 
+// Change stream parameters of a running stream without reconnecting. The
+// GameStream control protocol has no message for this, so every change
+// sets the stream up again (RTSP) within the running app session. Applied
+// by the streaming thread.
+void moonlight_client_reconfigure(struct moonlight_client *client, int width,
+				  int height, int fps, int bitrate);
+
+// Statistics
+void moonlight_client_get_stats(struct moonlight_client *client,
+				struct moonlight_client_stats *stats);
+
 // Callbacks (to be called by the protocol implementation)
 void moonlight_client_video_frame(struct moonlight_client *client,
+				  uint32_t frame_number, uint32_t flags,
 				  uint8_t *data, size_t size);
+void moonlight_client_video_slice(struct moonlight_client *client,
+				  uint32_t frame_number, uint32_t flags,
+				  uint8_t *data, size_t size, bool end_of_frame);
 void moonlight_client_audio_frame(struct moonlight_client *client,
 				  uint8_t *data, size_t size);
@@ -2,10 +2,14 @@
 #include "plugin-main.h"
 #include "moonlight-client.h"
 #include "video-decoder.h"
+#include "decoder-pool.h"
 #include "audio-decoder.h"
+#include "stream-recorder.h"
+#include "input-sender.h"
 #include <obs-module.h>
 #include <util/dstr.h>
 #include <util/threading.h>
+#include <stdio.h>
 
 // Default values
 #define DEFAULT_HOST "localhost"
@@ -15,6 +19,19 @@
 #define DEFAULT_HEIGHT 1080
 #define DEFAULT_FPS 60
 #define DEFAULT_BITRATE 20000
+#define DEFAULT_SLICE_DECODE false
+#define DEFAULT_CONCEALMENT MOONLIGHT_CONCEAL_SHOW
+#define DEFAULT_INACTIVE_REF_ONLY true
+#define DEFAULT_ENCRYPT_STREAMS true
+#define DEFAULT_FORWARD_INPUT true
+#define DEFAULT_MEMORY_BUDGET 0
+#define DEFAULT_HUGEPAGES false
+#define DEFAULT_FRAME_EXPORT false
+#define DEFAULT_VIDEO_CODEC MOONLIGHT_CODEC_H264
+#define DEFAULT_HDR false
+#define DEFAULT_RECORD false
+#define DEFAULT_RECORD_FORMAT STREAM_RECORDER_MKV
+#define DEFAULT_RECORD_SEGMENT 0
 
 // Source callbacks forward declarations
 static const char *moonlight_source_get_name(void *unused);
@@ -22,20 +39,57 @@ static void *moonlight_source_create(obs_data_t *settings, obs_source_t *source)
 static void moonlight_source_destroy(void *data);
 static void moonlight_source_update(void *data, obs_data_t *settings);
 static void moonlight_source_defaults(obs_data_t *settings);
+// Frames lost to the decoder memory budget, shown under the budget
+static void add_memory_warning(obs_properties_t *props,
+			       struct moonlight_source *context)
+{
+	if (!context || !context->client)
+		return;
+
+	struct moonlight_client_stats stats;
+	moonlight_client_get_stats(context->client, &stats);
+	if (!stats.memory_refused)
+		return;
+
+	char text[160];
+	snprintf(text, sizeof(text),
+		 "%llu frames not decoded: the %llu MB budget was reached",
+		 (unsigned long long)stats.memory_refused,
+		 (unsigned long long)(stats.memory_budget / (1024 * 1024)));
+	obs_property_t *warning = obs_properties_add_text(
+		props, "memory_warning", text, OBS_TEXT_INFO);
+	obs_property_text_set_info_type(warning, OBS_TEXT_INFO_WARNING);
+}
+
 static obs_properties_t *moonlight_source_properties(void *data);
 static void moonlight_source_show(void *data);
 static void moonlight_source_hide(void *data);
-static void moonlight_source_video_tick(void *data, float seconds);
-static void moonlight_source_video_render(void *data, gs_effect_t *effect);
+static void moonlight_source_activate(void *data);
+static void moonlight_source_deactivate(void *data);
+
 static uint32_t moonlight_source_get_width(void *data);
 static uint32_t moonlight_source_get_height(void *data);
+static void moonlight_source_mouse_click(void *data,
+					 const struct obs_mouse_event *event,
+					 int32_t type, bool mouse_up,
+					 uint32_t click_count);
+static void moonlight_source_mouse_move(void *data,
+					const struct obs_mouse_event *event,
+					bool mouse_leave);
+static void moonlight_source_mouse_wheel(void *data,
+					 const struct obs_mouse_event *event,
+					 int x_delta, int y_delta);
+static void moonlight_source_focus(void *data, bool focus);
+static void moonlight_source_key_click(void *data,
+				       const struct obs_key_event *event,
+				       bool key_up);
 
 // Source info structure
 struct obs_source_info moonlight_source_info = {
 	.id = "moonlight_source",
 	.type = OBS_SOURCE_TYPE_INPUT,
 	.output_flags = OBS_SOURCE_ASYNC_VIDEO | OBS_SOURCE_AUDIO |
-			OBS_SOURCE_DO_NOT_DUPLICATE,
+			OBS_SOURCE_DO_NOT_DUPLICATE | OBS_SOURCE_INTERACTION,
 	.get_name = moonlight_source_get_name,
 	.create = moonlight_source_create,
 	.destroy = moonlight_source_destroy,
@@ -44,10 +98,15 @@ struct obs_source_info moonlight_source_info = {
 	.get_properties = moonlight_source_properties,
 	.show = moonlight_source_show,
 	.hide = moonlight_source_hide,
-	.video_tick = moonlight_source_video_tick,
-	.video_render = moonlight_source_video_render,
+	.activate = moonlight_source_activate,
+	.deactivate = moonlight_source_deactivate,
 	.get_width = moonlight_source_get_width,
 	.get_height = moonlight_source_get_height,
+	.mouse_click = moonlight_source_mouse_click,
+	.mouse_move = moonlight_source_mouse_move,
+	.mouse_wheel = moonlight_source_mouse_wheel,
+	.focus = moonlight_source_focus,
+	.key_click = moonlight_source_key_click,
 };
 
 static const char *moonlight_source_get_name(void *unused)
@@ -62,6 +121,7 @@ static void *moonlight_source_create(obs_data_t *settings, obs_source_t *source)
 	context->source = source;
 
 	pthread_mutex_init(&context->mutex, NULL);
+	context->recorder = stream_recorder_create();
 
 	// Initialize with settings
 	moonlight_source_update(context, settings);
@@ -91,9 +151,13 @@ static void moonlight_source_destroy(void *data)
 		context->client = NULL;
 	}
 
+	// Finish the recording after the last packet
+	stream_recorder_destroy(context->recorder);
+	context->recorder = NULL;
+
 	// Cleanup decoders
 	if (context->video_dec) {
-		video_decoder_destroy(context->video_dec);
+		decoder_pool_release(context->video_dec);
 		context->video_dec = NULL;
 	}
 
@@ -103,13 +167,6 @@ static void moonlight_source_destroy(void *data)
 	}
 
 	// Free resources
-	if (context->texture) {
-		obs_enter_graphics();
-		gs_texture_destroy(context->texture);
-		obs_leave_graphics();
-		context->texture = NULL;
-	}
-
 	if (context->video_data) {
 		bfree(context->video_data);
 		context->video_data = NULL;
@@ -119,9 +176,35 @@ static void moonlight_source_destroy(void *data)
 
 	bfree(context->host);
 	bfree(context->app_name);
+	bfree(context->record_path);
+	bfree(context->frame_export_name);
 	bfree(context);
 }
 
+// Remux what the host sends into files, without decoding or encoding
+static void start_recording(struct moonlight_source *context)
+{
+	if (context->video_codec == MOONLIGHT_CODEC_AV1) {
+		mlog(LOG_WARNING, "Recording is not supported for AV1 streams");
+		return;
+	}
+
+	struct audio_decoder *audio_dec = context->audio_dec;
+	struct stream_recorder_config config = {
+		.directory = context->record_path,
+		.format = context->record_format,
+		.segment_seconds = context->record_segment,
+		.hevc = context->video_codec == MOONLIGHT_CODEC_HEVC,
+		.width = context->width,
+		.height = context->height,
+		.fps = context->fps,
+		.sample_rate = audio_dec ? audio_dec->sample_rate : 48000,
+		.channels = audio_dec ? audio_dec->channels : 2,
+	};
+
+	stream_recorder_start(context->recorder, &config);
+}
+
 static void moonlight_source_update(void *data, obs_data_t *settings)
 {
 	struct moonlight_source *context = data;
@@ -134,9 +217,50 @@ static void moonlight_source_update(void *data, obs_data_t *settings)
 	int height = (int)obs_data_get_int(settings, "height");
 	int fps = (int)obs_data_get_int(settings, "fps");
 	int bitrate = (int)obs_data_get_int(settings, "bitrate");
+	bool slice_decode = obs_data_get_bool(settings, "slice_decode");
+	enum moonlight_concealment concealment =
+		(enum moonlight_concealment)obs_data_get_int(settings,
+							     "concealment");
+	bool inactive_ref_only =
+		obs_data_get_bool(settings, "inactive_ref_only");
+	bool encrypt_streams = obs_data_get_bool(settings, "encrypt_streams");
+	bool forward_input = obs_data_get_bool(settings, "forward_input");
+	int memory_budget = (int)obs_data_get_int(settings, "memory_budget");
+	bool hugepages = obs_data_get_bool(settings, "hugepages");
+	bool frame_export = obs_data_get_bool(settings, "frame_export");
+	const char *frame_export_name =
+		obs_data_get_string(settings, "frame_export_name");
+	int video_codec = (int)obs_data_get_int(settings, "video_codec");
+	bool hdr = obs_data_get_bool(settings, "hdr");
+	bool record = obs_data_get_bool(settings, "record");
+	const char *record_path = obs_data_get_string(settings, "record_path");
+	int record_format = (int)obs_data_get_int(settings, "record_format");
+	int record_segment = (int)obs_data_get_int(settings, "record_segment");
 
 	pthread_mutex_lock(&context->mutex);
 
+	// Diff against the running session: a different host or app needs a
+	// new connection, stream parameters are changed live
+	bool reconnect = context->streaming &&
+			 (strcmp(context->host, host) != 0 ||
+			  context->port != port ||
+			  strcmp(context->app_name, app_name) != 0 ||
+			  context->encrypt_streams != encrypt_streams ||
+			  context->video_codec != video_codec ||
+			  context->hdr != hdr);
+	bool reconfigure = context->streaming && !reconnect &&
+			   (context->width != width ||
+			    context->height != height || context->fps != fps ||
+			    context->bitrate != bitrate);
+
+	// A running recording starts a new file with the new settings
+	bool rerecord = context->streaming && !reconnect &&
+			(reconfigure || context->record != record ||
+			 !context->record_path ||
+			 strcmp(context->record_path, record_path) != 0 ||
+			 context->record_format != record_format ||
+			 context->record_segment != record_segment);
+
 	// Update connection settings
 	if (context->host)
 		bfree(context->host);
@@ -152,11 +276,58 @@ static void moonlight_source_update(void *data, obs_data_t *settings)
 	context->height = height;
 	context->fps = fps;
 	context->bitrate = bitrate;
+	context->slice_decode = slice_decode;
+	context->concealment = concealment;
+	context->inactive_ref_only = inactive_ref_only;
+	context->encrypt_streams = encrypt_streams;
+	context->forward_input = forward_input;
+	context->memory_budget = memory_budget;
+	context->hugepages = hugepages;
+
+	// Named after the source unless a name is given
+	if (frame_export && !*frame_export_name)
+		frame_export_name = obs_source_get_name(context->source);
+	bfree(context->frame_export_name);
+	context->frame_export_name =
+		frame_export ? bstrdup(frame_export_name) : NULL;
+
+	context->video_codec = video_codec;
+	context->hdr = hdr;
+
+	context->record = record;
+	bfree(context->record_path);
+	context->record_path = bstrdup(record_path);
+	context->record_format = record_format;
+	context->record_segment = record_segment;
 
 	pthread_mutex_unlock(&context->mutex);
 
+	// Nothing stays held on the host once input is turned off
+	if (!forward_input && context->client)
+		input_sender_release_all(context->client->input);
+
 	mlog(LOG_INFO, "Moonlight source updated: %s:%d (%dx%d@%dfps)",
 	     host, port, width, height, fps);
+
+	video_decoder_set_active(context->video_dec,
+				 obs_source_active(context->source),
+				 inactive_ref_only);
+
+	if (reconnect) {
+		mlog(LOG_INFO, "Connection settings changed - reconnecting");
+		moonlight_source_hide(context);
+		moonlight_source_show(context);
+	} else if (reconfigure) {
+		moonlight_client_reconfigure(context->client, width, height,
+					     fps, bitrate);
+	}
+
+	if (rerecord) {
+		if (record)
+			start_recording(context);
+		else
+			stream_recorder_stop(context->recorder);
+	}
 }
 
 static void moonlight_source_defaults(obs_data_t *settings)
@@ -168,11 +339,32 @@ static void moonlight_source_defaults(obs_data_t *settings)
 	obs_data_set_default_int(settings, "height", DEFAULT_HEIGHT);
 	obs_data_set_default_int(settings, "fps", DEFAULT_FPS);
 	obs_data_set_default_int(settings, "bitrate", DEFAULT_BITRATE);
+	obs_data_set_default_bool(settings, "slice_decode",
+				  DEFAULT_SLICE_DECODE);
+	obs_data_set_default_int(settings, "concealment", DEFAULT_CONCEALMENT);
+	obs_data_set_default_bool(settings, "inactive_ref_only",
+				  DEFAULT_INACTIVE_REF_ONLY);
+	obs_data_set_default_bool(settings, "encrypt_streams",
+				  DEFAULT_ENCRYPT_STREAMS);
+	obs_data_set_default_bool(settings, "forward_input",
+				  DEFAULT_FORWARD_INPUT);
+	obs_data_set_default_int(settings, "memory_budget",
+				 DEFAULT_MEMORY_BUDGET);
+	obs_data_set_default_bool(settings, "hugepages", DEFAULT_HUGEPAGES);
+	obs_data_set_default_bool(settings, "frame_export",
+				  DEFAULT_FRAME_EXPORT);
+	obs_data_set_default_int(settings, "video_codec", DEFAULT_VIDEO_CODEC);
+	obs_data_set_default_bool(settings, "hdr", DEFAULT_HDR);
+	obs_data_set_default_bool(settings, "record", DEFAULT_RECORD);
+	obs_data_set_default_int(settings, "record_format",
+				 DEFAULT_RECORD_FORMAT);
+	obs_data_set_default_int(settings, "record_segment",
+				 DEFAULT_RECORD_SEGMENT);
 }
 
 static obs_properties_t *moonlight_source_properties(void *data)
 {
-	UNUSED_PARAMETER(data);
+	struct moonlight_source *context = data;
 
 	obs_properties_t *props = obs_properties_create();
 
@@ -189,6 +381,59 @@ static obs_properties_t *moonlight_source_properties(void *data)
 						     120, 1);
 	obs_property_t *bitrate = obs_properties_add_int(
 		props, "bitrate", "Bitrate (Kbps)", 1000, 100000, 1000);
+	obs_properties_add_bool(props, "slice_decode",
+				"Decode slices as they arrive (lower latency)");
+
+	obs_property_t *video_codec = obs_properties_add_list(
+		props, "video_codec", "Video Codec", OBS_COMBO_TYPE_LIST,
+		OBS_COMBO_FORMAT_INT);
+	obs_property_list_add_int(video_codec, "H.264", MOONLIGHT_CODEC_H264);
+	obs_property_list_add_int(video_codec, "HEVC", MOONLIGHT_CODEC_HEVC);
+	obs_property_list_add_int(video_codec, "AV1", MOONLIGHT_CODEC_AV1);
+	obs_properties_add_bool(props, "hdr", "HDR (10-bit, HEVC or AV1)");
+
+	obs_property_t *concealment = obs_properties_add_list(
+		props, "concealment", "On packet loss", OBS_COMBO_TYPE_LIST,
+		OBS_COMBO_FORMAT_INT);
+	obs_property_list_add_int(concealment, "Show concealed frames",
+				  MOONLIGHT_CONCEAL_SHOW);
+	obs_property_list_add_int(concealment, "Hold last good frame",
+				  MOONLIGHT_CONCEAL_HOLD);
+
+	obs_properties_add_bool(
+		props, "inactive_ref_only",
+		"Decode only reference frames while not in program");
+	obs_properties_add_bool(
+		props, "encrypt_streams",
+		"Encrypt video and audio (if the host supports it)");
+	obs_properties_add_bool(props, "forward_input",
+				"Forward mouse and keyboard (Interact)");
+	obs_properties_add_int(props, "memory_budget",
+			       "Decoder Memory Budget (MB, 0 = auto)", 0, 4096,
+			       16);
+	add_memory_warning(props, context);
+	obs_properties_add_bool(props, "hugepages",
+				"Back decoder buffers with 2 MB pages");
+	obs_properties_add_bool(props, "frame_export",
+				"Share decoded frames with local applications");
+	obs_properties_add_text(props, "frame_export_name",
+				"Shared Frames Name (empty = source name)",
+				OBS_TEXT_DEFAULT);
+
+	obs_properties_add_bool(props, "record",
+				"Record received stream (no re-encode)");
+	obs_properties_add_path(props, "record_path", "Recording Path",
+				OBS_PATH_DIRECTORY, NULL, NULL);
+	obs_property_t *record_format = obs_properties_add_list(
+		props, "record_format", "Recording Format",
+		OBS_COMBO_TYPE_LIST, OBS_COMBO_FORMAT_INT);
+	obs_property_list_add_int(record_format, "Matroska (.mkv)",
+				  STREAM_RECORDER_MKV);
+	obs_property_list_add_int(record_format, "Fragmented MP4 (.mp4)",
+				  STREAM_RECORDER_FMP4);
+	obs_properties_add_int(props, "record_segment",
+			       "Split Recording Every (s, 0 = never)", 0, 86400,
+			       1);
 
 	return props;
 }
@@ -208,9 +453,10 @@ static void moonlight_source_show(void *data)
 		}
 	}
 
-	// Initialize decoders if needed
+	// Initialize decoders if needed. The video decoder normally comes
+	// open from the pool.
 	if (!context->video_dec) {
-		context->video_dec = video_decoder_create(context);
+		context->video_dec = decoder_pool_acquire(context);
 		if (!context->video_dec) {
 			mlog(LOG_ERROR, "Failed to create video decoder");
 			return;
@@ -225,6 +471,19 @@ static void moonlight_source_show(void *data)
 		}
 	}
 
+	video_decoder_start(context->video_dec,
+			    context->concealment == MOONLIGHT_CONCEAL_SHOW);
+
+	// The first file starts with the stream's first IDR frame
+	if (context->record)
+		start_recording(context);
+
+	// A source shown only in preview or a non-program scene decodes
+	// without passing its frames to OBS
+	video_decoder_set_active(context->video_dec,
+				 obs_source_active(context->source),
+				 context->inactive_ref_only);
+
 	// Start streaming
 	if (moonlight_client_start(context->client, context->host,
 				   context->port, context->app_name)) {
@@ -247,43 +506,295 @@ static void moonlight_source_hide(void *data)
 		context->streaming = false;
 		context->connected = false;
 	}
+
+	stream_recorder_stop(context->recorder);
+
+	// The stream is gone, the decoder goes back to the pool flushed
+	pthread_mutex_lock(&context->mutex);
+	struct video_decoder *video_dec = context->video_dec;
+	context->video_dec = NULL;
+	pthread_mutex_unlock(&context->mutex);
+
+	decoder_pool_release(video_dec);
 }
 
-static void moonlight_source_video_tick(void *data, float seconds)
+// Program state only gates the picture, the stream and the decoder keep
+// running so the source comes back on the next frame
+static void moonlight_source_activate(void *data)
 {
-	UNUSED_PARAMETER(seconds);
 	struct moonlight_source *context = data;
 
-	if (!context->streaming)
-		return;
+	mlog(LOG_INFO, "Moonlight source active - resuming output");
+	video_decoder_set_active(context->video_dec, true,
+				 context->inactive_ref_only);
+}
+
+static void moonlight_source_deactivate(void *data)
+{
+	struct moonlight_source *context = data;
 
-	// Video frames are delivered asynchronously through callbacks
-	// This function can be used for periodic updates if needed
+	mlog(LOG_INFO, "Moonlight source inactive - skipping output");
+	video_decoder_set_active(context->video_dec, false,
+				 context->inactive_ref_only);
 }
 
-static void moonlight_source_video_render(void *data, gs_effect_t *effect)
+static uint32_t moonlight_source_get_width(void *data)
 {
 	struct moonlight_source *context = data;
+	return context->width;
+}
 
-	if (!context->texture)
+static uint32_t moonlight_source_get_height(void *data)
+{
+	struct moonlight_source *context = data;
+	return context->height;
+}
+
+// Input from the interact window, NULL while it is not forwarded
+static struct input_sender *source_input(struct moonlight_source *context)
+{
+	if (!context->forward_input || !context->client)
+		return NULL;
+
+	return context->client->input;
+}
+
+static uint8_t input_modifiers(uint32_t modifiers)
+{
+	uint8_t result = 0;
+
+	if (modifiers & INTERACT_SHIFT_KEY)
+		result |= INPUT_MODIFIER_SHIFT;
+	if (modifiers & INTERACT_CONTROL_KEY)
+		result |= INPUT_MODIFIER_CTRL;
+	if (modifiers & INTERACT_ALT_KEY)
+		result |= INPUT_MODIFIER_ALT;
+	if (modifiers & INTERACT_COMMAND_KEY)
+		result |= INPUT_MODIFIER_META;
+
+	return result;
+}
+
+// Windows virtual-key code the host expects for an OBS key, 0 if none. The
+// key on a US layout, shifted symbols map to their unshifted key.
+static uint16_t input_key_code(obs_key_t key, uint32_t modifiers)
+{
+	bool right = (modifiers & INTERACT_IS_RIGHT) != 0;
+
+	if (key >= OBS_KEY_A && key <= OBS_KEY_Z)
+		return (uint16_t)('A' + (key - OBS_KEY_A));
+	if (key >= OBS_KEY_0 && key <= OBS_KEY_9)
+		return (uint16_t)('0' + (key - OBS_KEY_0));
+	if (key >= OBS_KEY_NUM0 && key <= OBS_KEY_NUM9)
+		return (uint16_t)(0x60 + (key - OBS_KEY_NUM0));
+	if (key >= OBS_KEY_F1 && key <= OBS_KEY_F24)
+		return (uint16_t)(0x70 + (key - OBS_KEY_F1));
+
+	switch (key) {
+	case OBS_KEY_BACKSPACE:
+		return 0x08;
+	case OBS_KEY_TAB:
+	case OBS_KEY_BACKTAB:
+		return 0x09;
+	case OBS_KEY_CLEAR:
+		return 0x0C;
+	case OBS_KEY_RETURN:
+	case OBS_KEY_ENTER:
+		return 0x0D;
+	case OBS_KEY_PAUSE:
+		return 0x13;
+	case OBS_KEY_CAPSLOCK:
+		return 0x14;
+	case OBS_KEY_ESCAPE:
+		return 0x1B;
+	case OBS_KEY_SPACE:
+		return 0x20;
+	case OBS_KEY_PAGEUP:
+		return 0x21;
+	case OBS_KEY_PAGEDOWN:
+		return 0x22;
+	case OBS_KEY_END:
+		return 0x23;
+	case OBS_KEY_HOME:
+		return 0x24;
+	case OBS_KEY_LEFT:
+		return 0x25;
+	case OBS_KEY_UP:
+		return 0x26;
+	case OBS_KEY_RIGHT:
+		return 0x27;
+	case OBS_KEY_DOWN:
+		return 0x28;
+	case OBS_KEY_PRINT:
+		return 0x2C;
+	case OBS_KEY_INSERT:
+		return 0x2D;
+	case OBS_KEY_DELETE:
+		return 0x2E;
+	case OBS_KEY_META:
+		return right ? 0x5C : 0x5B;
+	case OBS_KEY_MENU:
+		return 0x5D;
+	case OBS_KEY_NUMASTERISK:
+		return 0x6A;
+	case OBS_KEY_NUMPLUS:
+		return 0x6B;
+	case OBS_KEY_NUMMINUS:
+		return 0x6D;
+	case OBS_KEY_NUMPERIOD:
+		return 0x6E;
+	case OBS_KEY_NUMSLASH:
+		return 0x6F;
+	case OBS_KEY_NUMLOCK:
+		return 0x90;
+	case OBS_KEY_SCROLLLOCK:
+		return 0x91;
+	case OBS_KEY_SHIFT:
+		return right ? 0xA1 : 0xA0;
+	case OBS_KEY_CONTROL:
+		return right ? 0xA3 : 0xA2;
+	case OBS_KEY_ALT:
+		return right ? 0xA5 : 0xA4;
+	case OBS_KEY_EXCLAM:
+		return '1';
+	case OBS_KEY_AT:
+		return '2';
+	case OBS_KEY_NUMBERSIGN:
+		return '3';
+	case OBS_KEY_DOLLAR:
+		return '4';
+	case OBS_KEY_PERCENT:
+		return '5';
+	case OBS_KEY_ASCIICIRCUM:
+		return '6';
+	case OBS_KEY_AMPERSAND:
+		return '7';
+	case OBS_KEY_ASTERISK:
+		return '8';
+	case OBS_KEY_PARENLEFT:
+		return '9';
+	case OBS_KEY_PARENRIGHT:
+		return '0';
+	case OBS_KEY_SEMICOLON:
+	case OBS_KEY_COLON:
+		return 0xBA;
+	case OBS_KEY_EQUAL:
+	case OBS_KEY_PLUS:
+		return 0xBB;
+	case OBS_KEY_COMMA:
+	case OBS_KEY_LESS:
+		return 0xBC;
+	case OBS_KEY_MINUS:
+	case OBS_KEY_UNDERSCORE:
+		return 0xBD;
+	case OBS_KEY_PERIOD:
+	case OBS_KEY_GREATER:
+		return 0xBE;
+	case OBS_KEY_SLASH:
+	case OBS_KEY_QUESTION:
+		return 0xBF;
+	case OBS_KEY_QUOTELEFT:
+	case OBS_KEY_ASCIITILDE:
+		return 0xC0;
+	case OBS_KEY_BRACKETLEFT:
+	case OBS_KEY_BRACELEFT:
+		return 0xDB;
+	case OBS_KEY_BACKSLASH:
+	case OBS_KEY_BAR:
+		return 0xDC;
+	case OBS_KEY_BRACKETRIGHT:
+	case OBS_KEY_BRACERIGHT:
+		return 0xDD;
+	case OBS_KEY_APOSTROPHE:
+	case OBS_KEY_QUOTEDBL:
+		return 0xDE;
+	default:
+		return 0;
+	}
+}
+
+static void moonlight_source_mouse_click(void *data,
+					 const struct obs_mouse_event *event,
+					 int32_t type, bool mouse_up,
+					 uint32_t click_count)
+{
+	UNUSED_PARAMETER(click_count);
+	struct moonlight_source *context = data;
+	struct input_sender *input = source_input(context);
+	if (!input)
 		return;
 
-	effect = obs_get_base_effect(OBS_EFFECT_DEFAULT);
+	uint8_t button;
+	switch (type) {
+	case MOUSE_LEFT:
+		button = INPUT_BUTTON_LEFT;
+		break;
+	case MOUSE_MIDDLE:
+		button = INPUT_BUTTON_MIDDLE;
+		break;
+	case MOUSE_RIGHT:
+		button = INPUT_BUTTON_RIGHT;
+		break;
+	default:
+		return;
+	}
 
-	gs_effect_set_texture(gs_effect_get_param_by_name(effect, "image"),
-			      context->texture);
+	// The click lands where it was made, even without a move before it
+	input_sender_mouse_move(input, event->x, event->y, context->width,
+				context->height);
+	input_sender_mouse_button(input, button, !mouse_up);
+}
+
+static void moonlight_source_mouse_move(void *data,
+					const struct obs_mouse_event *event,
+					bool mouse_leave)
+{
+	struct moonlight_source *context = data;
+	struct input_sender *input = source_input(context);
+	if (!input || mouse_leave)
+		return;
 
-	gs_draw_sprite(context->texture, 0, context->width, context->height);
+	input_sender_mouse_move(input, event->x, event->y, context->width,
+				context->height);
 }
 
-static uint32_t moonlight_source_get_width(void *data)
+static void moonlight_source_mouse_wheel(void *data,
+					 const struct obs_mouse_event *event,
+					 int x_delta, int y_delta)
 {
+	UNUSED_PARAMETER(event);
 	struct moonlight_source *context = data;
-	return context->width;
+
+	input_sender_scroll(source_input(context), y_delta, x_delta);
 }
 
-static uint32_t moonlight_source_get_height(void *data)
+// Keys and buttons held when the interact window loses focus would stay
+// down on the host
+static void moonlight_source_focus(void *data, bool focus)
 {
 	struct moonlight_source *context = data;
-	return context->height;
+
+	if (!focus)
+		input_sender_release_all(source_input(context));
+}
+
+static void moonlight_source_key_click(void *data,
+				       const struct obs_key_event *event,
+				       bool key_up)
+{
+	struct moonlight_source *context = data;
+	struct input_sender *input = source_input(context);
+	if (!input)
+		return;
+
+	obs_key_t key = obs_key_from_virtual_key((int)event->native_vkey);
+	uint16_t key_code = input_key_code(key, event->modifiers);
+	if (!key_code) {
+		mlog(LOG_DEBUG, "No host key for %s",
+		     obs_key_to_name(key));
+		return;
+	}
+
+	input_sender_key(input, key_code, input_modifiers(event->modifiers),
+			 !key_up);
 }
@@ -8,6 +8,13 @@
 struct moonlight_client;
 struct video_decoder;
 struct audio_decoder;
+struct stream_recorder;
+
+// What to show while the picture is damaged by packet loss
+enum moonlight_concealment {
+	MOONLIGHT_CONCEAL_SHOW,
+	MOONLIGHT_CONCEAL_HOLD,
+};
 
 // Moonlight source context
 struct moonlight_source {
@@ -21,6 +28,35 @@ struct moonlight_source {
 	int height;
 	int fps;
 	int bitrate;
+	bool slice_decode;
+	enum moonlight_concealment concealment;
+	bool inactive_ref_only;
+	bool encrypt_streams;
+
+	// Mouse and keyboard from the interact window go to the host
+	bool forward_input;
+
+	// Decoder buffers: the most they may take (MB, 0 sizes it from the
+	// stream), and whether they are backed by 2 MB pages. Applied when the
+	// decoder is attached.
+	int memory_budget;
+	bool hugepages;
+
+	// Decoded frames are shared with processes on this machine under
+	// this name (see frame-export.h), NULL when off. Applied when the
+	// decoder is attached.
+	char *frame_export_name;
+
+	// Preferred video format (enum moonlight_video_codec), 10-bit HDR
+	// with HEVC or AV1
+	int video_codec;
+	bool hdr;
+
+	// Passthrough recording of the received stream
+	bool record;
+	char *record_path;
+	int record_format;
+	int record_segment;
 
 	// Connection state
 	bool connected;
@@ -32,9 +68,9 @@ struct moonlight_source {
 	struct moonlight_client *client;
 	struct video_decoder *video_dec;
 	struct audio_decoder *audio_dec;
+	struct stream_recorder *recorder;
 
 	// Video rendering
-	gs_texture_t *texture;
 	uint8_t *video_data;
 	uint32_t video_linesize;
 };
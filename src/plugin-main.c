@@ -1,5 +1,8 @@
 #include "plugin-main.h"
 #include "moonlight-source.h"
+#include "handshake.h"
+#include "decoder-pool.h"
+#include "hot-log.h"
 #include <obs-module.h>
 
 OBS_DECLARE_MODULE()
@@ -10,6 +13,15 @@ bool obs_module_load(void)
 	mlog(LOG_INFO, "Moonlight OBS Plugin loaded successfully (version %s)",
 	     PLUGIN_VERSION);
 
+	// Background writer for logging from the streaming threads
+	hot_log_init();
+
+	// Shared host connection state
+	handshake_global_init();
+
+	// Decoders opened ahead of the first source being shown
+	decoder_pool_init();
+
 	// Register the Moonlight source
 	obs_register_source(&moonlight_source_info);
 
@@ -18,6 +30,12 @@ bool obs_module_load(void)
 
 void obs_module_unload(void)
 {
+	decoder_pool_free();
+	handshake_global_free();
+
+	// Last, the decoders log as they close
+	hot_log_free();
+
 	mlog(LOG_INFO, "Moonlight OBS Plugin unloaded");
 }
 
@@ -0,0 +1,179 @@
+#include "reference-tracker.h"
+#include <string.h>
+
+void reference_tracker_init(struct reference_tracker *tracker,
+			    bool host_supports_rfi)
+{
+	memset(tracker, 0, sizeof(*tracker));
+	tracker->host_supports_rfi = host_supports_rfi;
+}
+
+static void begin_recovery(struct reference_tracker *tracker, uint64_t now_ns)
+{
+	if (tracker->recovering)
+		return;
+
+	tracker->recovering = true;
+	tracker->loss_start_ns = now_ns;
+}
+
+static void finish_recovery(struct reference_tracker *tracker, uint64_t now_ns)
+{
+	if (!tracker->recovering)
+		return;
+
+	uint64_t elapsed = now_ns - tracker->loss_start_ns;
+
+	tracker->recovering = false;
+	tracker->recoveries++;
+	tracker->last_recovery_ns = elapsed;
+	tracker->total_recovery_ns += elapsed;
+	if (elapsed > tracker->max_recovery_ns)
+		tracker->max_recovery_ns = elapsed;
+}
+
+static void request_idr(struct reference_tracker *tracker, uint64_t now_ns,
+			struct reference_request *request)
+{
+	// When concealing, the damaged chain is decoded until the IDR frame
+	if (!tracker->conceal)
+		tracker->have_reference = false;
+	tracker->idr_pending = true;
+	tracker->idr_requests++;
+	tracker->last_request_ns = now_ns;
+
+	request->type = REFERENCE_REQUEST_IDR;
+}
+
+static void request_invalidate(struct reference_tracker *tracker,
+			       uint32_t first_frame, uint32_t last_frame,
+			       uint64_t now_ns,
+			       struct reference_request *request)
+{
+	tracker->rfi_requests++;
+	tracker->last_request_ns = now_ns;
+
+	request->type = REFERENCE_REQUEST_INVALIDATE;
+	request->first_frame = first_frame;
+	request->last_frame = last_frame;
+}
+
+static void request_recovery(struct reference_tracker *tracker,
+			     uint32_t first_frame, uint32_t last_frame,
+			     uint64_t now_ns, struct reference_request *request)
+{
+	if (tracker->host_supports_rfi)
+		request_invalidate(tracker, first_frame, last_frame, now_ns,
+				   request);
+	else
+		request_idr(tracker, now_ns, request);
+}
+
+// The frame references missing data
+static enum reference_action damaged_frame(struct reference_tracker *tracker)
+{
+	if (tracker->conceal) {
+		tracker->frames_concealed++;
+		return REFERENCE_ACTION_CONCEAL;
+	}
+
+	tracker->frames_dropped++;
+	return REFERENCE_ACTION_DROP;
+}
+
+enum reference_action
+reference_tracker_frame_incomplete(struct reference_tracker *tracker,
+				   uint32_t frame_number, uint64_t now_ns,
+				   struct reference_request *request)
+{
+	request->type = REFERENCE_REQUEST_NONE;
+
+	if (!tracker->have_reference) {
+		tracker->frames_dropped++;
+		return REFERENCE_ACTION_DROP;
+	}
+
+	// Later frames reference the damaged one
+	begin_recovery(tracker, now_ns);
+	request_recovery(tracker, frame_number, frame_number, now_ns, request);
+	return damaged_frame(tracker);
+}
+
+enum reference_action
+reference_tracker_frame(struct reference_tracker *tracker,
+			uint32_t frame_number, uint32_t flags, uint64_t now_ns,
+			struct reference_request *request)
+{
+	request->type = REFERENCE_REQUEST_NONE;
+
+	// An IDR frame starts a fresh reference chain
+	if (flags & MOONLIGHT_FRAME_IDR) {
+		finish_recovery(tracker, now_ns);
+		tracker->have_reference = true;
+		tracker->idr_pending = false;
+		tracker->next_frame = frame_number + 1;
+
+		if (flags & MOONLIGHT_FRAME_INCOMPLETE)
+			return reference_tracker_frame_incomplete(
+				tracker, frame_number, now_ns, request);
+
+		return REFERENCE_ACTION_DECODE;
+	}
+
+	// Frame numbers wrap, so compare them as a signed distance
+	int32_t distance = (int32_t)(frame_number - tracker->next_frame);
+
+	// Nothing can be decoded until the host sends an IDR frame
+	if (!tracker->have_reference) {
+		if (distance >= 0)
+			tracker->next_frame = frame_number + 1;
+
+		if (!tracker->idr_pending ||
+		    now_ns - tracker->last_request_ns >
+			    REFERENCE_RECOVERY_TIMEOUT_NS)
+			request_idr(tracker, now_ns, request);
+
+		tracker->frames_dropped++;
+		return REFERENCE_ACTION_DROP;
+	}
+
+	// Late or duplicate frame, its slot has already been given up on
+	if (distance < 0) {
+		tracker->frames_dropped++;
+		return REFERENCE_ACTION_DROP;
+	}
+
+	tracker->next_frame = frame_number + 1;
+
+	// Frames were lost. Everything from the first lost frame up to this
+	// one may reference missing data, so invalidate the whole range.
+	if (distance > 0) {
+		uint32_t first_lost = frame_number - (uint32_t)distance;
+
+		tracker->frames_lost += (uint32_t)distance;
+		begin_recovery(tracker, now_ns);
+		request_recovery(tracker, first_lost, frame_number, now_ns,
+				 request);
+
+		return damaged_frame(tracker);
+	}
+
+	if (flags & MOONLIGHT_FRAME_INCOMPLETE)
+		return reference_tracker_frame_incomplete(tracker, frame_number,
+							  now_ns, request);
+
+	if (!tracker->recovering)
+		return REFERENCE_ACTION_DECODE;
+
+	// The host re-encoded against a valid reference
+	if (flags & MOONLIGHT_FRAME_RECOVERY) {
+		finish_recovery(tracker, now_ns);
+		return REFERENCE_ACTION_DECODE;
+	}
+
+	// The invalidation request was lost or ignored, fall back to an IDR
+	if (now_ns - tracker->last_request_ns > REFERENCE_RECOVERY_TIMEOUT_NS)
+		request_idr(tracker, now_ns, request);
+
+	return damaged_frame(tracker);
+}
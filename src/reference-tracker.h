@@ -0,0 +1,80 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Frame flags reported by the protocol implementation
+#define MOONLIGHT_FRAME_IDR (1 << 0)
+// First frame the host encoded after honouring an invalidation request
+#define MOONLIGHT_FRAME_RECOVERY (1 << 1)
+// Slices of the frame were lost and could not be recovered
+#define MOONLIGHT_FRAME_INCOMPLETE (1 << 2)
+
+// How long to wait for a recovery frame before escalating to an IDR request
+#define REFERENCE_RECOVERY_TIMEOUT_NS 500000000ULL
+
+// What the caller should do with the frame that was just reported
+enum reference_action {
+	REFERENCE_ACTION_DECODE,
+	REFERENCE_ACTION_DROP,
+	// Decode although data is missing, the decoder conceals the damage
+	REFERENCE_ACTION_CONCEAL,
+};
+
+// Control request the caller should send to the host
+enum reference_request_type {
+	REFERENCE_REQUEST_NONE,
+	REFERENCE_REQUEST_INVALIDATE,
+	REFERENCE_REQUEST_IDR,
+};
+
+struct reference_request {
+	enum reference_request_type type;
+	uint32_t first_frame;
+	uint32_t last_frame;
+};
+
+// Tracks the reference chain of received video frames
+struct reference_tracker {
+	bool host_supports_rfi;
+
+	// Keep decoding frames with missing references (concealed) while
+	// waiting for recovery, instead of dropping them
+	bool conceal;
+
+	// State
+	bool have_reference;
+	bool recovering;
+	bool idr_pending;
+	uint32_t next_frame;
+	uint64_t loss_start_ns;
+	uint64_t last_request_ns;
+
+	// Statistics
+	uint64_t frames_lost;
+	uint64_t frames_dropped;
+	uint64_t frames_concealed;
+	uint64_t rfi_requests;
+	uint64_t idr_requests;
+	uint64_t recoveries;
+	uint64_t last_recovery_ns;
+	uint64_t max_recovery_ns;
+	uint64_t total_recovery_ns;
+};
+
+void reference_tracker_init(struct reference_tracker *tracker,
+			    bool host_supports_rfi);
+
+// Report a received frame, or the first slice of one in slice decode mode.
+// Fills in request when the host needs to be told about lost frames.
+enum reference_action
+reference_tracker_frame(struct reference_tracker *tracker,
+			uint32_t frame_number, uint32_t flags, uint64_t now_ns,
+			struct reference_request *request);
+
+// Report that slices of an already reported frame were lost (slice decode
+// mode, where frames are reported by their first slice)
+enum reference_action
+reference_tracker_frame_incomplete(struct reference_tracker *tracker,
+				   uint32_t frame_number, uint64_t now_ns,
+				   struct reference_request *request);
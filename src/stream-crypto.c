@@ -0,0 +1,172 @@
+#include "stream-crypto.h"
+#include "plugin-main.h"
+#include <openssl/evp.h>
+#include <string.h>
+
+#define AES_BLOCK_SIZE 16
+
+enum decrypt_result {
+	DECRYPT_OK,
+	DECRYPT_MALFORMED,
+	DECRYPT_AUTH_FAILED,
+};
+
+// OpenSSL picks the fastest AES implementation for the CPU (AES-NI, and
+// VAES with AVX-512 for GCM) when the context is created
+static EVP_CIPHER_CTX *create_context(const EVP_CIPHER *cipher,
+				      const uint8_t *key)
+{
+	EVP_CIPHER_CTX *ctx = EVP_CIPHER_CTX_new();
+	if (!ctx)
+		return NULL;
+
+	if (EVP_DecryptInit_ex(ctx, cipher, NULL, key, NULL) != 1) {
+		EVP_CIPHER_CTX_free(ctx);
+		return NULL;
+	}
+
+	return ctx;
+}
+
+bool stream_crypto_init(struct stream_crypto *crypto, uint32_t streams,
+			const uint8_t key[STREAM_CRYPTO_KEY_SIZE],
+			uint32_t key_id)
+{
+	memset(crypto, 0, sizeof(*crypto));
+	crypto->streams = streams;
+	crypto->key_id = key_id;
+
+	if (streams & STREAM_ENCRYPT_VIDEO) {
+		crypto->video_ctx = create_context(EVP_aes_128_gcm(), key);
+		if (!crypto->video_ctx)
+			goto fail;
+	}
+
+	if (streams & STREAM_ENCRYPT_AUDIO) {
+		crypto->audio_ctx = create_context(EVP_aes_128_cbc(), key);
+		if (!crypto->audio_ctx)
+			goto fail;
+	}
+
+	return true;
+
+fail:
+	mlog(LOG_ERROR, "Failed to set up stream decryption");
+	stream_crypto_free(crypto);
+	return false;
+}
+
+void stream_crypto_free(struct stream_crypto *crypto)
+{
+	EVP_CIPHER_CTX_free(crypto->video_ctx);
+	EVP_CIPHER_CTX_free(crypto->audio_ctx);
+	crypto->video_ctx = NULL;
+	crypto->audio_ctx = NULL;
+	crypto->streams = 0;
+}
+
+static enum decrypt_result decrypt_video_packet(EVP_CIPHER_CTX *ctx,
+						struct stream_packet *packet)
+{
+	if (packet->size <= VIDEO_CRYPTO_HEADER_SIZE)
+		return DECRYPT_MALFORMED;
+
+	uint8_t *iv = packet->data;
+	uint8_t *tag = packet->data + VIDEO_CRYPTO_IV_SIZE + 4;
+	uint8_t *data = packet->data + VIDEO_CRYPTO_HEADER_SIZE;
+	int size = (int)(packet->size - VIDEO_CRYPTO_HEADER_SIZE);
+	int decrypted = 0, final = 0;
+
+	if (EVP_DecryptInit_ex(ctx, NULL, NULL, NULL, iv) != 1 ||
+	    EVP_DecryptUpdate(ctx, data, &decrypted, data, size) != 1 ||
+	    EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_SET_TAG,
+				VIDEO_CRYPTO_TAG_SIZE, tag) != 1 ||
+	    EVP_DecryptFinal_ex(ctx, data + decrypted, &final) != 1)
+		return DECRYPT_AUTH_FAILED;
+
+	packet->data = data;
+	packet->size = (size_t)(decrypted + final);
+	return DECRYPT_OK;
+}
+
+static enum decrypt_result decrypt_audio_packet(EVP_CIPHER_CTX *ctx,
+						uint32_t key_id,
+						struct stream_packet *packet)
+{
+	if (packet->size < AUDIO_RTP_HEADER_SIZE + AES_BLOCK_SIZE ||
+	    (packet->size - AUDIO_RTP_HEADER_SIZE) % AES_BLOCK_SIZE)
+		return DECRYPT_MALFORMED;
+
+	// The IV is the key ID plus the RTP sequence number, big endian
+	uint16_t sequence = (uint16_t)(packet->data[2] << 8 | packet->data[3]);
+	uint32_t iv_sequence = key_id + sequence;
+	uint8_t iv[AES_BLOCK_SIZE] = {
+		(uint8_t)(iv_sequence >> 24),
+		(uint8_t)(iv_sequence >> 16),
+		(uint8_t)(iv_sequence >> 8),
+		(uint8_t)iv_sequence,
+	};
+
+	uint8_t *data = packet->data + AUDIO_RTP_HEADER_SIZE;
+	int size = (int)(packet->size - AUDIO_RTP_HEADER_SIZE);
+	int decrypted = 0, final = 0;
+
+	// CBC has no tag, bad padding is the only sign of a wrong key
+	if (EVP_DecryptInit_ex(ctx, NULL, NULL, NULL, iv) != 1 ||
+	    EVP_DecryptUpdate(ctx, data, &decrypted, data, size) != 1 ||
+	    EVP_DecryptFinal_ex(ctx, data + decrypted, &final) != 1)
+		return DECRYPT_AUTH_FAILED;
+
+	packet->size = AUDIO_RTP_HEADER_SIZE + (size_t)(decrypted + final);
+	return DECRYPT_OK;
+}
+
+static void count_result(struct stream_crypto *crypto,
+			 struct stream_packet *packet,
+			 enum decrypt_result result)
+{
+	switch (result) {
+	case DECRYPT_OK:
+		crypto->packets_decrypted++;
+		return;
+	case DECRYPT_MALFORMED:
+		crypto->malformed++;
+		break;
+	case DECRYPT_AUTH_FAILED:
+		crypto->auth_failures++;
+		break;
+	}
+
+	packet->size = 0;
+}
+
+size_t stream_crypto_decrypt_video(struct stream_crypto *crypto,
+				   struct stream_packet *packets, size_t count)
+{
+	EVP_CIPHER_CTX *ctx = crypto->video_ctx;
+	if (!ctx)
+		return 0;
+
+	uint64_t before = crypto->packets_decrypted;
+	for (size_t i = 0; i < count; i++)
+		count_result(crypto, &packets[i],
+			     decrypt_video_packet(ctx, &packets[i]));
+
+	return (size_t)(crypto->packets_decrypted - before);
+}
+
+size_t stream_crypto_decrypt_audio(struct stream_crypto *crypto,
+				   struct stream_packet *packets, size_t count)
+{
+	EVP_CIPHER_CTX *ctx = crypto->audio_ctx;
+	if (!ctx)
+		return 0;
+
+	uint64_t before = crypto->packets_decrypted;
+	for (size_t i = 0; i < count; i++)
+		count_result(crypto, &packets[i],
+			     decrypt_audio_packet(ctx, crypto->key_id,
+						  &packets[i]));
+
+	return (size_t)(crypto->packets_decrypted - before);
+}
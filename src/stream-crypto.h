@@ -0,0 +1,57 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Streams the host encrypts, as negotiated over RTSP
+// (x-ss-general.encryptionRequested)
+#define STREAM_ENCRYPT_VIDEO 0x02
+#define STREAM_ENCRYPT_AUDIO 0x04
+
+#define STREAM_CRYPTO_KEY_SIZE 16
+
+// Encrypted video packet: AES-128-GCM, the ciphertext follows a header of
+// IV, frame number (LE32) and tag
+#define VIDEO_CRYPTO_IV_SIZE 12
+#define VIDEO_CRYPTO_TAG_SIZE 16
+#define VIDEO_CRYPTO_HEADER_SIZE 32
+
+// Encrypted audio packet: RTP header in the clear, AES-128-CBC payload
+#define AUDIO_RTP_HEADER_SIZE 12
+
+// A received packet, decrypted in place. data and size are updated to the
+// plaintext, size is 0 if the packet failed to decrypt.
+struct stream_packet {
+	uint8_t *data;
+	size_t size;
+};
+
+// Decryption state of one session. The key schedules are expanded once when
+// the session starts, each packet only sets its IV.
+struct stream_crypto {
+	uint32_t streams;
+	uint32_t key_id;
+
+	// EVP_CIPHER_CTX, AES-128-GCM and AES-128-CBC
+	void *video_ctx;
+	void *audio_ctx;
+
+	// Statistics
+	uint64_t packets_decrypted;
+	uint64_t auth_failures;
+	uint64_t malformed;
+};
+
+bool stream_crypto_init(struct stream_crypto *crypto, uint32_t streams,
+			const uint8_t key[STREAM_CRYPTO_KEY_SIZE],
+			uint32_t key_id);
+void stream_crypto_free(struct stream_crypto *crypto);
+
+// Decrypt a batch of received packets in place. Packets that fail
+// authentication or are malformed are counted and get size 0. Returns the
+// number of packets decrypted.
+size_t stream_crypto_decrypt_video(struct stream_crypto *crypto,
+				   struct stream_packet *packets, size_t count);
+size_t stream_crypto_decrypt_audio(struct stream_crypto *crypto,
+				   struct stream_packet *packets, size_t count);
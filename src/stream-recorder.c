@@ -0,0 +1,770 @@
+#include "stream-recorder.h"
+#include "plugin-main.h"
+#include "reference-tracker.h"
+#include <libavformat/avformat.h>
+#include <libavutil/channel_layout.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef _WIN32
+#define fseeko _fseeki64
+#define ftello _ftelli64
+#endif
+
+// Packets waiting for the writer. At 100 Mbps this covers more than two
+// seconds of a stalled disk before packets are dropped.
+#define RECORDER_BUFFER_SIZE (32 * 1024 * 1024)
+
+// libavformat output is collected into writes of this size
+#define RECORDER_IO_BUFFER_SIZE (1024 * 1024)
+
+// Opus timestamps are always in 48 kHz samples
+#define OPUS_SAMPLE_RATE 48000
+#define OPUS_MAX_PACKET_SAMPLES 5760
+
+// Ring buffer entries are aligned to their header
+#define ENTRY_ALIGN 8
+#define ENTRY_WRAP UINT32_MAX
+
+enum recorder_stream {
+	RECORDER_STREAM_VIDEO,
+	RECORDER_STREAM_AUDIO,
+};
+
+// Header of a packet in the ring buffer, followed by its data. A header
+// with size ENTRY_WRAP (or no room for a header) continues at the start.
+struct ring_entry {
+	uint32_t size;
+	uint32_t duration;
+	int64_t pts;
+	uint8_t stream;
+	bool keyframe;
+	bool new_segment;
+};
+
+struct stream_recorder {
+	pthread_t thread;
+	pthread_mutex_t mutex;
+	pthread_cond_t packet_ready;
+	pthread_cond_t closed;
+	bool thread_started;
+	bool shutdown;
+
+	// Current recording
+	bool recording;
+	bool closing;
+	struct stream_recorder_config config;
+	char *directory;
+	char prefix[64];
+	int segment_index;
+
+	// Ring buffer, filled on the receive path and drained by the writer
+	uint8_t *buffer;
+	size_t head;
+	size_t tail;
+	size_t used;
+
+	// Timestamps: video in host frames, audio in samples, both counted
+	// from the start of the current segment
+	bool need_idr;
+	bool keyframe_wanted;
+	bool keyframe_requested;
+	uint32_t request_frame;
+	uint32_t segment_frame;
+	int64_t segment_frames;
+	int64_t audio_samples;
+	int64_t segment_audio;
+
+	// Output, only touched by the writer thread
+	AVFormatContext *output;
+	AVPacket *packet;
+	FILE *file;
+	bool output_failed;
+
+	struct stream_recorder_stats stats;
+};
+
+/* ------------------------------------------------------------------------- */
+/* Ring buffer (called with the mutex held) */
+
+static size_t entry_size(uint32_t size)
+{
+	return (sizeof(struct ring_entry) + size + ENTRY_ALIGN - 1) &
+	       ~(size_t)(ENTRY_ALIGN - 1);
+}
+
+static bool push_entry(struct stream_recorder *recorder,
+		       const struct ring_entry *entry, const uint8_t *data)
+{
+	size_t total = entry_size(entry->size);
+	size_t room = RECORDER_BUFFER_SIZE - recorder->head;
+	size_t waste = room < total ? room : 0;
+
+	if (recorder->used + waste + total > RECORDER_BUFFER_SIZE)
+		return false;
+
+	if (waste) {
+		if (room >= sizeof(struct ring_entry)) {
+			struct ring_entry *wrap = (struct ring_entry *)(
+				recorder->buffer + recorder->head);
+			wrap->size = ENTRY_WRAP;
+		}
+		recorder->used += waste;
+		recorder->head = 0;
+	}
+
+	uint8_t *dst = recorder->buffer + recorder->head;
+	memcpy(dst, entry, sizeof(*entry));
+	memcpy(dst + sizeof(*entry), data, entry->size);
+
+	recorder->head += total;
+	recorder->used += total;
+	if (recorder->head == RECORDER_BUFFER_SIZE)
+		recorder->head = 0;
+
+	pthread_cond_signal(&recorder->packet_ready);
+	return true;
+}
+
+static struct ring_entry *peek_entry(struct stream_recorder *recorder)
+{
+	size_t room = RECORDER_BUFFER_SIZE - recorder->tail;
+	struct ring_entry *entry =
+		(struct ring_entry *)(recorder->buffer + recorder->tail);
+
+	if (room < sizeof(*entry) || entry->size == ENTRY_WRAP) {
+		recorder->used -= room;
+		recorder->tail = 0;
+		entry = (struct ring_entry *)recorder->buffer;
+	}
+
+	return entry;
+}
+
+static void release_entry(struct stream_recorder *recorder,
+			  const struct ring_entry *entry)
+{
+	size_t total = entry_size(entry->size);
+	recorder->tail += total;
+	recorder->used -= total;
+
+	// Start over at the beginning while the buffer is empty, which keeps
+	// the most contiguous room for large frames
+	if (!recorder->used)
+		recorder->head = recorder->tail = 0;
+}
+
+/* ------------------------------------------------------------------------- */
+/* Output files (writer thread) */
+
+#if LIBAVFORMAT_VERSION_MAJOR >= 61
+static int write_file(void *opaque, const uint8_t *buf, int size)
+#else
+static int write_file(void *opaque, uint8_t *buf, int size)
+#endif
+{
+	struct stream_recorder *recorder = opaque;
+
+	if (fwrite(buf, 1, (size_t)size, recorder->file) != (size_t)size)
+		return AVERROR(EIO);
+
+	pthread_mutex_lock(&recorder->mutex);
+	recorder->stats.bytes_written += (uint64_t)size;
+	pthread_mutex_unlock(&recorder->mutex);
+	return size;
+}
+
+static int64_t seek_file(void *opaque, int64_t offset, int whence)
+{
+	struct stream_recorder *recorder = opaque;
+
+	if (whence & AVSEEK_SIZE) {
+		int64_t position = ftello(recorder->file);
+		if (fseeko(recorder->file, 0, SEEK_END) != 0)
+			return AVERROR(EIO);
+		int64_t size = ftello(recorder->file);
+		fseeko(recorder->file, position, SEEK_SET);
+		return size;
+	}
+
+	if (fseeko(recorder->file, offset, whence & ~AVSEEK_FORCE) != 0)
+		return AVERROR(EIO);
+	return ftello(recorder->file);
+}
+
+// Position of the next 00 00 01 start code at or after p
+static const uint8_t *next_start_code(const uint8_t *p, const uint8_t *end)
+{
+	for (; p + 3 <= end; p++) {
+		if (p[0] == 0 && p[1] == 0 && p[2] == 1)
+			return p;
+	}
+	return end;
+}
+
+static bool is_parameter_set(int codec, uint8_t header)
+{
+	if (codec == AV_CODEC_ID_HEVC) {
+		int type = (header >> 1) & 0x3f;
+		return type >= 32 && type <= 34; // VPS, SPS, PPS
+	}
+
+	int type = header & 0x1f;
+	return type == 7 || type == 8; // SPS, PPS
+}
+
+// Copies the parameter sets of an IDR frame into the codec extradata, in
+// Annex-B form, which the muxers convert to avcC/hvcC
+static bool set_parameter_sets(AVCodecParameters *par, const uint8_t *data,
+			       size_t size)
+{
+	const uint8_t *end = data + size;
+	uint8_t *extradata =
+		av_mallocz(size * 2 + AV_INPUT_BUFFER_PADDING_SIZE);
+	size_t extradata_size = 0;
+
+	const uint8_t *start = next_start_code(data, end);
+	while (start < end) {
+		const uint8_t *nal = start + 3;
+		const uint8_t *next = next_start_code(nal, end);
+
+		// Leading zero of a following four byte start code
+		const uint8_t *nal_end = next;
+		while (nal_end > nal && nal_end[-1] == 0)
+			nal_end--;
+
+		if (nal < nal_end && is_parameter_set(par->codec_id, *nal)) {
+			static const uint8_t start_code[4] = {0, 0, 0, 1};
+			memcpy(extradata + extradata_size, start_code, 4);
+			memcpy(extradata + extradata_size + 4, nal,
+			       (size_t)(nal_end - nal));
+			extradata_size += 4 + (size_t)(nal_end - nal);
+		}
+
+		start = next;
+	}
+
+	if (!extradata_size) {
+		av_free(extradata);
+		return false;
+	}
+
+	par->extradata = extradata;
+	par->extradata_size = (int)extradata_size;
+	return true;
+}
+
+// OpusHead for mapping family 0 (mono or stereo)
+static void set_opus_header(AVCodecParameters *par, int channels,
+			    int sample_rate)
+{
+	uint8_t *header = av_mallocz(19 + AV_INPUT_BUFFER_PADDING_SIZE);
+	memcpy(header, "OpusHead", 8);
+	header[8] = 1;
+	header[9] = (uint8_t)channels;
+	header[12] = (uint8_t)sample_rate;
+	header[13] = (uint8_t)(sample_rate >> 8);
+	header[14] = (uint8_t)(sample_rate >> 16);
+	header[15] = (uint8_t)(sample_rate >> 24);
+
+	par->extradata = header;
+	par->extradata_size = 19;
+}
+
+static void close_segment(struct stream_recorder *recorder)
+{
+	AVFormatContext *output = recorder->output;
+	if (!output)
+		return;
+
+	av_write_trailer(output);
+	avio_flush(output->pb);
+
+	av_freep(&output->pb->buffer);
+	avio_context_free(&output->pb);
+	avformat_free_context(output);
+	recorder->output = NULL;
+
+	if (fclose(recorder->file) != 0) {
+		mlog(LOG_ERROR, "Failed to finish recording file");
+		pthread_mutex_lock(&recorder->mutex);
+		recorder->stats.write_errors++;
+		pthread_mutex_unlock(&recorder->mutex);
+	}
+	recorder->file = NULL;
+}
+
+// Starts a file with the IDR frame that opens it
+static bool open_segment(struct stream_recorder *recorder,
+			 const uint8_t *data, size_t size)
+{
+	const struct stream_recorder_config *config = &recorder->config;
+	bool mkv = config->format == STREAM_RECORDER_MKV;
+
+	char path[512];
+	snprintf(path, sizeof(path), "%s/%s-%03d.%s", recorder->directory,
+		 recorder->prefix, ++recorder->segment_index,
+		 mkv ? "mkv" : "mp4");
+
+	AVFormatContext *output = NULL;
+	avformat_alloc_output_context2(&output, NULL, mkv ? "matroska" : "mp4",
+				       path);
+	if (!output) {
+		mlog(LOG_ERROR, "Failed to create recording muxer");
+		return false;
+	}
+
+	AVStream *video = avformat_new_stream(output, NULL);
+	AVStream *audio = avformat_new_stream(output, NULL);
+	if (!video || !audio) {
+		avformat_free_context(output);
+		return false;
+	}
+
+	video->time_base = (AVRational){1, config->fps};
+	video->avg_frame_rate = (AVRational){config->fps, 1};
+	video->codecpar->codec_type = AVMEDIA_TYPE_VIDEO;
+	video->codecpar->codec_id = config->hevc ? AV_CODEC_ID_HEVC
+						  : AV_CODEC_ID_H264;
+	video->codecpar->width = config->width;
+	video->codecpar->height = config->height;
+	if (!set_parameter_sets(video->codecpar, data, size)) {
+		mlog(LOG_ERROR, "IDR frame has no parameter sets, cannot "
+				"start recording file");
+		avformat_free_context(output);
+		return false;
+	}
+
+	audio->time_base = (AVRational){1, OPUS_SAMPLE_RATE};
+	audio->codecpar->codec_type = AVMEDIA_TYPE_AUDIO;
+	audio->codecpar->codec_id = AV_CODEC_ID_OPUS;
+	audio->codecpar->sample_rate = config->sample_rate;
+#if LIBAVUTIL_VERSION_MAJOR >= 57
+	av_channel_layout_default(&audio->codecpar->ch_layout,
+				  config->channels);
+#else
+	audio->codecpar->channels = config->channels;
+#endif
+	set_opus_header(audio->codecpar, config->channels,
+			config->sample_rate);
+
+	recorder->file = fopen(path, "wb");
+	if (!recorder->file) {
+		mlog(LOG_ERROR, "Failed to open recording file %s", path);
+		avformat_free_context(output);
+		return false;
+	}
+
+	// Large writes straight to the file instead of avio's small buffer
+	uint8_t *io_buffer = av_malloc(RECORDER_IO_BUFFER_SIZE);
+	output->pb = avio_alloc_context(io_buffer, RECORDER_IO_BUFFER_SIZE, 1,
+					recorder, NULL, write_file, seek_file);
+	output->flags |= AVFMT_FLAG_CUSTOM_IO;
+
+	AVDictionary *options = NULL;
+	if (!mkv)
+		av_dict_set(&options, "movflags",
+			    "frag_keyframe+empty_moov+default_base_moof", 0);
+
+	int ret = avformat_write_header(output, &options);
+	av_dict_free(&options);
+
+	recorder->output = output;
+	if (ret < 0) {
+		mlog(LOG_ERROR, "Failed to write recording header: %d", ret);
+		close_segment(recorder);
+		return false;
+	}
+
+	pthread_mutex_lock(&recorder->mutex);
+	recorder->stats.segments++;
+	pthread_mutex_unlock(&recorder->mutex);
+
+	mlog(LOG_INFO, "Recording to %s", path);
+	return true;
+}
+
+static bool write_entry(struct stream_recorder *recorder,
+			const struct ring_entry *entry)
+{
+	const uint8_t *data = (const uint8_t *)(entry + 1);
+
+	if (entry->new_segment) {
+		close_segment(recorder);
+		recorder->output_failed =
+			!open_segment(recorder, data, entry->size);
+	}
+
+	if (!recorder->output || recorder->output_failed)
+		return false;
+
+	bool video = entry->stream == RECORDER_STREAM_VIDEO;
+	AVRational time_base = video ? (AVRational){1, recorder->config.fps}
+				     : (AVRational){1, OPUS_SAMPLE_RATE};
+
+	// The packet is not reference counted, the muxer copies what it
+	// has to keep
+	AVPacket *packet = recorder->packet;
+	packet->data = (uint8_t *)data;
+	packet->size = (int)entry->size;
+	packet->stream_index = entry->stream;
+	packet->pts = entry->pts;
+	packet->dts = entry->pts;
+	packet->duration = entry->duration;
+	packet->flags = entry->keyframe ? AV_PKT_FLAG_KEY : 0;
+	av_packet_rescale_ts(packet, time_base,
+			     recorder->output->streams[entry->stream]->time_base);
+
+	int ret = av_interleaved_write_frame(recorder->output, packet);
+	if (ret < 0) {
+		mlog(LOG_ERROR, "Failed to write recorded packet: %d", ret);
+		return false;
+	}
+
+	return true;
+}
+
+static void *writer_thread(void *data)
+{
+	struct stream_recorder *recorder = data;
+
+	pthread_mutex_lock(&recorder->mutex);
+
+	while (!recorder->shutdown) {
+		if (!recorder->used) {
+			// Everything queued before the stop has been written
+			if (recorder->closing) {
+				pthread_mutex_unlock(&recorder->mutex);
+				close_segment(recorder);
+				pthread_mutex_lock(&recorder->mutex);
+
+				recorder->closing = false;
+				pthread_cond_broadcast(&recorder->closed);
+				continue;
+			}
+
+			pthread_cond_wait(&recorder->packet_ready,
+					  &recorder->mutex);
+			continue;
+		}
+
+		// The entry stays in place until it is released
+		struct ring_entry *entry = peek_entry(recorder);
+		pthread_mutex_unlock(&recorder->mutex);
+
+		bool written = write_entry(recorder, entry);
+
+		pthread_mutex_lock(&recorder->mutex);
+		if (!written)
+			recorder->stats.write_errors++;
+		else if (entry->stream == RECORDER_STREAM_VIDEO)
+			recorder->stats.video_packets++;
+		else
+			recorder->stats.audio_packets++;
+		release_entry(recorder, entry);
+	}
+
+	pthread_mutex_unlock(&recorder->mutex);
+
+	close_segment(recorder);
+	return NULL;
+}
+
+/* ------------------------------------------------------------------------- */
+
+struct stream_recorder *stream_recorder_create(void)
+{
+	struct stream_recorder *recorder =
+		bzalloc(sizeof(struct stream_recorder));
+
+	recorder->packet = av_packet_alloc();
+	if (!recorder->packet) {
+		bfree(recorder);
+		return NULL;
+	}
+
+	pthread_mutex_init(&recorder->mutex, NULL);
+	pthread_cond_init(&recorder->packet_ready, NULL);
+	pthread_cond_init(&recorder->closed, NULL);
+	return recorder;
+}
+
+void stream_recorder_destroy(struct stream_recorder *recorder)
+{
+	if (!recorder)
+		return;
+
+	stream_recorder_stop(recorder);
+
+	if (recorder->thread_started) {
+		pthread_mutex_lock(&recorder->mutex);
+		recorder->shutdown = true;
+		pthread_cond_signal(&recorder->packet_ready);
+		pthread_mutex_unlock(&recorder->mutex);
+
+		pthread_join(recorder->thread, NULL);
+	}
+
+	pthread_cond_destroy(&recorder->closed);
+	pthread_cond_destroy(&recorder->packet_ready);
+	pthread_mutex_destroy(&recorder->mutex);
+	av_packet_free(&recorder->packet);
+	bfree(recorder->directory);
+	bfree(recorder->buffer);
+	bfree(recorder);
+}
+
+bool stream_recorder_start(struct stream_recorder *recorder,
+			   const struct stream_recorder_config *config)
+{
+	if (!recorder || !config)
+		return false;
+
+	if (!config->directory || !*config->directory || config->fps <= 0) {
+		mlog(LOG_WARNING, "No recording directory set, not recording");
+		return false;
+	}
+
+	stream_recorder_stop(recorder);
+
+	if (!recorder->thread_started) {
+		recorder->buffer = bmalloc(RECORDER_BUFFER_SIZE);
+		if (pthread_create(&recorder->thread, NULL, writer_thread,
+				   recorder) != 0) {
+			mlog(LOG_ERROR, "Failed to create recording thread");
+			return false;
+		}
+		recorder->thread_started = true;
+	}
+
+	time_t now = time(NULL);
+	char prefix[64];
+	strftime(prefix, sizeof(prefix), "moonlight-%Y-%m-%d_%H-%M-%S",
+		 localtime(&now));
+
+	pthread_mutex_lock(&recorder->mutex);
+
+	bfree(recorder->directory);
+	recorder->directory = bstrdup(config->directory);
+	recorder->config = *config;
+	recorder->config.directory = recorder->directory;
+	strcpy(recorder->prefix, prefix);
+	recorder->segment_index = 0;
+	recorder->output_failed = false;
+
+	recorder->segment_frames =
+		(int64_t)config->segment_seconds * config->fps;
+	recorder->audio_samples = 0;
+	recorder->need_idr = true;
+	recorder->keyframe_requested = false;
+	recorder->recording = true;
+
+	pthread_mutex_unlock(&recorder->mutex);
+
+	mlog(LOG_INFO, "Recording started (%s, %s segments)",
+	     config->format == STREAM_RECORDER_MKV ? "MKV" : "fragmented MP4",
+	     config->segment_seconds ? "timed" : "no");
+	return true;
+}
+
+void stream_recorder_stop(struct stream_recorder *recorder)
+{
+	if (!recorder)
+		return;
+
+	pthread_mutex_lock(&recorder->mutex);
+
+	if (!recorder->recording) {
+		pthread_mutex_unlock(&recorder->mutex);
+		return;
+	}
+
+	recorder->recording = false;
+	recorder->keyframe_wanted = false;
+	recorder->closing = true;
+	pthread_cond_signal(&recorder->packet_ready);
+
+	while (recorder->closing)
+		pthread_cond_wait(&recorder->closed, &recorder->mutex);
+
+	struct stream_recorder_stats stats = recorder->stats;
+	pthread_mutex_unlock(&recorder->mutex);
+
+	mlog(LOG_INFO,
+	     "Recording stopped (%llu video, %llu audio packets, %llu MB in "
+	     "%llu files; %llu dropped, %llu errors)",
+	     (unsigned long long)stats.video_packets,
+	     (unsigned long long)stats.audio_packets,
+	     (unsigned long long)(stats.bytes_written / (1024 * 1024)),
+	     (unsigned long long)stats.segments,
+	     (unsigned long long)stats.packets_dropped,
+	     (unsigned long long)stats.write_errors);
+}
+
+bool stream_recorder_active(struct stream_recorder *recorder)
+{
+	if (!recorder)
+		return false;
+
+	pthread_mutex_lock(&recorder->mutex);
+	bool recording = recorder->recording;
+	pthread_mutex_unlock(&recorder->mutex);
+	return recording;
+}
+
+void stream_recorder_write_video(struct stream_recorder *recorder,
+				 uint32_t frame_number, uint32_t flags,
+				 const uint8_t *data, size_t size)
+{
+	if (!recorder || !data || !size)
+		return;
+
+	bool idr = (flags & MOONLIGHT_FRAME_IDR) != 0;
+
+	pthread_mutex_lock(&recorder->mutex);
+
+	if (!recorder->recording) {
+		pthread_mutex_unlock(&recorder->mutex);
+		return;
+	}
+
+	int64_t pts = (uint32_t)(frame_number - recorder->segment_frame);
+	bool segment_due = !recorder->need_idr && recorder->segment_frames &&
+			   pts >= recorder->segment_frames;
+	bool waiting = recorder->need_idr || segment_due;
+	bool new_segment = idr && waiting;
+
+	if (new_segment) {
+		// A file can only start with an IDR frame
+		recorder->segment_frame = frame_number;
+		recorder->segment_audio = recorder->audio_samples;
+		recorder->need_idr = false;
+		recorder->keyframe_requested = false;
+		pts = 0;
+	} else if (waiting &&
+		   (!recorder->keyframe_requested ||
+		    frame_number - recorder->request_frame >=
+			    (uint32_t)recorder->config.fps)) {
+		// Ask again each second in case a request was lost
+		recorder->keyframe_wanted = true;
+		recorder->keyframe_requested = true;
+		recorder->request_frame = frame_number;
+	}
+
+	if (recorder->need_idr) {
+		pthread_mutex_unlock(&recorder->mutex);
+		return;
+	}
+
+	struct ring_entry entry = {
+		.size = (uint32_t)size,
+		.duration = 1,
+		.pts = pts,
+		.stream = RECORDER_STREAM_VIDEO,
+		.keyframe = idr,
+		.new_segment = new_segment,
+	};
+
+	if (!push_entry(recorder, &entry, data)) {
+		// Continue in a new file once the writer has caught up
+		recorder->stats.packets_dropped++;
+		recorder->need_idr = true;
+	}
+
+	pthread_mutex_unlock(&recorder->mutex);
+}
+
+void stream_recorder_write_audio(struct stream_recorder *recorder,
+				 const uint8_t *data, size_t size)
+{
+	int samples = stream_recorder_opus_samples(data, size);
+	if (!recorder || !samples)
+		return;
+
+	pthread_mutex_lock(&recorder->mutex);
+
+	if (recorder->recording && !recorder->need_idr) {
+		struct ring_entry entry = {
+			.size = (uint32_t)size,
+			.duration = (uint32_t)samples,
+			.pts = recorder->audio_samples -
+			       recorder->segment_audio,
+			.stream = RECORDER_STREAM_AUDIO,
+			.keyframe = true,
+		};
+
+		if (!push_entry(recorder, &entry, data)) {
+			recorder->stats.packets_dropped++;
+			recorder->need_idr = true;
+		}
+	}
+
+	// Counted while waiting for an IDR too, to keep later files in sync
+	recorder->audio_samples += samples;
+
+	pthread_mutex_unlock(&recorder->mutex);
+}
+
+bool stream_recorder_keyframe_wanted(struct stream_recorder *recorder)
+{
+	if (!recorder)
+		return false;
+
+	pthread_mutex_lock(&recorder->mutex);
+	bool wanted = recorder->keyframe_wanted;
+	recorder->keyframe_wanted = false;
+	pthread_mutex_unlock(&recorder->mutex);
+	return wanted;
+}
+
+void stream_recorder_get_stats(struct stream_recorder *recorder,
+			       struct stream_recorder_stats *stats)
+{
+	memset(stats, 0, sizeof(*stats));
+
+	if (!recorder)
+		return;
+
+	pthread_mutex_lock(&recorder->mutex);
+	*stats = recorder->stats;
+	pthread_mutex_unlock(&recorder->mutex);
+}
+
+int stream_recorder_opus_samples(const uint8_t *data, size_t size)
+{
+	// Frame sizes at 48 kHz for each configuration (RFC 6716, 3.1)
+	static const int silk_samples[4] = {480, 960, 1920, 2880};
+
+	if (!data || size < 1)
+		return 0;
+
+	int config = data[0] >> 3;
+	int frame_samples;
+	if (config < 12)
+		frame_samples = silk_samples[config & 3];
+	else if (config < 16)
+		frame_samples = 480 << (config & 1);
+	else
+		frame_samples = 120 << (config & 3);
+
+	int frames;
+	switch (data[0] & 3) {
+	case 0:
+		frames = 1;
+		break;
+	case 1:
+	case 2:
+		frames = 2;
+		break;
+	default:
+		if (size < 2)
+			return 0;
+		frames = data[1] & 0x3f;
+		break;
+	}
+
+	int samples = frames * frame_samples;
+	return samples <= OPUS_MAX_PACKET_SAMPLES ? samples : 0;
+}
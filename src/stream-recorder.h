@@ -0,0 +1,80 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+// Container of the recorded segments
+enum stream_recorder_format {
+	STREAM_RECORDER_MKV,
+	STREAM_RECORDER_FMP4,
+};
+
+// Recording settings, copied by stream_recorder_start
+struct stream_recorder_config {
+	const char *directory;
+	enum stream_recorder_format format;
+
+	// Start a new file at the first IDR frame after this many seconds
+	// (0 records a single file)
+	int segment_seconds;
+
+	// Stream parameters negotiated with the host
+	bool hevc;
+	int width;
+	int height;
+	int fps;
+	int sample_rate;
+	int channels;
+};
+
+struct stream_recorder_stats {
+	uint64_t video_packets;
+	uint64_t audio_packets;
+	uint64_t bytes_written;
+	uint64_t segments;
+
+	// Packets dropped because the writer fell behind
+	uint64_t packets_dropped;
+	uint64_t write_errors;
+};
+
+// Records the received bitstream as it is: packets are copied into a ring
+// buffer on the receive path and remuxed by a writer thread, without
+// decoding or encoding. Timestamps come from the host's frame numbers and
+// audio packet durations.
+struct stream_recorder;
+
+// The buffer and writer thread are only set up by the first recording
+struct stream_recorder *stream_recorder_create(void);
+void stream_recorder_destroy(struct stream_recorder *recorder);
+
+// Start recording. The first file begins with the next IDR frame, which is
+// requested through stream_recorder_keyframe_wanted. A running recording
+// is finished first.
+bool stream_recorder_start(struct stream_recorder *recorder,
+			   const struct stream_recorder_config *config);
+
+// Write out what is still buffered and close the current file
+void stream_recorder_stop(struct stream_recorder *recorder);
+
+bool stream_recorder_active(struct stream_recorder *recorder);
+
+// Queue a complete video frame (Annex-B) or audio packet (Opus). Never
+// blocks on I/O, packets are dropped when the buffer is full.
+void stream_recorder_write_video(struct stream_recorder *recorder,
+				 uint32_t frame_number, uint32_t flags,
+				 const uint8_t *data, size_t size);
+void stream_recorder_write_audio(struct stream_recorder *recorder,
+				 const uint8_t *data, size_t size);
+
+// Returns true once when the recorder needs an IDR frame from the host, to
+// start a file or a new segment
+bool stream_recorder_keyframe_wanted(struct stream_recorder *recorder);
+
+void stream_recorder_get_stats(struct stream_recorder *recorder,
+			       struct stream_recorder_stats *stats);
+
+// Number of 48 kHz samples in an Opus packet, from its TOC byte (0 if the
+// packet is malformed)
+int stream_recorder_opus_samples(const uint8_t *data, size_t size);
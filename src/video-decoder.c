@@ -1,90 +1,354 @@
 #include "video-decoder.h"
 #include "moonlight-source.h"
-#include "plugin-main.h"
+#include "frame-pool.h"
+#include "frame-export.h"
+#include "hot-log.h"
 #include <libavcodec/avcodec.h>
 #include <libavutil/imgutils.h>
-#include <libswscale/swscale.h>
+#include <libavutil/mastering_display_metadata.h>
+#include <libavutil/pixdesc.h>
 #include <obs-module.h>
-#include <graphics/graphics.h>
+#include <string.h>
 
-// RGBA format has 4 bytes per pixel
-#define BYTES_PER_PIXEL_RGBA 4
+// A gap between pictures longer than this is counted as a freeze
+#define VIDEO_FREEZE_THRESHOLD_NS 100000000ULL
 
-struct video_decoder *video_decoder_create(struct moonlight_source *source)
+// FFmpeg reads and writes past the last row of a frame
+// (16 + STRIDE_ALIGN - 1 bytes)
+#define FRAME_PADDING 128
+
+#define MB (1024 * 1024)
+
+static enum AVCodecID codec_id(enum moonlight_video_codec codec)
 {
-	struct video_decoder *decoder =
-		bzalloc(sizeof(struct video_decoder));
-	if (!decoder)
-		return NULL;
+	switch (codec) {
+	case MOONLIGHT_CODEC_HEVC:
+		return AV_CODEC_ID_HEVC;
+	case MOONLIGHT_CODEC_AV1:
+		return AV_CODEC_ID_AV1;
+	default:
+		return AV_CODEC_ID_H264;
+	}
+}
 
-	decoder->source = source;
-	decoder->width = source->width;
-	decoder->height = source->height;
+static void release_buffer(void *opaque, uint8_t *data)
+{
+	frame_pool_free(opaque, data);
+}
 
-	// Find H.264 decoder
-	const AVCodec *codec = avcodec_find_decoder(AV_CODEC_ID_H264);
-	if (!codec) {
-		mlog(LOG_ERROR, "H.264 decoder not found");
-		bfree(decoder);
+// Decode into the pool, in one block per frame. Decoders that cannot
+// decode into given buffers use FFmpeg's allocator; a frame the budget has
+// no room for is not decoded.
+static int get_frame_buffer(AVCodecContext *codec_ctx, AVFrame *frame,
+			    int flags)
+{
+	struct frame_pool *pool = codec_ctx->opaque;
+	if (!pool || !(codec_ctx->codec->capabilities & AV_CODEC_CAP_DR1))
+		return avcodec_default_get_buffer2(codec_ctx, frame, flags);
+
+	// Padded as the codec needs, rows aligned for SIMD
+	int width = frame->width;
+	int height = frame->height;
+	int linesize_align[AV_NUM_DATA_POINTERS];
+	avcodec_align_dimensions2(codec_ctx, &width, &height, linesize_align);
+
+	int linesizes[4];
+	if (av_image_fill_linesizes(linesizes, frame->format, width) < 0)
+		return AVERROR(EINVAL);
+	for (int i = 0; i < 4; i++)
+		linesizes[i] = FFALIGN(linesizes[i], FRAME_POOL_ALIGN);
+
+	uint8_t *planes[4];
+	int size = av_image_fill_pointers(planes, frame->format, height, NULL,
+					  linesizes);
+	if (size < 0)
+		return size;
+
+	uint8_t *data = frame_pool_alloc(pool, (size_t)size + FRAME_PADDING);
+	if (!data) {
+		struct frame_pool_stats stats;
+		frame_pool_get_stats(pool, &stats);
+		hlog(LOG_WARNING,
+		     "Decoder memory budget of %zu MB reached, frame not "
+		     "decoded (%llu so far); raise Decoder Memory Budget",
+		     stats.budget / MB, (unsigned long long)stats.refused);
+		return AVERROR(ENOMEM);
+	}
+
+	frame->buf[0] = av_buffer_create(data, size + FRAME_PADDING,
+					 release_buffer, pool, 0);
+	if (!frame->buf[0]) {
+		frame_pool_free(pool, data);
+		return AVERROR(ENOMEM);
+	}
+
+	av_image_fill_pointers(frame->data, frame->format, height, data,
+			       linesizes);
+	for (int i = 0; i < 4; i++)
+		frame->linesize[i] = linesizes[i];
+	frame->extended_data = frame->data;
+	return 0;
+}
+
+static AVCodecContext *open_codec(struct video_decoder *decoder,
+				  enum moonlight_video_codec codec)
+{
+	enum AVCodecID id = codec_id(codec);
+	const AVCodec *av_codec = avcodec_find_decoder(id);
+	if (!av_codec) {
+		hlog(LOG_ERROR, "%s decoder not found", avcodec_get_name(id));
 		return NULL;
 	}
 
 	// Allocate codec context
-	AVCodecContext *codec_ctx = avcodec_alloc_context3(codec);
+	AVCodecContext *codec_ctx = avcodec_alloc_context3(av_codec);
 	if (!codec_ctx) {
-		mlog(LOG_ERROR, "Failed to allocate codec context");
-		bfree(decoder);
+		hlog(LOG_ERROR, "Failed to allocate codec context");
 		return NULL;
 	}
 
-	codec_ctx->width = source->width;
-	codec_ctx->height = source->height;
-	// Using YUV420P as it's the standard output format for H.264 in GameStream
-	// In a production implementation, this could be detected from the stream
-	codec_ctx->pix_fmt = AV_PIX_FMT_YUV420P;
+	// The output format follows the stream: 8-bit streams decode to
+	// YUV420P, Main10 streams to a 10-bit format that is passed on as is
+	codec_ctx->width = decoder->width;
+	codec_ctx->height = decoder->height;
+
+	codec_ctx->opaque = decoder->pool;
+	codec_ctx->get_buffer2 = get_frame_buffer;
+
+	// Slice decode mode submits each slice NAL as its own packet. The
+	// decoder outputs the frame once its last macroblock row is decoded,
+	// which only works with slice threading (frame threading would hold
+	// frames back). Only the H.264 decoder takes partial frames this way,
+	// other codecs are fed whole frames.
+	if (video_decoder_slice_mode(decoder->slice_decode, codec)) {
+		codec_ctx->flags2 |= AV_CODEC_FLAG2_CHUNKS;
+		codec_ctx->thread_type = FF_THREAD_SLICE;
+	}
+
+	// Keep pictures coming through packet loss. Damaged macroblocks are
+	// rebuilt from neighbouring motion vectors, preferring the previous
+	// frame since game content is mostly camera motion over a stable
+	// scene, and frames that could not be fully decoded are output
+	// instead of discarded.
+	codec_ctx->flags |= AV_CODEC_FLAG_OUTPUT_CORRUPT;
+	codec_ctx->error_concealment = FF_EC_GUESS_MVS | FF_EC_DEBLOCK;
+#ifdef FF_EC_FAVOR_INTER
+	codec_ctx->error_concealment |= FF_EC_FAVOR_INTER;
+#endif
 
 	// Open codec
-	if (avcodec_open2(codec_ctx, codec, NULL) < 0) {
-		mlog(LOG_ERROR, "Failed to open codec");
+	if (avcodec_open2(codec_ctx, av_codec, NULL) < 0) {
+		hlog(LOG_ERROR, "Failed to open codec");
 		avcodec_free_context(&codec_ctx);
+		return NULL;
+	}
+
+	return codec_ctx;
+}
+
+bool video_decoder_slice_mode(bool slice_decode,
+			      enum moonlight_video_codec codec)
+{
+	return slice_decode && codec == MOONLIGHT_CODEC_H264;
+}
+
+// The budget the source asks for, or one sized from the stream: its frame
+// size and bit depth, and the frames the codec's decode threads hold
+static size_t stream_budget(struct video_decoder *decoder)
+{
+	struct moonlight_source *source = decoder->source;
+	if (source && source->memory_budget > 0)
+		return (size_t)source->memory_budget * MB;
+
+	AVCodecContext *codec_ctx = decoder->codec_ctx;
+	int threads = (codec_ctx->active_thread_type & FF_THREAD_FRAME)
+			      ? codec_ctx->thread_count
+			      : 1;
+	int bytes_per_sample = source && source->hdr ? 2 : 1;
+
+	return (size_t)frame_pool_stream_budget(decoder->width,
+						decoder->height,
+						bytes_per_sample, threads) *
+	       MB;
+}
+
+struct video_decoder *video_decoder_open(enum moonlight_video_codec codec,
+					 int width, int height,
+					 bool slice_decode)
+{
+	struct video_decoder *decoder =
+		bzalloc(sizeof(struct video_decoder));
+	if (!decoder)
+		return NULL;
+
+	decoder->width = width;
+	decoder->height = height;
+	decoder->active = true;
+	decoder->slice_decode = slice_decode;
+	decoder->show_concealed = true;
+
+	decoder->codec = codec;
+	AVCodecContext *codec_ctx = open_codec(decoder, codec);
+	if (!codec_ctx) {
 		bfree(decoder);
 		return NULL;
 	}
 
 	decoder->codec_ctx = codec_ctx;
 
+	// Sized for an 8-bit stream until a source attaches
+	decoder->memory_budget = stream_budget(decoder);
+	decoder->pool = frame_pool_create(decoder->memory_budget, false);
+	if (!decoder->pool) {
+		avcodec_free_context(&codec_ctx);
+		bfree(decoder);
+		return NULL;
+	}
+	codec_ctx->opaque = decoder->pool;
+
 	// Allocate frame
 	AVFrame *frame = av_frame_alloc();
 	if (!frame) {
-		mlog(LOG_ERROR, "Failed to allocate frame");
+		hlog(LOG_ERROR, "Failed to allocate frame");
 		avcodec_free_context(&codec_ctx);
+		frame_pool_release(decoder->pool);
 		bfree(decoder);
 		return NULL;
 	}
 
 	decoder->frame = frame;
 
-	// Allocate output buffer for RGBA data
-	int output_size = source->width * source->height * BYTES_PER_PIXEL_RGBA;
-	decoder->output_data = bmalloc(output_size);
-	decoder->output_linesize = source->width * BYTES_PER_PIXEL_RGBA;
+	hlog(LOG_INFO, "Video decoder opened (%s, %dx%d%s)",
+	     avcodec_get_name(codec_id(codec)), width, height,
+	     video_decoder_slice_mode(slice_decode, codec) ? ", slice decode"
+							    : "");
+	return decoder;
+}
 
-	mlog(LOG_INFO, "Video decoder created (%dx%d)", source->width,
-	     source->height);
+struct video_decoder *video_decoder_create(struct moonlight_source *source)
+{
+	// The preferred codec, replaced if the host falls back to another
+	struct video_decoder *decoder = video_decoder_open(
+		(enum moonlight_video_codec)source->video_codec, source->width,
+		source->height, source->slice_decode);
+	if (decoder)
+		video_decoder_attach(decoder, source);
 	return decoder;
 }
 
+static bool set_size(struct video_decoder *decoder, int width, int height)
+{
+	if (width == decoder->width && height == decoder->height)
+		return false;
+
+	struct moonlight_source *source = decoder->source;
+	pthread_mutex_lock(&source->mutex);
+	decoder->width = width;
+	decoder->height = height;
+	pthread_mutex_unlock(&source->mutex);
+
+	hlog(LOG_INFO, "Video decoder resized to %dx%d", width, height);
+	return true;
+}
+
+// Move to a pool with another budget or page size. Called while no frame
+// is being decoded; frames the codec still holds go back to the old pool.
+static void set_memory(struct video_decoder *decoder, size_t budget,
+		       bool hugepages)
+{
+	if (budget == decoder->memory_budget &&
+	    hugepages == decoder->hugepages)
+		return;
+
+	struct frame_pool *pool = frame_pool_create(budget, hugepages);
+	if (!pool) {
+		hlog(LOG_ERROR, "Memory budget of %zu MB not available, "
+				"keeping %zu MB",
+		     budget / MB, decoder->memory_budget / MB);
+		return;
+	}
+
+	// Statistics read the pool under the source's lock
+	struct moonlight_source *source = decoder->source;
+	if (source)
+		pthread_mutex_lock(&source->mutex);
+	frame_pool_release(decoder->pool);
+	decoder->pool = pool;
+	decoder->memory_budget = budget;
+	decoder->hugepages = hugepages;
+	((AVCodecContext *)decoder->codec_ctx)->opaque = pool;
+	if (source)
+		pthread_mutex_unlock(&source->mutex);
+
+	struct frame_pool_stats stats;
+	frame_pool_get_stats(pool, &stats);
+	hlog(LOG_INFO, "Video decoder memory budget: %zu MB (%s)",
+	     budget / MB, frame_pool_pages_name(stats.pages));
+}
+
+// Publish under the source's export name, or stop publishing
+static void set_export(struct video_decoder *decoder, const char *name)
+{
+	const char *current = frame_export_get_name(decoder->export);
+	if (name && current && strcmp(name, current) == 0)
+		return;
+
+	frame_export_destroy(decoder->export);
+	decoder->export = name ? frame_export_create(name) : NULL;
+}
+
+void video_decoder_attach(struct video_decoder *decoder,
+			  struct moonlight_source *source)
+{
+	decoder->source = source;
+	decoder->show_concealed =
+		source->concealment == MOONLIGHT_CONCEAL_SHOW;
+	decoder->active = true;
+	decoder->reference_only = false;
+
+	set_size(decoder, source->width, source->height);
+	set_memory(decoder, stream_budget(decoder), source->hugepages);
+	set_export(decoder, source->frame_export_name);
+}
+
+void video_decoder_detach(struct video_decoder *decoder)
+{
+	// Drop buffered frames and references of the old stream
+	avcodec_flush_buffers(decoder->codec_ctx);
+
+	// Readers see the export closed until another stream publishes
+	frame_export_destroy(decoder->export);
+	decoder->export = NULL;
+
+	decoder->source = NULL;
+	decoder->frame_corrupt = false;
+	decoder->output_format = VIDEO_FORMAT_NONE;
+	decoder->max_luminance = 0;
+
+	decoder->last_packet_ns = 0;
+	decoder->frames_decoded = 0;
+	decoder->total_latency_ns = 0;
+	decoder->max_latency_ns = 0;
+	decoder->frames_corrupt = 0;
+	decoder->frames_held = 0;
+	decoder->decode_errors = 0;
+	decoder->last_output_ns = 0;
+	decoder->freezes = 0;
+	decoder->total_freeze_ns = 0;
+	decoder->max_freeze_ns = 0;
+	decoder->frames_inactive = 0;
+	frame_pool_reset_stats(decoder->pool);
+}
+
 void video_decoder_destroy(struct video_decoder *decoder)
 {
 	if (!decoder)
 		return;
 
-	mlog(LOG_INFO, "Destroying video decoder");
+	hlog(LOG_INFO, "Destroying video decoder");
 
-	if (decoder->sws_ctx) {
-		sws_freeContext(decoder->sws_ctx);
-		decoder->sws_ctx = NULL;
-	}
+	frame_export_destroy(decoder->export);
+	decoder->export = NULL;
 
 	if (decoder->frame) {
 		av_frame_free((AVFrame **)&decoder->frame);
@@ -96,90 +360,409 @@ void video_decoder_destroy(struct video_decoder *decoder)
 		decoder->codec_ctx = NULL;
 	}
 
-	if (decoder->output_data) {
-		bfree(decoder->output_data);
-		decoder->output_data = NULL;
-	}
+	// The codec has returned its frames by now
+	frame_pool_release(decoder->pool);
+	decoder->pool = NULL;
 
 	bfree(decoder);
 }
 
-bool video_decoder_decode(struct video_decoder *decoder, uint8_t *data,
-			  size_t size)
+void video_decoder_start(struct video_decoder *decoder, bool show_concealed)
 {
-	if (!decoder || !data || size == 0)
+	if (!decoder)
+		return;
+
+	struct moonlight_source *source = decoder->source;
+	pthread_mutex_lock(&source->mutex);
+	decoder->show_concealed = show_concealed;
+	decoder->frame_corrupt = false;
+	decoder->last_output_ns = 0;
+	pthread_mutex_unlock(&source->mutex);
+}
+
+void video_decoder_set_active(struct video_decoder *decoder, bool active,
+			      bool reference_only)
+{
+	if (!decoder)
+		return;
+
+	struct moonlight_source *source = decoder->source;
+	pthread_mutex_lock(&source->mutex);
+
+	bool changed = decoder->active != active;
+	decoder->active = active;
+	decoder->reference_only = reference_only;
+
+	// Time off program is not a freeze
+	if (changed && active)
+		decoder->last_output_ns = 0;
+
+	pthread_mutex_unlock(&source->mutex);
+}
+
+bool video_decoder_set_codec(struct video_decoder *decoder,
+			     enum moonlight_video_codec codec)
+{
+	if (!decoder)
 		return false;
+	if (codec == decoder->codec)
+		return true;
 
+	AVCodecContext *codec_ctx = open_codec(decoder, codec);
+	if (!codec_ctx)
+		return false;
+
+	avcodec_free_context((AVCodecContext **)&decoder->codec_ctx);
+	decoder->codec_ctx = codec_ctx;
+	decoder->codec = codec;
+
+	// The new codec may run another number of frame threads
+	set_memory(decoder, stream_budget(decoder), decoder->hugepages);
+
+	hlog(LOG_INFO, "Video decoder switched to %s%s",
+	     avcodec_get_name(codec_id(codec)),
+	     video_decoder_slice_mode(decoder->slice_decode, codec)
+		     ? ", slice decode"
+		     : "");
+	return true;
+}
+
+void video_decoder_set_size(struct video_decoder *decoder, int width,
+			    int height)
+{
+	if (!decoder || !set_size(decoder, width, height))
+		return;
+
+	// A budget sized from the stream follows it
+	set_memory(decoder, stream_budget(decoder), decoder->hugepages);
+}
+
+static bool send_packet(struct video_decoder *decoder, uint8_t *data,
+			size_t size, bool corrupt)
+{
 	AVCodecContext *codec_ctx = decoder->codec_ctx;
-	AVFrame *frame = decoder->frame;
 
 	// Create packet
 	AVPacket *packet = av_packet_alloc();
 	if (!packet)
 		return false;
 
+	// The decoder keeps its own reference to the data. A copy in the
+	// pool saves it allocating one for every packet; without room for
+	// it FFmpeg copies the data as before.
+	size_t padded = size + AV_INPUT_BUFFER_PADDING_SIZE;
+	uint8_t *copy = frame_pool_alloc(decoder->pool, padded);
+	if (copy) {
+		memcpy(copy, data, size);
+		memset(copy + size, 0, AV_INPUT_BUFFER_PADDING_SIZE);
+		packet->buf = av_buffer_create(copy, (int)padded,
+					       release_buffer, decoder->pool,
+					       0);
+		if (packet->buf)
+			data = copy;
+		else
+			frame_pool_free(decoder->pool, copy);
+	}
+
 	packet->data = data;
 	packet->size = size;
+	if (corrupt) {
+		packet->flags |= AV_PKT_FLAG_CORRUPT;
+		decoder->frame_corrupt = true;
+	}
+
+	// Non-reference frames are never needed to decode later frames, so
+	// an inactive decoder can discard them without losing its state
+	codec_ctx->skip_frame = !decoder->active && decoder->reference_only
+					? AVDISCARD_NONREF
+					: AVDISCARD_DEFAULT;
 
 	// Send packet to decoder
 	int ret = avcodec_send_packet(codec_ctx, packet);
 	av_packet_free(&packet);
 
 	if (ret < 0) {
-		mlog(LOG_ERROR, "Error sending packet to decoder: %d", ret);
+		// The data is lost, but the decoder carries on and conceals it
+		hlog(LOG_ERROR, "Error sending packet to decoder: %d", ret);
+		decoder->frame_corrupt = true;
+
+		pthread_mutex_lock(&decoder->source->mutex);
+		decoder->decode_errors++;
+		pthread_mutex_unlock(&decoder->source->mutex);
 		return false;
 	}
 
+	return true;
+}
+
+// Called with the source mutex held when a new picture goes on screen
+static void record_output(struct video_decoder *decoder, uint64_t now_ns)
+{
+	if (decoder->last_output_ns) {
+		uint64_t gap = now_ns - decoder->last_output_ns;
+		if (gap > VIDEO_FREEZE_THRESHOLD_NS) {
+			decoder->freezes++;
+			decoder->total_freeze_ns += gap;
+			if (gap > decoder->max_freeze_ns)
+				decoder->max_freeze_ns = gap;
+		}
+	}
+
+	decoder->last_output_ns = now_ns;
+}
+
+// The OBS format for the planes of a decoded frame, VIDEO_FORMAT_NONE if
+// OBS has none
+static enum video_format obs_format(int format)
+{
+	switch (format) {
+	case AV_PIX_FMT_YUV420P:
+	case AV_PIX_FMT_YUVJ420P:
+		return VIDEO_FORMAT_I420;
+	case AV_PIX_FMT_NV12:
+		return VIDEO_FORMAT_NV12;
+	case AV_PIX_FMT_YUV422P:
+	case AV_PIX_FMT_YUVJ422P:
+		return VIDEO_FORMAT_I422;
+	case AV_PIX_FMT_YUV444P:
+	case AV_PIX_FMT_YUVJ444P:
+		return VIDEO_FORMAT_I444;
+	case AV_PIX_FMT_YUV420P10LE:
+		return VIDEO_FORMAT_I010;
+	case AV_PIX_FMT_P010LE:
+		return VIDEO_FORMAT_P010;
+	default:
+		return VIDEO_FORMAT_NONE;
+	}
+}
+
+static bool is_full_range(const AVFrame *frame)
+{
+	switch (frame->format) {
+	case AV_PIX_FMT_YUVJ420P:
+	case AV_PIX_FMT_YUVJ422P:
+	case AV_PIX_FMT_YUVJ444P:
+		return true;
+	default:
+		return frame->color_range == AVCOL_RANGE_JPEG;
+	}
+}
+
+// Peak brightness for tone mapping: the content light level, or else the
+// mastering display's peak
+static uint16_t max_luminance(struct video_decoder *decoder,
+			      const AVFrame *frame)
+{
+	const AVFrameSideData *side_data = av_frame_get_side_data(
+		frame, AV_FRAME_DATA_CONTENT_LIGHT_LEVEL);
+	if (side_data) {
+		const AVContentLightMetadata *light =
+			(const AVContentLightMetadata *)side_data->data;
+		if (light->MaxCLL)
+			decoder->max_luminance = (uint16_t)light->MaxCLL;
+		return decoder->max_luminance;
+	}
+
+	side_data = av_frame_get_side_data(
+		frame, AV_FRAME_DATA_MASTERING_DISPLAY_METADATA);
+	if (side_data) {
+		const AVMasteringDisplayMetadata *mastering =
+			(const AVMasteringDisplayMetadata *)side_data->data;
+		if (mastering->has_luminance)
+			decoder->max_luminance = (uint16_t)(
+				av_q2d(mastering->max_luminance) + 0.5);
+	}
+
+	return decoder->max_luminance;
+}
+
+// Hand a frame to OBS with the planes as decoded and the stream's colour
+// description (BT.2020 with PQ or HLG for HDR). OBS copies it into its own
+// frame cache and converts it on the GPU, nothing is converted on this
+// thread.
+static bool output_async_frame(struct video_decoder *decoder,
+			       const AVFrame *frame)
+{
+	struct obs_source_frame output = {0};
+
+	output.format = obs_format(frame->format);
+	if (output.format == VIDEO_FORMAT_NONE) {
+		hlog(LOG_ERROR, "Cannot pass %s frames to OBS",
+		     av_get_pix_fmt_name(frame->format));
+		return false;
+	}
+
+	output.width = (uint32_t)frame->width;
+	output.height = (uint32_t)frame->height;
+	output.timestamp = os_gettime_ns();
+	for (int i = 0; i < 4 && frame->data[i]; i++) {
+		output.data[i] = frame->data[i];
+		output.linesize[i] = (uint32_t)frame->linesize[i];
+	}
+
+	enum video_colorspace space = VIDEO_CS_709;
+	const char *dynamic_range = "SDR";
+	output.trc = VIDEO_TRC_DEFAULT;
+	if (frame->color_trc == AVCOL_TRC_SMPTE2084) {
+		space = VIDEO_CS_2100_PQ;
+		output.trc = VIDEO_TRC_PQ;
+		dynamic_range = "HDR, PQ";
+	} else if (frame->color_trc == AVCOL_TRC_ARIB_STD_B67) {
+		space = VIDEO_CS_2100_HLG;
+		output.trc = VIDEO_TRC_HLG;
+		dynamic_range = "HDR, HLG";
+	} else if (frame->colorspace == AVCOL_SPC_BT470BG ||
+		   frame->colorspace == AVCOL_SPC_SMPTE170M) {
+		space = VIDEO_CS_601;
+	}
+
+	output.full_range = is_full_range(frame);
+	video_format_get_parameters_for_format(
+		space,
+		output.full_range ? VIDEO_RANGE_FULL : VIDEO_RANGE_PARTIAL,
+		output.format, output.color_matrix, output.color_range_min,
+		output.color_range_max);
+	output.max_luminance = max_luminance(decoder, frame);
+
+	if ((int)output.format != decoder->output_format)
+		hlog(LOG_INFO, "Passing %s frames to OBS (%s)",
+		     get_video_format_name(output.format), dynamic_range);
+	decoder->output_format = (int)output.format;
+
+	obs_source_output_video(decoder->source->source, &output);
+	return true;
+}
+
+static enum frame_export_format export_format(int format)
+{
+	switch (format) {
+	case AV_PIX_FMT_YUV420P:
+	case AV_PIX_FMT_YUVJ420P:
+		return FRAME_EXPORT_I420;
+	case AV_PIX_FMT_YUV420P10LE:
+		return FRAME_EXPORT_I010;
+	case AV_PIX_FMT_P010LE:
+		return FRAME_EXPORT_P010;
+	default:
+		return FRAME_EXPORT_NONE;
+	}
+}
+
+// Publish the planes as decoded. The copy into the shared mapping never
+// waits for a reader.
+static void export_frame(struct video_decoder *decoder, const AVFrame *frame,
+			 bool corrupt)
+{
+	struct frame_export_picture picture = {
+		.format = export_format(frame->format),
+		.width = (uint32_t)frame->width,
+		.height = (uint32_t)frame->height,
+		.full_range = is_full_range(frame),
+		.color_primaries = (uint8_t)frame->color_primaries,
+		.color_trc = (uint8_t)frame->color_trc,
+		.color_matrix = (uint8_t)frame->colorspace,
+		.corrupt = corrupt,
+		.received_ns = decoder->last_packet_ns,
+	};
+
+	for (int i = 0; i < FRAME_EXPORT_PLANES; i++) {
+		picture.data[i] = frame->data[i];
+		picture.linesize[i] = frame->linesize[i];
+	}
+
+	frame_export_publish(decoder->export, &picture);
+}
+
+// Receive a decoded frame, if one is ready, and hand it to OBS
+static bool output_frame(struct video_decoder *decoder)
+{
+	AVCodecContext *codec_ctx = decoder->codec_ctx;
+	AVFrame *frame = decoder->frame;
+
 	// Receive decoded frame
-	ret = avcodec_receive_frame(codec_ctx, frame);
+	int ret = avcodec_receive_frame(codec_ctx, frame);
 	if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF) {
 		return true; // Need more data
 	} else if (ret < 0) {
-		mlog(LOG_ERROR, "Error receiving frame from decoder: %d", ret);
+		hlog(LOG_ERROR, "Error receiving frame from decoder: %d", ret);
 		return false;
 	}
 
-	// Convert frame to RGBA for OBS
-	struct SwsContext *sws_ctx = decoder->sws_ctx;
-	if (!sws_ctx) {
-		sws_ctx = sws_getContext(
-			frame->width, frame->height, codec_ctx->pix_fmt,
-			decoder->width, decoder->height, AV_PIX_FMT_RGBA,
-			SWS_BILINEAR, NULL, NULL, NULL);
-		if (!sws_ctx) {
-			mlog(LOG_ERROR, "Failed to create swscale context");
-			return false;
-		}
-		decoder->sws_ctx = sws_ctx;
+	struct moonlight_source *source = decoder->source;
+
+	bool corrupt = decoder->frame_corrupt ||
+		       (frame->flags & AV_FRAME_FLAG_CORRUPT) ||
+		       frame->decode_error_flags;
+	decoder->frame_corrupt = false;
+
+	// Local consumers get every decoded frame, on program or not
+	if (decoder->export)
+		export_frame(decoder, frame, corrupt);
+
+	// Off program the frame only had to update the reference state
+	if (!decoder->active) {
+		pthread_mutex_lock(&source->mutex);
+		decoder->frames_inactive++;
+		if (corrupt)
+			decoder->frames_corrupt++;
+		pthread_mutex_unlock(&source->mutex);
+		return true;
 	}
 
-	// Scale and convert to RGBA
-	uint8_t *dst_data[4] = {decoder->output_data, NULL, NULL, NULL};
-	int dst_linesize[4] = {decoder->output_linesize, 0, 0, 0};
+	// Keep the last good frame on screen until the picture is clean
+	if (corrupt && !decoder->show_concealed) {
+		pthread_mutex_lock(&source->mutex);
+		decoder->frames_corrupt++;
+		decoder->frames_held++;
+		pthread_mutex_unlock(&source->mutex);
+		return true;
+	}
 
-	sws_scale(sws_ctx, (const uint8_t *const *)frame->data,
-		  frame->linesize, 0, frame->height, dst_data, dst_linesize);
+	if (!output_async_frame(decoder, frame))
+		return false;
 
-	// Update OBS texture
-	struct moonlight_source *source = decoder->source;
 	pthread_mutex_lock(&source->mutex);
 
-	obs_enter_graphics();
+	uint64_t now = os_gettime_ns();
+	uint64_t latency = now - decoder->last_packet_ns;
+	decoder->frames_decoded++;
+	decoder->total_latency_ns += latency;
+	if (latency > decoder->max_latency_ns)
+		decoder->max_latency_ns = latency;
 
-	if (!source->texture) {
-		source->texture = gs_texture_create(
-			decoder->width, decoder->height, GS_RGBA, 1, NULL,
-			GS_DYNAMIC);
-	}
-
-	if (source->texture) {
-		gs_texture_set_image(source->texture, decoder->output_data,
-				     decoder->output_linesize, false);
-	}
-
-	obs_leave_graphics();
+	if (corrupt)
+		decoder->frames_corrupt++;
+	record_output(decoder, now);
 
 	pthread_mutex_unlock(&source->mutex);
 
 	return true;
 }
+
+bool video_decoder_decode(struct video_decoder *decoder, uint8_t *data,
+			  size_t size, bool corrupt)
+{
+	if (!decoder || !data || size == 0)
+		return false;
+
+	decoder->last_packet_ns = os_gettime_ns();
+
+	bool sent = send_packet(decoder, data, size, corrupt);
+
+	// Drain even after an error so the next picture is not held back
+	return output_frame(decoder) && sent;
+}
+
+bool video_decoder_decode_slice(struct video_decoder *decoder, uint8_t *data,
+				size_t size, bool end_of_frame, bool corrupt)
+{
+	if (!decoder || !data || size == 0)
+		return false;
+
+	if (end_of_frame)
+		decoder->last_packet_ns = os_gettime_ns();
+
+	bool sent = send_packet(decoder, data, size, corrupt);
+
+	return output_frame(decoder) && sent;
+}
@@ -3,32 +3,123 @@
 #include <stdint.h>
 #include <stddef.h>
 #include <stdbool.h>
+#include "moonlight-client.h"
 
 // Forward declarations
 struct moonlight_source;
+struct frame_pool;
+struct frame_export;
 
 // Video decoder structure
 struct video_decoder {
 	struct moonlight_source *source;
 	
 	// Decoder context
+	enum moonlight_video_codec codec;
 	void *codec_ctx;
 	void *frame;
-	void *sws_ctx;
 	
 	// Stream info
 	int width;
 	int height;
 	
-	// Output buffer
-	uint8_t *output_data;
-	int output_linesize;
+	// Frames and packets come from the pool, which holds the source's
+	// memory budget
+	struct frame_pool *pool;
+	size_t memory_budget;
+	bool hugepages;
+
+	// Decoded frames published to local processes, if the source asks
+	// for it (see frame-export.h)
+	struct frame_export *export;
+
+	// Frames go to OBS as async video in their decoded format (I420,
+	// I010, P010...), this is the enum video_format of the last one. The
+	// peak brightness comes with IDR frames and is kept for the rest.
+	int output_format;
+	uint16_t max_luminance;
+
+	// Feed slices to the decoder as they arrive, as requested by the
+	// source. Only applied to H.264 (see video_decoder_slice_mode).
+	bool slice_decode;
+
+	// Time from the last packet of a frame to the decoded frame
+	uint64_t last_packet_ns;
+	uint64_t frames_decoded;
+	uint64_t total_latency_ns;
+	uint64_t max_latency_ns;
+
+	// Error concealment: show damaged frames as concealed by the decoder,
+	// or hold the last good frame until the picture is clean again
+	bool show_concealed;
+	bool frame_corrupt;
+	uint64_t frames_corrupt;
+	uint64_t frames_held;
+	uint64_t decode_errors;
+
+	// Periods without a new picture on screen
+	uint64_t last_output_ns;
+	uint64_t freezes;
+	uint64_t total_freeze_ns;
+	uint64_t max_freeze_ns;
+
+	// Off program the decoder only keeps its reference state current:
+	// frames are decoded but not passed to OBS, and optionally only
+	// reference frames are decoded at all
+	bool active;
+	bool reference_only;
+	uint64_t frames_inactive;
 };
 
 // Decoder lifecycle
 struct video_decoder *video_decoder_create(struct moonlight_source *source);
 void video_decoder_destroy(struct video_decoder *decoder);
 
-// Decode a video frame
+// Whether a stream in the codec is decoded slice by slice. Slice decode is
+// only supported for H.264; HEVC and AV1 are submitted as whole frames.
+bool video_decoder_slice_mode(bool slice_decode,
+			      enum moonlight_video_codec codec);
+
+// Open a decoder that is not bound to a source yet (see decoder-pool.h)
+struct video_decoder *video_decoder_open(enum moonlight_video_codec codec,
+					 int width, int height,
+					 bool slice_decode);
+
+// Bind a decoder to a source, taking the source's stream size, memory
+// budget, frame export and concealment policy
+void video_decoder_attach(struct video_decoder *decoder,
+			  struct moonlight_source *source);
+
+// Unbind a decoder from its source: flushes the codec, closes the frame
+// export and clears the statistics, so it can be used for another stream
+void video_decoder_detach(struct video_decoder *decoder);
+
+// Prepare for a new stream: applies the concealment policy and restarts
+// freeze tracking
+void video_decoder_start(struct video_decoder *decoder, bool show_concealed);
+
+// Follow the source's program state. An inactive decoder does not pass its
+// frames to OBS, and with reference_only also skips non-reference frames.
+// The next frame after activation is shown without waiting for an IDR.
+void video_decoder_set_active(struct video_decoder *decoder, bool active,
+			      bool reference_only);
+
+// Switch to the codec negotiated with the host. The codec context is only
+// replaced if the codec changes.
+bool video_decoder_set_codec(struct video_decoder *decoder,
+			     enum moonlight_video_codec codec);
+
+// Change the stream size of a running decoder. The codec context is kept,
+// a new resolution arrives in-band with the next IDR frame.
+void video_decoder_set_size(struct video_decoder *decoder, int width,
+			    int height);
+
+// Decode a video frame. corrupt marks a frame with missing data or
+// references, which the decoder conceals.
 bool video_decoder_decode(struct video_decoder *decoder, uint8_t *data,
-			  size_t size);
+			  size_t size, bool corrupt);
+
+// Decode one slice of a frame (slice decode mode only). The frame is output
+// as soon as its last slice has been decoded.
+bool video_decoder_decode_slice(struct video_decoder *decoder, uint8_t *data,
+				size_t size, bool end_of_frame, bool corrupt);
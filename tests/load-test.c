@@ -0,0 +1,794 @@
+/*
+ * Multi-session load test for Moonlight OBS Plugin
+ * Runs N simulated sessions in one process against loopback senders. Each
+ * session goes through the real client, decoder and output code with the
+ * libobs calls stubbed, and the report shows how far one machine scales.
+ *
+ * Usage: moonlight-load-test [options]
+ *   -n <sessions>   maximum number of sessions (default 8)
+ *   -w <width>      stream width (default 1920)
+ *   -h <height>     stream height (default 1080)
+ *   -f <fps>        stream frame rate (default 60)
+ *   -b <kbps>       bitrate of the synthetic stream (default 20000)
+ *   -d <seconds>    duration of each step (default 10)
+ *   -i <file>       Annex-B H.264 file to send instead of a synthetic stream
+ *   -o              sessions are off program: decoded, not passed to OBS
+ *   -m <MB>         decoder memory budget per session (default: auto)
+ *   -H              back decoder buffers with 2 MB pages
+ *   -v              verbose plugin logging
+ */
+
+#include "obs-stubs.h"
+#include "moonlight-client.h"
+#include "moonlight-source.h"
+#include "video-decoder.h"
+#include "frame-pool.h"
+#include "reference-tracker.h"
+#include <libavcodec/avcodec.h>
+#include <libavutil/opt.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define PACKET_PAYLOAD 1392
+#define SOCKET_BUFFER_SIZE (8 * 1024 * 1024)
+#define SYNTHETIC_SECONDS 5
+#define MAX_DROP_RATE 0.01
+
+struct packet_header {
+	uint32_t frame_number;
+	uint32_t flags;
+	uint32_t frame_size;
+	uint16_t index;
+	uint16_t count;
+	uint64_t send_ns;
+};
+
+struct encoded_frame {
+	uint8_t *data;
+	size_t size;
+	bool idr;
+};
+
+struct stream {
+	struct encoded_frame *frames;
+	size_t count;
+	size_t max_size;
+};
+
+struct options {
+	int max_sessions;
+	int width;
+	int height;
+	int fps;
+	int bitrate;
+	int duration;
+	const char *input;
+	bool inactive;
+	int memory_budget;
+	bool hugepages;
+	bool verbose;
+};
+
+struct session {
+	struct moonlight_source source;
+	struct moonlight_client *client;
+
+	int recv_fd;
+	int send_fd;
+	pthread_t sender;
+	pthread_t receiver;
+	atomic_bool idr_requested;
+
+	// Frame being reassembled
+	uint8_t *frame_data;
+	uint32_t frame_number;
+	uint16_t packets_received;
+	bool frame_active;
+
+	// Results
+	uint64_t *latencies;
+	size_t latency_count;
+	size_t latency_capacity;
+	uint64_t frames_sent;
+	uint64_t control_requests;
+};
+
+struct step_result {
+	int sessions;
+	double cpu_cores;
+	double p50_ms;
+	double p99_ms;
+	double drop_rate;
+	uint64_t frames_sent;
+	uint64_t frames_decoded;
+	uint64_t memory_peak;
+	uint64_t memory_budget;
+	uint64_t memory_refused;
+	struct obs_stub_counters counters;
+	double wall_s;
+	bool sustainable;
+};
+
+static struct options opts = {
+	.max_sessions = 8,
+	.width = 1920,
+	.height = 1080,
+	.fps = 60,
+	.bitrate = 20000,
+	.duration = 10,
+};
+
+static struct stream stream;
+static atomic_bool stopping;
+
+/* ------------------------------------------------------------------------- */
+/* Input stream */
+
+static void add_frame(const uint8_t *data, size_t size, bool idr)
+{
+	stream.frames = realloc(stream.frames,
+				(stream.count + 1) * sizeof(*stream.frames));
+
+	struct encoded_frame *frame = &stream.frames[stream.count++];
+	frame->data = malloc(size);
+	frame->size = size;
+	frame->idr = idr;
+	memcpy(frame->data, data, size);
+
+	if (size > stream.max_size)
+		stream.max_size = size;
+}
+
+static bool load_input(const char *path)
+{
+	FILE *file = fopen(path, "rb");
+	if (!file) {
+		fprintf(stderr, "Cannot open %s\n", path);
+		return false;
+	}
+
+	AVCodecParserContext *parser = av_parser_init(AV_CODEC_ID_H264);
+	const AVCodec *codec = avcodec_find_decoder(AV_CODEC_ID_H264);
+	AVCodecContext *ctx = avcodec_alloc_context3(codec);
+
+	uint8_t buffer[65536 + AV_INPUT_BUFFER_PADDING_SIZE] = {0};
+	bool eof = false;
+
+	while (!eof) {
+		size_t bytes = fread(buffer, 1, 65536, file);
+		eof = bytes == 0;
+
+		uint8_t *data = buffer;
+		int remaining = (int)bytes;
+		do {
+			uint8_t *out;
+			int out_size;
+			int used = av_parser_parse2(parser, ctx, &out,
+						    &out_size, data, remaining,
+						    AV_NOPTS_VALUE,
+						    AV_NOPTS_VALUE, 0);
+			data += used;
+			remaining -= used;
+
+			if (out_size)
+				add_frame(out, out_size,
+					  parser->key_frame == 1);
+		} while (remaining > 0);
+	}
+
+	av_parser_close(parser);
+	avcodec_free_context(&ctx);
+	fclose(file);
+
+	if (!stream.count || !stream.frames[0].idr) {
+		fprintf(stderr, "%s must start with an IDR frame\n", path);
+		return false;
+	}
+
+	return true;
+}
+
+// Moving gradient with some noise so the decoder has real work to do
+static void fill_pattern(AVFrame *frame, int index)
+{
+	for (int y = 0; y < frame->height; y++) {
+		uint8_t *row = frame->data[0] + y * frame->linesize[0];
+		for (int x = 0; x < frame->width; x++)
+			row[x] = (uint8_t)(x + y + index * 3 +
+					   ((x * 7919 + y * 104729 + index) &
+					    15));
+	}
+
+	for (int plane = 1; plane < 3; plane++) {
+		for (int y = 0; y < frame->height / 2; y++) {
+			uint8_t *row = frame->data[plane] +
+				       y * frame->linesize[plane];
+			for (int x = 0; x < frame->width / 2; x++)
+				row[x] = (uint8_t)(128 + ((x - y + index) &
+							  63));
+		}
+	}
+}
+
+static bool encode_synthetic(void)
+{
+	const AVCodec *codec = avcodec_find_encoder_by_name("libx264");
+	if (!codec)
+		codec = avcodec_find_encoder(AV_CODEC_ID_H264);
+	if (!codec) {
+		fprintf(stderr, "No H.264 encoder available, use -i <file>\n");
+		return false;
+	}
+
+	int frame_count = opts.fps * SYNTHETIC_SECONDS;
+
+	AVCodecContext *ctx = avcodec_alloc_context3(codec);
+	ctx->width = opts.width;
+	ctx->height = opts.height;
+	ctx->time_base = (AVRational){1, opts.fps};
+	ctx->framerate = (AVRational){opts.fps, 1};
+	ctx->pix_fmt = AV_PIX_FMT_YUV420P;
+	ctx->bit_rate = (int64_t)opts.bitrate * 1000;
+	ctx->gop_size = frame_count;
+	ctx->max_b_frames = 0;
+	av_opt_set(ctx->priv_data, "preset", "ultrafast", 0);
+	av_opt_set(ctx->priv_data, "tune", "zerolatency", 0);
+
+	if (avcodec_open2(ctx, codec, NULL) < 0) {
+		fprintf(stderr, "Failed to open %s\n", codec->name);
+		avcodec_free_context(&ctx);
+		return false;
+	}
+
+	AVFrame *frame = av_frame_alloc();
+	frame->width = opts.width;
+	frame->height = opts.height;
+	frame->format = AV_PIX_FMT_YUV420P;
+	av_frame_get_buffer(frame, 0);
+
+	AVPacket *packet = av_packet_alloc();
+
+	printf("Encoding %d synthetic frames (%dx%d, %s)...\n", frame_count,
+	       opts.width, opts.height, codec->name);
+
+	for (int i = 0; i <= frame_count; i++) {
+		if (i < frame_count) {
+			av_frame_make_writable(frame);
+			fill_pattern(frame, i);
+			frame->pts = i;
+			avcodec_send_frame(ctx, frame);
+		} else {
+			avcodec_send_frame(ctx, NULL);
+		}
+
+		while (avcodec_receive_packet(ctx, packet) == 0) {
+			add_frame(packet->data, packet->size,
+				  packet->flags & AV_PKT_FLAG_KEY);
+			av_packet_unref(packet);
+		}
+	}
+
+	av_packet_free(&packet);
+	av_frame_free(&frame);
+	avcodec_free_context(&ctx);
+	return stream.count > 0;
+}
+
+/* ------------------------------------------------------------------------- */
+/* Loopback sender (stand-in host) */
+
+static void sleep_until(uint64_t target_ns)
+{
+	uint64_t now = os_gettime_ns();
+	if (target_ns <= now)
+		return;
+
+	uint64_t wait = target_ns - now;
+	struct timespec ts = {
+		.tv_sec = (time_t)(wait / 1000000000ULL),
+		.tv_nsec = (long)(wait % 1000000000ULL),
+	};
+	nanosleep(&ts, NULL);
+}
+
+static void send_frame(struct session *session, uint32_t frame_number,
+		       const struct encoded_frame *frame)
+{
+	uint8_t packet[sizeof(struct packet_header) + PACKET_PAYLOAD];
+	struct packet_header header = {
+		.frame_number = frame_number,
+		.flags = frame->idr ? MOONLIGHT_FRAME_IDR : 0,
+		.frame_size = (uint32_t)frame->size,
+		.count = (uint16_t)((frame->size + PACKET_PAYLOAD - 1) /
+				    PACKET_PAYLOAD),
+		.send_ns = os_gettime_ns(),
+	};
+
+	for (uint16_t i = 0; i < header.count; i++) {
+		size_t offset = (size_t)i * PACKET_PAYLOAD;
+		size_t size = frame->size - offset;
+		if (size > PACKET_PAYLOAD)
+			size = PACKET_PAYLOAD;
+
+		header.index = i;
+		memcpy(packet, &header, sizeof(header));
+		memcpy(packet + sizeof(header), frame->data + offset, size);
+		send(session->send_fd, packet, sizeof(header) + size, 0);
+	}
+}
+
+static void *sender_thread(void *arg)
+{
+	struct session *session = arg;
+	const uint64_t interval = 1000000000ULL / (uint64_t)opts.fps;
+	uint64_t next = os_gettime_ns();
+	uint32_t frame_number = 0;
+	size_t index = 0;
+
+	while (!atomic_load(&stopping)) {
+		// The stream is pre-encoded, so recover by restarting at its
+		// IDR frame
+		if (atomic_exchange(&session->idr_requested, false))
+			index = 0;
+
+		send_frame(session, frame_number++, &stream.frames[index]);
+		session->frames_sent++;
+		index = (index + 1) % stream.count;
+
+		next += interval;
+		sleep_until(next);
+	}
+
+	return NULL;
+}
+
+static bool send_control(void *param, uint16_t type, const void *payload,
+			 size_t size)
+{
+	UNUSED_PARAMETER(payload);
+	UNUSED_PARAMETER(size);
+
+	struct session *session = param;
+	session->control_requests++;
+
+	if (type == CONTROL_TYPE_REQUEST_IDR_FRAME)
+		atomic_store(&session->idr_requested, true);
+
+	return true;
+}
+
+/* ------------------------------------------------------------------------- */
+/* Receiver */
+
+static void record_latency(struct session *session, uint64_t latency)
+{
+	if (session->latency_count == session->latency_capacity) {
+		session->latency_capacity = session->latency_capacity * 2 + 1024;
+		session->latencies =
+			realloc(session->latencies,
+				session->latency_capacity * sizeof(uint64_t));
+	}
+
+	session->latencies[session->latency_count++] = latency;
+}
+
+static void receive_packet(struct session *session, const uint8_t *packet,
+			   size_t size)
+{
+	struct packet_header header;
+	if (size < sizeof(header))
+		return;
+
+	memcpy(&header, packet, sizeof(header));
+
+	// A new frame abandons whatever was left of the previous one
+	if (!session->frame_active ||
+	    header.frame_number != session->frame_number) {
+		session->frame_active = true;
+		session->frame_number = header.frame_number;
+		session->packets_received = 0;
+	}
+
+	size_t offset = (size_t)header.index * PACKET_PAYLOAD;
+	size_t payload = size - sizeof(header);
+	if (offset + payload > stream.max_size)
+		return;
+
+	memcpy(session->frame_data + offset, packet + sizeof(header), payload);
+
+	if (++session->packets_received < header.count)
+		return;
+
+	session->frame_active = false;
+
+	// Only frames that made it through the decoder count towards latency
+	struct video_decoder *video_dec = session->source.video_dec;
+	uint64_t decoded = video_dec->frames_decoded +
+			   video_dec->frames_inactive;
+
+	moonlight_client_video_frame(session->client, header.frame_number,
+				     header.flags, session->frame_data,
+				     header.frame_size);
+
+	if (video_dec->frames_decoded + video_dec->frames_inactive != decoded)
+		record_latency(session, os_gettime_ns() - header.send_ns);
+}
+
+static void *receiver_thread(void *arg)
+{
+	struct session *session = arg;
+	uint8_t packet[2048];
+
+	while (!atomic_load(&stopping)) {
+		struct pollfd pfd = {.fd = session->recv_fd, .events = POLLIN};
+		if (poll(&pfd, 1, 100) <= 0)
+			continue;
+
+		ssize_t size;
+		while ((size = recv(session->recv_fd, packet, sizeof(packet),
+				    MSG_DONTWAIT)) > 0)
+			receive_packet(session, packet, (size_t)size);
+	}
+
+	return NULL;
+}
+
+/* ------------------------------------------------------------------------- */
+/* Sessions */
+
+static bool open_sockets(struct session *session)
+{
+	struct sockaddr_in addr = {
+		.sin_family = AF_INET,
+		.sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+	};
+	socklen_t len = sizeof(addr);
+	int buffer_size = SOCKET_BUFFER_SIZE;
+
+	session->recv_fd = socket(AF_INET, SOCK_DGRAM, 0);
+	session->send_fd = socket(AF_INET, SOCK_DGRAM, 0);
+	if (session->recv_fd < 0 || session->send_fd < 0)
+		return false;
+
+	setsockopt(session->recv_fd, SOL_SOCKET, SO_RCVBUF, &buffer_size,
+		   sizeof(buffer_size));
+	setsockopt(session->send_fd, SOL_SOCKET, SO_SNDBUF, &buffer_size,
+		   sizeof(buffer_size));
+
+	if (bind(session->recv_fd, (struct sockaddr *)&addr, sizeof(addr)) <
+		    0 ||
+	    getsockname(session->recv_fd, (struct sockaddr *)&addr, &len) < 0 ||
+	    connect(session->send_fd, (struct sockaddr *)&addr, len) < 0)
+		return false;
+
+	return true;
+}
+
+static bool session_init(struct session *session)
+{
+	memset(session, 0, sizeof(*session));
+
+	struct moonlight_source *source = &session->source;
+	source->width = opts.width;
+	source->height = opts.height;
+	source->fps = opts.fps;
+	source->bitrate = opts.bitrate;
+	source->memory_budget = opts.memory_budget;
+	source->hugepages = opts.hugepages;
+	pthread_mutex_init(&source->mutex, NULL);
+
+	if (!open_sockets(session)) {
+		fprintf(stderr, "Failed to open loopback sockets: %s\n",
+			strerror(errno));
+		return false;
+	}
+
+	source->video_dec = video_decoder_create(source);
+	source->client = moonlight_client_create(source);
+	if (!source->video_dec || !source->client)
+		return false;
+
+	video_decoder_set_active(source->video_dec, !opts.inactive, true);
+
+	session->client = source->client;
+	session->client->send_control = send_control;
+	session->client->send_control_param = session;
+	session->frame_data = calloc(1, stream.max_size +
+						AV_INPUT_BUFFER_PADDING_SIZE);
+
+	// The client is driven directly, without connecting to a host
+	return session->frame_data != NULL;
+}
+
+static void session_free(struct session *session)
+{
+	struct moonlight_source *source = &session->source;
+
+	if (session->client)
+		moonlight_client_destroy(session->client);
+
+	video_decoder_destroy(source->video_dec);
+	pthread_mutex_destroy(&source->mutex);
+
+	if (session->recv_fd > 0)
+		close(session->recv_fd);
+	if (session->send_fd > 0)
+		close(session->send_fd);
+
+	free(session->frame_data);
+	free(session->latencies);
+}
+
+/* ------------------------------------------------------------------------- */
+/* Measurement */
+
+static int compare_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a;
+	uint64_t y = *(const uint64_t *)b;
+	return (x > y) - (x < y);
+}
+
+static double cpu_seconds(void)
+{
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	return (double)usage.ru_utime.tv_sec + usage.ru_utime.tv_usec * 1e-6 +
+	       (double)usage.ru_stime.tv_sec + usage.ru_stime.tv_usec * 1e-6;
+}
+
+static bool run_step(int count, struct step_result *result)
+{
+	struct session *sessions = calloc((size_t)count, sizeof(*sessions));
+	bool ok = true;
+
+	memset(result, 0, sizeof(*result));
+	result->sessions = count;
+
+	for (int i = 0; i < count && ok; i++)
+		ok = session_init(&sessions[i]);
+
+	if (!ok) {
+		fprintf(stderr, "Failed to set up %d sessions\n", count);
+		goto cleanup;
+	}
+
+	atomic_store(&stopping, false);
+	obs_stubs_reset_counters();
+
+	double cpu_start = cpu_seconds();
+	uint64_t wall_start = os_gettime_ns();
+
+	for (int i = 0; i < count; i++) {
+		pthread_create(&sessions[i].receiver, NULL, receiver_thread,
+			       &sessions[i]);
+		pthread_create(&sessions[i].sender, NULL, sender_thread,
+			       &sessions[i]);
+	}
+
+	sleep_until(wall_start + (uint64_t)opts.duration * 1000000000ULL);
+	atomic_store(&stopping, true);
+
+	for (int i = 0; i < count; i++) {
+		pthread_join(sessions[i].sender, NULL);
+		pthread_join(sessions[i].receiver, NULL);
+	}
+
+	result->wall_s = (double)(os_gettime_ns() - wall_start) * 1e-9;
+	result->cpu_cores = (cpu_seconds() - cpu_start) / result->wall_s;
+	obs_stubs_get_counters(&result->counters);
+
+	// Merge per-session results
+	size_t total_latencies = 0;
+	for (int i = 0; i < count; i++)
+		total_latencies += sessions[i].latency_count;
+
+	uint64_t *latencies = malloc((total_latencies + 1) * sizeof(uint64_t));
+	size_t n = 0;
+
+	for (int i = 0; i < count; i++) {
+		struct moonlight_client_stats stats;
+		moonlight_client_get_stats(sessions[i].client, &stats);
+
+		result->frames_sent += sessions[i].frames_sent;
+		result->frames_decoded += stats.frames_decoded +
+					  stats.frames_inactive;
+		if (stats.memory_peak > result->memory_peak)
+			result->memory_peak = stats.memory_peak;
+		result->memory_budget = stats.memory_budget;
+		result->memory_refused += stats.memory_refused;
+
+		memcpy(latencies + n, sessions[i].latencies,
+		       sessions[i].latency_count * sizeof(uint64_t));
+		n += sessions[i].latency_count;
+	}
+
+	if (n) {
+		qsort(latencies, n, sizeof(uint64_t), compare_u64);
+		result->p50_ms = latencies[n / 2] * 1e-6;
+		result->p99_ms = latencies[(n * 99) / 100] * 1e-6;
+	}
+	free(latencies);
+
+	if (result->frames_sent)
+		result->drop_rate =
+			1.0 - (double)result->frames_decoded /
+				      (double)result->frames_sent;
+	if (result->drop_rate < 0.0)
+		result->drop_rate = 0.0;
+
+	double interval_ms = 1000.0 / opts.fps;
+	result->sustainable = n > 0 && result->p99_ms < interval_ms &&
+			      result->drop_rate < MAX_DROP_RATE;
+
+cleanup:
+	for (int i = 0; i < count; i++)
+		session_free(&sessions[i]);
+	free(sessions);
+	return ok;
+}
+
+static void print_header(void)
+{
+	printf("\n%8s %8s %10s %8s %8s %7s %11s\n", "sessions", "cores",
+	       "sess/core", "p50 ms", "p99 ms", "drop %", "allocs/frm");
+}
+
+static void print_result(const struct step_result *r)
+{
+	const struct obs_stub_counters *c = &r->counters;
+	uint64_t frames = r->frames_decoded ? r->frames_decoded : 1;
+	double per_core = r->cpu_cores > 0.0 ? r->sessions / r->cpu_cores
+					     : 0.0;
+
+	printf("%8d %8.2f %10.2f %8.2f %8.2f %7.2f %11.2f %s\n", r->sessions,
+	       r->cpu_cores, per_core, r->p50_ms, r->p99_ms,
+	       r->drop_rate * 100.0, (double)c->allocs / (double)frames,
+	       r->sustainable ? "" : "(overloaded)");
+}
+
+static void print_summary(const struct step_result *best,
+			  const struct step_result *last)
+{
+	long cores = sysconf(_SC_NPROCESSORS_ONLN);
+
+	printf("\nMachine: %ld cores, stream %dx%d@%d, %d Kbps%s\n", cores,
+	       opts.width, opts.height, opts.fps, opts.bitrate,
+	       opts.inactive ? ", off program" : "");
+
+	if (!best) {
+		printf("No sustainable configuration, even one session "
+		       "misses the frame deadline\n");
+	} else {
+		double per_core = best->cpu_cores > 0.0
+					  ? best->sessions / best->cpu_cores
+					  : 0.0;
+		printf("Sustainable: %d sessions, %.2f sessions per core "
+		       "(p99 %.2f ms)\n",
+		       best->sessions, per_core, best->p99_ms);
+	}
+
+	// Point at shared resources that stop the pipeline from scaling
+	const struct obs_stub_counters *c = &last->counters;
+	uint64_t frames = last->frames_decoded ? last->frames_decoded : 1;
+
+	printf("\nContention at %d sessions:\n", last->sessions);
+	printf("  output: %.1f MiB/s copied into OBS frame caches\n",
+	       (double)c->video_frame_bytes / last->wall_s /
+		       (1024.0 * 1024.0));
+	printf("  allocator: %.2f bmalloc calls and %.1f KiB per decoded "
+	       "frame\n",
+	       (double)c->allocs / (double)frames,
+	       (double)c->alloc_bytes / (double)frames / 1024.0);
+	printf("  logging: %llu log lines\n",
+	       (unsigned long long)c->log_lines);
+	printf("  decoder memory: peak %.1f MiB per session of a %llu MB "
+	       "budget, %llu buffers refused\n",
+	       (double)last->memory_peak / (1024.0 * 1024.0),
+	       (unsigned long long)(last->memory_budget / (1024 * 1024)),
+	       (unsigned long long)last->memory_refused);
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr,
+		"Usage: %s [-n sessions] [-w width] [-h height] [-f fps] "
+		"[-b kbps] [-d seconds] [-i file.h264] [-o] [-m MB] [-H] "
+		"[-v]\n",
+		name);
+}
+
+int main(int argc, char **argv)
+{
+	int opt;
+	while ((opt = getopt(argc, argv, "n:w:h:f:b:d:i:om:Hv")) != -1) {
+		switch (opt) {
+		case 'n':
+			opts.max_sessions = atoi(optarg);
+			break;
+		case 'w':
+			opts.width = atoi(optarg);
+			break;
+		case 'h':
+			opts.height = atoi(optarg);
+			break;
+		case 'f':
+			opts.fps = atoi(optarg);
+			break;
+		case 'b':
+			opts.bitrate = atoi(optarg);
+			break;
+		case 'd':
+			opts.duration = atoi(optarg);
+			break;
+		case 'i':
+			opts.input = optarg;
+			break;
+		case 'o':
+			opts.inactive = true;
+			break;
+		case 'm':
+			opts.memory_budget = atoi(optarg);
+			break;
+		case 'H':
+			opts.hugepages = true;
+			break;
+		case 'v':
+			opts.verbose = true;
+			break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if (opts.max_sessions < 1 || opts.fps < 1 || opts.duration < 1) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	obs_stubs_set_verbose(opts.verbose);
+
+	if (opts.input ? !load_input(opts.input) : !encode_synthetic())
+		return 1;
+
+	printf("Stream: %zu frames, largest %zu bytes\n", stream.count,
+	       stream.max_size);
+	print_header();
+
+	// Double the session count until the machine falls over
+	struct step_result result, best = {0}, last = {0};
+	bool have_best = false;
+
+	for (int count = 1;; count *= 2) {
+		if (count > opts.max_sessions)
+			count = opts.max_sessions;
+
+		if (!run_step(count, &result))
+			return 1;
+
+		print_result(&result);
+		last = result;
+		if (result.sustainable) {
+			best = result;
+			have_best = true;
+		}
+
+		if (count == opts.max_sessions || !result.sustainable)
+			break;
+	}
+
+	print_summary(have_best ? &best : NULL, &last);
+	return 0;
+}
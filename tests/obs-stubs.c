@@ -0,0 +1,201 @@
+/*
+ * Stubbed libobs calls for running the plugin pipeline outside of OBS
+ * Output to OBS is counted, with the format of the last video frame
+ */
+
+#include "obs-stubs.h"
+#include <obs-module.h>
+#include <util/bmem.h>
+#include <util/platform.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static atomic_bool verbose;
+
+static atomic_uint_fast64_t allocs;
+static atomic_uint_fast64_t frees;
+static atomic_uint_fast64_t alloc_bytes;
+static atomic_uint_fast64_t video_frames;
+static atomic_uint_fast64_t video_frame_bytes;
+static atomic_int last_video_format;
+static atomic_uint_fast64_t audio_frames;
+static atomic_uint_fast64_t log_lines;
+
+static obs_stub_log_hook_t log_hook;
+static void *log_hook_param;
+
+void obs_stubs_set_verbose(bool enable)
+{
+	atomic_store(&verbose, enable);
+}
+
+// Set before the threads that log start
+void obs_stubs_set_log_hook(obs_stub_log_hook_t hook, void *param)
+{
+	log_hook = hook;
+	log_hook_param = param;
+}
+
+void obs_stubs_get_counters(struct obs_stub_counters *counters)
+{
+	counters->allocs = atomic_load(&allocs);
+	counters->frees = atomic_load(&frees);
+	counters->alloc_bytes = atomic_load(&alloc_bytes);
+	counters->video_frames = atomic_load(&video_frames);
+	counters->video_frame_bytes = atomic_load(&video_frame_bytes);
+	counters->last_video_format = atomic_load(&last_video_format);
+	counters->audio_frames = atomic_load(&audio_frames);
+	counters->log_lines = atomic_load(&log_lines);
+}
+
+void obs_stubs_reset_counters(void)
+{
+	atomic_store(&allocs, 0);
+	atomic_store(&frees, 0);
+	atomic_store(&alloc_bytes, 0);
+	atomic_store(&video_frames, 0);
+	atomic_store(&video_frame_bytes, 0);
+	atomic_store(&last_video_format, 0);
+	atomic_store(&audio_frames, 0);
+	atomic_store(&log_lines, 0);
+}
+
+/* ------------------------------------------------------------------------- */
+/* util */
+
+void blog(int log_level, const char *format, ...)
+{
+	atomic_fetch_add(&log_lines, 1);
+
+	if (log_hook) {
+		char text[4096];
+		va_list args;
+		va_start(args, format);
+		vsnprintf(text, sizeof(text), format, args);
+		va_end(args);
+		log_hook(log_level, text, log_hook_param);
+	}
+
+	if (!atomic_load(&verbose) && log_level > LOG_WARNING)
+		return;
+
+	va_list args;
+	va_start(args, format);
+	vfprintf(stderr, format, args);
+	va_end(args);
+	fputc('\n', stderr);
+}
+
+void *bmalloc(size_t size)
+{
+	atomic_fetch_add(&allocs, 1);
+	atomic_fetch_add(&alloc_bytes, size);
+	return malloc(size ? size : 1);
+}
+
+void *brealloc(void *ptr, size_t size)
+{
+	atomic_fetch_add(&allocs, 1);
+	atomic_fetch_add(&alloc_bytes, size);
+	return realloc(ptr, size ? size : 1);
+}
+
+void bfree(void *ptr)
+{
+	if (ptr)
+		atomic_fetch_add(&frees, 1);
+	free(ptr);
+}
+
+bool os_file_exists(const char *path)
+{
+	UNUSED_PARAMETER(path);
+	return false;
+}
+
+uint64_t os_gettime_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+/* ------------------------------------------------------------------------- */
+/* module */
+
+obs_module_t *obs_current_module(void)
+{
+	return NULL;
+}
+
+char *obs_module_get_config_path(obs_module_t *module, const char *file)
+{
+	UNUSED_PARAMETER(module);
+	UNUSED_PARAMETER(file);
+	return NULL;
+}
+
+/* ------------------------------------------------------------------------- */
+/* source output */
+
+// Rows of each plane, 0 past the last one
+static uint32_t plane_rows(enum video_format format, uint32_t height,
+			   int plane)
+{
+	switch (format) {
+	case VIDEO_FORMAT_I420:
+	case VIDEO_FORMAT_I010:
+		return plane < 3 ? (plane ? (height + 1) / 2 : height) : 0;
+	case VIDEO_FORMAT_NV12:
+	case VIDEO_FORMAT_P010:
+		return plane < 2 ? (plane ? (height + 1) / 2 : height) : 0;
+	case VIDEO_FORMAT_I422:
+	case VIDEO_FORMAT_I444:
+		return plane < 3 ? height : 0;
+	default:
+		return plane == 0 ? height : 0;
+	}
+}
+
+// OBS copies this much into the source's frame cache
+void obs_source_output_video(obs_source_t *source,
+			     const struct obs_source_frame *frame)
+{
+	UNUSED_PARAMETER(source);
+
+	size_t size = 0;
+	for (int i = 0; i < MAX_AV_PLANES; i++)
+		size += (size_t)frame->linesize[i] *
+			plane_rows(frame->format, frame->height, i);
+
+	atomic_fetch_add(&video_frames, 1);
+	atomic_fetch_add(&video_frame_bytes, size);
+	atomic_store(&last_video_format, (int)frame->format);
+}
+
+bool video_format_get_parameters_for_format(enum video_colorspace color_space,
+					    enum video_range_type range,
+					    enum video_format format,
+					    float matrix[16], float min[3],
+					    float max[3])
+{
+	UNUSED_PARAMETER(color_space);
+	UNUSED_PARAMETER(range);
+	UNUSED_PARAMETER(format);
+	memset(matrix, 0, sizeof(float) * 16);
+	memset(min, 0, sizeof(float) * 3);
+	memset(max, 0, sizeof(float) * 3);
+	return true;
+}
+
+void obs_source_output_audio(obs_source_t *source,
+			     const struct obs_source_audio *audio)
+{
+	UNUSED_PARAMETER(source);
+	UNUSED_PARAMETER(audio);
+	atomic_fetch_add(&audio_frames, 1);
+}
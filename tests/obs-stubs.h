@@ -0,0 +1,29 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Counters collected by the stubbed libobs calls
+struct obs_stub_counters {
+	// Allocator (bmalloc/brealloc/bfree)
+	uint64_t allocs;
+	uint64_t frees;
+	uint64_t alloc_bytes;
+
+	// Output to OBS, and the enum video_format of the last video frame
+	uint64_t video_frames;
+	uint64_t video_frame_bytes;
+	int last_video_format;
+	uint64_t audio_frames;
+
+	uint64_t log_lines;
+};
+
+// Called with every formatted blog line, from the thread that logs it
+typedef void (*obs_stub_log_hook_t)(int log_level, const char *text,
+				    void *param);
+
+void obs_stubs_set_verbose(bool verbose);
+void obs_stubs_set_log_hook(obs_stub_log_hook_t hook, void *param);
+void obs_stubs_get_counters(struct obs_stub_counters *counters);
+void obs_stubs_reset_counters(void);
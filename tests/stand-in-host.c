@@ -0,0 +1,322 @@
+/*
+ * Stand-in GameStream host for Moonlight OBS Plugin tests
+ * Serves canned responses over plain HTTP and RTSP on loopback
+ */
+
+#include "stand-in-host.h"
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define DEFAULT_VIDEO_PORT 47998
+#define DEFAULT_AUDIO_PORT 48000
+#define DEFAULT_CONTROL_PORT 47999
+
+static struct stand_in_host host;
+
+struct connection {
+	int fd;
+	bool rtsp;
+};
+
+static void sleep_ms(int ms)
+{
+	struct timespec ts = {.tv_sec = ms / 1000,
+			      .tv_nsec = (long)(ms % 1000) * 1000000};
+	nanosleep(&ts, NULL);
+}
+
+// Reads one request, returns false when the connection is closed
+static bool read_request(int fd, char *request, size_t size)
+{
+	size_t used = 0;
+
+	while (used + 1 < size) {
+		ssize_t n = recv(fd, request + used, 1, 0);
+		if (n <= 0)
+			return false;
+
+		used += (size_t)n;
+		request[used] = 0;
+		if (used >= 4 && strcmp(request + used - 4, "\r\n\r\n") == 0)
+			break;
+	}
+
+	// Append the body (ANNOUNCE) while it fits, discard the rest
+	const char *length = strstr(request, "Content-Length:");
+	if (length) {
+		int remaining = atoi(length + 15);
+		char discard[256];
+		while (remaining > 0) {
+			bool fits = used + (size_t)remaining < size;
+			char *dst = fits ? request + used : discard;
+			size_t max = fits ? (size_t)remaining : sizeof(discard);
+			if (max > (size_t)remaining)
+				max = (size_t)remaining;
+
+			ssize_t n = recv(fd, dst, max, 0);
+			if (n <= 0)
+				return false;
+			remaining -= (int)n;
+			if (fits) {
+				used += (size_t)n;
+				request[used] = 0;
+			}
+		}
+	}
+
+	return true;
+}
+
+static void send_response(int fd, const char *status_line,
+			  const char *headers, const char *body)
+{
+	char response[4096];
+	int size = snprintf(response, sizeof(response),
+			    "%s\r\n%sContent-Length: %zu\r\n\r\n%s",
+			    status_line, headers, strlen(body), body);
+	send(fd, response, (size_t)size, 0);
+}
+
+static void handle_http(int fd, const char *request)
+{
+	char body[1024];
+
+	int in_flight = atomic_fetch_add(&host.in_flight, 1) + 1;
+	int max = atomic_load(&host.max_in_flight);
+	while (in_flight > max &&
+	       !atomic_compare_exchange_weak(&host.max_in_flight, &max,
+					     in_flight))
+		;
+
+	if (strncmp(request, "GET /serverinfo", 15) == 0) {
+		atomic_fetch_add(&host.serverinfo_requests, 1);
+		sleep_ms(atomic_load(&host.host_info_delay_ms));
+
+		char codecs[96] = "";
+		int modes = atomic_load(&host.codec_modes);
+		if (modes)
+			snprintf(codecs, sizeof(codecs),
+				 "<ServerCodecModeSupport>%d"
+				 "</ServerCodecModeSupport>",
+				 modes);
+
+		snprintf(body, sizeof(body),
+			 "<root status_code=\"200\">"
+			 "<appversion>7.1.431.-1</appversion>%s"
+			 "<currentgame>%d</currentgame></root>",
+			 codecs, atomic_load(&host.current_game));
+	} else if (strncmp(request, "GET /applist", 12) == 0) {
+		atomic_fetch_add(&host.applist_requests, 1);
+		sleep_ms(atomic_load(&host.host_info_delay_ms));
+		snprintf(body, sizeof(body),
+			 "<root status_code=\"200\">"
+			 "<App><AppTitle>Desktop</AppTitle><ID>1</ID></App>"
+			 "<App><AppTitle>Steam</AppTitle><ID>2</ID></App>"
+			 "</root>");
+	} else if (strncmp(request, "GET /launch", 11) == 0) {
+		atomic_fetch_add(&host.launch_requests, 1);
+		atomic_store(&host.launch_hdr,
+			     strstr(request, "hdrMode=1") != NULL);
+		atomic_store(&host.current_game, 2);
+		snprintf(body, sizeof(body),
+			 "<root status_code=\"200\">"
+			 "<sessionUrl0>rtsp://127.0.0.1:%d</sessionUrl0>"
+			 "<gamesession>1</gamesession></root>",
+			 host.rtsp_port);
+	} else if (strncmp(request, "GET /resume", 11) == 0) {
+		atomic_fetch_add(&host.resume_requests, 1);
+		atomic_store(&host.launch_hdr,
+			     strstr(request, "hdrMode=1") != NULL);
+		const char *mode = strstr(request, "mode=");
+		if (mode)
+			atomic_store(&host.resume_width, atoi(mode + 5));
+		snprintf(body, sizeof(body),
+			 "<root status_code=\"200\">"
+			 "<sessionUrl0>rtsp://127.0.0.1:%d</sessionUrl0>"
+			 "<resume>1</resume></root>",
+			 host.rtsp_port);
+	} else {
+		snprintf(body, sizeof(body), "<root status_code=\"404\"/>");
+	}
+
+	atomic_fetch_sub(&host.in_flight, 1);
+	send_response(fd, "HTTP/1.1 200 OK", "", body);
+}
+
+static void handle_rtsp(int fd, const char *request)
+{
+	atomic_fetch_add(&host.rtsp_requests, 1);
+
+	int cseq = 0;
+	const char *header = strstr(request, "CSeq:");
+	if (header)
+		cseq = atoi(header + 5);
+
+	if (strstr(request, "ANNOUNCE") == request) {
+		const char *codec = strstr(request, "bitStreamFormat:");
+		const char *hdr = strstr(request, "dynamicRangeMode:");
+		const char *bitrate = strstr(request, "initialBitrateKbps:");
+		atomic_store(&host.announced_codec,
+			     codec ? atoi(codec + 16) : -1);
+		atomic_store(&host.announced_hdr, hdr ? atoi(hdr + 17) : -1);
+		atomic_store(&host.announced_bitrate,
+			     bitrate ? atoi(bitrate + 19) : -1);
+	}
+
+	char headers[256];
+	int port = 0;
+	if (strstr(request, "SETUP") == request) {
+		if (strstr(request, "streamid=audio"))
+			port = atomic_load(&host.audio_port);
+		else if (strstr(request, "streamid=video"))
+			port = atomic_load(&host.video_port);
+		else
+			port = atomic_load(&host.control_port);
+	}
+
+	if (port)
+		snprintf(headers, sizeof(headers),
+			 "CSeq: %d\r\nSession: 1234\r\n"
+			 "Transport: server_port=%d\r\n",
+			 cseq, port);
+	else
+		snprintf(headers, sizeof(headers),
+			 "CSeq: %d\r\nSession: 1234\r\n", cseq);
+
+	send_response(fd, "RTSP/1.0 200 OK", headers,
+		      strstr(request, "DESCRIBE") == request ? "v=0\r\n" : "");
+}
+
+static void *connection_thread(void *arg)
+{
+	struct connection *conn = arg;
+	char request[8192];
+
+	while (read_request(conn->fd, request, sizeof(request))) {
+		if (conn->rtsp)
+			handle_rtsp(conn->fd, request);
+		else
+			handle_http(conn->fd, request);
+	}
+
+	close(conn->fd);
+	free(conn);
+	return NULL;
+}
+
+static void *accept_thread(void *arg)
+{
+	bool rtsp = arg != NULL;
+	int listen_fd = rtsp ? host.rtsp_fd : host.http_fd;
+
+	for (;;) {
+		int fd = accept(listen_fd, NULL, NULL);
+		if (fd < 0)
+			break;
+
+		struct connection *conn = malloc(sizeof(*conn));
+		conn->fd = fd;
+		conn->rtsp = rtsp;
+
+		pthread_t thread;
+		pthread_create(&thread, NULL, connection_thread, conn);
+		pthread_detach(thread);
+	}
+
+	return NULL;
+}
+
+// Stands in for the host applying input: tells the sender when each input
+// packet arrived
+static void *input_thread(void *arg)
+{
+	(void)arg;
+	uint8_t packet[1500];
+
+	for (;;) {
+		struct sockaddr_storage from;
+		socklen_t len = sizeof(from);
+		ssize_t size = recvfrom(host.input_fd, packet + 8,
+					sizeof(packet) - 8, 0,
+					(struct sockaddr *)&from, &len);
+		if (size < 0)
+			break;
+
+		struct timespec ts;
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		uint64_t now = (uint64_t)ts.tv_sec * 1000000000ULL +
+			       (uint64_t)ts.tv_nsec;
+		for (int i = 0; i < 8; i++)
+			packet[i] = (uint8_t)(now >> (i * 8));
+
+		atomic_fetch_add(&host.input_packets, 1);
+		sendto(host.input_fd, packet, (size_t)size + 8, 0,
+		       (struct sockaddr *)&from, len);
+	}
+
+	return NULL;
+}
+
+static int bind_udp_loopback(int *port)
+{
+	struct sockaddr_in addr = {
+		.sin_family = AF_INET,
+		.sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+	};
+	socklen_t len = sizeof(addr);
+
+	int fd = socket(AF_INET, SOCK_DGRAM, 0);
+	if (fd < 0 || bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+	    getsockname(fd, (struct sockaddr *)&addr, &len) < 0)
+		return -1;
+
+	*port = ntohs(addr.sin_port);
+	return fd;
+}
+
+static int listen_loopback(int *port)
+{
+	struct sockaddr_in addr = {
+		.sin_family = AF_INET,
+		.sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+	};
+	socklen_t len = sizeof(addr);
+
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (fd < 0 || bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+	    listen(fd, 16) < 0 ||
+	    getsockname(fd, (struct sockaddr *)&addr, &len) < 0)
+		return -1;
+
+	*port = ntohs(addr.sin_port);
+	return fd;
+}
+
+struct stand_in_host *stand_in_host_start(void)
+{
+	host.http_fd = listen_loopback(&host.http_port);
+	host.rtsp_fd = listen_loopback(&host.rtsp_port);
+	host.input_fd = bind_udp_loopback(&host.input_port);
+	if (host.http_fd < 0 || host.rtsp_fd < 0 || host.input_fd < 0)
+		return NULL;
+
+	atomic_store(&host.video_port, DEFAULT_VIDEO_PORT);
+	atomic_store(&host.audio_port, DEFAULT_AUDIO_PORT);
+	atomic_store(&host.control_port, DEFAULT_CONTROL_PORT);
+
+	pthread_t thread;
+	pthread_create(&thread, NULL, accept_thread, NULL);
+	pthread_detach(thread);
+	pthread_create(&thread, NULL, accept_thread, &host);
+	pthread_detach(thread);
+	pthread_create(&thread, NULL, input_thread, NULL);
+	pthread_detach(thread);
+	return &host;
+}
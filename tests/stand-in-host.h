@@ -0,0 +1,50 @@
+#pragma once
+
+#include <stdatomic.h>
+#include <stdbool.h>
+
+// Minimal GameStream host on loopback for tests: plain HTTP serverinfo,
+// applist, launch and resume, and an RTSP endpoint that accepts the stream
+// setup
+struct stand_in_host {
+	int http_fd;
+	int rtsp_fd;
+	int http_port;
+	int rtsp_port;
+
+	// Stream ports handed out in the RTSP SETUP replies
+	atomic_int video_port;
+	atomic_int audio_port;
+	atomic_int control_port;
+
+	// Simulated round trip of serverinfo and applist
+	atomic_int host_info_delay_ms;
+
+	atomic_int serverinfo_requests;
+	atomic_int applist_requests;
+	atomic_int launch_requests;
+	atomic_int resume_requests;
+	atomic_int rtsp_requests;
+	atomic_int in_flight;
+	atomic_int max_in_flight;
+	atomic_int current_game;
+	atomic_int resume_width;
+
+	// Codecs in serverinfo (ServerCodecModeSupport, 0 leaves it out), and
+	// the video format and bitrate the client asked for at launch and in
+	// the SDP
+	atomic_int codec_modes;
+	atomic_int launch_hdr;
+	atomic_int announced_codec;
+	atomic_int announced_hdr;
+	atomic_int announced_bitrate;
+
+	// Input echo: each datagram sent to input_port (UDP) goes back to its
+	// sender with the time it arrived in front (CLOCK_MONOTONIC ns, LE64)
+	int input_fd;
+	int input_port;
+	atomic_int input_packets;
+};
+
+// Starts the host on ephemeral loopback ports, NULL on failure
+struct stand_in_host *stand_in_host_start(void);
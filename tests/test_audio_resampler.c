@@ -0,0 +1,193 @@
+/*
+ * Audio drift compensation test for Moonlight OBS Plugin
+ * Checks the resampler output and that the drift controller holds the
+ * buffer level against a host clock that runs fast or slow
+ */
+
+#include "audio-resampler.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define SAMPLE_RATE 48000
+#define PACKET_FRAMES 240
+#define TARGET_NS 10000000ULL
+#define OUT_CAPACITY 1024
+
+static int failures;
+
+#define CHECK(cond)                                                      \
+	do {                                                             \
+		if (!(cond)) {                                           \
+			fprintf(stderr, "%s:%d: check failed: %s\n",     \
+				__FILE__, __LINE__, #cond);              \
+			failures++;                                      \
+		}                                                        \
+	} while (0)
+
+static struct audio_resampler resampler;
+
+static void test_sine(double ratio)
+{
+	static float in_left[PACKET_FRAMES], in_right[PACKET_FRAMES];
+	static float out_left[OUT_CAPACITY], out_right[OUT_CAPACITY];
+	const float *in[2] = {in_left, in_right};
+	float *out[2] = {out_left, out_right};
+
+	audio_resampler_init(&resampler, 2);
+
+	const double freq = 1000.0;
+	double sum_sq = 0.0;
+	double max_channel_diff = 0.0;
+	size_t total_in = 0, total_out = 0, measured = 0;
+
+	for (int packet = 0; packet < 400; packet++) {
+		for (int i = 0; i < PACKET_FRAMES; i++) {
+			double t = (double)(total_in + i) / SAMPLE_RATE;
+			in_left[i] = (float)sin(2.0 * M_PI * freq * t);
+			in_right[i] = in_left[i];
+		}
+		total_in += PACKET_FRAMES;
+
+		size_t n = audio_resampler_process(&resampler, in,
+						   PACKET_FRAMES, out,
+						   OUT_CAPACITY, ratio);
+
+		// Skip the filter warm-up
+		for (size_t i = 0; i < n; i++) {
+			if (total_out + i < 1000)
+				continue;
+			sum_sq += (double)out_left[i] * out_left[i];
+			double diff = fabs(out_left[i] - out_right[i]);
+			if (diff > max_channel_diff)
+				max_channel_diff = diff;
+			measured++;
+		}
+		total_out += n;
+	}
+
+	double rms = sqrt(sum_sq / (double)measured);
+	double expected_out = (double)total_in / ratio;
+
+	CHECK(fabs(rms - M_SQRT1_2) < 0.01);
+	CHECK(max_channel_diff == 0.0);
+	CHECK(fabs((double)total_out - expected_out) < RESAMPLER_TAPS + 2);
+}
+
+static void test_identity(void)
+{
+	static float in_buf[PACKET_FRAMES], out_buf[OUT_CAPACITY];
+	const float *in[1] = {in_buf};
+	float *out[1] = {out_buf};
+
+	audio_resampler_init(&resampler, 1);
+
+	double max_error = 0.0;
+	size_t total_in = 0, total_out = 0;
+
+	for (int packet = 0; packet < 50; packet++) {
+		for (int i = 0; i < PACKET_FRAMES; i++)
+			in_buf[i] = (float)sin(0.05 * (double)(total_in + i));
+		total_in += PACKET_FRAMES;
+
+		size_t n = audio_resampler_process(&resampler, in,
+						   PACKET_FRAMES, out,
+						   OUT_CAPACITY, 1.0);
+
+		// Output frame k is centred on input frame k
+		for (size_t i = 0; i < n; i++) {
+			size_t k = total_out + i;
+			if (k < RESAMPLER_TAPS)
+				continue;
+			double expected = sin(0.05 * (double)k);
+			double error = fabs(out_buf[i] - expected);
+			if (error > max_error)
+				max_error = error;
+		}
+		total_out += n;
+	}
+
+	CHECK(max_error < 1e-3);
+}
+
+// Host clock off by drift_ppm, packets arrive with up to jitter_ns of delay
+static void test_drift(double drift_ppm, uint64_t jitter_ns)
+{
+	static float in_buf[2][PACKET_FRAMES];
+	static float out_buf[2][OUT_CAPACITY];
+	const float *in[2] = {in_buf[0], in_buf[1]};
+	float *out[2] = {out_buf[0], out_buf[1]};
+	struct audio_drift drift;
+
+	audio_resampler_init(&resampler, 2);
+	audio_drift_init(&drift, SAMPLE_RATE, TARGET_NS);
+	srand(1234);
+
+	// Ten minutes of 5 ms packets
+	const int packets = 10 * 60 * 200;
+	const double interval_ns =
+		5000000.0 / (1.0 + drift_ppm * 1e-6);
+	double max_fill_error = 0.0;
+
+	for (int packet = 0; packet < packets; packet++) {
+		uint64_t now = (uint64_t)(packet * interval_ns) +
+			       (uint64_t)(rand() % (int)(jitter_ns + 1));
+
+		audio_drift_update(&drift, now);
+
+		size_t n = audio_resampler_process(&resampler, in,
+						   PACKET_FRAMES, out,
+						   OUT_CAPACITY, drift.ratio);
+		audio_drift_advance(&drift, n);
+
+		// Give the loop two minutes to settle
+		if (packet > 2 * 60 * 200) {
+			double error = fabs(drift.fill_ns - (double)TARGET_NS);
+			if (error > max_fill_error)
+				max_fill_error = error;
+		}
+	}
+
+	double ratio_ppm = (drift.ratio - 1.0) * 1e6;
+
+	CHECK(drift.resets == 0);
+	CHECK(max_fill_error < 2000000.0);
+	CHECK(fabs(ratio_ppm - drift_ppm) < 10.0);
+}
+
+static void test_stall_resets(void)
+{
+	struct audio_drift drift;
+	audio_drift_init(&drift, SAMPLE_RATE, TARGET_NS);
+
+	uint64_t first = audio_drift_update(&drift, 0);
+	CHECK(first == TARGET_NS);
+	audio_drift_advance(&drift, PACKET_FRAMES);
+
+	// A one second gap in the stream re-anchors the timeline
+	uint64_t now = 1000000000ULL;
+	uint64_t next = audio_drift_update(&drift, now);
+	CHECK(drift.resets == 1);
+	CHECK(next == now + TARGET_NS);
+}
+
+int main(void)
+{
+	test_identity();
+	test_sine(1.0);
+	test_sine(1.0 + AUDIO_DRIFT_MAX_PPM * 1e-6);
+	test_sine(1.0 - AUDIO_DRIFT_MAX_PPM * 1e-6);
+	test_drift(80.0, 3000000);
+	test_drift(-50.0, 3000000);
+	test_drift(0.0, 0);
+	test_stall_resets();
+
+	if (failures) {
+		fprintf(stderr, "Audio resampler test: %d failure(s)\n",
+			failures);
+		return 1;
+	}
+
+	printf("Moonlight OBS Plugin - Audio resampler test passed\n");
+	return 0;
+}
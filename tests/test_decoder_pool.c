@@ -0,0 +1,219 @@
+/*
+ * Decoder pool test for Moonlight OBS Plugin
+ * Checks that warm decoders are handed out by codec, resolution and slice
+ * mode, that a returned decoder is flushed and decodes a new stream, and
+ * compares the time to a ready decoder with opening one
+ */
+
+#include "decoder-pool.h"
+#include "video-decoder.h"
+#include "moonlight-source.h"
+#include "frame-pool.h"
+#include <libavcodec/avcodec.h>
+#include <libavutil/opt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define WIDTH 320
+#define HEIGHT 180
+#define STREAM_FRAMES 10
+
+static int failures;
+
+#define CHECK(cond)                                                      \
+	do {                                                             \
+		if (!(cond)) {                                           \
+			fprintf(stderr, "%s:%d: check failed: %s\n",     \
+				__FILE__, __LINE__, #cond);              \
+			failures++;                                      \
+		}                                                        \
+	} while (0)
+
+static void source_init(struct moonlight_source *source, int width,
+			int height, bool slice_decode)
+{
+	memset(source, 0, sizeof(*source));
+	source->width = width;
+	source->height = height;
+	source->video_codec = MOONLIGHT_CODEC_H264;
+	source->slice_decode = slice_decode;
+	pthread_mutex_init(&source->mutex, NULL);
+}
+
+static void source_free(struct moonlight_source *source)
+{
+	pthread_mutex_destroy(&source->mutex);
+}
+
+// Encode a short stream starting with an IDR frame
+static bool encode_stream(AVPacket **packets, int seed)
+{
+	const AVCodec *codec = avcodec_find_encoder_by_name("libx264");
+	if (!codec)
+		return false;
+
+	AVCodecContext *ctx = avcodec_alloc_context3(codec);
+	ctx->width = WIDTH;
+	ctx->height = HEIGHT;
+	ctx->time_base = (AVRational){1, 60};
+	ctx->pix_fmt = AV_PIX_FMT_YUV420P;
+	ctx->max_b_frames = 0;
+	av_opt_set(ctx->priv_data, "preset", "ultrafast", 0);
+	av_opt_set(ctx->priv_data, "tune", "zerolatency", 0);
+
+	bool ok = avcodec_open2(ctx, codec, NULL) == 0;
+	AVFrame *frame = av_frame_alloc();
+	frame->width = WIDTH;
+	frame->height = HEIGHT;
+	frame->format = AV_PIX_FMT_YUV420P;
+	ok = ok && av_frame_get_buffer(frame, 0) == 0;
+
+	for (int i = 0; ok && i < STREAM_FRAMES; i++) {
+		for (int plane = 0; plane < 3; plane++) {
+			int height = plane ? HEIGHT / 2 : HEIGHT;
+			memset(frame->data[plane], (seed + i * 7) & 0xff,
+			       (size_t)frame->linesize[plane] * height);
+		}
+		frame->pts = i;
+
+		packets[i] = av_packet_alloc();
+		ok = avcodec_send_frame(ctx, frame) == 0 &&
+		     avcodec_receive_packet(ctx, packets[i]) == 0;
+	}
+
+	av_frame_free(&frame);
+	avcodec_free_context(&ctx);
+	return ok;
+}
+
+static void free_stream(AVPacket **packets)
+{
+	for (int i = 0; i < STREAM_FRAMES; i++)
+		av_packet_free(&packets[i]);
+}
+
+static void decode_stream(struct video_decoder *decoder, AVPacket **packets)
+{
+	for (int i = 0; i < STREAM_FRAMES; i++)
+		CHECK(video_decoder_decode(decoder, packets[i]->data,
+					   (size_t)packets[i]->size, false));
+}
+
+static void test_pool(void)
+{
+	setenv(DECODER_POOL_WARM_ENV, "2", 1);
+	decoder_pool_init();
+
+	struct decoder_pool_stats stats;
+	decoder_pool_get_stats(&stats);
+	CHECK(stats.idle == 2);
+
+	// Default settings match a warm decoder
+	struct moonlight_source first;
+	source_init(&first, 1920, 1080, false);
+	struct video_decoder *decoder = decoder_pool_acquire(&first);
+	CHECK(decoder && decoder->source == &first);
+	decoder_pool_get_stats(&stats);
+	CHECK(stats.hits == 1 && stats.misses == 0 && stats.idle == 1);
+	uint64_t pooled_ns = stats.last_acquire_ns;
+
+	// Another resolution reuses the second one, resized, with the
+	// source's memory budget
+	struct moonlight_source second;
+	source_init(&second, WIDTH, HEIGHT, false);
+	second.memory_budget = 64;
+	struct video_decoder *resized = decoder_pool_acquire(&second);
+	CHECK(resized && resized->width == WIDTH && resized->height == HEIGHT);
+	CHECK(resized && resized->memory_budget == 64 * 1024 * 1024);
+	decoder_pool_get_stats(&stats);
+	CHECK(stats.hits == 2 && stats.idle == 0);
+
+	// Slice mode is fixed when the codec opens, so this one is new
+	struct moonlight_source third;
+	source_init(&third, 1920, 1080, true);
+	struct video_decoder *sliced = decoder_pool_acquire(&third);
+	CHECK(sliced && sliced->slice_decode);
+
+	// Only H.264 is decoded slice by slice, other codecs take frames
+	CHECK(video_decoder_slice_mode(true, MOONLIGHT_CODEC_H264));
+	CHECK(!video_decoder_slice_mode(true, MOONLIGHT_CODEC_HEVC));
+	CHECK(!video_decoder_slice_mode(true, MOONLIGHT_CODEC_AV1));
+	CHECK(!video_decoder_slice_mode(false, MOONLIGHT_CODEC_H264));
+	decoder_pool_get_stats(&stats);
+	CHECK(stats.misses == 1);
+	uint64_t opened_ns = stats.last_acquire_ns;
+
+	printf("Decoder ready: %llu us pooled, %llu us opened\n",
+	       (unsigned long long)(pooled_ns / 1000),
+	       (unsigned long long)(opened_ns / 1000));
+	CHECK(pooled_ns < opened_ns);
+
+	// A decoder comes back flushed and decodes the next stream
+	AVPacket *stream_a[STREAM_FRAMES] = {0};
+	AVPacket *stream_b[STREAM_FRAMES] = {0};
+	if (encode_stream(stream_a, 0) && encode_stream(stream_b, 100)) {
+		decode_stream(resized, stream_a);
+		CHECK(resized->frames_decoded == STREAM_FRAMES);
+
+		// Frames and packets were decoded in the pool, within budget
+		struct frame_pool_stats memory;
+		frame_pool_get_stats(resized->pool, &memory);
+		CHECK(memory.allocs > 2 * STREAM_FRAMES);
+		CHECK(memory.refused == 0);
+		CHECK(memory.peak_in_use >= (size_t)WIDTH * HEIGHT * 3 / 2);
+		CHECK(memory.peak_in_use <= memory.budget);
+
+		decoder_pool_release(resized);
+		CHECK(!resized->source);
+		CHECK(resized->frames_decoded == 0);
+
+		struct video_decoder *again = decoder_pool_acquire(&second);
+		CHECK(again == resized);
+		decode_stream(again, stream_b);
+		CHECK(again->frames_decoded == STREAM_FRAMES);
+		CHECK(again->decode_errors == 0);
+		resized = again;
+	} else {
+		printf("libx264 not available, decode check skipped\n");
+	}
+	free_stream(stream_a);
+	free_stream(stream_b);
+
+	decoder_pool_release(decoder);
+	decoder_pool_release(resized);
+	decoder_pool_release(sliced);
+	decoder_pool_get_stats(&stats);
+	CHECK(stats.idle == 3);
+
+	// Past the idle limit decoders are freed
+	struct video_decoder *extra[DECODER_POOL_MAX_IDLE];
+	for (int i = 0; i < DECODER_POOL_MAX_IDLE; i++)
+		extra[i] = video_decoder_open(MOONLIGHT_CODEC_H264, WIDTH,
+					      HEIGHT, false);
+	for (int i = 0; i < DECODER_POOL_MAX_IDLE; i++)
+		decoder_pool_release(extra[i]);
+	decoder_pool_get_stats(&stats);
+	CHECK(stats.idle == DECODER_POOL_MAX_IDLE);
+
+	decoder_pool_free();
+	decoder_pool_get_stats(&stats);
+	CHECK(stats.idle == 0);
+
+	source_free(&first);
+	source_free(&second);
+	source_free(&third);
+}
+
+int main(void)
+{
+	test_pool();
+
+	if (failures) {
+		fprintf(stderr, "Decoder pool test: %d failure(s)\n", failures);
+		return 1;
+	}
+
+	printf("Moonlight OBS Plugin - Decoder pool test passed\n");
+	return 0;
+}
@@ -0,0 +1,524 @@
+/*
+ * Frame export test for Moonlight OBS Plugin
+ * Publishes decoded frames and reads them back through the reader library:
+ * in place from another process, with the planes and timestamps as
+ * published. Checks that a reader too slow for the slot ring finds its
+ * frame overwritten instead of holding up the writer, that the mapping
+ * cannot be written by readers, and that readers move on when a larger
+ * stream needs a new mapping or the export closes.
+ */
+
+#include "frame-export.h"
+#include "frame-export-reader.h"
+#include "hot-log.h"
+#include "obs-stubs.h"
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+// Source rows are longer than the exported ones, as FFmpeg pads them
+#define SOURCE_PADDING 96
+
+#define PROCESS_FRAMES 300
+#define HELD_FRAME 10
+
+static int failures;
+
+#define CHECK(cond)                                                      \
+	do {                                                             \
+		if (!(cond)) {                                           \
+			fprintf(stderr, "%s:%d: check failed: %s\n",     \
+				__FILE__, __LINE__, #cond);              \
+			failures++;                                      \
+		}                                                        \
+	} while (0)
+
+struct picture_buffer {
+	struct frame_export_picture picture;
+	uint8_t *planes[FRAME_EXPORT_PLANES];
+};
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static void sleep_ms(int ms)
+{
+	struct timespec ts = {.tv_sec = ms / 1000,
+			      .tv_nsec = (long)(ms % 1000) * 1000000};
+	nanosleep(&ts, NULL);
+}
+
+static void export_name(char *name, size_t size, const char *test)
+{
+	snprintf(name, size, "test-%d-%s", (int)getpid(), test);
+}
+
+static uint8_t pattern(uint32_t plane, uint32_t y, uint32_t x, uint8_t seed)
+{
+	return (uint8_t)(seed + plane * 71 + y * 13 + x);
+}
+
+static void picture_init(struct picture_buffer *buffer,
+			 enum frame_export_format format, uint32_t width,
+			 uint32_t height)
+{
+	memset(buffer, 0, sizeof(*buffer));
+	buffer->picture.format = format;
+	buffer->picture.width = width;
+	buffer->picture.height = height;
+
+	for (uint32_t i = 0; i < frame_export_planes(format); i++) {
+		uint32_t row_bytes, rows;
+		frame_export_plane_size(format, width, height, i, &row_bytes,
+					&rows);
+		int linesize = (int)row_bytes + SOURCE_PADDING;
+		buffer->planes[i] = malloc((size_t)linesize * rows);
+		buffer->picture.data[i] = buffer->planes[i];
+		buffer->picture.linesize[i] = linesize;
+	}
+}
+
+static void picture_free(struct picture_buffer *buffer)
+{
+	for (int i = 0; i < FRAME_EXPORT_PLANES; i++)
+		free(buffer->planes[i]);
+}
+
+static void picture_fill(struct picture_buffer *buffer, uint8_t seed)
+{
+	struct frame_export_picture *picture = &buffer->picture;
+
+	for (uint32_t i = 0; i < frame_export_planes(picture->format); i++) {
+		uint32_t row_bytes, rows;
+		frame_export_plane_size(picture->format, picture->width,
+					picture->height, i, &row_bytes, &rows);
+		for (uint32_t y = 0; y < rows; y++) {
+			uint8_t *row = buffer->planes[i] +
+				       (size_t)y * picture->linesize[i];
+			for (uint32_t x = 0; x < row_bytes; x++)
+				row[x] = pattern(i, y, x, seed);
+		}
+	}
+}
+
+static bool frame_matches(const struct frame_export_frame *frame,
+			  uint8_t seed)
+{
+	for (uint32_t i = 0; i < frame->planes; i++) {
+		uint32_t row_bytes, rows;
+		frame_export_plane_size(frame->format, frame->width,
+					frame->height, i, &row_bytes, &rows);
+		if (frame->linesize[i] % FRAME_EXPORT_ALIGN ||
+		    (uintptr_t)frame->data[i] % FRAME_EXPORT_ALIGN)
+			return false;
+
+		for (uint32_t y = 0; y < rows; y++) {
+			const uint8_t *row =
+				frame->data[i] + (size_t)y * frame->linesize[i];
+			for (uint32_t x = 0; x < row_bytes; x++) {
+				if (row[x] != pattern(i, y, x, seed))
+					return false;
+			}
+		}
+	}
+
+	return true;
+}
+
+static void test_round_trip(void)
+{
+	char name[FRAME_EXPORT_MAX_NAME];
+	export_name(name, sizeof(name), "round-trip");
+
+	struct frame_export *export = frame_export_create(name);
+	CHECK(export != NULL);
+	if (!export)
+		return;
+
+	// One export per name
+	CHECK(frame_export_create(name) == NULL);
+
+	// Nothing to map before the first frame
+	errno = 0;
+	CHECK(frame_export_reader_open(name) == NULL && errno == EAGAIN);
+
+	struct picture_buffer buffer;
+	picture_init(&buffer, FRAME_EXPORT_I420, 642, 362);
+	picture_fill(&buffer, 1);
+	buffer.picture.full_range = true;
+	buffer.picture.color_primaries = 9;
+	buffer.picture.color_trc = 16;
+	buffer.picture.color_matrix = 9;
+	buffer.picture.corrupt = true;
+	buffer.picture.received_ns = now_ns();
+	frame_export_publish(export, &buffer.picture);
+
+	struct frame_export_reader *reader = frame_export_reader_open(name);
+	CHECK(reader != NULL);
+	if (!reader) {
+		picture_free(&buffer);
+		frame_export_destroy(export);
+		return;
+	}
+
+	struct frame_export_frame frame;
+	CHECK(frame_export_reader_next(reader, &frame) == FRAME_EXPORT_FRAME);
+	CHECK(frame.number == 1 && frame.missed == 0);
+	CHECK(frame.format == FRAME_EXPORT_I420 && frame.planes == 3);
+	CHECK(frame.width == 642 && frame.height == 362);
+	CHECK(frame.full_range && frame.corrupt);
+	CHECK(frame.color_primaries == 9 && frame.color_trc == 16 &&
+	      frame.color_matrix == 9);
+	CHECK(frame.received_ns == buffer.picture.received_ns);
+	CHECK(frame.decoded_ns >= frame.received_ns);
+	CHECK(frame_matches(&frame, 1));
+	CHECK(frame_export_reader_check(reader, &frame));
+
+	// Each frame once
+	CHECK(frame_export_reader_next(reader, &frame) ==
+	      FRAME_EXPORT_NO_FRAME);
+
+	// Readers cannot write to the frames
+	uintptr_t page = (uintptr_t)frame.data[0] & ~(uintptr_t)4095;
+	CHECK(mprotect((void *)page, 4096, PROT_READ | PROT_WRITE) != 0);
+
+	// A 10-bit stream needs a larger mapping: the reader is told to
+	// connect again, and finds the frame there
+	struct picture_buffer p010;
+	picture_init(&p010, FRAME_EXPORT_P010, 642, 362);
+	picture_fill(&p010, 2);
+	frame_export_publish(export, &p010.picture);
+
+	CHECK(frame_export_reader_next(reader, &frame) ==
+	      FRAME_EXPORT_CLOSED);
+	frame_export_reader_close(reader);
+
+	reader = frame_export_reader_open(name);
+	CHECK(reader != NULL);
+	if (reader) {
+		CHECK(frame_export_reader_next(reader, &frame) ==
+		      FRAME_EXPORT_FRAME);
+		CHECK(frame.number == 2 && frame.format == FRAME_EXPORT_P010);
+		CHECK(frame.planes == 2 && frame_matches(&frame, 2));
+		CHECK(!frame.corrupt && !frame.full_range);
+	}
+
+	// Smaller frames fit the mapping as it is
+	frame_export_publish(export, &buffer.picture);
+	if (reader) {
+		CHECK(frame_export_reader_next(reader, &frame) ==
+		      FRAME_EXPORT_FRAME);
+		CHECK(frame.number == 3 && frame_matches(&frame, 1));
+	}
+
+	struct frame_export_stats stats;
+	frame_export_get_stats(export, &stats);
+	CHECK(stats.frames == 3 && stats.mappings == 2);
+	CHECK(stats.readers == 2);
+
+	frame_export_destroy(export);
+
+	// The mapping stays readable until the reader lets go of it
+	if (reader) {
+		CHECK(frame_export_reader_next(reader, &frame) ==
+		      FRAME_EXPORT_CLOSED);
+		CHECK(frame.data[0][0] == pattern(0, 0, 0, 1));
+		frame_export_reader_close(reader);
+	}
+
+	errno = 0;
+	CHECK(frame_export_reader_open(name) == NULL &&
+	      errno == ECONNREFUSED);
+
+	picture_free(&buffer);
+	picture_free(&p010);
+}
+
+static void test_slow_reader(void)
+{
+	char name[FRAME_EXPORT_MAX_NAME];
+	export_name(name, sizeof(name), "slow");
+
+	struct frame_export *export = frame_export_create(name);
+	struct picture_buffer buffer;
+	picture_init(&buffer, FRAME_EXPORT_I420, 1280, 720);
+
+	picture_fill(&buffer, 10);
+	frame_export_publish(export, &buffer.picture);
+
+	struct frame_export_reader *reader = frame_export_reader_open(name);
+	CHECK(reader != NULL);
+	if (!reader) {
+		picture_free(&buffer);
+		frame_export_destroy(export);
+		return;
+	}
+
+	struct frame_export_frame frame;
+	CHECK(frame_export_reader_next(reader, &frame) == FRAME_EXPORT_FRAME);
+
+	// The frame stays as it is for the other slots' worth of frames
+	for (int i = 1; i < FRAME_EXPORT_SLOTS; i++) {
+		picture_fill(&buffer, (uint8_t)(10 + i));
+		frame_export_publish(export, &buffer.picture);
+	}
+	CHECK(frame_export_reader_check(reader, &frame));
+	CHECK(frame_matches(&frame, 10));
+
+	// The next one goes over it, the writer does not wait
+	picture_fill(&buffer, 20);
+	uint64_t start = now_ns();
+	frame_export_publish(export, &buffer.picture);
+	uint64_t publish_ns = now_ns() - start;
+	CHECK(!frame_export_reader_check(reader, &frame));
+
+	// The reader goes on with the newest frame
+	CHECK(frame_export_reader_next(reader, &frame) == FRAME_EXPORT_FRAME);
+	CHECK(frame.number == FRAME_EXPORT_SLOTS + 1);
+	CHECK(frame.missed == FRAME_EXPORT_SLOTS - 1);
+	CHECK(frame_matches(&frame, 20));
+
+	printf("Slow reader: frame overwritten after %d frames, publish "
+	       "%.2f ms at 1280x720\n",
+	       FRAME_EXPORT_SLOTS, publish_ns / 1e6);
+
+	frame_export_reader_close(reader);
+	frame_export_destroy(export);
+	picture_free(&buffer);
+}
+
+struct publisher {
+	struct frame_export *export;
+	struct picture_buffer *buffer;
+	int delay_ms;
+};
+
+static void *publish_thread(void *arg)
+{
+	struct publisher *publisher = arg;
+	sleep_ms(publisher->delay_ms);
+	frame_export_publish(publisher->export, &publisher->buffer->picture);
+	return NULL;
+}
+
+static void test_wait(void)
+{
+	char name[FRAME_EXPORT_MAX_NAME];
+	export_name(name, sizeof(name), "wait");
+
+	struct frame_export *export = frame_export_create(name);
+	struct picture_buffer buffer;
+	picture_init(&buffer, FRAME_EXPORT_I420, 320, 240);
+	picture_fill(&buffer, 0);
+	frame_export_publish(export, &buffer.picture);
+
+	struct frame_export_reader *reader = frame_export_reader_open(name);
+	CHECK(reader != NULL);
+	if (!reader) {
+		picture_free(&buffer);
+		frame_export_destroy(export);
+		return;
+	}
+
+	// A frame not read yet is there at once
+	CHECK(frame_export_reader_wait(reader, 0));
+	struct frame_export_frame frame;
+	CHECK(frame_export_reader_next(reader, &frame) == FRAME_EXPORT_FRAME);
+
+	uint64_t start = now_ns();
+	CHECK(!frame_export_reader_wait(reader, 20));
+	CHECK(now_ns() - start >= 15000000);
+
+	// The writer wakes the reader
+	struct publisher publisher = {export, &buffer, 10};
+	pthread_t thread;
+	pthread_create(&thread, NULL, publish_thread, &publisher);
+
+	bool woken = false;
+	start = now_ns();
+	while (!woken && now_ns() - start < 1000000000ULL)
+		woken = frame_export_reader_wait(reader, 1000);
+	uint64_t wait_ns = now_ns() - start;
+	pthread_join(thread, NULL);
+
+	CHECK(woken && wait_ns < 500000000ULL);
+	CHECK(frame_export_reader_next(reader, &frame) == FRAME_EXPORT_FRAME);
+
+	// And again when the export closes
+	publisher.delay_ms = 0;
+	frame_export_destroy(export);
+	CHECK(frame_export_reader_wait(reader, 1000));
+	CHECK(frame_export_reader_next(reader, &frame) ==
+	      FRAME_EXPORT_CLOSED);
+
+	frame_export_reader_close(reader);
+	picture_free(&buffer);
+}
+
+struct process_result {
+	int frames;
+	int overwritten;
+	int inconsistent;
+	uint64_t missed;
+	uint64_t max_age_ns;
+};
+
+// Reads in place until the export closes. One frame is held until the
+// writer has gone round the ring, which it would never do if it waited for
+// readers.
+static void reader_process(const char *name, int ready_fd, int result_fd)
+{
+	struct process_result result = {0};
+	struct frame_export_reader *reader = NULL;
+
+	for (int i = 0; i < 1000 && !reader; i++) {
+		reader = frame_export_reader_open(name);
+		if (!reader)
+			sleep_ms(1);
+	}
+
+	char ready = reader ? 1 : 0;
+	if (write(ready_fd, &ready, 1) != 1 || !reader)
+		_exit(1);
+
+	struct frame_export_frame frame;
+	for (;;) {
+		if (!frame_export_reader_wait(reader, 1000))
+			break;
+
+		enum frame_export_status status =
+			frame_export_reader_next(reader, &frame);
+		if (status == FRAME_EXPORT_CLOSED)
+			break;
+		if (status != FRAME_EXPORT_FRAME)
+			continue;
+
+		uint64_t age = now_ns() - frame.decoded_ns;
+		if (age > result.max_age_ns)
+			result.max_age_ns = age;
+
+		for (int i = 0; frame.number == HELD_FRAME && i < 1000 &&
+				frame_export_reader_check(reader, &frame);
+		     i++)
+			sleep_ms(5);
+
+		// A frame that was not overwritten must be the one published
+		bool matches = frame_matches(&frame, (uint8_t)frame.number);
+		if (!frame_export_reader_check(reader, &frame))
+			result.overwritten++;
+		else if (!matches)
+			result.inconsistent++;
+
+		result.frames++;
+		result.missed += frame.missed;
+	}
+
+	frame_export_reader_close(reader);
+	if (write(result_fd, &result, sizeof(result)) != sizeof(result))
+		_exit(1);
+	_exit(0);
+}
+
+static void test_other_process(void)
+{
+	char name[FRAME_EXPORT_MAX_NAME];
+	export_name(name, sizeof(name), "process");
+
+	struct frame_export *export = frame_export_create(name);
+	struct picture_buffer buffer;
+	picture_init(&buffer, FRAME_EXPORT_I420, 1920, 1080);
+
+	// Every byte of frame n depends on n
+	picture_fill(&buffer, 1);
+	frame_export_publish(export, &buffer.picture);
+
+	int ready_pipe[2], result_pipe[2];
+	if (pipe(ready_pipe) != 0 || pipe(result_pipe) != 0) {
+		fprintf(stderr, "Failed to create pipes\n");
+		failures++;
+		return;
+	}
+
+	pid_t pid = fork();
+	if (pid == 0)
+		reader_process(name, ready_pipe[1], result_pipe[1]);
+
+	char ready = 0;
+	CHECK(read(ready_pipe[0], &ready, 1) == 1 && ready);
+
+	// At a 240 fps pace
+	uint64_t total_ns = 0, max_ns = 0;
+	for (int i = 1; i <= PROCESS_FRAMES; i++) {
+		picture_fill(&buffer, (uint8_t)(i + 1));
+
+		uint64_t start = now_ns();
+		frame_export_publish(export, &buffer.picture);
+		uint64_t elapsed = now_ns() - start;
+
+		total_ns += elapsed;
+		if (elapsed > max_ns)
+			max_ns = elapsed;
+		sleep_ms(4);
+	}
+
+	frame_export_destroy(export);
+
+	struct process_result result = {0};
+	CHECK(read(result_pipe[0], &result, sizeof(result)) ==
+	      sizeof(result));
+	int status = 0;
+	waitpid(pid, &status, 0);
+	CHECK(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+	printf("Other process: %d frames read, %d overwritten while held, "
+	       "%llu skipped, max age %.1f ms; publish avg %.2f ms, "
+	       "max %.2f ms at 1920x1080\n",
+	       result.frames, result.overwritten,
+	       (unsigned long long)result.missed, result.max_age_ns / 1e6,
+	       total_ns / 1e6 / PROCESS_FRAMES, max_ns / 1e6);
+
+	CHECK(result.frames > 0);
+	CHECK(result.inconsistent == 0);
+
+	// The held frame did not hold the writer up: it was overwritten and
+	// the reader skipped ahead
+	CHECK(result.overwritten > 0 && result.missed > 0);
+	CHECK(result.frames + (int)result.missed <= PROCESS_FRAMES + 1);
+
+	close(ready_pipe[0]);
+	close(ready_pipe[1]);
+	close(result_pipe[0]);
+	close(result_pipe[1]);
+	picture_free(&buffer);
+}
+
+int main(void)
+{
+	hot_log_init();
+
+	test_round_trip();
+	test_slow_reader();
+	test_wait();
+	test_other_process();
+
+	hot_log_free();
+
+	if (failures) {
+		fprintf(stderr, "Frame export test: %d failure(s)\n",
+			failures);
+		return 1;
+	}
+
+	printf("Moonlight OBS Plugin - Frame export test passed\n");
+	return 0;
+}
@@ -0,0 +1,329 @@
+/*
+ * Frame pool test for Moonlight OBS Plugin
+ * Checks that buffers are reused by size, that the arena never grows past
+ * its budget and shrinks back as buffers are returned, that the default
+ * budget holds a decoder's frames, that a released pool stays until its
+ * last buffer is back, and that concurrent use never hands out overlapping
+ * buffers. Compares page walks with and without huge pages.
+ */
+
+#include "frame-pool.h"
+#include "obs-stubs.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define MB (1024 * 1024)
+
+// A 1080p 4:2:0 frame, padded as the decoder asks for it
+#define FRAME_SIZE (1920 * 1088 * 3 / 2 + 128)
+
+#define THREADS 4
+#define THREAD_ROUNDS 2000
+
+// Page walk: one byte per 4 KiB page, over this much memory
+#define WALK_SIZE (128 * MB)
+#define WALK_ROUNDS 20
+
+static int failures;
+
+#define CHECK(cond)                                                      \
+	do {                                                             \
+		if (!(cond)) {                                           \
+			fprintf(stderr, "%s:%d: check failed: %s\n",     \
+				__FILE__, __LINE__, #cond);              \
+			failures++;                                      \
+		}                                                        \
+	} while (0)
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static bool aligned(const void *buffer)
+{
+	return ((uintptr_t)buffer % FRAME_POOL_ALIGN) == 0;
+}
+
+static void test_reuse(void)
+{
+	struct frame_pool *pool = frame_pool_create(64 * MB, false);
+	CHECK(pool != NULL);
+	if (!pool)
+		return;
+
+	// A returned frame buffer is handed out again
+	uint8_t *frame = frame_pool_alloc(pool, FRAME_SIZE);
+	uint8_t *held = frame_pool_alloc(pool, FRAME_SIZE);
+	CHECK(frame && held && aligned(frame) && aligned(held));
+	CHECK(held >= frame + FRAME_SIZE);
+	memset(frame, 0x55, FRAME_SIZE);
+
+	frame_pool_free(pool, frame);
+	CHECK(frame_pool_alloc(pool, FRAME_SIZE) == frame);
+
+	// Packets of varying size share a block of their power of two
+	uint8_t *packet = frame_pool_alloc(pool, 40000);
+	CHECK(packet && aligned(packet));
+	frame_pool_free(pool, packet);
+	CHECK(frame_pool_alloc(pool, 50000) == packet);
+	frame_pool_free(pool, packet);
+
+	struct frame_pool_stats stats;
+	frame_pool_get_stats(pool, &stats);
+	CHECK(stats.blocks == 2);
+	CHECK(stats.in_use == stats.carved);
+	CHECK(stats.peak_in_use >= stats.in_use + 65536);
+	CHECK(stats.allocs == 5);
+	CHECK(stats.refused == 0);
+
+	frame_pool_free(pool, frame);
+	frame_pool_free(pool, held);
+
+	frame_pool_get_stats(pool, &stats);
+	CHECK(stats.in_use == 0 && stats.carved == 0 && stats.blocks == 0);
+
+	frame_pool_release(pool);
+}
+
+// The default budget holds every frame a decoder keeps at once
+static void test_stream_budget(void)
+{
+	int threads = 4;
+	int budget = frame_pool_stream_budget(1920, 1080, 1, threads);
+	CHECK(frame_pool_stream_budget(1920, 1080, 1, 8) > budget);
+	CHECK(frame_pool_stream_budget(1920, 1080, 2, threads) > budget);
+	CHECK(frame_pool_stream_budget(3840, 2160, 1, threads) > budget);
+
+	struct frame_pool *pool = frame_pool_create((size_t)budget * MB, false);
+	CHECK(pool != NULL);
+	if (!pool)
+		return;
+
+	enum { FRAMES = FRAME_POOL_MAX_REFS + FRAME_POOL_OUTPUT_FRAMES + 4 };
+	uint8_t *frames[FRAMES];
+	for (int i = 0; i < FRAMES; i++)
+		frames[i] = frame_pool_alloc(pool, FRAME_SIZE);
+
+	struct frame_pool_stats stats;
+	frame_pool_get_stats(pool, &stats);
+	CHECK(stats.refused == 0);
+	printf("Stream budget: %d MB for 1080p with %d threads, peak %.1f "
+	       "MiB\n",
+	       budget, threads, (double)stats.peak_in_use / MB);
+
+	for (int i = 0; i < FRAMES; i++)
+		frame_pool_free(pool, frames[i]);
+	frame_pool_release(pool);
+}
+
+static void test_budget(void)
+{
+	struct frame_pool *pool = frame_pool_create(8 * MB, false);
+	CHECK(pool != NULL);
+	if (!pool)
+		return;
+
+	// Two 3 MB buffers fit, a third does not
+	uint8_t *first = frame_pool_alloc(pool, 3 * MB);
+	uint8_t *second = frame_pool_alloc(pool, 3 * MB);
+	CHECK(first && second);
+	CHECK(frame_pool_alloc(pool, 3 * MB) == NULL);
+
+	struct frame_pool_stats stats;
+	frame_pool_get_stats(pool, &stats);
+	CHECK(stats.budget == 8 * MB);
+	CHECK(stats.carved <= stats.budget);
+	CHECK(stats.refused == 1);
+
+	// The arena shrinks back from its end: a larger stream starts over
+	// at the beginning once nothing is held
+	frame_pool_free(pool, second);
+	frame_pool_free(pool, first);
+	uint8_t *larger = frame_pool_alloc(pool, 7 * MB);
+	CHECK(larger == first);
+	frame_pool_free(pool, larger);
+
+	// A hole in the middle is reused by a request that fits it
+	first = frame_pool_alloc(pool, 2 * MB);
+	second = frame_pool_alloc(pool, 2 * MB);
+	frame_pool_free(pool, first);
+	CHECK(frame_pool_alloc(pool, 2 * MB) == first);
+	frame_pool_free(pool, first);
+	frame_pool_free(pool, second);
+
+	frame_pool_reset_stats(pool);
+	frame_pool_get_stats(pool, &stats);
+	CHECK(stats.refused == 0 && stats.allocs == 0);
+	CHECK(stats.peak_in_use == 0);
+
+	frame_pool_release(pool);
+}
+
+static void test_release(void)
+{
+	struct obs_stub_counters before;
+	obs_stubs_get_counters(&before);
+
+	struct frame_pool *pool = frame_pool_create(16 * MB, false);
+	uint8_t *frame = frame_pool_alloc(pool, FRAME_SIZE);
+	CHECK(frame != NULL);
+
+	// The decoder still holds a frame: the pool stays until it is back
+	frame_pool_release(pool);
+	struct obs_stub_counters counters;
+	obs_stubs_get_counters(&counters);
+	CHECK(counters.frees == before.frees);
+
+	memset(frame, 0xaa, FRAME_SIZE);
+	frame_pool_free(pool, frame);
+	obs_stubs_get_counters(&counters);
+	CHECK(counters.frees == before.frees + 1);
+}
+
+struct worker {
+	struct frame_pool *pool;
+	int id;
+	int refused;
+	bool overlapped;
+};
+
+static void *worker_thread(void *arg)
+{
+	struct worker *worker = arg;
+	unsigned seed = (unsigned)worker->id * 7919u + 1u;
+	uint8_t *held[4] = {0};
+	size_t sizes[4] = {0};
+
+	for (int round = 0; round < THREAD_ROUNDS; round++) {
+		int slot = round % 4;
+		if (held[slot]) {
+			// Nobody else wrote into the buffer while it was held
+			for (size_t i = 0; i < sizes[slot]; i += 4096) {
+				if (held[slot][i] != (uint8_t)worker->id)
+					worker->overlapped = true;
+			}
+			frame_pool_free(worker->pool, held[slot]);
+		}
+
+		seed = seed * 1103515245u + 12345u;
+		sizes[slot] = 1024 + (seed >> 8) % (2 * MB);
+		held[slot] = frame_pool_alloc(worker->pool, sizes[slot]);
+		if (!held[slot]) {
+			worker->refused++;
+			continue;
+		}
+		memset(held[slot], worker->id, sizes[slot]);
+	}
+
+	for (int slot = 0; slot < 4; slot++)
+		frame_pool_free(worker->pool, held[slot]);
+	return NULL;
+}
+
+static void test_threads(void)
+{
+	struct frame_pool *pool = frame_pool_create(64 * MB, false);
+	CHECK(pool != NULL);
+	if (!pool)
+		return;
+
+	pthread_t threads[THREADS];
+	struct worker workers[THREADS];
+	for (int i = 0; i < THREADS; i++) {
+		workers[i] = (struct worker){.pool = pool, .id = i + 1};
+		pthread_create(&threads[i], NULL, worker_thread, &workers[i]);
+	}
+
+	int refused = 0;
+	for (int i = 0; i < THREADS; i++) {
+		pthread_join(threads[i], NULL);
+		CHECK(!workers[i].overlapped);
+		refused += workers[i].refused;
+	}
+
+	struct frame_pool_stats stats;
+	frame_pool_get_stats(pool, &stats);
+	printf("Concurrent use: %llu buffers, %d refused, peak %.1f MiB of "
+	       "%zu MiB\n",
+	       (unsigned long long)stats.allocs, refused,
+	       (double)stats.peak_in_use / MB, stats.budget / MB);
+
+	CHECK(stats.in_use == 0 && stats.carved == 0 && stats.blocks == 0);
+	CHECK(stats.peak_in_use <= stats.budget);
+	CHECK(stats.refused == (uint64_t)refused);
+
+	frame_pool_release(pool);
+}
+
+// Touch one byte per page, as a conversion pass over large frames does
+static uint64_t walk_pages(volatile uint8_t *data)
+{
+	uint64_t start = now_ns();
+	for (int round = 0; round < WALK_ROUNDS; round++) {
+		for (size_t i = 0; i < WALK_SIZE; i += 4096)
+			data[i]++;
+	}
+	return now_ns() - start;
+}
+
+static void test_hugepages(void)
+{
+	struct frame_pool *normal = frame_pool_create(WALK_SIZE, false);
+	struct frame_pool *huge = frame_pool_create(WALK_SIZE, true);
+	CHECK(normal && huge);
+	if (!normal || !huge) {
+		frame_pool_release(normal);
+		frame_pool_release(huge);
+		return;
+	}
+
+	struct frame_pool_stats stats;
+	frame_pool_get_stats(huge, &stats);
+	uint8_t *huge_data = frame_pool_alloc(huge, WALK_SIZE);
+	uint8_t *normal_data = frame_pool_alloc(normal, WALK_SIZE);
+	CHECK(huge_data && normal_data);
+
+	// The arena starts on a huge page
+	if (stats.pages != FRAME_POOL_PAGES_NORMAL)
+		CHECK(huge_data && (uintptr_t)huge_data % (2 * MB) == 0);
+
+	if (huge_data && normal_data) {
+		memset(normal_data, 0, WALK_SIZE);
+		memset(huge_data, 0, WALK_SIZE);
+		uint64_t normal_ns = walk_pages(normal_data);
+		uint64_t huge_ns = walk_pages(huge_data);
+		printf("Page walk over %d MiB: %.1f ms with normal pages, "
+		       "%.1f ms with %s\n",
+		       WALK_SIZE / MB, normal_ns / 1e6, huge_ns / 1e6,
+		       frame_pool_pages_name(stats.pages));
+	}
+
+	frame_pool_free(normal, normal_data);
+	frame_pool_free(huge, huge_data);
+	frame_pool_release(normal);
+	frame_pool_release(huge);
+}
+
+int main(void)
+{
+	test_reuse();
+	test_budget();
+	test_stream_budget();
+	test_release();
+	test_threads();
+	test_hugepages();
+
+	if (failures) {
+		fprintf(stderr, "Frame pool test: %d failure(s)\n", failures);
+		return 1;
+	}
+
+	printf("Moonlight OBS Plugin - Frame pool test passed\n");
+	return 0;
+}
@@ -0,0 +1,153 @@
+/*
+ * Connection handshake test for Moonlight OBS Plugin
+ * Runs the handshake engine against a local HTTP/RTSP stand-in host and
+ * checks request concurrency, the host info cache and stream re-setup
+ */
+
+#include "handshake.h"
+#include "stand-in-host.h"
+#include <stdio.h>
+#include <string.h>
+
+// Simulated round trip for each host info request
+#define HOST_INFO_DELAY_MS 100
+
+static struct stand_in_host *host;
+static int failures;
+
+#define CHECK(cond)                                                      \
+	do {                                                             \
+		if (!(cond)) {                                           \
+			fprintf(stderr, "%s:%d: check failed: %s\n",     \
+				__FILE__, __LINE__, #cond);              \
+			failures++;                                      \
+		}                                                        \
+	} while (0)
+
+static void init_params(struct handshake_params *params)
+{
+	memset(params, 0, sizeof(*params));
+	params->host = "127.0.0.1";
+	params->https_port = host->http_port;
+	params->rtsp_port = host->rtsp_port;
+	params->app_name = "Steam";
+	params->width = 1920;
+	params->height = 1080;
+	params->fps = 60;
+	params->bitrate = 20000;
+	params->disable_tls = true;
+}
+
+int main(void)
+{
+	host = stand_in_host_start();
+	if (!host) {
+		fprintf(stderr, "Failed to start stand-in host\n");
+		return 1;
+	}
+	atomic_store(&host->host_info_delay_ms, HOST_INFO_DELAY_MS);
+
+	handshake_global_init();
+
+	struct handshake_params params;
+	struct handshake_result first, second, third;
+	init_params(&params);
+
+	// Cold connect: serverinfo and applist go out together
+	CHECK(handshake_run(&params, &first));
+	CHECK(first.app_id == 2);
+	CHECK(!first.resumed);
+	CHECK(first.supports_rfi);
+	CHECK(first.video_port == atomic_load(&host->video_port));
+	CHECK(first.audio_port == atomic_load(&host->audio_port));
+	CHECK(first.control_port == atomic_load(&host->control_port));
+	CHECK(!first.timing.serverinfo_cached);
+	CHECK(!first.timing.applist_cached);
+	CHECK(atomic_load(&host->max_in_flight) >= 2);
+	CHECK(first.timing.total_ns <
+	      (2 * HOST_INFO_DELAY_MS - 10) * 1000000ULL +
+		      first.timing.launch_ns + first.timing.rtsp_ns);
+	CHECK(atomic_load(&host->rtsp_requests) == 7);
+
+	// Reconnect: host info comes from the cache
+	CHECK(handshake_run(&params, &second));
+	CHECK(second.timing.serverinfo_cached);
+	CHECK(second.timing.applist_cached);
+	CHECK(atomic_load(&host->serverinfo_requests) == 1);
+	CHECK(atomic_load(&host->applist_requests) == 1);
+	CHECK(second.timing.total_ns < HOST_INFO_DELAY_MS * 1000000ULL);
+
+	// Fresh host info shows the app running, so it is resumed
+	handshake_invalidate(params.host);
+	CHECK(handshake_run(&params, &third));
+	CHECK(third.resumed);
+	CHECK(atomic_load(&host->serverinfo_requests) == 2);
+	CHECK(atomic_load(&host->resume_requests) == 1);
+
+	// Resolution change: the stream is set up again without querying the
+	// host or relaunching the app
+	int rtsp_requests = atomic_load(&host->rtsp_requests);
+	params.width = 1280;
+	params.height = 720;
+	third.video_port = 0;
+	CHECK(handshake_reconfigure(&params, &third));
+	CHECK(third.resumed);
+	CHECK(third.video_port == atomic_load(&host->video_port));
+	CHECK(atomic_load(&host->resume_width) == 1280);
+	CHECK(atomic_load(&host->resume_requests) == 2);
+	CHECK(atomic_load(&host->serverinfo_requests) == 2);
+	CHECK(atomic_load(&host->launch_requests) == 2);
+	CHECK(atomic_load(&host->rtsp_requests) == rtsp_requests + 7);
+
+	// Video format: HDR goes to a Main10 encoder the host has, otherwise
+	// the host falls back
+	atomic_store(&host->codec_modes, 0x301); // H.264, HEVC, HEVC Main10
+	handshake_invalidate(params.host);
+	params.codec = HANDSHAKE_CODEC_AV1;
+	params.hdr = true;
+	CHECK(handshake_run(&params, &third));
+	CHECK(third.codec == HANDSHAKE_CODEC_HEVC);
+	CHECK(third.hdr);
+	CHECK(atomic_load(&host->launch_hdr) == 1);
+	CHECK(atomic_load(&host->announced_codec) == HANDSHAKE_CODEC_HEVC);
+	CHECK(atomic_load(&host->announced_hdr) == 1);
+
+	atomic_store(&host->codec_modes, 0); // Older host, H.264 only
+	handshake_invalidate(params.host);
+	params.codec = HANDSHAKE_CODEC_HEVC;
+	CHECK(handshake_run(&params, &third));
+	CHECK(third.codec == HANDSHAKE_CODEC_H264);
+	CHECK(!third.hdr);
+	CHECK(atomic_load(&host->launch_hdr) == 0);
+	CHECK(atomic_load(&host->announced_codec) == HANDSHAKE_CODEC_H264);
+	CHECK(atomic_load(&host->announced_hdr) == 0);
+
+	// Unknown app
+	params.app_name = "Missing";
+	CHECK(!handshake_run(&params, &third));
+
+	// Over TLS nothing is sent without a certificate from pairing to pin
+	int serverinfos = atomic_load(&host->serverinfo_requests);
+	int launches = atomic_load(&host->launch_requests);
+	int resumes = atomic_load(&host->resume_requests);
+	handshake_invalidate(params.host);
+	params.app_name = "Steam";
+	params.disable_tls = false;
+	params.server_cert_path = "/nonexistent/server.pem";
+	CHECK(!handshake_run(&params, &third));
+	params.server_cert_path = NULL;
+	CHECK(!handshake_reconfigure(&params, &third));
+	CHECK(atomic_load(&host->serverinfo_requests) == serverinfos);
+	CHECK(atomic_load(&host->launch_requests) == launches);
+	CHECK(atomic_load(&host->resume_requests) == resumes);
+
+	handshake_global_free();
+
+	if (failures) {
+		fprintf(stderr, "Handshake test: %d failure(s)\n", failures);
+		return 1;
+	}
+
+	printf("Moonlight OBS Plugin - Handshake test passed\n");
+	return 0;
+}
@@ -0,0 +1,387 @@
+/*
+ * Hot path logging test for Moonlight OBS Plugin
+ * Checks that each call site is rate limited with a summary of what it
+ * suppressed, that records keep their order per thread, that a full ring
+ * drops and reports records, that levels above HOT_LOG_LEVEL compile out,
+ * and compares the cost of a call against a synchronous write, in the
+ * median and in the tail
+ */
+
+// Release build level, whatever the build type
+#define HOT_LOG_LEVEL LOG_INFO
+
+#include "hot-log.h"
+#include "obs-stubs.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define MAX_LINES 4096
+#define THREADS 4
+#define THREAD_RECORDS 200
+#define BURST_CALLS 1000
+#define LATENCY_CALLS 1000
+
+static int failures;
+
+#define CHECK(cond)                                                      \
+	do {                                                             \
+		if (!(cond)) {                                           \
+			fprintf(stderr, "%s:%d: check failed: %s\n",     \
+				__FILE__, __LINE__, #cond);              \
+			failures++;                                      \
+		}                                                        \
+	} while (0)
+
+// Lines as blog sees them
+static pthread_mutex_t lines_mutex = PTHREAD_MUTEX_INITIALIZER;
+static char lines[MAX_LINES][HOT_LOG_RECORD_SIZE + 64];
+static int line_count;
+
+// Holds the drain thread inside blog, to fill a ring
+static atomic_bool hold_drain;
+static atomic_bool drain_held;
+
+// The synchronous sink of the latency comparison
+static _Atomic(FILE *) sink;
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static void sleep_us(int us)
+{
+	struct timespec ts = {.tv_sec = us / 1000000,
+			      .tv_nsec = (long)(us % 1000000) * 1000};
+	nanosleep(&ts, NULL);
+}
+
+static void capture_line(int log_level, const char *text, void *param)
+{
+	(void)log_level;
+	(void)param;
+
+	FILE *file = atomic_load(&sink);
+	if (file) {
+		fputs(text, file);
+		fflush(file);
+		return;
+	}
+
+	while (atomic_load(&hold_drain)) {
+		atomic_store(&drain_held, true);
+		sleep_us(100);
+	}
+
+	pthread_mutex_lock(&lines_mutex);
+	if (line_count < MAX_LINES)
+		snprintf(lines[line_count++], sizeof(lines[0]), "%s", text);
+	pthread_mutex_unlock(&lines_mutex);
+}
+
+static void reset_lines(void)
+{
+	pthread_mutex_lock(&lines_mutex);
+	line_count = 0;
+	pthread_mutex_unlock(&lines_mutex);
+}
+
+// Lines containing text
+static int count_lines(const char *text)
+{
+	int count = 0;
+
+	pthread_mutex_lock(&lines_mutex);
+	for (int i = 0; i < line_count; i++) {
+		if (strstr(lines[i], text))
+			count++;
+	}
+	pthread_mutex_unlock(&lines_mutex);
+
+	return count;
+}
+
+static bool wait_for_line(const char *text, int timeout_ms)
+{
+	for (int i = 0; i < timeout_ms; i++) {
+		if (count_lines(text))
+			return true;
+		sleep_us(1000);
+	}
+	return false;
+}
+
+static void log_burst(int i)
+{
+	hlog(LOG_INFO, "burst record %d", i);
+}
+
+static void test_synchronous_fallback(void)
+{
+	reset_lines();
+
+	// Before hot_log_init a record is written by the caller
+	hlog(LOG_INFO, "before init");
+	CHECK(count_lines("[" PLUGIN_NAME "] before init") == 1);
+}
+
+static void test_rate_limit(void)
+{
+	reset_lines();
+
+	for (int i = 0; i < BURST_CALLS; i++)
+		log_burst(i);
+	hot_log_flush();
+
+	CHECK(count_lines("burst record") == HOT_LOG_BURST);
+	CHECK(count_lines("burst record 0") == 1);
+	CHECK(count_lines("burst record 9") == 1);
+	CHECK(count_lines("burst record 10") == 0);
+
+	char summary[64];
+	snprintf(summary, sizeof(summary), ": suppressed %d messages",
+		 BURST_CALLS - HOT_LOG_BURST);
+	CHECK(count_lines(summary) == 1);
+	CHECK(count_lines("test_hot_log.c:") == 1);
+
+	// Without a flush the summary comes one window later
+	reset_lines();
+	sleep_us((int)(HOT_LOG_WINDOW_NS / 1000));
+	for (int i = 0; i < 2 * HOT_LOG_BURST; i++)
+		log_burst(i);
+	CHECK(wait_for_line("burst record 9", 100));
+	CHECK(!count_lines("suppressed"));
+	CHECK(wait_for_line("suppressed 10 messages",
+			    (int)(2 * HOT_LOG_WINDOW_NS / 1000000)));
+}
+
+// One call site per record, so that no record is rate limited
+static struct hot_log_site thread_sites[THREADS][THREAD_RECORDS];
+
+static void *ordering_thread(void *arg)
+{
+	int thread = (int)(intptr_t)arg;
+
+	for (int i = 0; i < THREAD_RECORDS; i++) {
+		struct hot_log_site *site = &thread_sites[thread][i];
+		site->file = __FILE__;
+		site->line = __LINE__;
+		hot_log_write(site, LOG_INFO, "thread %d record %d", thread,
+			      i);
+	}
+
+	return NULL;
+}
+
+static void test_thread_order(void)
+{
+	reset_lines();
+
+	pthread_t threads[THREADS];
+	for (int i = 0; i < THREADS; i++)
+		pthread_create(&threads[i], NULL, ordering_thread,
+			       (void *)(intptr_t)i);
+	for (int i = 0; i < THREADS; i++)
+		pthread_join(threads[i], NULL);
+	hot_log_flush();
+
+	// Records of different threads interleave, but each thread's come
+	// in the order it wrote them
+	int next[THREADS] = {0};
+	bool ordered = true;
+
+	pthread_mutex_lock(&lines_mutex);
+	for (int i = 0; i < line_count; i++) {
+		int thread, record;
+		if (sscanf(lines[i], "thread %d record %d", &thread,
+			   &record) != 2 ||
+		    thread < 0 || thread >= THREADS)
+			continue;
+
+		if (record != next[thread])
+			ordered = false;
+		next[thread] = record + 1;
+	}
+	pthread_mutex_unlock(&lines_mutex);
+
+	CHECK(ordered);
+	for (int i = 0; i < THREADS; i++)
+		CHECK(next[i] == THREAD_RECORDS);
+}
+
+static struct hot_log_site drop_sites[2 * HOT_LOG_RING_SIZE];
+
+static void test_ring_full(void)
+{
+	reset_lines();
+
+	struct hot_log_stats before;
+	hot_log_get_stats(&before);
+
+	// The drain thread takes the first record and waits in blog, the
+	// ring fills up behind it
+	atomic_store(&drain_held, false);
+	atomic_store(&hold_drain, true);
+
+	int records = 2 * HOT_LOG_RING_SIZE;
+	for (int i = 0; i < records; i++) {
+		struct hot_log_site *site = &drop_sites[i];
+		site->file = __FILE__;
+		site->line = __LINE__;
+		hot_log_write(site, LOG_INFO, "fill record %d", i);
+		if (i == 0) {
+			for (int j = 0; j < 1000 && !atomic_load(&drain_held);
+			     j++)
+				sleep_us(1000);
+		}
+	}
+
+	atomic_store(&hold_drain, false);
+	hot_log_flush();
+
+	struct hot_log_stats after;
+	hot_log_get_stats(&after);
+	uint64_t dropped = after.dropped - before.dropped;
+
+	printf("Full ring: %d records, %d written, %llu dropped\n", records,
+	       count_lines("fill record"), (unsigned long long)dropped);
+
+	CHECK(dropped >= (uint64_t)(records - HOT_LOG_RING_SIZE - 1));
+	CHECK(count_lines("fill record") + (int)dropped == records);
+	CHECK(count_lines("log records dropped, log ring full") >= 1);
+
+	// The writer never waited for the ring
+	CHECK(count_lines("fill record 0") == 1);
+}
+
+static int side_effects;
+
+static int side_effect(void)
+{
+	return ++side_effects;
+}
+
+static void test_compiled_out(void)
+{
+	reset_lines();
+
+	struct hot_log_stats before;
+	hot_log_get_stats(&before);
+
+	// Above HOT_LOG_LEVEL: neither the arguments nor the call remain
+	for (int i = 0; i < 100; i++)
+		hlog(LOG_DEBUG, "debug record %d", side_effect());
+	hot_log_flush();
+
+	struct hot_log_stats after;
+	hot_log_get_stats(&after);
+
+	CHECK(side_effects == 0);
+	CHECK(!count_lines("debug record"));
+	CHECK(after.written == before.written);
+	CHECK(after.suppressed == before.suppressed);
+}
+
+static int compare_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a;
+	uint64_t y = *(const uint64_t *)b;
+	return x < y ? -1 : x > y;
+}
+
+static struct hot_log_site latency_sites[LATENCY_CALLS];
+
+static void test_latency(void)
+{
+	// Lines go to a file and are flushed, as the OBS log does
+	FILE *file = tmpfile();
+	if (!file) {
+		fprintf(stderr, "Failed to open a log file\n");
+		failures++;
+		return;
+	}
+	atomic_store(&sink, file);
+
+	static uint64_t hot_ns[LATENCY_CALLS];
+	static uint64_t sync_ns[LATENCY_CALLS];
+
+	for (int i = 0; i < LATENCY_CALLS; i++) {
+		struct hot_log_site *site = &latency_sites[i];
+		site->file = __FILE__;
+		site->line = __LINE__;
+
+		uint64_t start = now_ns();
+		hot_log_write(site, LOG_INFO, "latency record %d: %d us", i,
+			      i * 7);
+		hot_ns[i] = now_ns() - start;
+
+		start = now_ns();
+		blog(LOG_INFO, "[" PLUGIN_NAME "] latency record %d: %d us", i,
+		     i * 7);
+		sync_ns[i] = now_ns() - start;
+
+		// Keep the ring from filling
+		if (i % 32 == 31)
+			hot_log_flush();
+	}
+	hot_log_flush();
+
+	atomic_store(&sink, NULL);
+	fclose(file);
+
+	qsort(hot_ns, LATENCY_CALLS, sizeof(uint64_t), compare_u64);
+	qsort(sync_ns, LATENCY_CALLS, sizeof(uint64_t), compare_u64);
+
+	int p99 = LATENCY_CALLS * 99 / 100;
+	printf("Log call: median %llu ns, p99 %llu ns, max %llu ns; "
+	       "synchronous: median %llu ns, p99 %llu ns, max %llu ns\n",
+	       (unsigned long long)hot_ns[LATENCY_CALLS / 2],
+	       (unsigned long long)hot_ns[p99],
+	       (unsigned long long)hot_ns[LATENCY_CALLS - 1],
+	       (unsigned long long)sync_ns[LATENCY_CALLS / 2],
+	       (unsigned long long)sync_ns[p99],
+	       (unsigned long long)sync_ns[LATENCY_CALLS - 1]);
+
+	// Waking the drain thread must not put its write on the caller
+	CHECK(hot_ns[LATENCY_CALLS / 2] < sync_ns[LATENCY_CALLS / 2]);
+	CHECK(hot_ns[p99] < sync_ns[p99]);
+}
+
+int main(void)
+{
+	obs_stubs_set_log_hook(capture_line, NULL);
+
+	test_synchronous_fallback();
+
+	hot_log_init();
+	test_rate_limit();
+	test_thread_order();
+	test_ring_full();
+	test_compiled_out();
+	test_latency();
+
+	reset_lines();
+	hot_log_free();
+	CHECK(count_lines("Hot path log:") == 1);
+
+	// Synchronous again
+	hlog(LOG_INFO, "after free");
+	CHECK(count_lines("after free") == 1);
+
+	obs_stubs_set_log_hook(NULL, NULL);
+
+	if (failures) {
+		fprintf(stderr, "Hot path log test: %d failure(s)\n",
+			failures);
+		return 1;
+	}
+
+	printf("Moonlight OBS Plugin - Hot path log test passed\n");
+	return 0;
+}
@@ -0,0 +1,387 @@
+/*
+ * Input forwarding test for Moonlight OBS Plugin
+ * Checks the GameStream input packets, that pointer motion is merged while
+ * a send is in progress without reordering clicks, that held keys are
+ * released on focus loss, and measures the time from an event to the
+ * stand-in host
+ */
+
+#include "input-sender.h"
+#include "stand-in-host.h"
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAX_PACKETS 1024
+#define KEY_EVENTS 100
+#define MOVE_EVENTS 500
+
+// Keys reach the host within this time (median), pointer positions within
+// this one (99th percentile)
+#define MAX_KEY_LATENCY_NS 1000000ULL
+#define MAX_MOTION_LATENCY_NS 5000000ULL
+
+// A control stream that takes this long per packet, for merging
+#define SLOW_SEND_US 2000
+
+static int failures;
+
+#define CHECK(cond)                                                      \
+	do {                                                             \
+		if (!(cond)) {                                           \
+			fprintf(stderr, "%s:%d: check failed: %s\n",     \
+				__FILE__, __LINE__, #cond);              \
+			failures++;                                      \
+		}                                                        \
+	} while (0)
+
+// Packets as the host sees them
+struct captured {
+	uint8_t data[32];
+	size_t size;
+	uint64_t host_ns;
+};
+
+static struct captured packets[MAX_PACKETS];
+static atomic_int packet_count;
+static atomic_int send_delay_us;
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static void sleep_us(int us)
+{
+	struct timespec ts = {.tv_sec = us / 1000000,
+			      .tv_nsec = (long)(us % 1000000) * 1000};
+	nanosleep(&ts, NULL);
+}
+
+static void capture(const uint8_t *data, size_t size, uint64_t host_ns)
+{
+	int index = atomic_load(&packet_count);
+	if (index >= MAX_PACKETS || size > sizeof(packets[index].data))
+		return;
+
+	memcpy(packets[index].data, data, size);
+	packets[index].size = size;
+	packets[index].host_ns = host_ns;
+	atomic_store(&packet_count, index + 1);
+}
+
+static void reset_capture(void)
+{
+	atomic_store(&packet_count, 0);
+}
+
+static bool wait_for_packets(int count)
+{
+	for (int i = 0; i < 2000; i++) {
+		if (atomic_load(&packet_count) >= count)
+			return true;
+		sleep_us(500);
+	}
+	return false;
+}
+
+static bool send_local(void *param, const void *packet, size_t size)
+{
+	(void)param;
+	int delay_us = atomic_load(&send_delay_us);
+	if (delay_us)
+		sleep_us(delay_us);
+	capture(packet, size, now_ns());
+	return true;
+}
+
+static uint32_t packet_magic(const struct captured *packet)
+{
+	const uint8_t *p = packet->data + 4;
+	return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 |
+	       (uint32_t)p[3] << 24;
+}
+
+static int packet_be16(const struct captured *packet, size_t offset)
+{
+	return (int16_t)(packet->data[offset] << 8 | packet->data[offset + 1]);
+}
+
+static bool packet_equals(int index, const uint8_t *expected, size_t size)
+{
+	return index < atomic_load(&packet_count) &&
+	       packets[index].size == size &&
+	       memcmp(packets[index].data, expected, size) == 0;
+}
+
+static void test_packets(void)
+{
+	struct input_sender *sender = input_sender_create(send_local, NULL);
+	reset_capture();
+
+	// Nothing is sent without a session
+	input_sender_key(sender, 'A', 0, true);
+	sleep_us(20000);
+	CHECK(atomic_load(&packet_count) == 0);
+
+	input_sender_start(sender);
+
+	input_sender_key(sender, 'A', INPUT_MODIFIER_SHIFT, true);
+	static const uint8_t key[] = {0, 0, 0, 10, 3, 0, 0, 0, 0,
+				      0x41, 0x80, 1, 0, 0};
+	CHECK(wait_for_packets(1) && packet_equals(0, key, sizeof(key)));
+
+	input_sender_mouse_move(sender, 100, 50, 1280, 720);
+	static const uint8_t move[] = {0, 0, 0,    14, 5, 0,    0, 0, 0,
+				       100, 0, 50, 0, 0, 0x04, 0xff, 0x02,
+				       0xcf};
+	CHECK(wait_for_packets(2) && packet_equals(1, move, sizeof(move)));
+
+	input_sender_mouse_button(sender, INPUT_BUTTON_LEFT, true);
+	static const uint8_t button[] = {0, 0, 0, 5, 8, 0, 0, 0, 1};
+	CHECK(wait_for_packets(3) &&
+	      packet_equals(2, button, sizeof(button)));
+
+	input_sender_scroll(sender, 120, -120);
+	static const uint8_t scroll[] = {0, 0, 0, 10, 10, 0,    0,
+					 0, 0, 120, 0, 120, 0, 0};
+	static const uint8_t hscroll[] = {0, 0, 0,    6,   1,
+					  0, 0, 0x55, 0xff, 0x88};
+	CHECK(wait_for_packets(5) &&
+	      packet_equals(3, scroll, sizeof(scroll)) &&
+	      packet_equals(4, hscroll, sizeof(hscroll)));
+
+	// Positions outside the picture are clamped to its edge
+	input_sender_mouse_move(sender, 5000, -3, 1280, 720);
+	CHECK(wait_for_packets(6));
+	CHECK(packet_be16(&packets[5], 8) == 1279);
+	CHECK(packet_be16(&packets[5], 10) == 0);
+
+	input_sender_destroy(sender);
+}
+
+static void test_merge_motion(void)
+{
+	struct input_sender *sender = input_sender_create(send_local, NULL);
+	input_sender_start(sender);
+	reset_capture();
+	atomic_store(&send_delay_us, SLOW_SEND_US);
+
+	// Motion at 2 kHz over a slow control stream, then a click
+	uint64_t start = now_ns();
+	for (int x = 0; x < 300; x++) {
+		input_sender_mouse_move(sender, x, 10, 1280, 720);
+		sleep_us(500);
+	}
+	input_sender_mouse_button(sender, INPUT_BUTTON_LEFT, true);
+	uint64_t elapsed = now_ns() - start;
+
+	sleep_us(50000);
+	atomic_store(&send_delay_us, 0);
+	int count = atomic_load(&packet_count);
+	CHECK(count >= 2);
+
+	int moves = 0;
+	for (int i = 0; i < count; i++) {
+		if (packet_magic(&packets[i]) == INPUT_MAGIC_MOUSE_MOVE_ABS)
+			moves++;
+	}
+
+	// One position per send, and the click after the last one
+	CHECK((uint64_t)moves <= elapsed / (SLOW_SEND_US * 1000ULL) + 2);
+	CHECK(packet_magic(&packets[count - 1]) ==
+	      INPUT_MAGIC_MOUSE_BUTTON_DOWN);
+	CHECK(packet_magic(&packets[count - 2]) == INPUT_MAGIC_MOUSE_MOVE_ABS);
+	CHECK(packet_be16(&packets[count - 2], 8) == 299);
+
+	struct input_sender_stats stats;
+	input_sender_get_stats(sender, &stats);
+	CHECK(stats.events == 301);
+	CHECK(stats.packets == (uint64_t)count);
+	CHECK(stats.moves_merged + (uint64_t)moves == 300);
+	printf("Motion: 300 events in %llu ms sent as %d packets\n",
+	       (unsigned long long)(elapsed / 1000000), moves);
+
+	input_sender_destroy(sender);
+}
+
+static void test_release_all(void)
+{
+	struct input_sender *sender = input_sender_create(send_local, NULL);
+	input_sender_start(sender);
+	reset_capture();
+
+	input_sender_key(sender, 'W', 0, true);
+	input_sender_key(sender, 'D', 0, true);
+	input_sender_key(sender, 'D', 0, false);
+	input_sender_mouse_button(sender, INPUT_BUTTON_RIGHT, true);
+	CHECK(wait_for_packets(4));
+
+	// Only what is still held comes back up
+	input_sender_release_all(sender);
+	CHECK(wait_for_packets(6));
+	sleep_us(20000);
+	CHECK(atomic_load(&packet_count) == 6);
+	CHECK(packet_magic(&packets[4]) == INPUT_MAGIC_KEY_UP &&
+	      packets[4].data[9] == 'W');
+	CHECK(packet_magic(&packets[5]) == INPUT_MAGIC_MOUSE_BUTTON_UP &&
+	      packets[5].data[8] == INPUT_BUTTON_RIGHT);
+
+	// A stopped session forgets them
+	input_sender_key(sender, 'W', 0, true);
+	CHECK(wait_for_packets(7));
+	input_sender_stop(sender);
+	input_sender_start(sender);
+	input_sender_release_all(sender);
+	sleep_us(20000);
+	CHECK(atomic_load(&packet_count) == 7);
+
+	input_sender_destroy(sender);
+}
+
+// Control stream stand-in: input packets go to the host over loopback UDP
+static bool send_to_host(void *param, const void *packet, size_t size)
+{
+	int fd = *(int *)param;
+	return send(fd, packet, size, 0) == (ssize_t)size;
+}
+
+static void *echo_thread(void *arg)
+{
+	int fd = *(int *)arg;
+	uint8_t echo[64];
+
+	for (;;) {
+		ssize_t size = recv(fd, echo, sizeof(echo), 0);
+		if (size <= 8)
+			break;
+
+		uint64_t host_ns = 0;
+		for (int i = 0; i < 8; i++)
+			host_ns |= (uint64_t)echo[i] << (i * 8);
+		capture(echo + 8, (size_t)size - 8, host_ns);
+	}
+
+	return NULL;
+}
+
+static int compare_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a;
+	uint64_t y = *(const uint64_t *)b;
+	return x < y ? -1 : x > y;
+}
+
+static void test_latency(void)
+{
+	struct stand_in_host *host = stand_in_host_start();
+	if (!host) {
+		fprintf(stderr, "Failed to start stand-in host\n");
+		failures++;
+		return;
+	}
+
+	struct sockaddr_in addr = {
+		.sin_family = AF_INET,
+		.sin_port = htons((uint16_t)host->input_port),
+		.sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+	};
+	int fd = socket(AF_INET, SOCK_DGRAM, 0);
+	if (fd < 0 || connect(fd, (struct sockaddr *)&addr, sizeof(addr))) {
+		fprintf(stderr, "Failed to open input socket\n");
+		failures++;
+		return;
+	}
+
+	struct timeval timeout = {.tv_sec = 1};
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+	reset_capture();
+	pthread_t thread;
+	pthread_create(&thread, NULL, echo_thread, &fd);
+
+	struct input_sender *sender = input_sender_create(send_to_host, &fd);
+	input_sender_start(sender);
+
+	// Keys go out one by one, as soon as they happen
+	static uint64_t key_latency[KEY_EVENTS];
+	for (int i = 0; i < KEY_EVENTS; i++) {
+		uint64_t start = now_ns();
+		input_sender_key(sender, 'A', 0, (i & 1) == 0);
+		CHECK(wait_for_packets(i + 1));
+		key_latency[i] = packets[i].host_ns - start;
+		sleep_us(1000);
+	}
+
+	// Continuous motion at 1 kHz: the time until the host has this
+	// position or a newer one
+	static uint64_t issued[MOVE_EVENTS];
+	static uint64_t move_latency[MOVE_EVENTS];
+	reset_capture();
+	for (int x = 0; x < MOVE_EVENTS; x++) {
+		issued[x] = now_ns();
+		input_sender_mouse_move(sender, x, 0, 1280, 720);
+		sleep_us(1000);
+	}
+	sleep_us(50000);
+
+	int count = atomic_load(&packet_count);
+	int next = 0;
+	for (int i = 0; i < count; i++) {
+		int x = packet_be16(&packets[i], 8);
+		for (; next <= x && next < MOVE_EVENTS; next++)
+			move_latency[next] = packets[i].host_ns - issued[next];
+	}
+	CHECK(next == MOVE_EVENTS);
+
+	qsort(key_latency, KEY_EVENTS, sizeof(uint64_t), compare_u64);
+	qsort(move_latency, next, sizeof(uint64_t), compare_u64);
+
+	printf("Key to host: median %llu us, max %llu us\n",
+	       (unsigned long long)(key_latency[KEY_EVENTS / 2] / 1000),
+	       (unsigned long long)(key_latency[KEY_EVENTS - 1] / 1000));
+	int p99 = next * 99 / 100;
+	if (next > 0)
+		printf("Motion to host: median %llu us, p99 %llu us, "
+		       "max %llu us (%d packets for %d events)\n",
+		       (unsigned long long)(move_latency[next / 2] / 1000),
+		       (unsigned long long)(move_latency[p99] / 1000),
+		       (unsigned long long)(move_latency[next - 1] / 1000),
+		       count, MOVE_EVENTS);
+
+	CHECK(key_latency[KEY_EVENTS / 2] < MAX_KEY_LATENCY_NS);
+
+	// A position goes out as soon as the previous packet is sent
+	CHECK(next > 0 && move_latency[p99] < MAX_MOTION_LATENCY_NS);
+
+	input_sender_destroy(sender);
+	shutdown(fd, SHUT_RDWR);
+	pthread_join(thread, NULL);
+	close(fd);
+}
+
+int main(void)
+{
+	test_packets();
+	test_merge_motion();
+	test_release_all();
+	test_latency();
+
+	if (failures) {
+		fprintf(stderr, "Input sender test: %d failure(s)\n",
+			failures);
+		return 1;
+	}
+
+	printf("Moonlight OBS Plugin - Input sender test passed\n");
+	return 0;
+}
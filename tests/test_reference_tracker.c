@@ -0,0 +1,315 @@
+/*
+ * Reference frame invalidation test for Moonlight OBS Plugin
+ * Drives the reference tracker from a simulated host with injected loss
+ */
+
+#include "reference-tracker.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define FRAME_INTERVAL_NS 16666666ULL
+#define FRAME_COUNT 600
+
+// Simulated host that honours recovery requests on the next frame it encodes
+struct test_host {
+	bool supports_rfi;
+	uint32_t frame_number;
+	bool send_idr;
+	bool send_recovery;
+};
+
+static int failures;
+
+#define CHECK(cond)                                                      \
+	do {                                                             \
+		if (!(cond)) {                                           \
+			fprintf(stderr, "%s:%d: check failed: %s\n",     \
+				__FILE__, __LINE__, #cond);              \
+			failures++;                                      \
+		}                                                        \
+	} while (0)
+
+static uint32_t host_next_flags(struct test_host *host)
+{
+	uint32_t flags = 0;
+
+	if (host->frame_number == 0 || host->send_idr)
+		flags |= MOONLIGHT_FRAME_IDR;
+	else if (host->send_recovery)
+		flags |= MOONLIGHT_FRAME_RECOVERY;
+
+	host->send_idr = false;
+	host->send_recovery = false;
+	return flags;
+}
+
+static void host_handle_request(struct test_host *host,
+				const struct reference_request *request)
+{
+	if (request->type == REFERENCE_REQUEST_IDR)
+		host->send_idr = true;
+	else if (request->type == REFERENCE_REQUEST_INVALIDATE)
+		host->send_recovery = true;
+}
+
+// Runs a stream through the tracker, dropping every frame for which
+// lose() returns true
+static void run_stream(struct reference_tracker *tracker,
+		       struct test_host *host, bool (*lose)(uint32_t))
+{
+	uint64_t now = 0;
+
+	for (uint32_t i = 0; i < FRAME_COUNT; i++) {
+		host->frame_number = i;
+		uint32_t flags = host_next_flags(host);
+		now += FRAME_INTERVAL_NS;
+
+		if (lose(i))
+			continue;
+
+		struct reference_request request;
+		reference_tracker_frame(tracker, i, flags, now, &request);
+		host_handle_request(host, &request);
+	}
+}
+
+static bool lose_bursts(uint32_t frame)
+{
+	// Two frames lost every 100 frames
+	return frame % 100 == 50 || frame % 100 == 51;
+}
+
+static bool lose_none(uint32_t frame)
+{
+	(void)frame;
+	return false;
+}
+
+static void test_invalidation(void)
+{
+	struct reference_tracker tracker;
+	struct test_host host = {.supports_rfi = true};
+
+	reference_tracker_init(&tracker, true);
+	run_stream(&tracker, &host, lose_bursts);
+
+	CHECK(tracker.frames_lost == 12);
+	CHECK(tracker.rfi_requests == 6);
+	CHECK(tracker.idr_requests == 0);
+	CHECK(tracker.recoveries == 6);
+	CHECK(!tracker.recovering);
+	// The host answers with the frame after the one that exposed the loss
+	CHECK(tracker.max_recovery_ns == FRAME_INTERVAL_NS);
+}
+
+static void test_invalidation_range(void)
+{
+	struct reference_tracker tracker;
+	struct reference_request request;
+
+	reference_tracker_init(&tracker, true);
+	reference_tracker_frame(&tracker, 0, MOONLIGHT_FRAME_IDR, 1, &request);
+	CHECK(request.type == REFERENCE_REQUEST_NONE);
+
+	CHECK(reference_tracker_frame(&tracker, 1, 0, 2, &request) ==
+	      REFERENCE_ACTION_DECODE);
+
+	// Frames 2-4 lost
+	CHECK(reference_tracker_frame(&tracker, 5, 0, 3, &request) ==
+	      REFERENCE_ACTION_DROP);
+	CHECK(request.type == REFERENCE_REQUEST_INVALIDATE);
+	CHECK(request.first_frame == 2);
+	CHECK(request.last_frame == 5);
+
+	// Frames encoded before the host saw the request are dropped
+	CHECK(reference_tracker_frame(&tracker, 6, 0, 4, &request) ==
+	      REFERENCE_ACTION_DROP);
+	CHECK(request.type == REFERENCE_REQUEST_NONE);
+
+	CHECK(reference_tracker_frame(&tracker, 7, MOONLIGHT_FRAME_RECOVERY, 5,
+				      &request) == REFERENCE_ACTION_DECODE);
+	CHECK(reference_tracker_frame(&tracker, 8, 0, 6, &request) ==
+	      REFERENCE_ACTION_DECODE);
+	CHECK(tracker.recoveries == 1);
+	CHECK(tracker.last_recovery_ns == 2);
+
+	// Late duplicate
+	CHECK(reference_tracker_frame(&tracker, 3, 0, 7, &request) ==
+	      REFERENCE_ACTION_DROP);
+	CHECK(request.type == REFERENCE_REQUEST_NONE);
+}
+
+static void test_idr_fallback(void)
+{
+	struct reference_tracker tracker;
+	struct test_host host = {.supports_rfi = false};
+
+	reference_tracker_init(&tracker, false);
+	run_stream(&tracker, &host, lose_bursts);
+
+	CHECK(tracker.frames_lost == 12);
+	CHECK(tracker.rfi_requests == 0);
+	CHECK(tracker.idr_requests == 6);
+	CHECK(tracker.recoveries == 6);
+}
+
+static void test_recovery_timeout(void)
+{
+	struct reference_tracker tracker;
+	struct reference_request request;
+	uint64_t now = 0;
+
+	reference_tracker_init(&tracker, true);
+	reference_tracker_frame(&tracker, 0, MOONLIGHT_FRAME_IDR, now,
+				&request);
+
+	// Frame 1 lost, host never answers the invalidation request
+	now += FRAME_INTERVAL_NS;
+	reference_tracker_frame(&tracker, 2, 0, now, &request);
+	CHECK(request.type == REFERENCE_REQUEST_INVALIDATE);
+
+	uint32_t frame = 3;
+	while (request.type != REFERENCE_REQUEST_IDR && frame < 100) {
+		now += FRAME_INTERVAL_NS;
+		reference_tracker_frame(&tracker, frame++, 0, now, &request);
+	}
+
+	CHECK(request.type == REFERENCE_REQUEST_IDR);
+	CHECK(tracker.idr_requests == 1);
+
+	now += FRAME_INTERVAL_NS;
+	CHECK(reference_tracker_frame(&tracker, frame, MOONLIGHT_FRAME_IDR, now,
+				      &request) == REFERENCE_ACTION_DECODE);
+	CHECK(tracker.recoveries == 1);
+}
+
+static void test_startup_without_idr(void)
+{
+	struct reference_tracker tracker;
+	struct reference_request request;
+
+	reference_tracker_init(&tracker, true);
+	CHECK(reference_tracker_frame(&tracker, 10, 0, 0, &request) ==
+	      REFERENCE_ACTION_DROP);
+	CHECK(request.type == REFERENCE_REQUEST_IDR);
+
+	// Only one request while it is outstanding
+	CHECK(reference_tracker_frame(&tracker, 11, 0, 1, &request) ==
+	      REFERENCE_ACTION_DROP);
+	CHECK(request.type == REFERENCE_REQUEST_NONE);
+}
+
+static void test_concealment(void)
+{
+	struct reference_tracker tracker;
+	struct reference_request request;
+
+	reference_tracker_init(&tracker, true);
+	tracker.conceal = true;
+	reference_tracker_frame(&tracker, 0, MOONLIGHT_FRAME_IDR, 1, &request);
+
+	// Frame 1 lost, the damaged chain keeps being decoded
+	CHECK(reference_tracker_frame(&tracker, 2, 0, 2, &request) ==
+	      REFERENCE_ACTION_CONCEAL);
+	CHECK(request.type == REFERENCE_REQUEST_INVALIDATE);
+	CHECK(reference_tracker_frame(&tracker, 3, 0, 3, &request) ==
+	      REFERENCE_ACTION_CONCEAL);
+	CHECK(reference_tracker_frame(&tracker, 4, MOONLIGHT_FRAME_RECOVERY, 4,
+				      &request) == REFERENCE_ACTION_DECODE);
+	CHECK(tracker.frames_concealed == 2);
+	CHECK(tracker.frames_dropped == 0);
+	CHECK(tracker.recoveries == 1);
+
+	// Frame 5 arrives with missing slices, only it is invalidated
+	CHECK(reference_tracker_frame(&tracker, 5, MOONLIGHT_FRAME_INCOMPLETE,
+				      5, &request) == REFERENCE_ACTION_CONCEAL);
+	CHECK(request.type == REFERENCE_REQUEST_INVALIDATE);
+	CHECK(request.first_frame == 5);
+	CHECK(request.last_frame == 5);
+	CHECK(tracker.frames_lost == 1);
+
+	// Slice decode mode reports missing slices after the first slice
+	CHECK(reference_tracker_frame(&tracker, 6, MOONLIGHT_FRAME_RECOVERY, 6,
+				      &request) == REFERENCE_ACTION_DECODE);
+	CHECK(reference_tracker_frame_incomplete(&tracker, 6, 7, &request) ==
+	      REFERENCE_ACTION_CONCEAL);
+	CHECK(request.type == REFERENCE_REQUEST_INVALIDATE);
+	CHECK(request.first_frame == 6);
+}
+
+static void test_concealment_idr_fallback(void)
+{
+	struct reference_tracker tracker;
+	struct reference_request request;
+
+	reference_tracker_init(&tracker, false);
+	tracker.conceal = true;
+	reference_tracker_frame(&tracker, 0, MOONLIGHT_FRAME_IDR, 1, &request);
+
+	// Without RFI, frames are still shown until the IDR frame arrives
+	CHECK(reference_tracker_frame(&tracker, 2, 0, 2, &request) ==
+	      REFERENCE_ACTION_CONCEAL);
+	CHECK(request.type == REFERENCE_REQUEST_IDR);
+	CHECK(reference_tracker_frame(&tracker, 3, 0, 3, &request) ==
+	      REFERENCE_ACTION_CONCEAL);
+	CHECK(request.type == REFERENCE_REQUEST_NONE);
+	CHECK(reference_tracker_frame(&tracker, 4, MOONLIGHT_FRAME_IDR, 4,
+				      &request) == REFERENCE_ACTION_DECODE);
+	CHECK(tracker.recoveries == 1);
+	CHECK(tracker.frames_dropped == 0);
+}
+
+static void test_incomplete_without_concealment(void)
+{
+	struct reference_tracker tracker;
+	struct reference_request request;
+
+	reference_tracker_init(&tracker, true);
+	reference_tracker_frame(&tracker, 0, MOONLIGHT_FRAME_IDR, 1, &request);
+
+	CHECK(reference_tracker_frame(&tracker, 1, MOONLIGHT_FRAME_INCOMPLETE,
+				      2, &request) == REFERENCE_ACTION_DROP);
+	CHECK(request.type == REFERENCE_REQUEST_INVALIDATE);
+	CHECK(reference_tracker_frame(&tracker, 2, 0, 3, &request) ==
+	      REFERENCE_ACTION_DROP);
+	CHECK(reference_tracker_frame(&tracker, 3, MOONLIGHT_FRAME_RECOVERY, 4,
+				      &request) == REFERENCE_ACTION_DECODE);
+	CHECK(tracker.frames_dropped == 2);
+}
+
+static void test_clean_stream(void)
+{
+	struct reference_tracker tracker;
+	struct test_host host = {.supports_rfi = true};
+
+	reference_tracker_init(&tracker, true);
+	run_stream(&tracker, &host, lose_none);
+
+	CHECK(tracker.frames_lost == 0);
+	CHECK(tracker.frames_dropped == 0);
+	CHECK(tracker.rfi_requests == 0);
+	CHECK(tracker.idr_requests == 0);
+}
+
+int main(void)
+{
+	test_invalidation();
+	test_invalidation_range();
+	test_idr_fallback();
+	test_recovery_timeout();
+	test_startup_without_idr();
+	test_concealment();
+	test_concealment_idr_fallback();
+	test_incomplete_without_concealment();
+	test_clean_stream();
+
+	if (failures) {
+		fprintf(stderr, "Reference tracker test: %d failure(s)\n",
+			failures);
+		return 1;
+	}
+
+	printf("Moonlight OBS Plugin - Reference tracker test passed\n");
+	return 0;
+}
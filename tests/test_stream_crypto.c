@@ -0,0 +1,253 @@
+/*
+ * Stream decryption test for Moonlight OBS Plugin
+ * Decrypts known-answer packets (NIST GCM test case 3 for video, an
+ * OpenSSL-generated CBC vector for audio), checks that tampered and
+ * malformed packets are counted and dropped without touching the rest of
+ * the batch, and measures batch throughput
+ */
+
+#include "stream-crypto.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Size of a full video packet and of a receive batch in the client
+#define BENCH_PACKET_SIZE 1392
+#define BENCH_BATCH_SIZE 32
+#define BENCH_BATCHES 20000
+
+static int failures;
+
+#define CHECK(cond)                                                      \
+	do {                                                             \
+		if (!(cond)) {                                           \
+			fprintf(stderr, "%s:%d: check failed: %s\n",     \
+				__FILE__, __LINE__, #cond);              \
+			failures++;                                      \
+		}                                                        \
+	} while (0)
+
+static const uint8_t key[STREAM_CRYPTO_KEY_SIZE] = {
+	0xfe, 0xff, 0xe9, 0x92, 0x86, 0x65, 0x73, 0x1c,
+	0x6d, 0x6a, 0x8f, 0x94, 0x67, 0x30, 0x83, 0x08,
+};
+
+static const uint8_t gcm_iv[VIDEO_CRYPTO_IV_SIZE] = {
+	0xca, 0xfe, 0xba, 0xbe, 0xfa, 0xce, 0xdb, 0xad, 0xde, 0xca, 0xf8, 0x88,
+};
+
+static const uint8_t gcm_plaintext[64] = {
+	0xd9, 0x31, 0x32, 0x25, 0xf8, 0x84, 0x06, 0xe5, 0xa5, 0x59, 0x09,
+	0xc5, 0xaf, 0xf5, 0x26, 0x9a, 0x86, 0xa7, 0xa9, 0x53, 0x15, 0x34,
+	0xf7, 0xda, 0x2e, 0x4c, 0x30, 0x3d, 0x8a, 0x31, 0x8a, 0x72, 0x1c,
+	0x3c, 0x0c, 0x95, 0x95, 0x68, 0x09, 0x53, 0x2f, 0xcf, 0x0e, 0x24,
+	0x49, 0xa6, 0xb5, 0x25, 0xb1, 0x6a, 0xed, 0xf5, 0xaa, 0x0d, 0xe6,
+	0x57, 0xba, 0x63, 0x7b, 0x39, 0x1a, 0xaf, 0xd2, 0x55,
+};
+
+static const uint8_t gcm_ciphertext[64] = {
+	0x42, 0x83, 0x1e, 0xc2, 0x21, 0x77, 0x74, 0x24, 0x4b, 0x72, 0x21,
+	0xb7, 0x84, 0xd0, 0xd4, 0x9c, 0xe3, 0xaa, 0x21, 0x2f, 0x2c, 0x02,
+	0xa4, 0xe0, 0x35, 0xc1, 0x7e, 0x23, 0x29, 0xac, 0xa1, 0x2e, 0x21,
+	0xd5, 0x14, 0xb2, 0x54, 0x66, 0x93, 0x1c, 0x7d, 0x8f, 0x6a, 0x5a,
+	0xac, 0x84, 0xaa, 0x05, 0x1b, 0xa3, 0x0b, 0x39, 0x6a, 0x0a, 0xac,
+	0x97, 0x3d, 0x58, 0xe0, 0x91, 0x47, 0x3f, 0x59, 0x85,
+};
+
+static const uint8_t gcm_tag[VIDEO_CRYPTO_TAG_SIZE] = {
+	0x4d, 0x5c, 0x2a, 0xf3, 0x27, 0xcd, 0x64, 0xa6,
+	0x2c, 0xf3, 0x5a, 0xbd, 0x2b, 0xa6, 0xfa, 0xb4,
+};
+
+// openssl enc -aes-128-cbc -K <key> -iv 1234577A000000000000000000000000
+// of the bytes 0..19: key ID 0x12345678 plus RTP sequence 0x0102
+#define AUDIO_KEY_ID 0x12345678
+#define AUDIO_SEQUENCE 0x0102
+
+static const uint8_t cbc_ciphertext[32] = {
+	0xec, 0x1b, 0xec, 0x0f, 0xbd, 0xa2, 0xae, 0x9c, 0xcf, 0x2a, 0x34,
+	0xf9, 0xb2, 0xf1, 0x14, 0x6b, 0x47, 0x22, 0x8b, 0xf3, 0xab, 0x0f,
+	0x19, 0x21, 0xc4, 0xf2, 0x31, 0xd8, 0x56, 0x57, 0x00, 0xbf,
+};
+
+// Encrypted video packet: IV, frame number, tag, ciphertext
+static size_t build_video_packet(uint8_t *packet)
+{
+	memcpy(packet, gcm_iv, sizeof(gcm_iv));
+	memset(packet + VIDEO_CRYPTO_IV_SIZE, 0x2a, 4);
+	memcpy(packet + VIDEO_CRYPTO_IV_SIZE + 4, gcm_tag, sizeof(gcm_tag));
+	memcpy(packet + VIDEO_CRYPTO_HEADER_SIZE, gcm_ciphertext,
+	       sizeof(gcm_ciphertext));
+	return VIDEO_CRYPTO_HEADER_SIZE + sizeof(gcm_ciphertext);
+}
+
+// Encrypted audio packet: RTP header in the clear, ciphertext
+static size_t build_audio_packet(uint8_t *packet)
+{
+	memset(packet, 0, AUDIO_RTP_HEADER_SIZE);
+	packet[0] = 0x80;
+	packet[1] = 97;
+	packet[2] = AUDIO_SEQUENCE >> 8;
+	packet[3] = AUDIO_SEQUENCE & 0xff;
+	memcpy(packet + AUDIO_RTP_HEADER_SIZE, cbc_ciphertext,
+	       sizeof(cbc_ciphertext));
+	return AUDIO_RTP_HEADER_SIZE + sizeof(cbc_ciphertext);
+}
+
+static void test_video_known_answer(void)
+{
+	struct stream_crypto crypto;
+	CHECK(stream_crypto_init(&crypto, STREAM_ENCRYPT_VIDEO, key, 0));
+
+	uint8_t buffer[128];
+	struct stream_packet packet = {buffer, build_video_packet(buffer)};
+
+	CHECK(stream_crypto_decrypt_video(&crypto, &packet, 1) == 1);
+	CHECK(packet.data == buffer + VIDEO_CRYPTO_HEADER_SIZE);
+	CHECK(packet.size == sizeof(gcm_plaintext));
+	CHECK(memcmp(packet.data, gcm_plaintext, sizeof(gcm_plaintext)) == 0);
+	CHECK(crypto.packets_decrypted == 1);
+	CHECK(crypto.auth_failures == 0);
+
+	// Not set up for audio
+	CHECK(stream_crypto_decrypt_audio(&crypto, &packet, 1) == 0);
+
+	stream_crypto_free(&crypto);
+}
+
+static void test_audio_known_answer(void)
+{
+	struct stream_crypto crypto;
+	CHECK(stream_crypto_init(&crypto, STREAM_ENCRYPT_AUDIO, key,
+				 AUDIO_KEY_ID));
+
+	uint8_t buffer[64];
+	struct stream_packet packet = {buffer, build_audio_packet(buffer)};
+
+	CHECK(stream_crypto_decrypt_audio(&crypto, &packet, 1) == 1);
+	CHECK(packet.data == buffer);
+	CHECK(packet.size == AUDIO_RTP_HEADER_SIZE + 20);
+	CHECK(buffer[2] == AUDIO_SEQUENCE >> 8);
+
+	bool payload_ok = true;
+	for (int i = 0; i < 20; i++)
+		payload_ok &= buffer[AUDIO_RTP_HEADER_SIZE + i] == i;
+	CHECK(payload_ok);
+
+	stream_crypto_free(&crypto);
+}
+
+// Bad packets are dropped and counted, the rest of the batch decrypts
+static void test_mixed_batch(void)
+{
+	struct stream_crypto crypto;
+	CHECK(stream_crypto_init(&crypto,
+				 STREAM_ENCRYPT_VIDEO | STREAM_ENCRYPT_AUDIO,
+				 key, AUDIO_KEY_ID));
+
+	uint8_t video[5][128];
+	struct stream_packet packets[5];
+	for (int i = 0; i < 5; i++)
+		packets[i] = (struct stream_packet){
+			video[i], build_video_packet(video[i])};
+
+	video[1][VIDEO_CRYPTO_HEADER_SIZE + 10] ^= 0x01; // ciphertext
+	video[2][VIDEO_CRYPTO_IV_SIZE + 4] ^= 0x80;      // tag
+	packets[3].size = VIDEO_CRYPTO_HEADER_SIZE;      // no payload
+
+	CHECK(stream_crypto_decrypt_video(&crypto, packets, 5) == 2);
+	CHECK(packets[0].size == sizeof(gcm_plaintext));
+	CHECK(packets[1].size == 0);
+	CHECK(packets[2].size == 0);
+	CHECK(packets[3].size == 0);
+	CHECK(packets[4].size == sizeof(gcm_plaintext));
+	CHECK(memcmp(packets[4].data, gcm_plaintext,
+		     sizeof(gcm_plaintext)) == 0);
+	CHECK(crypto.auth_failures == 2);
+	CHECK(crypto.malformed == 1);
+
+	// Audio: corrupted padding, not a whole block. CBC has no tag, a bad
+	// first block only garbles its own plaintext.
+	uint8_t audio[3][64];
+	struct stream_packet audio_packets[3];
+	for (int i = 0; i < 3; i++)
+		audio_packets[i] = (struct stream_packet){
+			audio[i], build_audio_packet(audio[i])};
+
+	audio[1][AUDIO_RTP_HEADER_SIZE + 15] ^= 0x01;
+	audio_packets[2].size -= 1;
+
+	CHECK(stream_crypto_decrypt_audio(&crypto, audio_packets, 3) == 1);
+	CHECK(audio_packets[0].size == AUDIO_RTP_HEADER_SIZE + 20);
+	CHECK(audio_packets[1].size == 0);
+	CHECK(audio_packets[2].size == 0);
+	CHECK(crypto.packets_decrypted == 3);
+	CHECK(crypto.auth_failures == 3);
+	CHECK(crypto.malformed == 2);
+
+	stream_crypto_free(&crypto);
+}
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+// Decryption throughput for full video packets, a receive batch at a time.
+// The packets carry no valid tag, so each is fully decrypted and then fails
+// authentication: the same work as a good packet.
+static void benchmark_video(void)
+{
+	struct stream_crypto crypto;
+	CHECK(stream_crypto_init(&crypto, STREAM_ENCRYPT_VIDEO, key, 0));
+
+	uint8_t *buffer = malloc(BENCH_BATCH_SIZE * BENCH_PACKET_SIZE);
+	for (size_t i = 0; i < BENCH_BATCH_SIZE * BENCH_PACKET_SIZE; i++)
+		buffer[i] = (uint8_t)(i * 31);
+
+	struct stream_packet packets[BENCH_BATCH_SIZE];
+	uint64_t start = now_ns();
+
+	for (int batch = 0; batch < BENCH_BATCHES; batch++) {
+		for (int i = 0; i < BENCH_BATCH_SIZE; i++)
+			packets[i] = (struct stream_packet){
+				buffer + i * BENCH_PACKET_SIZE,
+				BENCH_PACKET_SIZE};
+		stream_crypto_decrypt_video(&crypto, packets,
+					    BENCH_BATCH_SIZE);
+	}
+
+	uint64_t elapsed = now_ns() - start;
+	double bytes = (double)BENCH_BATCHES * BENCH_BATCH_SIZE *
+		       (BENCH_PACKET_SIZE - VIDEO_CRYPTO_HEADER_SIZE);
+
+	printf("Video decryption: %.0f MB/s, %.0f ns per packet\n",
+	       bytes / ((double)elapsed / 1e9) / 1e6,
+	       (double)elapsed / (BENCH_BATCHES * BENCH_BATCH_SIZE));
+
+	CHECK(crypto.packets_decrypted + crypto.auth_failures ==
+	      (uint64_t)BENCH_BATCHES * BENCH_BATCH_SIZE);
+
+	free(buffer);
+	stream_crypto_free(&crypto);
+}
+
+int main(void)
+{
+	test_video_known_answer();
+	test_audio_known_answer();
+	test_mixed_batch();
+	benchmark_video();
+
+	if (failures) {
+		fprintf(stderr, "Stream crypto test: %d failure(s)\n",
+			failures);
+		return 1;
+	}
+
+	printf("Moonlight OBS Plugin - Stream crypto test passed\n");
+	return 0;
+}
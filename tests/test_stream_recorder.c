@@ -0,0 +1,316 @@
+/*
+ * Passthrough recording test for Moonlight OBS Plugin
+ * Records an encoded stream into segmented MKV and fragmented MP4 files and
+ * reads them back: every file must start with an IDR frame and hold the
+ * packets exactly as they were received, with host timestamps
+ */
+
+#include "stream-recorder.h"
+#include "reference-tracker.h"
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+#include <libavutil/opt.h>
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define WIDTH 320
+#define HEIGHT 180
+#define FPS 30
+#define SEGMENT_SECONDS 1
+#define RECORD_FRAMES (FPS * 7 / 2)
+
+// 20 ms CELT, stereo, one frame per packet
+#define OPUS_PACKET_SAMPLES 960
+
+static int failures;
+
+#define CHECK(cond)                                                      \
+	do {                                                             \
+		if (!(cond)) {                                           \
+			fprintf(stderr, "%s:%d: check failed: %s\n",     \
+				__FILE__, __LINE__, #cond);              \
+			failures++;                                      \
+		}                                                        \
+	} while (0)
+
+static void test_opus_samples(void)
+{
+	// Code 0: one frame of the configured duration
+	CHECK(stream_recorder_opus_samples((const uint8_t[]){0x9C}, 1) ==
+	      960);
+	CHECK(stream_recorder_opus_samples((const uint8_t[]){0x8C}, 1) ==
+	      240);
+	CHECK(stream_recorder_opus_samples((const uint8_t[]){0x08}, 1) ==
+	      960);
+	CHECK(stream_recorder_opus_samples((const uint8_t[]){0x18}, 1) ==
+	      2880);
+	CHECK(stream_recorder_opus_samples((const uint8_t[]){0x60}, 1) ==
+	      480);
+
+	// Codes 1 and 2: two frames, code 3: count in the second byte
+	CHECK(stream_recorder_opus_samples((const uint8_t[]){0x9D}, 1) ==
+	      1920);
+	CHECK(stream_recorder_opus_samples((const uint8_t[]){0x9E}, 1) ==
+	      1920);
+	CHECK(stream_recorder_opus_samples((const uint8_t[]){0x8F, 0x03},
+					   2) == 720);
+
+	// Malformed: missing count byte, more than 120 ms
+	CHECK(stream_recorder_opus_samples((const uint8_t[]){0x8F}, 1) == 0);
+	CHECK(stream_recorder_opus_samples((const uint8_t[]){0x9F, 0x07},
+					   2) == 0);
+	CHECK(stream_recorder_opus_samples(NULL, 0) == 0);
+}
+
+struct encoder {
+	AVCodecContext *ctx;
+	AVFrame *frame;
+	AVPacket *packet;
+};
+
+static bool encoder_init(struct encoder *enc)
+{
+	const AVCodec *codec = avcodec_find_encoder_by_name("libx264");
+	if (!codec)
+		return false;
+
+	// Like a GameStream host: no periodic keyframes, IDR on request
+	enc->ctx = avcodec_alloc_context3(codec);
+	enc->ctx->width = WIDTH;
+	enc->ctx->height = HEIGHT;
+	enc->ctx->time_base = (AVRational){1, FPS};
+	enc->ctx->pix_fmt = AV_PIX_FMT_YUV420P;
+	enc->ctx->gop_size = INT32_MAX;
+	enc->ctx->max_b_frames = 0;
+	av_opt_set(enc->ctx->priv_data, "preset", "ultrafast", 0);
+	av_opt_set(enc->ctx->priv_data, "tune", "zerolatency", 0);
+	av_opt_set(enc->ctx->priv_data, "forced-idr", "1", 0);
+
+	if (avcodec_open2(enc->ctx, codec, NULL) < 0)
+		return false;
+
+	enc->frame = av_frame_alloc();
+	enc->frame->width = WIDTH;
+	enc->frame->height = HEIGHT;
+	enc->frame->format = AV_PIX_FMT_YUV420P;
+	av_frame_get_buffer(enc->frame, 0);
+	enc->packet = av_packet_alloc();
+	return true;
+}
+
+static void encoder_free(struct encoder *enc)
+{
+	av_packet_free(&enc->packet);
+	av_frame_free(&enc->frame);
+	avcodec_free_context(&enc->ctx);
+}
+
+static bool encode(struct encoder *enc, int index, bool idr)
+{
+	av_frame_make_writable(enc->frame);
+	for (int plane = 0; plane < 3; plane++) {
+		int height = plane ? HEIGHT / 2 : HEIGHT;
+		memset(enc->frame->data[plane], (index * 5 + plane * 40) & 0xff,
+		       (size_t)enc->frame->linesize[plane] * height);
+	}
+
+	enc->frame->pts = index;
+	enc->frame->pict_type = idr ? AV_PICTURE_TYPE_I : AV_PICTURE_TYPE_NONE;
+
+	return avcodec_send_frame(enc->ctx, enc->frame) == 0 &&
+	       avcodec_receive_packet(enc->ctx, enc->packet) == 0;
+}
+
+struct file_result {
+	int video_packets;
+	int audio_packets;
+	bool starts_with_idr;
+	bool timestamps_increase;
+	int64_t first_video_pts;
+};
+
+static bool read_file(const char *path, struct file_result *result)
+{
+	AVFormatContext *input = NULL;
+	memset(result, 0, sizeof(*result));
+	result->timestamps_increase = true;
+	result->first_video_pts = AV_NOPTS_VALUE;
+
+	if (avformat_open_input(&input, path, NULL, NULL) < 0)
+		return false;
+
+	AVPacket *packet = av_packet_alloc();
+	int64_t last_pts[2] = {AV_NOPTS_VALUE, AV_NOPTS_VALUE};
+
+	while (av_read_frame(input, packet) >= 0) {
+		AVStream *stream = input->streams[packet->stream_index];
+		bool video = stream->codecpar->codec_type == AVMEDIA_TYPE_VIDEO;
+		int index = video ? 0 : 1;
+
+		if (video) {
+			if (!result->video_packets) {
+				result->starts_with_idr =
+					(packet->flags & AV_PKT_FLAG_KEY) != 0;
+				result->first_video_pts = av_rescale_q(
+					packet->pts, stream->time_base,
+					(AVRational){1, FPS});
+			}
+			result->video_packets++;
+		} else {
+			result->audio_packets++;
+		}
+
+		if (last_pts[index] != AV_NOPTS_VALUE &&
+		    packet->pts <= last_pts[index])
+			result->timestamps_increase = false;
+		last_pts[index] = packet->pts;
+
+		av_packet_unref(packet);
+	}
+
+	av_packet_free(&packet);
+	avformat_close_input(&input);
+	return true;
+}
+
+static void test_recording(enum stream_recorder_format format,
+			   const char *extension)
+{
+	char directory[] = "/tmp/moonlight-recorder-XXXXXX";
+	if (!mkdtemp(directory)) {
+		CHECK(false);
+		return;
+	}
+
+	struct encoder enc = {0};
+	if (!encoder_init(&enc)) {
+		printf("libx264 not available, recording test skipped\n");
+		encoder_free(&enc);
+		rmdir(directory);
+		return;
+	}
+
+	struct stream_recorder *recorder = stream_recorder_create();
+	struct stream_recorder_config config = {
+		.directory = directory,
+		.format = format,
+		.segment_seconds = SEGMENT_SECONDS,
+		.width = WIDTH,
+		.height = HEIGHT,
+		.fps = FPS,
+		.sample_rate = 48000,
+		.channels = 2,
+	};
+
+	// The stream is already running when recording starts
+	int frame = 0;
+	for (; frame < 10; frame++)
+		CHECK(encode(&enc, frame, false));
+
+	CHECK(stream_recorder_start(recorder, &config));
+	CHECK(stream_recorder_active(recorder));
+
+	static const uint8_t opus_packet[] = {0x9C, 0xFF, 0xFE, 0x01};
+	int64_t audio_samples = 0;
+	int idr_requests = 0;
+	int frames_recorded = 0;
+	bool want_idr = false;
+
+	for (int i = 0; i < RECORD_FRAMES; i++, frame++) {
+		CHECK(encode(&enc, frame, want_idr));
+		bool idr = (enc.packet->flags & AV_PKT_FLAG_KEY) != 0;
+		CHECK(idr == want_idr);
+
+		stream_recorder_write_video(recorder, (uint32_t)frame,
+					    idr ? MOONLIGHT_FRAME_IDR : 0,
+					    enc.packet->data,
+					    (size_t)enc.packet->size);
+		if (idr || frames_recorded)
+			frames_recorded++;
+		av_packet_unref(enc.packet);
+
+		want_idr = stream_recorder_keyframe_wanted(recorder);
+		if (want_idr)
+			idr_requests++;
+
+		// Audio up to the end of this frame
+		while (audio_samples * FPS < (int64_t)(i + 1) * 48000) {
+			stream_recorder_write_audio(recorder, opus_packet,
+						    sizeof(opus_packet));
+			audio_samples += OPUS_PACKET_SAMPLES;
+		}
+	}
+
+	stream_recorder_stop(recorder);
+	CHECK(!stream_recorder_active(recorder));
+
+	struct stream_recorder_stats stats;
+	stream_recorder_get_stats(recorder, &stats);
+	stream_recorder_destroy(recorder);
+	encoder_free(&enc);
+
+	// One request to start, then one per segment
+	int segments = (RECORD_FRAMES - 2) / (SEGMENT_SECONDS * FPS) + 1;
+	CHECK(idr_requests == segments);
+	CHECK(stats.segments == (uint64_t)segments);
+	CHECK(stats.video_packets == (uint64_t)frames_recorded);
+	CHECK(stats.packets_dropped == 0);
+	CHECK(stats.write_errors == 0);
+
+	// Read every file back
+	DIR *dir = opendir(directory);
+	struct dirent *entry;
+	int files = 0, video_packets = 0, audio_packets = 0;
+
+	while (dir && (entry = readdir(dir))) {
+		const char *dot = strrchr(entry->d_name, '.');
+		if (!dot || strcmp(dot + 1, extension) != 0)
+			continue;
+
+		char path[512];
+		snprintf(path, sizeof(path), "%s/%s", directory,
+			 entry->d_name);
+
+		struct file_result result;
+		CHECK(read_file(path, &result));
+		CHECK(result.starts_with_idr);
+		CHECK(result.timestamps_increase);
+		CHECK(result.first_video_pts == 0);
+		CHECK(result.audio_packets > 0);
+
+		files++;
+		video_packets += result.video_packets;
+		audio_packets += result.audio_packets;
+		unlink(path);
+	}
+
+	if (dir)
+		closedir(dir);
+	rmdir(directory);
+
+	printf("%s: %d files, %d video and %d audio packets\n", extension,
+	       files, video_packets, audio_packets);
+
+	CHECK(files == segments);
+	CHECK(video_packets == frames_recorded);
+	CHECK((uint64_t)audio_packets == stats.audio_packets);
+}
+
+int main(void)
+{
+	test_opus_samples();
+	test_recording(STREAM_RECORDER_MKV, "mkv");
+	test_recording(STREAM_RECORDER_FMP4, "mp4");
+
+	if (failures) {
+		fprintf(stderr, "Stream recorder test: %d failure(s)\n",
+			failures);
+		return 1;
+	}
+
+	printf("Moonlight OBS Plugin - Stream recorder test passed\n");
+	return 0;
+}
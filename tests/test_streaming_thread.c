@@ -0,0 +1,296 @@
+/*
+ * Streaming thread test for Moonlight OBS Plugin
+ * Connects a client to a stand-in host, then checks that the streaming
+ * thread reacts to packets, reconfigure and stop commands, also while the
+ * handshake waits on a host that does not answer. Wake-up latencies and
+ * context switches while idle depend on the machine and are logged, not
+ * asserted.
+ */
+
+#include "moonlight-client.h"
+#include "moonlight-source.h"
+#include "handshake.h"
+#include "stand-in-host.h"
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define CYCLES 9
+#define IDLE_MS 300
+
+// A stop during the handshake must not wait for the host, whose requests
+// only time out after seconds: it has to take less than the time already
+// spent waiting
+#define CONNECT_STALL_MS 250
+
+static int failures;
+
+#define CHECK(cond)                                                      \
+	do {                                                             \
+		if (!(cond)) {                                           \
+			fprintf(stderr, "%s:%d: check failed: %s\n",     \
+				__FILE__, __LINE__, #cond);              \
+			failures++;                                      \
+		}                                                        \
+	} while (0)
+
+static atomic_int packets[MOONLIGHT_STREAM_COUNT];
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static void sleep_ms(int ms)
+{
+	struct timespec ts = {.tv_sec = ms / 1000,
+			      .tv_nsec = (long)(ms % 1000) * 1000000};
+	nanosleep(&ts, NULL);
+}
+
+static void on_packet(void *param, enum moonlight_stream stream,
+		      const uint8_t *data, size_t size)
+{
+	(void)param;
+	(void)data;
+	(void)size;
+	atomic_fetch_add(&packets[stream], 1);
+}
+
+static bool on_control(void *param, uint16_t type, const void *payload,
+		       size_t size)
+{
+	(void)param;
+	(void)type;
+	(void)payload;
+	(void)size;
+	return true;
+}
+
+static int open_udp(int *port)
+{
+	struct sockaddr_in addr = {
+		.sin_family = AF_INET,
+		.sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+	};
+	socklen_t len = sizeof(addr);
+
+	int fd = socket(AF_INET, SOCK_DGRAM, 0);
+	if (fd < 0 || bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+	    getsockname(fd, (struct sockaddr *)&addr, &len) < 0)
+		return -1;
+
+	struct timeval timeout = {.tv_sec = 2};
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+	*port = ntohs(addr.sin_port);
+	return fd;
+}
+
+// A host that takes connections into its backlog and never answers
+static int open_silent_host(int *port)
+{
+	struct sockaddr_in addr = {
+		.sin_family = AF_INET,
+		.sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+	};
+	socklen_t len = sizeof(addr);
+
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (fd < 0 || bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+	    listen(fd, 4) < 0 ||
+	    getsockname(fd, (struct sockaddr *)&addr, &len) < 0)
+		return -1;
+
+	*port = ntohs(addr.sin_port);
+	return fd;
+}
+
+// Waits for the client's ping and answers with a stream packet
+static bool answer_ping(int fd)
+{
+	struct sockaddr_storage from;
+	socklen_t len = sizeof(from);
+	char ping[16];
+
+	ssize_t size = recvfrom(fd, ping, sizeof(ping), 0,
+				(struct sockaddr *)&from, &len);
+	if (size != 4 || memcmp(ping, "PING", 4) != 0)
+		return false;
+
+	static const char packet[64] = "stream packet";
+	return sendto(fd, packet, sizeof(packet), 0, (struct sockaddr *)&from,
+		      len) == sizeof(packet);
+}
+
+// Drops pings still queued from a stream that was set up again
+static void drain(int fd)
+{
+	char buf[64];
+	while (recv(fd, buf, sizeof(buf), MSG_DONTWAIT) > 0)
+		;
+}
+
+static bool wait_for_packets(int video, int audio)
+{
+	for (int i = 0; i < 1000; i++) {
+		if (atomic_load(&packets[MOONLIGHT_STREAM_VIDEO]) >= video &&
+		    atomic_load(&packets[MOONLIGHT_STREAM_AUDIO]) >= audio)
+			return true;
+		sleep_ms(1);
+	}
+	return false;
+}
+
+static long voluntary_switches(void)
+{
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	return usage.ru_nvcsw;
+}
+
+static int compare_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a;
+	uint64_t y = *(const uint64_t *)b;
+	return x < y ? -1 : x > y;
+}
+
+int main(void)
+{
+	struct stand_in_host *host = stand_in_host_start();
+	if (!host) {
+		fprintf(stderr, "Failed to start stand-in host\n");
+		return 1;
+	}
+
+	int video_port, audio_port;
+	int video_fd = open_udp(&video_port);
+	int audio_fd = open_udp(&audio_port);
+	if (video_fd < 0 || audio_fd < 0) {
+		fprintf(stderr, "Failed to open stream sockets\n");
+		return 1;
+	}
+	atomic_store(&host->video_port, video_port);
+	atomic_store(&host->audio_port, audio_port);
+
+	handshake_global_init();
+
+	struct moonlight_source source = {
+		.width = 1280,
+		.height = 720,
+		.fps = 60,
+		.bitrate = 10000,
+	};
+	pthread_mutex_init(&source.mutex, NULL);
+
+	struct moonlight_client *client = moonlight_client_create(&source);
+	client->receive_packet = on_packet;
+	client->send_control = on_control;
+	client->disable_tls = true;
+
+	uint64_t stop_latency[CYCLES];
+	uint64_t reconfigure_latency[CYCLES];
+	int port = host->http_port - GAMESTREAM_HTTPS_PORT_OFFSET;
+
+	for (int cycle = 0; cycle < CYCLES; cycle++) {
+		int expected = cycle + 1;
+
+		CHECK(moonlight_client_start(client, "127.0.0.1", port,
+					     "Steam"));
+
+		// Pings open both streams, packets reach the handler
+		CHECK(answer_ping(video_fd));
+		CHECK(answer_ping(audio_fd));
+		CHECK(wait_for_packets(expected, expected));
+
+		// Once both streams arrive nothing should wake the thread;
+		// the sleep itself is one switch
+		if (cycle == 0) {
+			long before = voluntary_switches();
+			sleep_ms(IDLE_MS);
+			long switches = voluntary_switches() - before;
+			printf("Idle: %ld context switches in %d ms\n",
+			       switches, IDLE_MS);
+		}
+
+		// A new bitrate sets the stream up again with the host
+		int bitrate = source.bitrate + 1000 * expected;
+		moonlight_client_reconfigure(client, source.width,
+					     source.height, source.fps,
+					     bitrate);
+		struct moonlight_client_stats stats = {0};
+		for (int i = 0;
+		     i < 1000 && stats.reconfigurations < (uint64_t)expected;
+		     i++) {
+			sleep_ms(1);
+			moonlight_client_get_stats(client, &stats);
+		}
+		CHECK(stats.reconfigurations == (uint64_t)expected);
+		CHECK(atomic_load(&host->announced_bitrate) == bitrate);
+		reconfigure_latency[cycle] = stats.last_reconfigure_ns;
+
+		uint64_t start = now_ns();
+		moonlight_client_stop(client);
+		stop_latency[cycle] = now_ns() - start;
+
+		drain(video_fd);
+		drain(audio_fd);
+	}
+
+	qsort(stop_latency, CYCLES, sizeof(uint64_t), compare_u64);
+	qsort(reconfigure_latency, CYCLES, sizeof(uint64_t), compare_u64);
+
+	printf("Stop latency: median %llu us, max %llu us\n",
+	       (unsigned long long)(stop_latency[CYCLES / 2] / 1000),
+	       (unsigned long long)(stop_latency[CYCLES - 1] / 1000));
+	printf("Reconfigure latency: median %llu us, max %llu us\n",
+	       (unsigned long long)(reconfigure_latency[CYCLES / 2] / 1000),
+	       (unsigned long long)(reconfigure_latency[CYCLES - 1] / 1000));
+
+
+	// Stop while the first handshake request waits for an answer. The
+	// host info is queried afresh rather than taken from the cache.
+	int silent_port;
+	int silent_fd = open_silent_host(&silent_port);
+	CHECK(silent_fd >= 0);
+	handshake_invalidate("127.0.0.1");
+
+	CHECK(moonlight_client_start(
+		client, "127.0.0.1",
+		silent_port - GAMESTREAM_HTTPS_PORT_OFFSET, "Steam"));
+	sleep_ms(CONNECT_STALL_MS);
+
+	uint64_t start = now_ns();
+	moonlight_client_stop(client);
+	uint64_t connect_stop_latency = now_ns() - start;
+
+	printf("Stop latency while connecting: %llu us\n",
+	       (unsigned long long)(connect_stop_latency / 1000));
+	CHECK(connect_stop_latency < CONNECT_STALL_MS * 1000000ULL);
+
+	moonlight_client_destroy(client);
+	pthread_mutex_destroy(&source.mutex);
+	handshake_global_free();
+	close(video_fd);
+	close(audio_fd);
+	close(silent_fd);
+
+	if (failures) {
+		fprintf(stderr, "Streaming thread test: %d failure(s)\n",
+			failures);
+		return 1;
+	}
+
+	printf("Moonlight OBS Plugin - Streaming thread test passed\n");
+	return 0;
+}
@@ -0,0 +1,172 @@
+/*
+ * Video output test for Moonlight OBS Plugin
+ * Decodes 8-bit and 10-bit streams and checks the path their frames take to
+ * OBS: both go out as async video in their decoded format (I420 and I010),
+ * and an off-program decoder passes nothing on
+ */
+
+#include "obs-stubs.h"
+#include "video-decoder.h"
+#include "moonlight-source.h"
+#include <libavcodec/avcodec.h>
+#include <libavutil/opt.h>
+#include <obs-module.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define WIDTH 320
+#define HEIGHT 180
+#define STREAM_FRAMES 10
+
+static int failures;
+
+#define CHECK(cond)                                                      \
+	do {                                                             \
+		if (!(cond)) {                                           \
+			fprintf(stderr, "%s:%d: check failed: %s\n",     \
+				__FILE__, __LINE__, #cond);              \
+			failures++;                                      \
+		}                                                        \
+	} while (0)
+
+// Fill a plane with a flat value, 8 or 16 bits per sample
+static void fill_plane(AVFrame *frame, int plane, int value, bool wide)
+{
+	int height = plane ? HEIGHT / 2 : HEIGHT;
+	int width = plane ? WIDTH / 2 : WIDTH;
+
+	for (int y = 0; y < height; y++) {
+		uint8_t *row = frame->data[plane] + y * frame->linesize[plane];
+		if (!wide) {
+			memset(row, value, (size_t)width);
+			continue;
+		}
+		for (int x = 0; x < width; x++)
+			((uint16_t *)row)[x] = (uint16_t)value;
+	}
+}
+
+// Encode a short stream starting with an IDR frame, in 8 or 10 bits
+static bool encode_stream(AVPacket **packets, enum AVPixelFormat format)
+{
+	const AVCodec *codec = avcodec_find_encoder_by_name("libx264");
+	if (!codec)
+		return false;
+
+	bool wide = format == AV_PIX_FMT_YUV420P10LE;
+	AVCodecContext *ctx = avcodec_alloc_context3(codec);
+	ctx->width = WIDTH;
+	ctx->height = HEIGHT;
+	ctx->time_base = (AVRational){1, 60};
+	ctx->pix_fmt = format;
+	ctx->max_b_frames = 0;
+	av_opt_set(ctx->priv_data, "preset", "ultrafast", 0);
+	av_opt_set(ctx->priv_data, "tune", "zerolatency", 0);
+
+	// libx264 may be built without 10-bit support
+	bool ok = avcodec_open2(ctx, codec, NULL) == 0;
+	AVFrame *frame = av_frame_alloc();
+	frame->width = WIDTH;
+	frame->height = HEIGHT;
+	frame->format = format;
+	ok = ok && av_frame_get_buffer(frame, 0) == 0;
+
+	for (int i = 0; ok && i < STREAM_FRAMES; i++) {
+		for (int plane = 0; plane < 3; plane++)
+			fill_plane(frame, plane, (wide ? 256 : 64) + i * 7,
+				   wide);
+		frame->pts = i;
+
+		packets[i] = av_packet_alloc();
+		ok = avcodec_send_frame(ctx, frame) == 0 &&
+		     avcodec_receive_packet(ctx, packets[i]) == 0;
+	}
+
+	av_frame_free(&frame);
+	avcodec_free_context(&ctx);
+	return ok;
+}
+
+static void free_stream(AVPacket **packets)
+{
+	for (int i = 0; i < STREAM_FRAMES; i++)
+		av_packet_free(&packets[i]);
+}
+
+// Decode a stream with a new decoder, returning the stub counters
+static void decode_stream(AVPacket **packets, bool active,
+			  struct obs_stub_counters *counters)
+{
+	struct moonlight_source source = {
+		.width = WIDTH,
+		.height = HEIGHT,
+		.video_codec = MOONLIGHT_CODEC_H264,
+	};
+	pthread_mutex_init(&source.mutex, NULL);
+
+	struct video_decoder *decoder = video_decoder_create(&source);
+	CHECK(decoder != NULL);
+	if (!decoder) {
+		pthread_mutex_destroy(&source.mutex);
+		return;
+	}
+	video_decoder_set_active(decoder, active, false);
+
+	obs_stubs_reset_counters();
+	for (int i = 0; i < STREAM_FRAMES; i++)
+		CHECK(video_decoder_decode(decoder, packets[i]->data,
+					   (size_t)packets[i]->size, false));
+	obs_stubs_get_counters(counters);
+
+	CHECK(decoder->frames_decoded == (active ? STREAM_FRAMES : 0));
+	CHECK(decoder->frames_inactive == (active ? 0 : STREAM_FRAMES));
+
+	video_decoder_destroy(decoder);
+	pthread_mutex_destroy(&source.mutex);
+}
+
+static void test_output_path(enum AVPixelFormat format,
+			     enum video_format expected, const char *name)
+{
+	AVPacket *packets[STREAM_FRAMES] = {0};
+	if (!encode_stream(packets, format)) {
+		printf("No libx264 encoder for %s, check skipped\n", name);
+		free_stream(packets);
+		return;
+	}
+
+	// Every frame goes to OBS as async video in its decoded format
+	struct obs_stub_counters counters;
+	decode_stream(packets, true, &counters);
+	CHECK(counters.video_frames == STREAM_FRAMES);
+	CHECK(counters.last_video_format == (int)expected);
+	CHECK(counters.video_frame_bytes >=
+	      (uint64_t)STREAM_FRAMES * WIDTH * HEIGHT * 3 / 2 *
+		      (expected == VIDEO_FORMAT_I010 ? 2 : 1));
+	printf("%s: %llu frames as %s, %llu bytes\n", name,
+	       (unsigned long long)counters.video_frames,
+	       get_video_format_name(
+		       (enum video_format)counters.last_video_format),
+	       (unsigned long long)counters.video_frame_bytes);
+
+	// Off program nothing is passed on
+	decode_stream(packets, false, &counters);
+	CHECK(counters.video_frames == 0);
+
+	free_stream(packets);
+}
+
+int main(void)
+{
+	test_output_path(AV_PIX_FMT_YUV420P, VIDEO_FORMAT_I420, "8-bit");
+	test_output_path(AV_PIX_FMT_YUV420P10LE, VIDEO_FORMAT_I010, "10-bit");
+
+	if (failures) {
+		fprintf(stderr, "Video output test: %d failure(s)\n", failures);
+		return 1;
+	}
+
+	printf("Moonlight OBS Plugin - Video output test passed\n");
+	return 0;
+}